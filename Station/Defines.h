@@ -101,6 +101,7 @@ Copyright 2014-2016 tony-osp (http://tony-osp.dreamwidth.org/)
 
 #define USE_I2C_LCD				1	// Use I2C LCD (instead of the parallel-connected LCD)
 #define SG_RF_TIME_CLIENT		1	// accept time broadcast messages on RF network
+//#define SG_RF_RELAY			1	// forward RF frames for stations outside of the master RF range
 
 #define DEFAULT_STATION_ID		2	// 
 
@@ -112,6 +113,7 @@ Copyright 2014-2016 tony-osp (http://tony-osp.dreamwidth.org/)
 
 #define USE_I2C_LCD				1	// Use I2C LCD (instead of the parallel-connected LCD)
 #define SG_RF_TIME_CLIENT		1	// accept time broadcast messages on RF network
+//#define SG_RF_RELAY			1	// forward RF frames for stations outside of the master RF range
 
 #define DEFAULT_STATION_ID		2	// 
 
@@ -178,6 +180,29 @@ Copyright 2014-2016 tony-osp (http://tony-osp.dreamwidth.org/)
 // SD Card logging
 #define MAX_LOG_RECORD_SIZE    80
 
+// Monthly sensor and watering log files are pre-allocated as contiguous files and written using raw block I/O.
+// Comment out SG_LOG_CONTIGUOUS to revert to regular (FAT append) log files.
+#define SG_LOG_CONTIGUOUS
+#define LOG_CONTIG_MAX_FILES		4		// number of contiguous log files with cached location and tail position
+#define LOG_CONTIG_MAX_HINTS		16		// number of tail positions remembered for the files evicted from the cache
+#define LOG_CONTIG_SENSOR_BLOCKS	512		// pre-allocated size of the monthly sensor log file, in 512 bytes blocks
+#define LOG_CONTIG_WATERING_BLOCKS	256		// pre-allocated size of the monthly watering log file, in 512 bytes blocks
+
+// RAM spool for log records while SD card is not available
+#define LOG_SPOOL_SIZE				512		// spool size, bytes
+#define LOG_SPOOL_DRAIN_BATCH		4		// max number of spooled records written to the card per second
+#define LOG_SPOOL_MAX_RETRIES		3		// spooled record is dropped if it cannot be written after that many attempts
+#define LOG_SD_RETRY_INTERVAL		30		// SD card re-initialization interval, seconds
+
+// SD-backed cache of JSON log query responses (json/tlogs, json/schlogs, json/sens)
+#define LOG_JCACHE_ENTRIES			8		// max number of cached responses
+
+// Seek hints for incremental ("since") log queries
+#define LOG_SEEK_HINTS				4		// max number of log files with remembered read position
+
+// Log queries are emitted in steps, the web server runs them within its time slice (see LogScan)
+#define LOG_SCAN_RECORDS			8		// max number of log records read per step
+
 // Sensors
 // Default sensors logging interval, minutes
 #if (SG_HARDWARE == HW_V15_MASTER) || (SG_HARDWARE == HW_V16_MASTER)
@@ -186,6 +211,43 @@ Copyright 2014-2016 tony-osp (http://tony-osp.dreamwidth.org/)
 #define SENSORS_POLL_DEFAULT_REPEAT  5		// on Remote station polling interval is 5minutes, to ensure local LCD display updates relatively quickly, and Remote station is not polling anybody else
 #endif
 
+// Sensors push reporting - remote station reports sensors on its own (see FCODE_SENSORS_REPORTCFG_SET), instead of being polled
+#define SENSORS_PUSH_DEFAULT_INTERVAL	60	// default max time between sensor reports, minutes
+#define SENSORS_PUSH_DEFAULT_DEADBAND	1	// default min reading change that triggers the report
+#define SENSORS_PUSH_SAMPLE_REPEAT		1	// local sensors sampling interval on the station while push reporting is enabled, minutes
+
+// Remote protocol (RProtocol) requests
+#define RPROTOCOL_MAX_TRANSACTIONS	8		// max number of outstanding requests to remote stations
+#define RPROTOCOL_CONTROL_SLOTS		2		// requests table slots kept free for zone control requests
+#define RPROTOCOL_RESPONSE_TIMEOUT	1000	// time to wait for the response before the request is re-sent, ms
+#define RPROTOCOL_MAX_RETRIES		2		// number of re-sends before the request is reported as failed
+#define RPROTOCOL_STATION_MAX_INFLIGHT	1	// max number of requests in flight per station, the rest wait in the station queue
+#define RPROTOCOL_MAX_FRAME_SIZE	60		// max RProtocol frame size (RFM69 packet payload, less the sequence number byte)
+#define RPROTOCOL_TX_FRAMES			3		// outgoing frame buffers - frames queued by the transport, and the one being built
+
+// Link statistics and health score (0-100). Health score is reduced by the packet loss (percent) and by the round-trip time.
+// Requests to stations with good links get RPROTOCOL_MAX_RETRIES re-sends, lossy links get one more, links that seem to be down get one.
+#define RPROTOCOL_LINK_GOOD			80		// health score of a good link
+#define RPROTOCOL_LINK_POOR			50		// below this the link is flagged as poor
+#define RPROTOCOL_LINK_DOWN			15		// below this the link is considered down
+#define RPROTOCOL_LINK_RTT_STEP		50		// round-trip time penalty - one point per RPROTOCOL_LINK_RTT_STEP ms
+#define RPROTOCOL_LINK_RTT_MAX		20		// max round-trip time penalty
+
+// Slotted sensors poll. Master polls all remote stations with one broadcast request, each station replies in its own time slot.
+#define RPROTOCOL_POLL_SLOT_TIME	80		// reply slot length, ms. Slot fits the report frame with RF ACK and one re-send
+#define RPROTOCOL_POLL_WINDOW_MARGIN	500	// extra time to wait for late (relayed) replies after the last slot, ms
+
+// Multi-hop RF. Stations outside of the master RF range are reached through relay stations (remote stations built with SG_RF_RELAY).
+#define RPROTOCOL_RELAY_MAX_HOPS	3		// TTL of the frames sent through relay stations
+#define RPROTOCOL_RELAY_DUP_CACHE	8		// number of recently seen relayed frames remembered for duplicates suppression
+
+// Fragmentation. Messages larger than one frame are sent as a series of fragments, receiver reassembles the message.
+#define RPROTOCOL_MAX_MESSAGE_SIZE	200		// max message size (including header), must be below 256
+#define RPROTOCOL_MAX_FRAGMENTS		8		// max number of fragments in the message (bit per fragment in FCODE_FRAGMENT_ACK)
+#define RPROTOCOL_FRAGMENT_RETRIES	3		// number of retransmission rounds before the fragmented message is dropped
+#define RPROTOCOL_REASSEMBLY_TIMEOUT	3000	// partially received message is dropped after this time without new fragments, ms
+#define RPROTOCOL_DONE_TIMEOUT		(RPROTOCOL_RESPONSE_TIMEOUT*(RPROTOCOL_FRAGMENT_RETRIES+1))	// how long lost ACK of the reassembled message is repeated, ms
+
 // XBee RF network
 #define NETWORK_ADDRESS_BROADCAST	0x0FFFF
 
@@ -21,24 +21,38 @@ another one is the list of last known sequence numbers received from stations on
 
 The above mechanism is intended for point-to-point transmissions, not broadcasts, because it relies on ACK to proceed to the next sequence number.
 
+Outgoing packets are placed into TX queue and are sent from loop() by a small state machine (send -> wait for ACK -> backoff and re-send -> done or fail),
+so waiting for ACK from a slow or unreachable station does not hold the main loop. Incoming packets are processed while we wait for ACK.
+Delivery outcome is reported to the sender via completion callback.
+Packets are not copied - the queue points to the sender's buffer, and the sequence number is written into the byte in front of
+the packet (RFRAME_TRANSPORT_HEADROOM). The buffer belongs to the queue until the completion callback is called.
+
+Transmit power is managed per station using RFM69_ATC (automatic transmission control). Station power level starts from the estimate
+based on the signal strength we receive from the station, and is then adjusted on each ACK towards the target RSSI. Failed deliveries
+raise the power level and the station target RSSI (more link margin), successful deliveries slowly bring the target back down.
+Lower power on good links means less interference on the shared channel and fewer retries for everybody.
+
 
 */
 
 #include "MoteinoRF.h"
 #include "settings.h"
 #include "RProtocolMS.h"
+#include "core.h"
 
 //#define TRACE_LEVEL			7		// trace everything for this module
 #include "port.h"
 
 extern int16_t		LastReceivedRSSI;
 
-RFM69 moteinoRF;
+RFM69_ATC moteinoRF;
 
 
 MoteinoRFClass::MoteinoRFClass()
 {
 	fMoteinoRFReady = false;
+	txHead = txCount = 0;
+	txState = MOTEINORF_TX_IDLE;
 }
 
 void MoteinoRFClass::begin()
@@ -72,11 +86,18 @@ void MoteinoRFClass::begin()
 
 	//moteinoRF.encrypt(MOTEINORF_ENCRYPTKEY);
 
-	// initialize packet sequence counters
+	moteinoRF.enableAutoPower(MOTEINORF_ATC_TARGET_RSSI);		// enable ATC, we set power level and target per station before each transmission
+
+	// initialize packet sequence counters and link budget
 	for( uint8_t i=0; i<MAX_STATIONS; i++ )
 	{
 		uNextSNumber[i] = 0;	
 		uLastReceivedSNumber[i] = 255;	// reserved counter value, used to synchronize state
+
+		txPower[i] = MOTEINORF_POWER_UNKNOWN;
+		targetRSSI[i] = MOTEINORF_ATC_TARGET_RSSI;
+		ackRSSI[i] = 0;
+		memset(rssiHistory[i], 0, MOTEINORF_RSSI_HISTORY);
 	}
 
 	SetMoteinoRFFlags(GetMoteinoRFFlags() | NETWORK_FLAGS_ON);	// Mark MoteinoRF network as On
@@ -97,47 +118,191 @@ failed_ex1:
 
 // Main packet send routine. 
 //
+// Packet is placed into TX queue and will be sent from loop(). Returns false if the packet cannot be queued.
+// Callback is called when the packet is delivered (ACK received, or broadcast is sent) or when all retries failed.
+// The packet is sent from msg, which must have RFRAME_TRANSPORT_HEADROOM bytes in front of it, and must not change until the callback.
 //
-//
-bool MoteinoRFSendPacket(uint8_t nStation, void *msg, uint8_t mSize)
+bool MoteinoRFSendPacket(uint8_t nStation, void *msg, uint8_t mSize, PTransportDoneCallback callback, uint8_t ctx)
 {
 	if( !MoteinoRF.fMoteinoRFReady )	// check that MoteinoRF is initialized and ready
 		return false;
 
+	return MoteinoRF.QueuePacket(nStation, msg, mSize, callback, ctx);
+}
+
+bool MoteinoRFClass::QueuePacket(uint8_t nStation, void *msg, uint8_t mSize, PTransportDoneCallback callback, uint8_t ctx)
+{
+	if( (txCount >= MOTEINORF_TX_QUEUE_SIZE) || (mSize >= RF69_MAX_DATA_LEN) )
+	{
+// for Master station we want to log transmission errors, while for Remote station should send errors to trace
+// This is required to avoid infine recursive loop on remote station, since attempt to log error will attempt to send error report which may also result in error
+#if (SG_HARDWARE == HW_V16_REMOTE) || (SG_HARDWARE == HW_V17_REMOTE) || (SG_HARDWARE == HW_V16_REMOTE_2)
+		TRACE_ERROR(F("MoteinoRF - cannot queue packet to station %u, queued:%u, len:%u\n"), uint16_t(nStation), uint16_t(txCount), uint16_t(mSize));
+#else
+		SYSEVT_ERROR(F("MoteinoRF - cannot queue packet to station %u, queued:%u, len:%u"), uint16_t(nStation), uint16_t(txCount), uint16_t(mSize));
+#endif
+		return false;
+	}
+
+	MoteinoRFTxPacket	*pPacket = &txQueue[(txHead + txCount) % MOTEINORF_TX_QUEUE_SIZE];
+
+	pPacket->nStation = nStation;
+	pPacket->callback = callback;
+	pPacket->ctx = ctx;
+
 	if( nStation == STATIONID_BROADCAST ) // broadcast
 	{
-		TRACE_VERBOSE(F("MoteinoRF - sending broadcast packet, len %u\n"), uint16_t(mSize));
-		moteinoRF.send(RF69_BROADCAST_ADDR,msg, mSize);
+		TRACE_VERBOSE(F("MoteinoRF - queueing broadcast packet, len %u\n"), uint16_t(mSize));
+		pPacket->buf = (uint8_t *)msg;		// broadcast messages don't have sequence numbers
+		pPacket->len = mSize;
 	}
 	else
 	{
-		uint8_t		buf[RF69_MAX_DATA_LEN];
+		pPacket->buf = (uint8_t *)msg - RFRAME_TRANSPORT_HEADROOM;
+		if( nStation < MAX_STATIONS )							// first byte of the packet is the sequence number
+		{
+			pPacket->buf[0] = uNextSNumber[nStation];			// we keep track of sequence numbers per station
 
-		if( nStation < MAX_STATIONS )						// first byte of the packet is the sequence number
-			buf[0] = MoteinoRF.uNextSNumber[nStation];		// we keep track of sequence numbers per station
+			// increase sequence counter for this destination
+			if( uNextSNumber[nStation] == 254 )	uNextSNumber[nStation] = 0;
+			else								uNextSNumber[nStation]++;
+		}
 		else
-			buf[0] = 255;
+			pPacket->buf[0] = 255;
 
-		TRACE_VERBOSE(F("MoteinoRF - sending packet to station %u, SN:%u, len %u\n"), uint16_t(nStation), uint16_t(buf[0]), uint16_t(mSize));
-		memcpy(buf+1, msg, mSize);	// because sequence number is added as the first byte in the transmission, need to allocate new buffer and copy data to it (TODO: fill fix it later)
+		TRACE_VERBOSE(F("MoteinoRF - queueing packet to station %u, SN:%u, len %u\n"), uint16_t(nStation), uint16_t(pPacket->buf[0]), uint16_t(mSize));
+		pPacket->len = mSize+1;
+	}
 
-		bool retFlag = moteinoRF.sendWithRetry(nStation, buf, mSize+1, NETWORK_MOTEINORF_RETRY_COUNT, 200); // num of retries, 200ms wait time
-		// increase sequence counter for this destination
-		if( MoteinoRF.uNextSNumber[nStation] == 254 )	MoteinoRF.uNextSNumber[nStation] = 0;
-		else											MoteinoRF.uNextSNumber[nStation]++;
-		if(!retFlag)
-		{
-// for Master station we want to log transmission errors, while for Remote station should send errors to trace
-// This is required to avoid infine recursive loop on remote station, since attempt to log error will attempt to send error report which may also result in error
+	txCount++;
+	return true;
+}
+
+// Transmit power level for the station.
+//
+// If station power level is not known yet, it is estimated from the signal strength we receive from the station (assuming symmetric link
+// and about 1dB per power level step). We use only half of the margin, since the station may be transmitting at reduced power as well.
+uint8_t MoteinoRFClass::StationPower(uint8_t nStation)
+{
+	if( nStation >= MAX_STATIONS )
+		return MOTEINORF_POWER_MAX;
+
+	if( txPower[nStation] == MOTEINORF_POWER_UNKNOWN )
+	{
+		int16_t		margin = runState.iLastReceivedRSSI[nStation] - targetRSSI[nStation];
+
+		if( (runState.sLastContactTime[nStation] == 0) || (margin <= 0) )
+			txPower[nStation] = MOTEINORF_POWER_MAX;
+		else
+			txPower[nStation] = MOTEINORF_POWER_MAX - min(margin/2, MOTEINORF_POWER_MAX);
+
+		TRACE_VERBOSE(F("MoteinoRF - station %u initial power level %u\n"), uint16_t(nStation), uint16_t(txPower[nStation]));
+	}
+	return txPower[nStation];
+}
+
+// Complete the packet at the head of TX queue and report the outcome
+void MoteinoRFClass::TxDone(bool bSuccess)
+{
+	MoteinoRFTxPacket		*pPacket = &txQueue[txHead];
+	uint8_t					nStation = pPacket->nStation;
+	uint8_t					ctx = pPacket->ctx;
+	PTransportDoneCallback	callback = pPacket->callback;
+
+	txHead = (txHead + 1) % MOTEINORF_TX_QUEUE_SIZE;
+	txCount--;
+	txState = MOTEINORF_TX_IDLE;
+
+	if( nStation < MAX_STATIONS )
+	{
+		if( !bSuccess )		// delivery failed - ask for more link margin
+			targetRSSI[nStation] = min(targetRSSI[nStation] + MOTEINORF_ATC_TARGET_STEP, MOTEINORF_ATC_TARGET_MAX);
+		else if( targetRSSI[nStation] > MOTEINORF_ATC_TARGET_RSSI )
+			targetRSSI[nStation]--;
+
+		rprotocol.LinkTxDone(nStation, txRetries, bSuccess);
+	}
+
+	if( !bSuccess )
+	{
 #if (SG_HARDWARE == HW_V16_REMOTE) || (SG_HARDWARE == HW_V17_REMOTE) || (SG_HARDWARE == HW_V16_REMOTE_2)
-			TRACE_ERROR(F("MoteinoRF - sendWithRetry returned %d\n"), int16_t(retFlag));
+		TRACE_ERROR(F("MoteinoRF - no ACK from station %u\n"), uint16_t(nStation));
 #else
-			SYSEVT_ERROR(F("MoteinoRF - sendWithRetry returned %d"), int16_t(retFlag));
+		SYSEVT_ERROR(F("MoteinoRF - no ACK from station %u"), uint16_t(nStation));
 #endif
-		}
 	}
 
-	return true;
+	if( callback != 0 )
+		callback(nStation, ctx, bSuccess);
+}
+
+// TX state machine. Called from loop(), never waits.
+void MoteinoRFClass::ProcessTx(void)
+{
+	switch( txState )
+	{
+		case MOTEINORF_TX_IDLE:
+						if( txCount == 0 )
+							return;
+
+						txRetries = 0;
+						txTimer = millis();
+						txState = MOTEINORF_TX_SEND;
+						// fall through
+
+		case MOTEINORF_TX_SEND:
+						{
+							MoteinoRFTxPacket	*pPacket = &txQueue[txHead];
+
+							// listen before talk - if the channel is busy, try again on the next pass (up to RF69_CSMA_LIMIT_MS, then send anyway)
+							if( !moteinoRF.canSend() && ((millis() - txTimer) < RF69_CSMA_LIMIT_MS) )
+								return;
+
+							if( pPacket->nStation == STATIONID_BROADCAST )
+							{
+								moteinoRF._transmitLevel = MOTEINORF_POWER_MAX;		// broadcasts go out at full power to reach all stations
+								moteinoRF.send(RF69_BROADCAST_ADDR, pPacket->buf, pPacket->len);
+								TxDone(true);		// broadcasts are not acknowledged
+								return;
+							}
+
+							moteinoRF._transmitLevel = StationPower(pPacket->nStation);
+							moteinoRF.send(pPacket->nStation, pPacket->buf, pPacket->len, true);
+							txTimer = millis();
+							txState = MOTEINORF_TX_WAIT_ACK;
+						}
+						return;
+
+		case MOTEINORF_TX_WAIT_ACK:
+						if( (millis() - txTimer) < MOTEINORF_ACK_TIMEOUT )
+							return;
+
+						if( txRetries >= NETWORK_MOTEINORF_RETRY_COUNT )
+						{
+							TxDone(false);
+							return;
+						}
+
+						txRetries++;
+						if( txQueue[txHead].nStation < MAX_STATIONS )		// no ACK - raise transmit power for the re-send
+						{
+							uint8_t		power = StationPower(txQueue[txHead].nStation) + MOTEINORF_ATC_RETRY_STEP;
+							txPower[txQueue[txHead].nStation] = min(power, MOTEINORF_POWER_MAX);
+						}
+						txBackoff = random(MOTEINORF_BACKOFF_MIN, MOTEINORF_BACKOFF_MAX);
+						txTimer = millis();
+						txState = MOTEINORF_TX_BACKOFF;
+						return;
+
+		case MOTEINORF_TX_BACKOFF:
+						if( (millis() - txTimer) < txBackoff )
+							return;
+
+						TRACE_VERBOSE(F("MoteinoRF - re-sending packet to station %u, retry %u\n"), uint16_t(txQueue[txHead].nStation), uint16_t(txRetries));
+						txTimer = millis();
+						txState = MOTEINORF_TX_SEND;
+						return;
+	}
 }
 
 
@@ -158,14 +323,37 @@ void MoteinoRFClass::loop(void)
 		uint8_t		senderID = moteinoRF.SENDERID;
 		uint8_t		targetID = moteinoRF.TARGETID;
 
+		if( (txState == MOTEINORF_TX_WAIT_ACK) && moteinoRF.ACK_RECEIVED && (senderID == txQueue[txHead].nStation) )
+		{
+			if( moteinoRF.ACK_RSSI_REQUESTED && (senderID < MAX_STATIONS) )		// ACK carries the RSSI the station received our packet with
+			{
+				int16_t	rssi = moteinoRF.getAckRSSI();
+
+				ackRSSI[senderID] = int8_t(rssi);
+				if( (rssi < targetRSSI[senderID]) && (txPower[senderID] < MOTEINORF_POWER_MAX) )	txPower[senderID]++;
+				else if( (rssi > targetRSSI[senderID]) && (txPower[senderID] > 0) )				txPower[senderID]--;
+
+				TRACE_VERBOSE(F("MoteinoRF - ACK RSSI %d from station %u, power level %u\n"), rssi, uint16_t(senderID), uint16_t(txPower[senderID]));
+			}
+			TRACE_VERBOSE(F("MoteinoRF - ACK received from station %u\n"), uint16_t(senderID));
+			TxDone(true);
+		}
+
 		if( moteinoRF.DATALEN > 5 )
 		{
 			memcpy(buf, (uint8_t *)(moteinoRF.DATA), moteinoRF.DATALEN);
 			buf_len = moteinoRF.DATALEN;
 		}
 
+		if( (buf_len > 5) && (senderID < MAX_STATIONS) )		// keep RSSI history of the station
+		{
+			memmove(rssiHistory[senderID]+1, rssiHistory[senderID], MOTEINORF_RSSI_HISTORY-1);
+			rssiHistory[senderID][0] = int8_t(moteinoRF.RSSI);
+		}
+
 		if( moteinoRF.ACKRequested() )
 		{
+			moteinoRF._transmitLevel = StationPower(senderID);
 			moteinoRF.sendACK();
 			TRACE_VERBOSE(F("MoteinoRF - ACK requested, sending it.\n"));
 		}
@@ -191,10 +379,13 @@ void MoteinoRFClass::loop(void)
 				else
 				{
 					TRACE_VERBOSE(F("MoteinoRF - received duplicate packet from %d, SN=%u\n"), int16_t(senderID), uint16_t(buf[0]));
+					rprotocol.LinkRxDuplicate(senderID);
 				}
 			}
 		}
 	}
+
+	ProcessTx();
 }
 
 
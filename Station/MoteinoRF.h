@@ -19,6 +19,8 @@ Copyright 2015 tony-osp (http://tony-osp.dreamwidth.org/)
 
 #include "Defines.h"
 #include "RFM69.h"
+#include "RFM69_ATC.h"
+#include "RProtocolMS.h"
 
 //#define FREQUENCY     RF69_433MHZ
 //#define FREQUENCY     RF69_868MHZ
@@ -30,6 +32,40 @@ Copyright 2015 tony-osp (http://tony-osp.dreamwidth.org/)
 // RFM69 encryption key is statically defined here (16 characters)
 #define MOTEINORF_ENCRYPTKEY	"SmartGarden v1.x"
 
+// Transmit queue. Packets are sent from loop(), one at a time, without blocking while waiting for ACK.
+// Packets are sent in place from the sender's buffer, the queue keeps only the pointer (see QueuePacket()).
+#define MOTEINORF_TX_QUEUE_SIZE		3		// max number of queued outgoing packets
+#define MOTEINORF_ACK_TIMEOUT		200		// time to wait for ACK before re-sending the packet, ms
+#define MOTEINORF_BACKOFF_MIN		10		// random delay before re-sending the packet, ms
+#define MOTEINORF_BACKOFF_MAX		50
+
+// Transmit states
+#define MOTEINORF_TX_IDLE			0		// nothing to send
+#define MOTEINORF_TX_SEND			1		// waiting for the channel to clear (listen before talk)
+#define MOTEINORF_TX_WAIT_ACK		2		// packet sent, waiting for ACK
+#define MOTEINORF_TX_BACKOFF		3		// no ACK, waiting before re-sending
+
+// Automatic transmit power control (RFM69_ATC). Transmit power is kept per station. Each ACK carries the signal strength
+// the station received our packet with, and we adjust station power level by one step (about 1dB) towards the station target RSSI.
+#define MOTEINORF_POWER_MAX			31		// max power level (RFM69 levels are 0-31)
+#define MOTEINORF_POWER_UNKNOWN		0xFF	// station power level is not set yet
+#define MOTEINORF_ATC_TARGET_RSSI	-80		// default target RSSI, dBm
+#define MOTEINORF_ATC_TARGET_MAX	-60		// max target RSSI, dBm
+#define MOTEINORF_ATC_TARGET_STEP	5		// target RSSI increase after delivery failure, dB (decays by 1dB on each successful delivery)
+#define MOTEINORF_ATC_RETRY_STEP	4		// power level increase on each re-send
+
+#define MOTEINORF_RSSI_HISTORY		4		// number of received RSSI samples kept per station
+
+// Queued outgoing packet
+struct MoteinoRFTxPacket
+{
+	uint8_t					nStation;
+	uint8_t					len;						// packet length (including sequence number)
+	uint8_t					ctx;
+	PTransportDoneCallback	callback;
+	uint8_t					*buf;						// packet, in the sender's buffer
+};
+
 class MoteinoRFClass
 {
  public:
@@ -37,16 +73,35 @@ class MoteinoRFClass
 	void begin(void);
 	void loop(void);
 
+	bool	QueuePacket(uint8_t nStation, void *msg, uint8_t mSize, PTransportDoneCallback callback, uint8_t ctx);
+
 	bool	fMoteinoRFReady;			// Flag indicating that XBee is initialized and ready
 	uint8_t	uNextSNumber[MAX_STATIONS];
 	uint8_t	uLastReceivedSNumber[MAX_STATIONS];
 
+	// link budget per station
+	uint8_t	txPower[MAX_STATIONS];									// transmit power level, MOTEINORF_POWER_UNKNOWN if not set yet
+	int8_t	targetRSSI[MAX_STATIONS];								// ATC target RSSI, dBm
+	int8_t	ackRSSI[MAX_STATIONS];									// RSSI reported by the station in the last ACK, dBm (0 - none)
+	int8_t	rssiHistory[MAX_STATIONS][MOTEINORF_RSSI_HISTORY];		// RSSI of the last packets received from the station, most recent first, dBm (0 - none)
+
 private:
+	uint8_t	StationPower(uint8_t nStation);
+
+	void	ProcessTx(void);
+	void	TxDone(bool bSuccess);
 
+	MoteinoRFTxPacket	txQueue[MOTEINORF_TX_QUEUE_SIZE];
+	uint8_t				txHead;					// index of the packet being sent
+	uint8_t				txCount;				// number of queued packets
+	uint8_t				txState;				// MOTEINORF_TX_xxx
+	uint8_t				txRetries;
+	uint8_t				txBackoff;				// current backoff delay, ms
+	unsigned long		txTimer;				// start of the current TX state, millis()
 };
 
 extern MoteinoRFClass MoteinoRF;
-bool MoteinoRFSendPacket(uint8_t nStation, void *msg, uint8_t mSize);
+bool MoteinoRFSendPacket(uint8_t nStation, void *msg, uint8_t mSize, PTransportDoneCallback callback = 0, uint8_t ctx = 0);
 
 #endif
 
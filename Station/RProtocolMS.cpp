@@ -18,6 +18,9 @@ Copyright 2014-2016 tony-osp (http://tony-osp.dreamwidth.org/)
 #include "sensors.h"
 #include "XBeeRF.h"
 #include "MoteinoRF.h"
+#ifdef HW_ENABLE_ETHERNET
+#include "web.h"
+#endif //HW_ENABLE_ETHERNET
 
 //#define TRACE_LEVEL			7		// trace everything for this module
 #include "port.h"
@@ -31,32 +34,66 @@ int16_t		LastReceivedRSSI;
 // Local forward declarations
 inline uint16_t		getSingleSensor(uint8_t regAddr);
 
-// 
-// Generic network "send packet" routine, used by all protocol messages.
-//
-// If new types of transport are added, appropriate handler needs to be added to this routine.
-//
-inline bool SendNetworkPacket(uint8_t stationID, void *pMessage, uint8_t mSize )
+// Transport delivery outcome, ctx is the frame buffer of the packet
+static void TransportDoneCallback(uint8_t nStation, uint8_t nFrame, bool bSuccess)
 {
-#ifdef HW_ENABLE_XBEE
-		XBeeSendPacket(stationID, pMessage, mSize);
-#endif //HW_ENABLE_XBEE
-
-#ifdef HW_ENABLE_MOTEINORF
-		MoteinoRFSendPacket(stationID, pMessage, mSize);
-#endif //HW_ENABLE_MOTEINORF
-
-		return true;
+		rprotocol.FrameDone(nStation, nFrame, bSuccess);
 }
 
 
 RProtocolMaster::RProtocolMaster()
 {
 	_ARPAddressUpdate = 0;
+	_lastTransactionID = 0;
+	memset(_transactions, 0, sizeof(_transactions));
+	memset(_deferred, 0, sizeof(_deferred));
+
+	_slotPollPending = 0;
+	_slotPollTID = 0;
+	_slotPollDeadline = 0;
+	_slotReplyTID = 0;
+	_slotReplyTo = 0;
+	_slotReplyTime = 0;
+
+	memset(_routeVia, RPROTOCOL_ROUTE_DIRECT, sizeof(_routeVia));
+	_staticRoutes = 0;
+	_knownRoutes = 0;
+	memset(_relaySeen, 0xFF, sizeof(_relaySeen));
+	_relaySeenNext = 0;
+	_relaySeqID = 0;
+	_bRelayedFrame = false;
+
+	memset(_txFrames, 0, sizeof(_txFrames));		// RFRAME_FREE
+	_txFrameCur = 0;
+
+	memset(_linkStats, 0, sizeof(_linkStats));
+
+	_txMessage.state = RMESSAGE_TX_FREE;
+	_txMessage.msgID = 0;
+	_rxMessage.bActive = false;
+	_rxMessage.doneFromUnitID = STATIONID_BROADCAST;
+	_rxMessage.doneMsgID = 0;
+	_rxMessage.doneDeadline = 0;
+	_bReassembled = false;
 }
 
+// Load static routes from the stations config
 bool RProtocolMaster::begin(void)
 {
+	FullStation		fStation;
+
+	for( uint8_t i=0; i<MAX_STATIONS; i++ )
+	{
+		LoadStation(i, &fStation);
+		if( !(fStation.stationFlags & STATION_FLAGS_VALID) || (fStation.relayStationID == 0) || 
+			(fStation.relayStationID >= MAX_STATIONS) || (fStation.relayStationID == i) )
+			continue;
+
+		_routeVia[i] = fStation.relayStationID;
+		_staticRoutes |= (1U << i);
+		_knownRoutes |= (1U << i);
+		TRACE_INFO(F("RProtocol - station %d is reached through relay station %d\n"), int(i), int(fStation.relayStationID));
+	}
 	return true;
 }
 
@@ -293,16 +330,6 @@ bool RProtocolMaster::SendZonesReport(uint8_t transactionID, uint8_t fromUnitID,
 	
 		//TRACE_VERBOSE(F("SendZonesReport - entering\n"));
 
-		RMESSAGE_ZONES_REPORT ReportMessage;
-
-		ReportMessage.Header.ProtocolID = RPROTOCOL_ID;
-		ReportMessage.Header.FCode = FCODE_ZONES_REPORT;
-		ReportMessage.Header.FromUnitID = fromUnitID;
-		ReportMessage.Header.ToUnitID = toUnitID;
-		ReportMessage.Header.TransactionID = transactionID;
-		ReportMessage.Header.Length = 4;	// we assume that we have no more than 8 zones, hence status data is 1 byte
-// Note: since currently we have no more than 8 zones in the Remote station, we hardcode response size
-
 		uint8_t			zonesStatus = 0;
 		uint8_t			stationFlags = 0;
 		
@@ -336,12 +363,16 @@ bool RProtocolMaster::SendZonesReport(uint8_t transactionID, uint8_t fromUnitID,
 			}
 		}
 
-		ReportMessage.StationFlags = ZONES_REPFLAG_STATION_ENABLED;
-		ReportMessage.FirstZone = firstZone;
-		ReportMessage.NumZones = numZones;
-		ReportMessage.ZonesData[0] = zonesStatus;
+		RMESSAGE_ZONES_REPORT *pReportMessage = (RMESSAGE_ZONES_REPORT *)NewFrame(FCODE_ZONES_REPORT, fromUnitID, toUnitID, transactionID);
+		if( pReportMessage == 0 )
+			return false;
+
+		pReportMessage->StationFlags = ZONES_REPFLAG_STATION_ENABLED;
+		pReportMessage->FirstZone = firstZone;
+		pReportMessage->NumZones = numZones;
+		pReportMessage->ZonesData[0] = zonesStatus;		// we assume that we have no more than 8 zones, hence status data is 1 byte
 
-		return SendNetworkPacket(toUnitID, (void *)(&ReportMessage), sizeof(ReportMessage) );	// send response with requested zones status bits
+		return SendFrame(sizeof(RMESSAGE_ZONES_REPORT));	// send response with requested zones status bits
 }
 
 
@@ -357,15 +388,9 @@ bool RProtocolMaster::SendSensorsReport(uint8_t transactionID, uint8_t fromUnitI
 	
 //	SYSEVT_ERROR(F("Sending sensors data to station %d"), uint16_t(toUnitID));
 
-	uint8_t		outbuf[sizeof(RMESSAGE_SENSORS_REPORT)+(MAX_SENSORS-1)*2];
-	RMESSAGE_SENSORS_REPORT *pReportMessage = (RMESSAGE_SENSORS_REPORT*) outbuf;
-
-	pReportMessage->Header.ProtocolID = RPROTOCOL_ID;
-	pReportMessage->Header.FCode = FCODE_SENSORS_REPORT;
-	pReportMessage->Header.FromUnitID = fromUnitID;
-	pReportMessage->Header.ToUnitID = toUnitID;
-	pReportMessage->Header.TransactionID = transactionID;
-	pReportMessage->Header.Length = 2+numSensors*2;	
+	RMESSAGE_SENSORS_REPORT *pReportMessage = (RMESSAGE_SENSORS_REPORT *)NewFrame(FCODE_SENSORS_REPORT, fromUnitID, toUnitID, transactionID);
+	if( pReportMessage == 0 )
+		return false;
 
 	for( uint8_t i=0; i<numSensors; i++ )
 	{
@@ -375,7 +400,7 @@ bool RProtocolMaster::SendSensorsReport(uint8_t transactionID, uint8_t fromUnitI
 	pReportMessage->FirstSensor = firstSensor;
 	pReportMessage->NumSensors = numSensors;
 
-	return SendNetworkPacket(toUnitID, (void *)(outbuf), sizeof(RMESSAGE_SENSORS_REPORT)+(numSensors-1)*2 );
+	return SendFrame(sizeof(RMESSAGE_SENSORS_REPORT)+(numSensors-1)*2);
 
 }
 
@@ -384,22 +409,19 @@ bool RProtocolMaster::SendSensorsReport(uint8_t transactionID, uint8_t fromUnitI
 
 bool RProtocolMaster::SendSystemRegisters(uint8_t transactionID, uint8_t fromUnitID, uint8_t toUnitID, uint8_t firstRegister, uint8_t numRegisters)
 {
-	if( (firstRegister+numRegisters) > MODBUSMAP_SYSTEM_MAX )
+	if( ((firstRegister+numRegisters) > MODBUSMAP_SYSTEM_MAX) || (numRegisters < 1) ||
+		((sizeof(RMESSAGE_SYSREGISTERS_REPORT)+(numRegisters-1)*2) > RPROTOCOL_MAX_MESSAGE_SIZE) )
 	{
 		SYSEVT_ERROR(F("SendSystemRegisters - wrong input parameters"));
 		return false;																										// unit ID, Exception Code=2 (Illegal Data Address)
 	}
-	uint8_t		outbuf[sizeof(RMESSAGE_SYSREGISTERS_REPORT)+MODBUSMAP_SYSTEM_MAX*2];
-	RMESSAGE_SYSREGISTERS_REPORT *pReportMessage = (RMESSAGE_SYSREGISTERS_REPORT*) outbuf;
 
-	pReportMessage->Header.ProtocolID = RPROTOCOL_ID;
-	pReportMessage->Header.FCode = FCODE_SYSREGISTERS_REPORT;
-	pReportMessage->Header.FromUnitID = fromUnitID;
-	pReportMessage->Header.ToUnitID = toUnitID;
-	pReportMessage->Header.TransactionID = transactionID;
-	pReportMessage->Header.Length = 2+numRegisters;	
+	uint8_t		mSize = sizeof(RMESSAGE_SYSREGISTERS_REPORT)+(numRegisters-1)*2;		// report larger than one frame is sent in fragments
+
+	RMESSAGE_SYSREGISTERS_REPORT *pReportMessage = (RMESSAGE_SYSREGISTERS_REPORT *)NewMessage(FCODE_SYSREGISTERS_REPORT, fromUnitID, toUnitID, transactionID, mSize);
+	if( pReportMessage == 0 )
+		return false;
 
-	
 	for( uint8_t i=0; i<numRegisters; i++ )
 	{
 		pReportMessage->RegistersData[i] = getSingleSystemRegister(i+firstRegister);
@@ -408,7 +430,7 @@ bool RProtocolMaster::SendSystemRegisters(uint8_t transactionID, uint8_t fromUni
 	pReportMessage->FirstRegister = firstRegister;
 	pReportMessage->NumRegisters = numRegisters;
 
-	return SendNetworkPacket(toUnitID, (void *)(outbuf), sizeof(RMESSAGE_SYSREGISTERS_REPORT)+numRegisters*2 );
+	return SendMessage(pReportMessage, mSize);
 }
 
 // Helper routine - notify Master of the system event
@@ -418,22 +440,32 @@ bool RProtocolMaster::NotifySysEvent(uint8_t eventType, uint32_t timeStamp, uint
 	if( !(GetEvtMasterFlags() & EVTMASTER_FLAGS_REPORT_SYSTEM) )
 		return false;	// no Master registered to receive System notifications
 
-	if( eventDataLength > SYSEVENT_MAX_STRING_LENGTH )
+	if( eventDataLength > SYSEVENT_MAX_EVENT_LENGTH )
 	{
 		SYSEVT_ERROR(F("SendSysEvent - too big payload"));
 		return false;																				
 	}
 	TRACE_VERBOSE(F("NotifySysEvent - evtDataLength:%u, str:'%s'\n"), eventDataLength, eventData );
 
-	uint8_t		outbuf[sizeof(RMESSAGE_SYSEVT_REPORT)+SYSEVENT_MAX_STRING_LENGTH];
-	RMESSAGE_SYSEVT_REPORT *pReportMessage = (RMESSAGE_SYSEVT_REPORT*) outbuf;
+	uint8_t		mSize = sizeof(RMESSAGE_SYSEVT_REPORT)+eventDataLength;		// long event is sent in fragments
+	uint8_t		maxFrame = MaxFrameSize(GetEvtMasterStationID());
+
+	if( (mSize > maxFrame) && !MessageBufFree() )
+	{
+		// previous long event is still being sent (or message buffer is used for reassembly) - send this one in single-frame parts, as continuation events
+		uint8_t		partSize = maxFrame - sizeof(RMESSAGE_SYSEVT_REPORT);
+		bool		ret = true;
+
+		for( uint8_t offset=0; offset<eventDataLength; offset += partSize )
+			ret &= NotifySysEvent(eventType, timeStamp, seqID, offset ? (flags | SYSEVENT_FLAG_CONTINUE) : flags, 
+								  min(partSize, uint8_t(eventDataLength-offset)), eventData+offset);
+		return ret;
+	}
 
-	pReportMessage->Header.ProtocolID = RPROTOCOL_ID;
-	pReportMessage->Header.FCode = FCODE_SYSEVT_REPORT;
-	pReportMessage->Header.FromUnitID = GetMyStationID();
-	pReportMessage->Header.ToUnitID = GetEvtMasterStationID();
-	pReportMessage->Header.TransactionID = 0;
-	pReportMessage->Header.Length = eventDataLength + sizeof(RMESSAGE_SYSEVT_REPORT)-sizeof(RMESSAGE_HEADER);
+	// event may be raised while another frame is being sent (e.g. transport error), in this case it is not reported
+	RMESSAGE_SYSEVT_REPORT *pReportMessage = (RMESSAGE_SYSEVT_REPORT *)NewMessage(FCODE_SYSEVT_REPORT, GetMyStationID(), GetEvtMasterStationID(), 0, mSize);
+	if( pReportMessage == 0 )
+		return false;
 
 	memcpy(&(pReportMessage->EvtString), eventData, size_t(eventDataLength) );
 
@@ -443,7 +475,7 @@ bool RProtocolMaster::NotifySysEvent(uint8_t eventType, uint32_t timeStamp, uint
 	pReportMessage->EventType = eventType;
 	pReportMessage->NumDataBytes = eventDataLength;
 
-	return SendNetworkPacket(pReportMessage->Header.ToUnitID, (void *)(outbuf), sizeof(RMESSAGE_SYSEVT_REPORT)+eventDataLength );
+	return SendMessage(pReportMessage, mSize);
 }
 
 
@@ -451,25 +483,20 @@ bool RProtocolMaster::NotifySysEvent(uint8_t eventType, uint32_t timeStamp, uint
 
 bool RProtocolMaster::SendEvtMasterReport(uint8_t transactionID, uint8_t fromUnitID, uint8_t toUnitID)
 {
-	RMESSAGE_EVTMASTER_REPORT Message;
-
-	Message.Header.ProtocolID = RPROTOCOL_ID;
-	Message.Header.FCode = FCODE_EVTMASTER_REPORT;
-	Message.Header.FromUnitID = fromUnitID;
-	Message.Header.ToUnitID = toUnitID;
-	Message.Header.TransactionID = transactionID;
-	Message.Header.Length = sizeof(RMESSAGE_EVTMASTER_REPORT)-sizeof(RMESSAGE_HEADER);	
+	RMESSAGE_EVTMASTER_REPORT *pMessage = (RMESSAGE_EVTMASTER_REPORT *)NewFrame(FCODE_EVTMASTER_REPORT, fromUnitID, toUnitID, transactionID);
+	if( pMessage == 0 )
+		return false;
 
 #ifndef SG_STATION_MASTER	// we send remote master notifications only if this station is not a master by itself
-	Message.EvtFlags = GetEvtMasterFlags();
-	Message.MasterStationID = GetEvtMasterStationID();
+	pMessage->EvtFlags = GetEvtMasterFlags();
+	pMessage->MasterStationID = GetEvtMasterStationID();
 #else
-	Message.EvtFlags = 0;
-	Message.MasterStationID = 0;
+	pMessage->EvtFlags = 0;
+	pMessage->MasterStationID = 0;
 #endif
-	Message.MasterStationAddress = 0;
+	pMessage->MasterStationAddress = 0;
 
-	return SendNetworkPacket(toUnitID, (void *)(&Message), sizeof(Message) );
+	return SendFrame(sizeof(RMESSAGE_EVTMASTER_REPORT));
 }
 
 
@@ -477,18 +504,13 @@ bool RProtocolMaster::SendEvtMasterReport(uint8_t transactionID, uint8_t fromUni
 
 bool RProtocolMaster::SendPingReply(uint8_t transactionID, uint8_t fromUnitID, uint8_t toUnitID, uint32_t cookie)
 {
-	RMESSAGE_PING_REPLY Message;
-
-	Message.Header.ProtocolID = RPROTOCOL_ID;
-	Message.Header.FCode = FCODE_PING_REPLY;
-	Message.Header.FromUnitID = fromUnitID;
-	Message.Header.ToUnitID = toUnitID;
-	Message.Header.TransactionID = transactionID;
-	Message.Header.Length = sizeof(RMESSAGE_PING_REPLY)-sizeof(RMESSAGE_HEADER);	
+	RMESSAGE_PING_REPLY *pMessage = (RMESSAGE_PING_REPLY *)NewFrame(FCODE_PING_REPLY, fromUnitID, toUnitID, transactionID);
+	if( pMessage == 0 )
+		return false;
 
-	Message.cookie = cookie;	
+	pMessage->cookie = cookie;	
 
-	return SendNetworkPacket(toUnitID, (void *)(&Message), sizeof(Message) );
+	return SendFrame(sizeof(RMESSAGE_PING_REPLY));
 }
 	
 
@@ -496,17 +518,12 @@ bool RProtocolMaster::SendPingReply(uint8_t transactionID, uint8_t fromUnitID, u
 // Helper function - send generic OK response
 bool RProtocolMaster::SendOKResponse(uint8_t transactionID, uint8_t fromUnitID, uint8_t toUnitID, uint8_t FCode)
 {
-	RMESSAGE_RESPONSE_OK  ResponseMessage;
-
-	ResponseMessage.Header.ProtocolID = RPROTOCOL_ID;
-	ResponseMessage.Header.FCode = FCODE_RESPONSE_OK;
-	ResponseMessage.Header.FromUnitID = fromUnitID;
-	ResponseMessage.Header.ToUnitID = toUnitID;
-	ResponseMessage.Header.TransactionID = transactionID;
-	ResponseMessage.Header.Length = 1;
+	RMESSAGE_RESPONSE_OK *pResponseMessage = (RMESSAGE_RESPONSE_OK *)NewFrame(FCODE_RESPONSE_OK, fromUnitID, toUnitID, transactionID);
+	if( pResponseMessage == 0 )
+		return false;
 
-	ResponseMessage.SuccessFCode = FCode;
-	return SendNetworkPacket(toUnitID, (void *)(&ResponseMessage), sizeof(ResponseMessage) );
+	pResponseMessage->SuccessFCode = FCode;
+	return SendFrame(sizeof(RMESSAGE_RESPONSE_OK));
 }
 
 //
@@ -514,18 +531,13 @@ bool RProtocolMaster::SendOKResponse(uint8_t transactionID, uint8_t fromUnitID,
 //
 bool RProtocolMaster::SendErrorResponse(uint8_t transactionID, uint8_t fromUnitID, uint8_t toUnitID, uint8_t fCode, uint8_t errorCode)	// send error response with the same transaction ID, 
 {																									// unit ID, FCode=1 and Exception Code=2 (Illegal Data Address)
-	RMESSAGE_RESPONSE_ERROR	Message;
-
-	Message.Header.ProtocolID = RPROTOCOL_ID;
-	Message.Header.TransactionID = transactionID;
-	Message.Header.FCode = FCODE_RESPONSE_ERROR;
-	Message.Header.FromUnitID = fromUnitID;
-	Message.Header.ToUnitID = toUnitID;
-	Message.Header.Length = 2;
+	RMESSAGE_RESPONSE_ERROR *pMessage = (RMESSAGE_RESPONSE_ERROR *)NewFrame(FCODE_RESPONSE_ERROR, fromUnitID, toUnitID, transactionID);
+	if( pMessage == 0 )
+		return false;
 
-	Message.FailedFCode = fCode;
-	Message.ExceptionCode = errorCode;
-	return SendNetworkPacket(toUnitID, (void *)(&Message), sizeof(Message) );
+	pMessage->FailedFCode = fCode;
+	pMessage->ExceptionCode = errorCode;
+	return SendFrame(sizeof(RMESSAGE_RESPONSE_ERROR));
 }
 
 
@@ -588,6 +600,9 @@ inline void MessageSensorsReport( void *ptr )
 	uint8_t  nSensors = pMessage->NumSensors;
 	uint8_t	 nFirstSensor = pMessage->FirstSensor;
 
+	if( pMessage->Header.TransactionID == 0 )		// unsolicited report - station pushes its sensors on its own
+		sensorsModule.ReportStationPush(pMessage->Header.FromUnitID);
+
 	for( uint8_t i=0; i<nSensors; i++ )
 	{
 //		SYSEVT_ERROR(F("MessageSensorsReport - reporting sensor reading, station=%d, channel=%d\n"), (int)(pMessage->Header.FromUnitID), (int)(nFirstSensor+i));		
@@ -613,14 +628,14 @@ inline void MessageSysEvtReport( void *ptr )
 
 // Parameters validity check.
 
-	if( pMessage->NumDataBytes > SYSEVENT_MAX_STRING_LENGTH )
+	if( pMessage->NumDataBytes > SYSEVENT_MAX_EVENT_LENGTH )
 	{
 		SYSEVT_ERROR(F("MessageSysEvtReport - payload data is too long (%u)"), uint16_t(pMessage->NumDataBytes));
 		return;	
 	}
 // OK, payload seems to be valid.
 
-	uint8_t		evtBuf[SYSEVENT_MAX_STRING_LENGTH+1];
+	uint8_t		evtBuf[SYSEVENT_MAX_EVENT_LENGTH+1];
 	memcpy(evtBuf, (void *)(&pMessage->EvtString), uint16_t(pMessage->NumDataBytes));
 	evtBuf[pMessage->NumDataBytes] = 0; // we need to null-terminate the string since incoming message has string without termination (but with explicit length)
 
@@ -691,19 +706,14 @@ inline void MessageResponseError( void *ptr )
 //
 bool RProtocolMaster::SendReadZonesStatus( uint8_t stationID, uint16_t transactionID )
 {
-        RMESSAGE_ZONES_READ  Message;
-
-        Message.Header.ProtocolID = RPROTOCOL_ID;
-		Message.Header.FCode = FCODE_ZONES_READ;
-        Message.Header.ToUnitID = stationID;
-        Message.Header.FromUnitID = GetMyStationID();
-        Message.Header.Length = sizeof(RMESSAGE_ZONES_READ)-sizeof(RMESSAGE_HEADER);
-		Message.Header.TransactionID = transactionID;
+        RMESSAGE_ZONES_READ  *pMessage = (RMESSAGE_ZONES_READ *)NewFrame(FCODE_ZONES_READ, GetMyStationID(), stationID, transactionID);
+		if( pMessage == 0 )
+			return false;
 
-        Message.FirstZone = 0;
-		Message.NumZones = 0x0FF;	// read all station zone channels
+        pMessage->FirstZone = 0;
+		pMessage->NumZones = 0x0FF;	// read all station zone channels
 
-		return SendNetworkPacket(stationID, (void *)(&Message), sizeof(Message) );
+		return SendFrame(sizeof(RMESSAGE_ZONES_READ));
 }
 
 
@@ -729,19 +739,14 @@ bool RProtocolMaster::SendReadZonesStatus( uint8_t stationID, uint16_t transacti
 //
 bool RProtocolMaster::SendReadSystemRegisters( uint8_t stationID, uint8_t startRegister, uint8_t numRegisters, uint16_t transactionID )
 {
-        RMESSAGE_SYSREGISTERS_READ  Message;
-
-        Message.Header.ProtocolID = RPROTOCOL_ID;
-		Message.Header.FCode = FCODE_SYSREGISTERS_READ;
-        Message.Header.ToUnitID = stationID;
-        Message.Header.FromUnitID = MY_STATION_ID;
-        Message.Header.Length = sizeof(RMESSAGE_SYSREGISTERS_READ)-sizeof(RMESSAGE_HEADER);
-		Message.Header.TransactionID = transactionID;
+        RMESSAGE_SYSREGISTERS_READ  *pMessage = (RMESSAGE_SYSREGISTERS_READ *)NewFrame(FCODE_SYSREGISTERS_READ, MY_STATION_ID, stationID, transactionID);
+		if( pMessage == 0 )
+			return false;
 
-        Message.FirstRegister = startRegister;
-		Message.NumRegisters = numRegisters;	
+        pMessage->FirstRegister = startRegister;
+		pMessage->NumRegisters = numRegisters;	
 
-		return SendNetworkPacket(stationID, (void *)(&Message), sizeof(Message) );
+		return SendFrame(sizeof(RMESSAGE_SYSREGISTERS_READ));
 }
 
 
@@ -766,19 +771,14 @@ bool RProtocolMaster::SendReadSystemRegisters( uint8_t stationID, uint8_t startR
 //
 bool RProtocolMaster::SendReadSensors( uint8_t stationID, uint16_t transactionID )
 {
-        RMESSAGE_SENSORS_READ  Message;
-
-        Message.Header.ProtocolID = RPROTOCOL_ID;
-		Message.Header.FCode = FCODE_SENSORS_READ;
-        Message.Header.ToUnitID = stationID;
-        Message.Header.FromUnitID = MY_STATION_ID;
-        Message.Header.Length = sizeof(RMESSAGE_SENSORS_READ)-sizeof(RMESSAGE_HEADER);
-		Message.Header.TransactionID = transactionID;
+        RMESSAGE_SENSORS_READ  *pMessage = (RMESSAGE_SENSORS_READ *)NewFrame(FCODE_SENSORS_READ, MY_STATION_ID, stationID, transactionID);
+		if( pMessage == 0 )
+			return false;
 
-        Message.FirstSensor = 0;
-		Message.NumSensors = 0x0FF;	
+        pMessage->FirstSensor = 0;
+		pMessage->NumSensors = 0x0FF;	
 
-		return SendNetworkPacket(stationID, (void *)(&Message), sizeof(Message) );
+		return SendFrame(sizeof(RMESSAGE_SENSORS_READ));
 }
 
 
@@ -797,25 +797,57 @@ bool RProtocolMaster::SendReadSensors( uint8_t stationID, uint16_t transactionID
 //
 bool RProtocolMaster::SendForceSingleZone( uint8_t stationID, uint8_t channel, uint16_t ttr, uint16_t transactionID )
 {
-        RMESSAGE_ZONES_SET  Message;
-
 		//TRACE_VERBOSE(F("SendForceSingleZone - sending request\n"));
 
-        Message.Header.ProtocolID = RPROTOCOL_ID;
-		Message.Header.FCode = FCODE_ZONES_SET;
-        Message.Header.ToUnitID = stationID;
-        Message.Header.FromUnitID = MY_STATION_ID;
-        Message.Header.Length = sizeof(RMESSAGE_ZONES_SET)-sizeof(RMESSAGE_HEADER);
-		Message.Header.TransactionID = transactionID;
+        RMESSAGE_ZONES_SET  *pMessage = (RMESSAGE_ZONES_SET *)NewFrame(FCODE_ZONES_SET, MY_STATION_ID, stationID, transactionID);
+		if( pMessage == 0 )
+			return false;
 
-        Message.FirstZone = channel;
-		Message.Ttr = ttr;
-		Message.NumZones = 1;
-		Message.ScheduleID = 0;
-		Message.ZonesData[0] = 1 << channel;
-		Message.Flags = RMESSAGE_FLAGS_ACK_STD;
+        pMessage->FirstZone = channel;
+		pMessage->Ttr = ttr;
+		pMessage->NumZones = 1;
+		pMessage->ScheduleID = 0;
+		pMessage->ZonesData[0] = 1 << channel;
+		pMessage->Flags = RMESSAGE_FLAGS_ACK_STD;
 
-		return SendNetworkPacket(stationID, (void *)(&Message), sizeof(Message) );
+		return SendFrame(sizeof(RMESSAGE_ZONES_SET));
+}
+
+
+//
+//      RProtocol packets processing routines - start/stop group of zones
+//
+//      Input:	- stationID 
+//				- bitmap of channels/zones to operate (bit 0 - channel 0)
+//				- time to run (min), or 0 for Off
+//				- transactionID
+//
+//		Output	- true for success and false for failure.
+//
+//      The routine will generate and send request packet.
+//
+bool RProtocolMaster::SendZonesSet( uint8_t stationID, uint8_t zonesMask, uint16_t ttr, uint16_t transactionID )
+{
+		uint8_t				numZones = 0;
+
+		for( uint8_t i=0; i<8; i++ )		// note: zones bitmap is one byte, we assume that remote station has no more than 8 zones
+		{
+			if( zonesMask & (1 << i) )
+				numZones = i+1;
+		}
+
+        RMESSAGE_ZONES_SET  *pMessage = (RMESSAGE_ZONES_SET *)NewFrame(FCODE_ZONES_SET, MY_STATION_ID, stationID, transactionID);
+		if( pMessage == 0 )
+			return false;
+
+        pMessage->FirstZone = 0;
+		pMessage->Ttr = ttr;
+		pMessage->NumZones = numZones;
+		pMessage->ScheduleID = 0;
+		pMessage->ZonesData[0] = zonesMask;
+		pMessage->Flags = RMESSAGE_FLAGS_ACK_STD;
+
+		return SendFrame(sizeof(RMESSAGE_ZONES_SET));
 }
 
 
@@ -833,23 +865,18 @@ bool RProtocolMaster::SendForceSingleZone( uint8_t stationID, uint8_t channel, u
 //
 bool RProtocolMaster::SendTurnOffAllZones( uint8_t stationID, uint16_t transactionID )
 {
-        RMESSAGE_ZONES_SET  Message;
-
-        Message.Header.ProtocolID = RPROTOCOL_ID;
-		Message.Header.FCode = FCODE_ZONES_SET;
-        Message.Header.ToUnitID = stationID;
-        Message.Header.FromUnitID = MY_STATION_ID;
-        Message.Header.Length = sizeof(RMESSAGE_ZONES_SET)-sizeof(RMESSAGE_HEADER);
-		Message.Header.TransactionID = transactionID;
+        RMESSAGE_ZONES_SET  *pMessage = (RMESSAGE_ZONES_SET *)NewFrame(FCODE_ZONES_SET, MY_STATION_ID, stationID, transactionID);
+		if( pMessage == 0 )
+			return false;
 
-        Message.FirstZone = 0;
-		Message.Ttr = 0;
-		Message.NumZones = 0x0FF;
-		Message.ScheduleID = 0;
-		Message.ZonesData[0] = 0;
-		Message.Flags = RMESSAGE_FLAGS_ACK_STD;
+        pMessage->FirstZone = 0;
+		pMessage->Ttr = 0;
+		pMessage->NumZones = 0x0FF;
+		pMessage->ScheduleID = 0;
+		pMessage->ZonesData[0] = 0;
+		pMessage->Flags = RMESSAGE_FLAGS_ACK_STD;
 
-		return SendNetworkPacket(stationID, (void *)(&Message), sizeof(Message) );
+		return SendFrame(sizeof(RMESSAGE_ZONES_SET));
 }
 
 
@@ -926,22 +953,66 @@ bool RProtocolMaster::SendSetName( uint8_t stationID, const char *str, uint16_t
 //
 bool RProtocolMaster::SendRegisterEvtMaster( uint8_t stationID, uint8_t eventsMask, uint16_t transactionID)
 {
-        RMESSAGE_EVTMASTER_SET	Message;
-
 //		SYSEVT_ERROR(F("SendRegisterEventsMaster - sending request\n"));
 
-        Message.Header.ProtocolID = RPROTOCOL_ID;
-		Message.Header.FCode = FCODE_EVTMASTER_SET;
-        Message.Header.ToUnitID = stationID;
-        Message.Header.FromUnitID = MY_STATION_ID;
-        Message.Header.Length = sizeof(RMESSAGE_EVTMASTER_SET)-sizeof(RMESSAGE_HEADER);
-		Message.Header.TransactionID = transactionID;
+        RMESSAGE_EVTMASTER_SET	*pMessage = (RMESSAGE_EVTMASTER_SET *)NewFrame(FCODE_EVTMASTER_SET, MY_STATION_ID, stationID, transactionID);
+		if( pMessage == 0 )
+			return false;
 
-        Message.EvtFlags = EVTMASTER_FLAGS_REGISTER_SELF | eventsMask;
-		Message.MasterStationAddress = Message.MasterStationID = 0;
-		Message.Flags = RMESSAGE_FLAGS_ACK_STD;
+        pMessage->EvtFlags = EVTMASTER_FLAGS_REGISTER_SELF | eventsMask;
+		pMessage->MasterStationAddress = pMessage->MasterStationID = 0;
+		pMessage->Flags = RMESSAGE_FLAGS_ACK_STD;
 
-		return SendNetworkPacket(stationID, (void *)(&Message), sizeof(Message) );
+		return SendFrame(sizeof(RMESSAGE_EVTMASTER_SET));
+}
+
+
+//
+//      RProtocol packets processing routines - FCODE_SENSORS_REPORTCFG_SET
+//
+//      Input:	- stationID 
+//				- transactionID
+//
+//		Output	- true for success and false for failure.
+//
+//		Sends push reporting config (report interval and deadband) for all sensors of the station.
+//		Sensor channel on the station is the sensor number in the message, channels that are not used on the Master
+//		are sent with reporting disabled.
+//
+bool RProtocolMaster::SendSensorsReportConfig( uint8_t stationID, uint16_t transactionID )
+{
+		ShortSensor			sSensor;
+		uint8_t				numSensors = 0;
+
+        RMESSAGE_SENSORS_REPORTCFG_SET *pMessage = (RMESSAGE_SENSORS_REPORTCFG_SET *)NewFrame(FCODE_SENSORS_REPORTCFG_SET, MY_STATION_ID, stationID, transactionID);
+		if( pMessage == 0 )
+			return false;
+
+		memset(pMessage->SensorsCfg, 0, MAX_SENSORS*sizeof(RSENSOR_REPORTCFG));
+
+		for( uint8_t i=0; i<GetNumSensors(); i++ )
+		{
+			LoadShortSensor(i, &sSensor);
+			if( (sSensor.sensorStationID != stationID) || (sSensor.sensorChannel >= MAX_SENSORS) )
+				continue;
+
+			pMessage->SensorsCfg[sSensor.sensorChannel].Interval = GetSensorReportInterval(i);
+			pMessage->SensorsCfg[sSensor.sensorChannel].Deadband = GetSensorReportDeadband(i);
+			if( sSensor.sensorChannel >= numSensors )
+				numSensors = sSensor.sensorChannel+1;
+		}
+
+		if( numSensors == 0 )
+		{
+			DropFrame();
+			return false;
+		}
+
+		pMessage->Flags = RMESSAGE_FLAGS_ACK_ERROR | RMESSAGE_FLAGS_ACK_BRIEF;
+        pMessage->FirstSensor = 0;
+		pMessage->NumSensors = numSensors;
+
+		return SendFrame(sizeof(RMESSAGE_SENSORS_REPORTCFG_SET) + (numSensors-1)*sizeof(RSENSOR_REPORTCFG));
 }
 
 //
@@ -955,20 +1026,15 @@ bool RProtocolMaster::SendRegisterEvtMaster( uint8_t stationID, uint8_t eventsMa
 //
 inline void SendTimeBroadcastInt(void)
 {
-	RMESSAGE_TIME_BROADCAST Message;
-
 		TRACE_INFO(F("Sending time broadcast\n"));
 
-        Message.Header.ProtocolID = RPROTOCOL_ID;
-		Message.Header.FCode = FCODE_TIME_BROADCAST;
-        Message.Header.ToUnitID = STATIONID_BROADCAST;	// broadcast
-        Message.Header.FromUnitID = MY_STATION_ID;
-        Message.Header.Length = sizeof(RMESSAGE_TIME_BROADCAST)-sizeof(RMESSAGE_HEADER);
-		Message.Header.TransactionID = 0;
+        RMESSAGE_TIME_BROADCAST *pMessage = (RMESSAGE_TIME_BROADCAST *)rprotocol.NewFrame(FCODE_TIME_BROADCAST, MY_STATION_ID, STATIONID_BROADCAST, 0);
+		if( pMessage == 0 )
+			return;
 
-		Message.timeNow = now();
+		pMessage->timeNow = now();
 
-		SendNetworkPacket(STATIONID_BROADCAST, (void *)(&Message), sizeof(Message) );
+		rprotocol.SendFrame(sizeof(RMESSAGE_TIME_BROADCAST));
 }
 
 //
@@ -1114,6 +1180,78 @@ inline void MessageSensorsRead( void *ptr )
 	return;
 }
 
+//
+//	RProtocol packets processing routines - FCODE_SENSORS_POLL
+//
+//	Input - pointer to the input packet 
+//	
+//	Slotted sensors poll is broadcast. If this station is polled, the routine will schedule sensors report 
+//	in the station time slot (see RMESSAGE_SENSORS_POLL).
+//
+inline void MessageSensorsPoll( void *ptr )
+{
+	register RMESSAGE_SENSORS_POLL	*pMessage = (RMESSAGE_SENSORS_POLL *)ptr;
+	uint8_t		myID = GetMyStationID();
+	uint8_t		slot = 0;
+
+	// parameters length check
+	if( pMessage->Header.Length != (sizeof(RMESSAGE_SENSORS_POLL)-sizeof(RMESSAGE_HEADER)) )
+	{
+		SYSEVT_ERROR(F("MessageSensorsPoll - bad parameters length"));
+		return;		// Note: In RProtocol station does not respond to malformed/invalid packets, just ignore it
+	}
+
+	if( (myID >= MAX_STATIONS) || !(pMessage->StationsMask & (1U << myID)) || (GetNumSensors() == 0) )
+		return;		// we are not polled, or have nothing to report
+
+	for( uint8_t i=0; i<myID; i++ )
+	{
+		if( pMessage->StationsMask & (1U << i) )
+			slot++;
+	}
+
+	rprotocol.ScheduleSlottedReport(pMessage->Header.TransactionID, pMessage->Header.FromUnitID, uint16_t(slot) * pMessage->SlotTime);
+}
+
+//
+//	RProtocol packets processing routines - FCODE_SENSORS_REPORTCFG_SET
+//
+//	Input - pointer to the input packet 
+//	
+//	The routine will save sensors push reporting config and send response.
+//	Sensors with new config are reported on the next sampling cycle.
+//
+inline void MessageSensorsReportCfgSet( void *ptr )
+{
+	register RMESSAGE_SENSORS_REPORTCFG_SET	*pMessage = (RMESSAGE_SENSORS_REPORTCFG_SET *)ptr;
+
+	// parameters length check
+	if( (pMessage->NumSensors < 1) || 
+		(pMessage->Header.Length != ((sizeof(RMESSAGE_SENSORS_REPORTCFG_SET)-sizeof(RMESSAGE_HEADER)) + (pMessage->NumSensors-1)*sizeof(RSENSOR_REPORTCFG))) )
+	{
+		SYSEVT_ERROR(F("MessageSensorsReportCfgSet - bad parameters length"));
+		return;		// Note: In RProtocol station does not respond to malformed/invalid packets, just ignore it
+	}
+
+	if( (pMessage->FirstSensor+pMessage->NumSensors) > GetNumSensors() )
+	{
+		SYSEVT_ERROR(F("MessageSensorsReportCfgSet - wrong input parameters"));
+
+		if( pMessage->Flags & RMESSAGE_FLAGS_ACK_ERROR )
+			rprotocol.SendErrorResponse(pMessage->Header.TransactionID, pMessage->Header.ToUnitID, pMessage->Header.FromUnitID, pMessage->Header.FCode, 2);	// Exception Code=2 (Illegal Data Address)
+		return;
+	}
+
+	for( uint8_t i=0; i<pMessage->NumSensors; i++ )
+	{
+		SetSensorReportConfig(pMessage->FirstSensor+i, pMessage->SensorsCfg[i].Interval, pMessage->SensorsCfg[i].Deadband);
+		sensorsModule.ResetSensorPush(pMessage->FirstSensor+i);
+	}
+
+	if( pMessage->Flags & RMESSAGE_FLAGS_ACK_BRIEF ) 
+		rprotocol.SendOKResponse(pMessage->Header.TransactionID, pMessage->Header.ToUnitID, pMessage->Header.FromUnitID, pMessage->Header.FCode);
+}
+
 //
 //	packets processing routines - Ping
 //
@@ -1212,14 +1350,51 @@ void RProtocolMaster::ProcessNewFrame(uint8_t *ptr, int len, uint8_t *pNetAddres
 		if( pMessage->Header.FromUnitID < MAX_STATIONS ){	// basic protection check to ensure we don't go outside of range
 			
 			runState.sLastContactTime[pMessage->Header.FromUnitID] = millis();
-			runState.iLastReceivedRSSI[pMessage->Header.FromUnitID] = LastReceivedRSSI;
+			if( !_bReassembled )		// fragments of the reassembled message are already counted
+				_linkStats[pMessage->Header.FromUnitID].rxFrames++;
+			if( !_bRelayedFrame )		// RSSI of the relayed frame is the RSSI of the last hop
+				runState.iLastReceivedRSSI[pMessage->Header.FromUnitID] = LastReceivedRSSI;
+#ifdef HW_ENABLE_ETHERNET
+			WebNotify(WEB_EVT_STATION, pMessage->Header.FromUnitID);
+#endif //HW_ENABLE_ETHERNET
 		}
 // and report station->address association to ARP (if registered)
 
 		if( (_ARPAddressUpdate != 0) && (pNetAddress != 0) ) _ARPAddressUpdate(pMessage->Header.FromUnitID, pNetAddress);
 
+// station that sent us a frame directly is within RF range, learned route to it is not needed anymore
+
+		if( !_bRelayedFrame && (pMessage->Header.ToUnitID == GetMyStationID()) )
+			LearnRoute(pMessage->Header.FromUnitID, pMessage->Header.FromUnitID);
+
 		TRACE_INFO(F("ProcessNewFrame - processing packet, FCode: %d\n"), pMessage->Header.FCode);
 
+// Match responses to outstanding requests. Responses are identified by non-zero TransactionID (unsolicited reports carry zero).
+// Response that does not match any outstanding request is stale (request already completed or timed out) and is dropped,
+// since its data may be older than the results we already have.
+
+		int8_t		transaction = -1;
+		uint16_t	stationBit = (pMessage->Header.FromUnitID < MAX_STATIONS) ? (1U << pMessage->Header.FromUnitID) : 0;
+
+		if( (pMessage->Header.FCode == FCODE_SENSORS_REPORT) && (pMessage->Header.TransactionID != 0) && 
+			(pMessage->Header.TransactionID == _slotPollTID) && (_slotPollPending & stationBit) )
+		{
+			_slotPollPending &= ~stationBit;		// reply to the slotted sensors poll
+		}
+		else if( (pMessage->Header.TransactionID != 0) && 
+			((pMessage->Header.FCode == FCODE_ZONES_REPORT) || (pMessage->Header.FCode == FCODE_SENSORS_REPORT) ||
+			 (pMessage->Header.FCode == FCODE_SYSREGISTERS_REPORT) || (pMessage->Header.FCode == FCODE_EVTMASTER_REPORT) ||
+			 (pMessage->Header.FCode == FCODE_PING_REPLY) || (pMessage->Header.FCode == FCODE_RESPONSE_OK) || 
+			 (pMessage->Header.FCode == FCODE_RESPONSE_ERROR)) )
+		{
+			transaction = FindTransaction(pMessage->Header.TransactionID, pMessage->Header.FromUnitID);
+			if( (transaction < 0) || (_transactions[transaction].state != RTRANSACTION_SENT) )
+			{
+				TRACE_INFO(F("ProcessNewFrame - stale response from station %d, TransactionID: %d\n"), int(pMessage->Header.FromUnitID), int(pMessage->Header.TransactionID));
+				return;
+			}
+		}
+
         switch( pMessage->Header.FCode )
         {
 // Standard FCodes
@@ -1247,6 +1422,9 @@ void RProtocolMaster::ProcessNewFrame(uint8_t *ptr, int len, uint8_t *pNetAddres
                                 MessageResponseError( ptr );
                                 break;
 
+                case FCODE_RESPONSE_OK:
+                                break;		// request completion is handled below
+
                 case FCODE_SCAN_REPLY:
 //                                StationsScanResponse( ptr );
                                 break;
@@ -1259,6 +1437,18 @@ void RProtocolMaster::ProcessNewFrame(uint8_t *ptr, int len, uint8_t *pNetAddres
 								MessagePing( ptr );
 								break;
 
+				case FCODE_RELAY:
+								ProcessRelayFrame( ptr );
+								break;
+
+				case FCODE_FRAGMENT:
+								ProcessFragment( ptr, pNetAddress );
+								break;
+
+				case FCODE_FRAGMENT_ACK:
+								ProcessFragmentAck( ptr );
+								break;
+
 //
 // Packets used when acting as a client
 //
@@ -1288,6 +1478,14 @@ void RProtocolMaster::ProcessNewFrame(uint8_t *ptr, int len, uint8_t *pNetAddres
 								MessageSensorsRead( ptr );
 								break;
 
+				case FCODE_SENSORS_REPORTCFG_SET:
+								MessageSensorsReportCfgSet( ptr );
+								break;
+
+				case FCODE_SENSORS_POLL:
+								MessageSensorsPoll( ptr );
+								break;
+
 				case FCODE_SCAN:	
 								MessageStationsScan( ptr );
 								break;
@@ -1299,121 +1497,1163 @@ void RProtocolMaster::ProcessNewFrame(uint8_t *ptr, int len, uint8_t *pNetAddres
 								break;
 		}
 
+		if( transaction >= 0 )
+			CompleteTransaction(transaction, (pMessage->Header.FCode != FCODE_RESPONSE_ERROR) ? RPROTOCOL_RESULT_OK : RPROTOCOL_RESULT_ERROR, ptr);
+
         return;
 }
 
 
 //
-//	Remote station requests
-//
-
+//	Outgoing frame buffer
 //
-// Turn On/Off channels
+//	Frames are built in place in the frame buffer, after the headroom reserved for the transport and relay headers. Multi-hop
+//	routing writes the relay header into the headroom instead of copying the frame into a new buffer, and the transport sends
+//	the frame from the buffer - MoteinoRF writes the sequence number into the headroom and keeps the frame queued until
+//	it is delivered (see FrameDone()), XBee sends it directly. There are RPROTOCOL_TX_FRAMES buffers, if all of them are
+//	queued by the transport NewFrame() fails as if the transport was busy.
+//	Only one frame is built at a time. Request to build a frame while another one is being built (e.g. system event raised
+//	by the transport) fails, which also protects us from recursive system event notifications.
 //
 
-bool RProtocolMaster::ChannelOn( uint8_t stationID, uint8_t chan, uint8_t ttr )
+// Free frame buffer, or -1 if all of them are queued by the transport
+int8_t RProtocolMaster::FreeFrame(void)
 {
-	{   // limit scope of sStation declaration to save memory during subsequent call
-		ShortStation	sStation;
+	for( int8_t i=0; i<RPROTOCOL_TX_FRAMES; i++ )
+	{
+		if( _txFrames[i].state == RFRAME_FREE )
+			return i;
+	}
+	return -1;
+}
 
-		TRACE_INFO(F("RProtocol - ChannelOn, stationID=%d, channel=%d, ttr=%d\n"), (int)stationID, (int)chan, (int)ttr);
+// Start new frame. Fills in the header and returns pointer to the message, or 0 if the frame buffer is busy.
+void *RProtocolMaster::NewFrame(uint8_t fCode, uint8_t fromUnitID, uint8_t toUnitID, uint8_t transactionID)
+{
+	int8_t	nFrame = -1;
 
-		if( stationID >= MAX_STATIONS )
-		{
-			SYSEVT_ERROR(F("RProtocol ChannelOn - stationID outside of range"));
-			return false;
-		}
+	if( _txFrames[_txFrameCur].state != RFRAME_BUILDING )
+		nFrame = FreeFrame();
 
-		LoadShortStation(stationID, &sStation);
-		if( !(sStation.stationFlags & STATION_FLAGS_VALID) || !(sStation.stationFlags & STATION_FLAGS_ENABLED) )
-		{
-			SYSEVT_ERROR(F("RProtocol ChannelOn - station %d is not enabled"), (int)stationID);
-			return false;
-		}
+	if( nFrame < 0 )
+	{
+		TRACE_ERROR(F("RProtocol - frame buffer is busy, FCode: %d not sent\n"), int(fCode));
+		return 0;
+	}
 
+	RFrame			*pFrame = &_txFrames[nFrame];
+	RMESSAGE_HEADER	*pHeader = (RMESSAGE_HEADER *)(pFrame->buf + RFRAME_HEADROOM);
+
+	_txFrameCur = nFrame;
+	pFrame->state = RFRAME_BUILDING;
+	pFrame->len = 0;
+
+	pHeader->ProtocolID = RPROTOCOL_ID;
+	pHeader->FCode = fCode;
+	pHeader->FromUnitID = fromUnitID;
+	pHeader->ToUnitID = toUnitID;
+	pHeader->TransactionID = transactionID;
+	pHeader->Length = 0;
+
+	return pHeader;
+}
+
+// Send the frame to the station in the frame header, mSize is the message size (including the header)
+bool RProtocolMaster::SendFrame(uint8_t mSize)
+{
+	RFrame			*pFrame = &_txFrames[_txFrameCur];
+	RMESSAGE_HEADER	*pHeader = (RMESSAGE_HEADER *)(pFrame->buf + RFRAME_HEADROOM);
+	bool			ret = false;
+
+	if( mSize > RPROTOCOL_MAX_FRAME_SIZE )
+	{
+		TRACE_ERROR(F("RProtocol - frame is too long, FCode: %d, len: %d\n"), int(pHeader->FCode), int(mSize));
 	}
+	else
+	{
+		pHeader->Length = mSize - sizeof(RMESSAGE_HEADER);
+		pFrame->len = mSize;
 
-// OK, everything seems to be good. Send command.
+		ret = RouteFrame(pHeader->ToUnitID);
+	}
 
-	return SendForceSingleZone( stationID, chan, ttr, 0 );
+	if( pFrame->state == RFRAME_BUILDING )		// not queued by the transport
+		pFrame->state = RFRAME_FREE;
+	return ret;
 }
 
-bool RProtocolMaster::ChannelOff( uint8_t stationID, uint8_t chan )
+// Drop the frame being built
+void RProtocolMaster::DropFrame(void)
 {
-	return ChannelOn( stationID, chan, 0 );
+	if( _txFrames[_txFrameCur].state == RFRAME_BUILDING )
+		_txFrames[_txFrameCur].state = RFRAME_FREE;
 }
 
-bool RProtocolMaster::AllChannelsOff(uint8_t stationID)
+// 
+// Transport "send packet" routine, sends the packet in the frame buffer to the station (single hop).
+//
+// If new types of transport are added, appropriate handler needs to be added to this routine.
+// Returns false if no transport accepted the packet (transport is not ready, TX queue is full etc).
+//
+bool RProtocolMaster::SendTransportPacket(uint8_t stationID, uint8_t nFrame, void *pMessage, uint8_t mSize)
 {
-	{
-		ShortStation	sStation;
+		RFrame	*pFrame = &_txFrames[nFrame];
+		bool	ret = false;
 
-		if( stationID >= MAX_STATIONS )
-		{
-			SYSEVT_ERROR(F("XBee AllChannelsOff - stationID outside of range"));
-			return false;
-		}
+		pFrame->transactionID = ((RMESSAGE_HEADER *)pMessage)->TransactionID;
 
-		LoadShortStation(stationID, &sStation);
-		if( !(sStation.stationFlags & STATION_FLAGS_VALID) || !(sStation.stationFlags & STATION_FLAGS_ENABLED) )
+#ifdef HW_ENABLE_XBEE
+		if( XBeeSendPacket(stationID, pMessage, mSize) )
+			ret = true;
+#endif //HW_ENABLE_XBEE
+
+#ifdef HW_ENABLE_MOTEINORF
+		if( MoteinoRFSendPacket(stationID, pMessage, mSize, TransportDoneCallback, nFrame) )
 		{
-			SYSEVT_ERROR(F("XBee AllChannelsOff - station %d is not enabled"), (int)stationID);
-			return false;
+			pFrame->state = RFRAME_SENDING;		// the frame is sent from the buffer, it is released by FrameDone()
+			ret = true;
 		}
+#endif //HW_ENABLE_MOTEINORF
 
-	}
+		return ret;
+}
 
-// OK, everything seems to be valid. Send command.
+// Transport is done with the frame
+void RProtocolMaster::FrameDone(uint8_t stationID, uint8_t nFrame, bool bSuccess)
+{
+	RFrame	*pFrame = &_txFrames[nFrame];
 
-	return SendTurnOffAllZones( stationID, 0 );
+	pFrame->state = RFRAME_FREE;
+	TransportDone(stationID, pFrame->transactionID, bSuccess);
 }
 
-void RProtocolMaster::SendTimeBroadcast(void)
+
+//
+//	Fragmentation
+//
+//	Message that does not fit into one frame is built in the message buffer and sent to the station as a series of
+//	FCODE_FRAGMENT frames. Fragments are sent from loop() as the transport accepts them, the message is kept until the receiver
+//	confirms it with FCODE_FRAGMENT_ACK. Fragments reported missing are re-sent, and if no ACK arrives in time the last fragment 
+//	is re-sent to ask the receiver for the reassembly state. After RPROTOCOL_FRAGMENT_RETRIES rounds the message is dropped.
+//
+//	Receiver reassembles one message at a time, and processes the complete message as if it arrived in one frame.
+//	Fragments of another message are dropped until the current one completes or times out (the sender will re-send them).
+//	Outgoing and incoming messages share the message buffer - fragments are dropped while own message is being sent, and
+//	new long message cannot be sent while another one is reassembled (or processed).
+//
+
+// Max frame size to the station - frames to stations reached through a relay carry the relay header
+uint8_t RProtocolMaster::MaxFrameSize(uint8_t stationID)
 {
-	static  time_t	nextBroadcastTime = 0;
+	if( NextHop(stationID) != stationID )
+		return RPROTOCOL_MAX_FRAME_SIZE - RMESSAGE_RELAY_OVERHEAD;
 
-	if(nextBroadcastTime <= now()){
+	return RPROTOCOL_MAX_FRAME_SIZE;
+}
 
-		SendTimeBroadcastInt();
+// Start new message of mSize bytes (including the header). Returns pointer to the message, or 0 if the message buffer is busy.
+void *RProtocolMaster::NewMessage(uint8_t fCode, uint8_t fromUnitID, uint8_t toUnitID, uint8_t transactionID, uint8_t mSize)
+{
+	if( mSize <= MaxFrameSize(toUnitID) )
+		return NewFrame(fCode, fromUnitID, toUnitID, transactionID);		// fits into one frame
 
-		nextBroadcastTime = now() + 60; //  every 60 seconds
-	}  
+	if( (toUnitID >= MAX_STATIONS) || (mSize > RPROTOCOL_MAX_MESSAGE_SIZE) )
+	{
+		TRACE_ERROR(F("RProtocol - message is too long, FCode: %d, len: %d\n"), int(fCode), int(mSize));
+		return 0;
+	}
+
+	if( !MessageBufFree() )
+	{
+		TRACE_ERROR(F("RProtocol - message buffer is busy, FCode: %d not sent\n"), int(fCode));
+		return 0;
+	}
+
+	RMESSAGE_HEADER	*pHeader = (RMESSAGE_HEADER *)(_msgBuf);
+
+	_txMessage.state = RMESSAGE_TX_BUILDING;
+
+	pHeader->ProtocolID = RPROTOCOL_ID;
+	pHeader->FCode = fCode;
+	pHeader->FromUnitID = fromUnitID;
+	pHeader->ToUnitID = toUnitID;
+	pHeader->TransactionID = transactionID;
+	pHeader->Length = 0;
 
+	return pHeader;
 }
 
-bool RProtocolMaster::PollStationSensors(uint8_t stationID)
+// Send the message started with NewMessage()
+bool RProtocolMaster::SendMessage(void *pMessage, uint8_t mSize)
 {
-	{
-		ShortStation	sStation;
+	if( pMessage != _msgBuf )
+		return SendFrame(mSize);		// message fits into one frame
 
-		if( stationID >= MAX_STATIONS )
-		{
-			SYSEVT_ERROR(F("RProtocol PollStationSensors - stationID outside of range"));
-			return false;
-		}
+	RMESSAGE_HEADER	*pHeader = (RMESSAGE_HEADER *)(_msgBuf);
 
-		LoadShortStation(stationID, &sStation);
-		if( !(sStation.stationFlags & STATION_FLAGS_VALID) || !(sStation.stationFlags & STATION_FLAGS_ENABLED) )
-		{
-			SYSEVT_ERROR(F("RProtocol PollStationSensors - station %d is not enabled"), (int)stationID);
-			return false;
-		}
+	_txMessage.fragSize = MaxFrameSize(pHeader->ToUnitID) - RMESSAGE_FRAGMENT_OVERHEAD;
+	_txMessage.numFrags = (mSize + _txMessage.fragSize - 1) / _txMessage.fragSize;
 
-		if( (sStation.networkID != NETWORK_ID_XBEE) && (sStation.networkID != NETWORK_ID_MOTEINORF) )
-		{
-			SYSEVT_ERROR(F("RProtocol PollStationSensors - station %d is of a wrong type (not XBee or RFM69)"), (int)stationID);
-			return false;
-		}
+	if( (mSize > RPROTOCOL_MAX_MESSAGE_SIZE) || (_txMessage.numFrags > RPROTOCOL_MAX_FRAGMENTS) )
+	{
+		TRACE_ERROR(F("RProtocol - message is too long, FCode: %d, len: %d\n"), int(pHeader->FCode), int(mSize));
+		_txMessage.state = RMESSAGE_TX_FREE;
+		return false;
 	}
 
-	TRACE_INFO(F("PollStationSensors - sending request to station %d\n"), stationID);
+	pHeader->Length = mSize - sizeof(RMESSAGE_HEADER);
+	_txMessage.len = mSize;
+	_txMessage.msgID++;
+	_txMessage.toSend = uint8_t((1U << _txMessage.numFrags) - 1);
+	_txMessage.retries = 0;
+	_txMessage.state = RMESSAGE_TX_SENDING;
 
-// OK, everything seems to be ready. Send command.
+	TRACE_INFO(F("RProtocol - sending message to station %d in %d fragments, FCode: %d\n"), int(pHeader->ToUnitID), int(_txMessage.numFrags), int(pHeader->FCode));
 
-	return SendReadSensors( stationID, 0 );
+	SendFragments();
+	return true;		// fragments the transport did not accept now are sent from loop()
 }
 
-bool RProtocolMaster::SubscribeEvents( uint8_t stationID )
+// Send pending fragments of the outgoing message. Returns false if the transport did not accept some of them.
+bool RProtocolMaster::SendFragments(void)
+{
+	RMESSAGE_HEADER	*pHeader = (RMESSAGE_HEADER *)(_msgBuf);
+
+	for( uint8_t i=0; i<_txMessage.numFrags; i++ )
+	{
+		if( !(_txMessage.toSend & (1 << i)) )
+			continue;
+
+		RMESSAGE_FRAGMENT	*pFragment = (RMESSAGE_FRAGMENT *)NewFrame(FCODE_FRAGMENT, pHeader->FromUnitID, pHeader->ToUnitID, pHeader->TransactionID);
+		if( pFragment == 0 )
+			return false;
+
+		uint8_t		offset = i * _txMessage.fragSize;
+		uint8_t		size = min(uint8_t(_txMessage.len - offset), _txMessage.fragSize);
+
+		pFragment->MsgID = _txMessage.msgID;
+		pFragment->FragIndex = i;
+		pFragment->NumFrags = _txMessage.numFrags;
+		pFragment->Offset = offset;
+		memcpy(pFragment->Data, _msgBuf + offset, size);
+
+		if( !SendFrame(RMESSAGE_FRAGMENT_OVERHEAD + size) )
+			return false;		// transport did not take it, the fragment stays pending
+
+		_txMessage.toSend &= ~(1 << i);
+	}
+
+	_txMessage.deadline = millis() + RPROTOCOL_RESPONSE_TIMEOUT;		// all sent, wait for ACK
+	return true;
+}
+
+bool RProtocolMaster::SendFragmentAck(uint8_t toUnitID, uint8_t msgID, uint8_t missing)
+{
+	RMESSAGE_FRAGMENT_ACK *pMessage = (RMESSAGE_FRAGMENT_ACK *)NewFrame(FCODE_FRAGMENT_ACK, GetMyStationID(), toUnitID, 0);
+	if( pMessage == 0 )
+		return false;
+
+	pMessage->MsgID = msgID;
+	pMessage->Missing = missing;
+
+	return SendFrame(sizeof(RMESSAGE_FRAGMENT_ACK));
+}
+
+//
+//	RProtocol packets processing routines - FCODE_FRAGMENT
+//
+//	Input - pointer to the input packet 
+// 			It is assumed that basic input packet structure is already validated
+//
+void RProtocolMaster::ProcessFragment(uint8_t *ptr, uint8_t *pNetAddress)
+{
+	RMESSAGE_FRAGMENT	*pMessage = (RMESSAGE_FRAGMENT *)ptr;
+	uint8_t				fromUnitID = pMessage->Header.FromUnitID;
+	uint8_t				size = pMessage->Header.Length + sizeof(RMESSAGE_HEADER) - RMESSAGE_FRAGMENT_OVERHEAD;
+	unsigned long		timeNow = millis();
+
+	if( pMessage->Header.ToUnitID != GetMyStationID() )
+		return;		// fragment to another station (e.g. XBee frame sent as broadcast)
+
+	if( (pMessage->Header.Length < (RMESSAGE_FRAGMENT_OVERHEAD - sizeof(RMESSAGE_HEADER))) ||
+		(pMessage->NumFrags > RPROTOCOL_MAX_FRAGMENTS) || (pMessage->FragIndex >= pMessage->NumFrags) ||
+		((uint16_t(pMessage->Offset) + size) > RPROTOCOL_MAX_MESSAGE_SIZE) )
+	{
+		SYSEVT_ERROR(F("ProcessFragment - bad fragment from station %d"), int(fromUnitID));
+		return;
+	}
+
+	if( (fromUnitID == _rxMessage.doneFromUnitID) && (pMessage->MsgID == _rxMessage.doneMsgID) && (long(timeNow - _rxMessage.doneDeadline) < 0) )
+	{
+		SendFragmentAck(fromUnitID, pMessage->MsgID, 0);		// message is already processed, sender did not get our ACK
+		return;
+	}
+
+	if( _rxMessage.bActive && ((fromUnitID != _rxMessage.fromUnitID) || (pMessage->MsgID != _rxMessage.msgID)) )
+	{
+		if( long(timeNow - _rxMessage.deadline) < 0 )
+		{
+			TRACE_INFO(F("ProcessFragment - reassembly buffer is busy, fragment from station %d dropped\n"), int(fromUnitID));
+			return;
+		}
+
+		TRACE_ERROR(F("ProcessFragment - message from station %d timed out\n"), int(_rxMessage.fromUnitID));
+		_rxMessage.bActive = false;
+	}
+
+	if( !_rxMessage.bActive )
+	{
+		if( _txMessage.state != RMESSAGE_TX_FREE )
+		{
+			TRACE_INFO(F("ProcessFragment - message buffer is busy, fragment from station %d dropped\n"), int(fromUnitID));
+			return;
+		}
+		_rxMessage.bActive = true;
+		_rxMessage.fromUnitID = fromUnitID;
+		_rxMessage.msgID = pMessage->MsgID;
+		_rxMessage.numFrags = pMessage->NumFrags;
+		_rxMessage.received = 0;
+		_rxMessage.len = 0;
+	}
+	else if( pMessage->NumFrags != _rxMessage.numFrags )
+	{
+		SYSEVT_ERROR(F("ProcessFragment - bad fragment from station %d"), int(fromUnitID));
+		return;
+	}
+
+	memcpy(_msgBuf + pMessage->Offset, pMessage->Data, size);
+	_rxMessage.received |= (1 << pMessage->FragIndex);
+	if( (pMessage->Offset + size) > _rxMessage.len )
+		_rxMessage.len = pMessage->Offset + size;
+	_rxMessage.deadline = timeNow + RPROTOCOL_REASSEMBLY_TIMEOUT;
+
+	uint8_t		missing = uint8_t((1U << _rxMessage.numFrags) - 1) & ~_rxMessage.received;
+
+	if( missing != 0 )
+	{
+		if( pMessage->FragIndex == (pMessage->NumFrags-1) )
+			SendFragmentAck(fromUnitID, pMessage->MsgID, missing);		// ask for the missing fragments
+
+		return;
+	}
+
+// message is complete - confirm it and process
+
+	_rxMessage.doneFromUnitID = fromUnitID;
+	_rxMessage.doneMsgID = pMessage->MsgID;
+	_rxMessage.doneDeadline = timeNow + RPROTOCOL_DONE_TIMEOUT;		// sender's MsgID restarts after reboot, don't confirm new messages by the old ID forever
+	SendFragmentAck(fromUnitID, pMessage->MsgID, 0);
+
+	TRACE_INFO(F("ProcessFragment - message from station %d reassembled, len: %d\n"), int(fromUnitID), int(_rxMessage.len));
+
+	uint8_t		fCode = ((RMESSAGE_HEADER *)(_msgBuf))->FCode;
+
+	if( (fCode == FCODE_FRAGMENT) || (fCode == FCODE_FRAGMENT_ACK) || (fCode == FCODE_RELAY) )
+	{
+		SYSEVT_ERROR(F("ProcessFragment - bad reassembled message from station %d"), int(fromUnitID));		// would be processed in the reassembly buffer
+		_rxMessage.bActive = false;
+		return;
+	}
+
+	_bReassembled = true;
+	ProcessNewFrame(_msgBuf, _rxMessage.len, pNetAddress);
+	_bReassembled = false;
+	_rxMessage.bActive = false;
+}
+
+//
+//	RProtocol packets processing routines - FCODE_FRAGMENT_ACK
+//
+void RProtocolMaster::ProcessFragmentAck(uint8_t *ptr)
+{
+	RMESSAGE_FRAGMENT_ACK	*pMessage = (RMESSAGE_FRAGMENT_ACK *)ptr;
+	RMESSAGE_HEADER			*pHeader = (RMESSAGE_HEADER *)(_msgBuf);
+
+	if( (_txMessage.state != RMESSAGE_TX_SENDING) || (pMessage->Header.FromUnitID != pHeader->ToUnitID) || (pMessage->MsgID != _txMessage.msgID) )
+		return;		// stale ACK
+
+	if( pMessage->Missing == 0 )
+	{
+		_txMessage.state = RMESSAGE_TX_FREE;		// delivered
+		return;
+	}
+
+	if( _txMessage.retries >= RPROTOCOL_FRAGMENT_RETRIES )
+	{
+		TRACE_ERROR(F("RProtocol - message to station %d dropped, fragments missing: %x\n"), int(pHeader->ToUnitID), uint16_t(pMessage->Missing));
+		_txMessage.state = RMESSAGE_TX_FREE;
+		return;
+	}
+
+	_txMessage.retries++;
+	_txMessage.toSend |= pMessage->Missing & uint8_t((1U << _txMessage.numFrags) - 1);
+	SendFragments();
+}
+
+// Send fragments the transport did not accept earlier, ask for ACK when it is overdue, and drop expired reassembly
+void RProtocolMaster::CheckFragments(void)
+{
+	unsigned long	timeNow = millis();
+
+	if( _txMessage.state == RMESSAGE_TX_SENDING )
+	{
+		if( _txMessage.toSend != 0 )
+		{
+			SendFragments();
+		}
+		else if( long(timeNow - _txMessage.deadline) >= 0 )
+		{
+			if( _txMessage.retries >= RPROTOCOL_FRAGMENT_RETRIES )
+			{
+				TRACE_ERROR(F("RProtocol - no ACK for the message to station %d, dropped\n"), int(((RMESSAGE_HEADER *)(_msgBuf))->ToUnitID));
+				_txMessage.state = RMESSAGE_TX_FREE;
+			}
+			else
+			{
+				_txMessage.retries++;
+				_txMessage.toSend = 1 << (_txMessage.numFrags-1);		// last fragment makes the receiver reply with ACK
+				SendFragments();
+			}
+		}
+	}
+
+	if( _rxMessage.bActive && (long(timeNow - _rxMessage.deadline) >= 0) )
+	{
+		TRACE_ERROR(F("RProtocol - message from station %d timed out, fragments received: %x\n"), int(_rxMessage.fromUnitID), uint16_t(_rxMessage.received));
+		_rxMessage.bActive = false;
+	}
+
+	if( (_rxMessage.doneFromUnitID != STATIONID_BROADCAST) && (long(timeNow - _rxMessage.doneDeadline) >= 0) )
+		_rxMessage.doneFromUnitID = STATIONID_BROADCAST;		// forget the last reassembled message
+}
+
+
+//
+//	Multi-hop RF (relay)
+//
+//	Stations outside of the master RF range are reached through relay stations (remote stations built with SG_RF_RELAY).
+//	Frames to such station are wrapped into FCODE_RELAY frame and sent to the relay, the relay forwards the frame towards
+//	the destination (directly, or through the next relay) and decrements TTL on each hop.
+//
+//	Routes are static (RelayVia in the station config), or learned - when a relayed frame from station X (unicast or
+//	broadcast) arrives through relay R, frames to X are sent through R. Only the first copy of the frame is processed, so
+//	the route follows the fastest path. Learned route is dropped when X is heard directly.
+//
+//	Relay that has no route to the destination yet re-broadcasts the frame, so that the request reaches the station
+//	several hops away, and the stations on the way learn the route back to the originator. The reply then goes back
+//	hop by hop, and the relays learn the route to the station. Master itself only needs the route to the first relay.
+//
+//	When some stations are reached through relays, master broadcasts are sent only wrapped into FCODE_RELAY frame
+//	(stations in range process it as usual, relays re-broadcast it). Each station remembers recently seen relayed frames
+//	(by OriginID and SeqID), processes and forwards each frame at most once, which keeps broadcast floods bounded.
+//
+
+// Next hop towards the station - relay station, or the station itself if it is reached directly
+uint8_t RProtocolMaster::NextHop(uint8_t stationID)
+{
+	if( (stationID < MAX_STATIONS) && (_routeVia[stationID] != RPROTOCOL_ROUTE_DIRECT) )
+		return _routeVia[stationID];
+
+	return stationID;
+}
+
+// Send the frame being built to the station, through the relay if the station has a route
+bool RProtocolMaster::RouteFrame(uint8_t stationID)
+{
+	RFrame			*pTx = &_txFrames[_txFrameCur];
+	RMESSAGE_HEADER	*pFrame = (RMESSAGE_HEADER *)(pTx->buf + RFRAME_HEADROOM);
+	uint8_t			nextHop = NextHop(stationID);
+
+	if( nextHop != stationID )
+		return SendRelayFrame(nextHop, ++_relaySeqID, pFrame->TransactionID);
+
+	if( (stationID == STATIONID_BROADCAST) && (pFrame->FromUnitID == GetMyStationID()) )
+	{
+		for( uint8_t i=0; i<MAX_STATIONS; i++ )
+		{
+			// some stations are reached through relays, let relays re-broadcast it. Plain copy is not sent - stations
+			// in range would process the frame twice, since only relayed frames are checked for duplicates.
+			if( _routeVia[i] != RPROTOCOL_ROUTE_DIRECT )
+				return SendRelayFrame(STATIONID_BROADCAST, ++_relaySeqID, 0);
+		}
+	}
+
+	return SendTransportPacket(stationID, _txFrameCur, pFrame, pTx->len);
+}
+
+// Wrap the frame into FCODE_RELAY frame and send it to the next hop.
+// hopTransactionID is passed to the transport delivery callback (0 - delivery outcome is not needed).
+// Send the frame being built through the relay. Relay header is written into the frame headroom, in front of the frame.
+bool RProtocolMaster::SendRelayFrame(uint8_t nextHop, uint8_t seqID, uint8_t hopTransactionID)
+{
+	RFrame			*pTx = &_txFrames[_txFrameCur];
+	RMESSAGE_HEADER	*pFrame = (RMESSAGE_HEADER *)(pTx->buf + RFRAME_HEADROOM);
+	RMESSAGE_RELAY	*pMessage = (RMESSAGE_RELAY *)(pTx->buf + RFRAME_HEADROOM - RMESSAGE_RELAY_OVERHEAD);
+
+	if( (pTx->len + RMESSAGE_RELAY_OVERHEAD) > RPROTOCOL_MAX_FRAME_SIZE )
+	{
+		SYSEVT_ERROR(F("RProtocol - frame is too long to relay, FCode: %d, len: %d"), int(pFrame->FCode), int(pTx->len));
+		return false;
+	}
+
+	pMessage->Header.ProtocolID = RPROTOCOL_ID;
+	pMessage->Header.FCode = FCODE_RELAY;
+	pMessage->Header.ToUnitID = nextHop;
+	pMessage->Header.FromUnitID = GetMyStationID();
+	pMessage->Header.Length = pTx->len + RMESSAGE_RELAY_OVERHEAD - sizeof(RMESSAGE_HEADER);
+	pMessage->Header.TransactionID = hopTransactionID;
+
+	pMessage->TTL = RPROTOCOL_RELAY_MAX_HOPS;
+	pMessage->OriginID = GetMyStationID();
+	pMessage->SeqID = seqID;
+
+	RelayFrameSeen(pMessage->OriginID, seqID);		// don't forward our own frame if a relay echoes it back
+
+	TRACE_INFO(F("RProtocol - relaying frame to station %d via %d\n"), int(pFrame->ToUnitID), int(nextHop));
+
+	return SendTransportPacket(nextHop, _txFrameCur, pMessage, pTx->len + RMESSAGE_RELAY_OVERHEAD);
+}
+
+// Check if the relayed frame was seen recently, and remember it.
+bool RProtocolMaster::RelayFrameSeen(uint8_t originID, uint8_t seqID)
+{
+	for( uint8_t i=0; i<RPROTOCOL_RELAY_DUP_CACHE; i++ )
+	{
+		if( (_relaySeen[i].originID == originID) && (_relaySeen[i].seqID == seqID) )
+			return true;
+	}
+
+	_relaySeen[_relaySeenNext].originID = originID;
+	_relaySeen[_relaySeenNext].seqID = seqID;
+	_relaySeenNext = (_relaySeenNext + 1) % RPROTOCOL_RELAY_DUP_CACHE;
+
+	return false;
+}
+
+// Update learned route to the station. viaStationID == stationID means the station is reached directly.
+// Static routes are not changed.
+void RProtocolMaster::LearnRoute(uint8_t stationID, uint8_t viaStationID)
+{
+	if( (stationID >= MAX_STATIONS) || (stationID == GetMyStationID()) || (_staticRoutes & (1U << stationID)) )
+		return;
+
+	uint8_t		route = ((viaStationID == stationID) || (viaStationID >= MAX_STATIONS)) ? RPROTOCOL_ROUTE_DIRECT : viaStationID;
+
+	_knownRoutes |= (1U << stationID);
+	if( _routeVia[stationID] != route )
+	{
+		TRACE_INFO(F("RProtocol - station %d route changed, via: %d\n"), int(stationID), int(route));
+		_routeVia[stationID] = route;
+	}
+}
+
+//
+//	RProtocol packets processing routines - FCODE_RELAY
+//
+//	Input - pointer to the input packet 
+// 			It is assumed that basic input packet structure is already validated
+//
+//	Frame addressed to this station (or broadcast) is unwrapped and processed as usual, relay stations also forward
+//	the frame towards its destination.
+//
+void RProtocolMaster::ProcessRelayFrame(uint8_t *ptr)
+{
+	RMESSAGE_RELAY	*pMessage = (RMESSAGE_RELAY *)ptr;
+	RMESSAGE_HEADER	*pFrame = (RMESSAGE_HEADER *)(pMessage->Data);
+	uint8_t			myID = GetMyStationID();
+	uint8_t			relayParams = RMESSAGE_RELAY_OVERHEAD - sizeof(RMESSAGE_HEADER);	// TTL, OriginID, SeqID
+
+	// parameters length check - relay parameters followed by at least the header of the relayed frame
+	if( pMessage->Header.Length < (relayParams + sizeof(RMESSAGE_HEADER)) )
+	{
+		SYSEVT_ERROR(F("ProcessRelayFrame - bad parameters length"));
+		return;
+	}
+
+	uint8_t			fSize = pMessage->Header.Length - relayParams;
+
+	if( (pMessage->Header.ToUnitID != myID) && (pMessage->Header.ToUnitID != STATIONID_BROADCAST) )
+		return;		// frame for another relay
+
+	if( (pMessage->OriginID == myID) || RelayFrameSeen(pMessage->OriginID, pMessage->SeqID) )
+	{
+		TRACE_INFO(F("ProcessRelayFrame - duplicate frame from station %d, SeqID: %d\n"), int(pMessage->OriginID), int(pMessage->SeqID));
+		return;
+	}
+
+	if( (pFrame->ProtocolID != RPROTOCOL_ID) || (pFrame->FCode == FCODE_RELAY) )
+	{
+		SYSEVT_ERROR(F("ProcessRelayFrame - bad relayed frame"));
+		return;
+	}
+
+	LearnRoute(pFrame->FromUnitID, pMessage->Header.FromUnitID);		// replies to the originator go back the same way
+
+#ifdef SG_RF_RELAY
+// forward the frame first, local processing may modify it. Frame is forwarded as is, only relay header is updated for the next hop.
+
+	if( (pFrame->ToUnitID != myID) && (pMessage->TTL > 1) )
+	{
+		uint8_t		nextHop = STATIONID_BROADCAST;		// broadcast, or the route to the destination is not known yet
+
+		if( (pFrame->ToUnitID < MAX_STATIONS) && (_knownRoutes & (1U << pFrame->ToUnitID)) )
+		{
+			nextHop = NextHop(pFrame->ToUnitID);
+			if( nextHop == pMessage->Header.FromUnitID )		// don't send it back where it came from
+				nextHop = pFrame->ToUnitID;
+		}
+
+		pMessage->Header.ToUnitID = nextHop;
+		pMessage->Header.FromUnitID = myID;
+		pMessage->Header.TransactionID = 0;
+		pMessage->TTL--;
+
+		TRACE_INFO(F("RProtocol - forwarding frame to station %d via %d, TTL: %d\n"), int(pFrame->ToUnitID), int(nextHop), int(pMessage->TTL));
+
+		// receive buffer is reused for the next packet, the transport sends the frame from the frame buffer
+		int8_t		nFrame = FreeFrame();
+		uint8_t		size = fSize + RMESSAGE_RELAY_OVERHEAD;
+
+		if( (nFrame < 0) || (size > RPROTOCOL_MAX_FRAME_SIZE) )
+			TRACE_ERROR(F("RProtocol - frame to station %d not forwarded\n"), int(pFrame->ToUnitID));
+		else
+		{
+			RFrame	*pFwd = &_txFrames[nFrame];
+
+			memcpy(pFwd->buf + RFRAME_TRANSPORT_HEADROOM, ptr, size);
+			pFwd->state = RFRAME_BUILDING;
+			SendTransportPacket(nextHop, nFrame, pFwd->buf + RFRAME_TRANSPORT_HEADROOM, size);
+			if( pFwd->state == RFRAME_BUILDING )
+				pFwd->state = RFRAME_FREE;
+		}
+	}
+#endif //SG_RF_RELAY
+
+	if( (pFrame->ToUnitID == myID) || (pFrame->ToUnitID == STATIONID_BROADCAST) )
+	{
+		_bRelayedFrame = true;
+		ProcessNewFrame((uint8_t *)pFrame, fSize, 0);
+		_bRelayedFrame = false;
+	}
+}
+
+
+//
+//	Outstanding requests (transactions)
+//
+//	Each request to a remote station gets unique TransactionID (1-255) and a slot in the transactions table. The table also serves
+//	as per-station outbound queue: new request is queued, and loop() sends queued requests one station at a time
+//	(RPROTOCOL_STATION_MAX_INFLIGHT requests in flight per station), zone control first, then configuration, then telemetry.
+//
+//	Zone control requests for the same station that are still in the queue are coalesced - zones with the same time to run
+//	are sent in one FCODE_ZONES_SET frame. Such requests share TransactionID and complete together (a group).
+//	Queued requests that became obsolete (zone On followed by zones Off, repeated sensors poll etc) are dropped.
+//
+//	The slot is released when the matching response arrives, or when the request timed out after all re-sends (see RetryBudget()).
+//	Re-sent request keeps the same TransactionID, so a late response to the previous attempt still completes it.
+//
+//	RPROTOCOL_CONTROL_SLOTS slots are used by zone control requests only, so that zone On/Off is not lost when the table is
+//	filled up by other requests (e.g. events subscription of all stations at startup). Events subscription and sensor reports
+//	config requests that do not fit are kept in a bitmap per station (see RDeferred), and started from loop() later.
+//
+
+// Request priority (lower value is sent first)
+static inline uint8_t RequestPriority(uint8_t fCode)
+{
+	switch( fCode )
+	{
+		case FCODE_ZONES_SET:			return RPROTOCOL_PRIORITY_CONTROL;
+		case FCODE_EVTMASTER_SET:
+		case FCODE_SENSORS_REPORTCFG_SET:
+		case FCODE_SYSREGISTERS_READ:	return RPROTOCOL_PRIORITY_CONFIG;
+		default:						return RPROTOCOL_PRIORITY_TELEMETRY;
+	}
+}
+
+// Queue new request.
+//
+// For FCODE_ZONES_SET param1 is the channel (0xFF - all channels) and param2 is time to run (0 - Off). Note that remote station
+// treats Off as "stop all zones", so Off obsoletes all queued zones On for that station.
+bool RProtocolMaster::StartTransaction(uint8_t stationID, uint8_t fCode, uint8_t param1, uint8_t param2, PTransactionCallback callback, uint8_t ctx)
+{
+	uint8_t			transactionID = 0;
+	unsigned long	queuedTime = millis();
+
+// drop obsolete queued requests, and find queued group this request can join
+
+	for( int8_t i=0; i<RPROTOCOL_MAX_TRANSACTIONS; i++ )
+	{
+		RTransaction	*pTransaction = &_transactions[i];
+
+		if( (pTransaction->transactionID == 0) || (pTransaction->state != RTRANSACTION_QUEUED) || 
+			(pTransaction->stationID != stationID) || (pTransaction->fCode != fCode) )
+			continue;
+
+		if( fCode == FCODE_ZONES_SET )
+		{
+			if( (param2 == 0) ? (pTransaction->param2 != 0) : (pTransaction->param1 == param1) )
+				CompleteTransactionEntry(i, RPROTOCOL_RESULT_CANCELLED, 0);
+			else if( pTransaction->param2 == param2 )
+			{
+				transactionID = pTransaction->transactionID;		// same time to run - send in one frame
+				queuedTime = pTransaction->deadline;
+			}
+		}
+		else if( (pTransaction->param1 == param1) && (pTransaction->param2 == param2) )
+			CompleteTransactionEntry(i, RPROTOCOL_RESULT_CANCELLED, 0);		// the same request is queued again
+	}
+
+	int8_t	freeSlot = FreeTransactionSlot(fCode);
+	if( freeSlot < 0 )
+	{
+		RDeferred	*pDeferred = DeferredRequests(fCode);
+
+		if( pDeferred != NULL )
+		{
+			pDeferred->stations |= 1U << stationID;
+			pDeferred->param1 = param1;
+			pDeferred->callback = callback;
+			pDeferred->ctx = ctx;
+			TRACE_INFO(F("RProtocol - requests table is full, request to station %d deferred\n"), (int)stationID);
+			return true;
+		}
+		SYSEVT_ERROR(F("RProtocol - too many outstanding requests, request to station %d dropped"), (int)stationID);
+		return false;
+	}
+
+	if( transactionID == 0 )
+		transactionID = NewTransactionID();
+
+	RTransaction	*pTransaction = &_transactions[freeSlot];
+
+	pTransaction->transactionID = transactionID;
+	pTransaction->stationID = stationID;
+	pTransaction->fCode = fCode;
+	pTransaction->param1 = param1;
+	pTransaction->param2 = param2;
+	pTransaction->state = RTRANSACTION_QUEUED;
+	pTransaction->retries = 0;
+	pTransaction->ctx = ctx;
+	pTransaction->callback = callback;
+	pTransaction->deadline = queuedTime;		// for queued requests - time the request (group) was queued
+
+	return true;
+}
+
+// Allocate TransactionID, skipping 0 (reserved for unsolicited messages) and IDs of outstanding requests
+uint8_t RProtocolMaster::NewTransactionID(void)
+{
+	do
+	{
+		_lastTransactionID++;
+		if( _lastTransactionID == 0 )
+			_lastTransactionID = 1;
+	} while( (FindTransaction(_lastTransactionID, 0xFF) >= 0) || ((_slotPollPending != 0) && (_lastTransactionID == _slotPollTID)) );
+
+	return _lastTransactionID;
+}
+
+// (Re)send request of the transaction group
+bool RProtocolMaster::SendTransaction(int8_t index)
+{
+	RTransaction	*pTransaction = &_transactions[index];
+
+	switch( pTransaction->fCode )
+	{
+		case FCODE_ZONES_READ:
+						return SendReadZonesStatus(pTransaction->stationID, pTransaction->transactionID);
+
+		case FCODE_ZONES_SET:
+						{
+							uint8_t		zonesMask = 0;
+
+							for( int8_t i=index; i<RPROTOCOL_MAX_TRANSACTIONS; i++ )
+							{
+								if( (_transactions[i].transactionID != pTransaction->transactionID) || (_transactions[i].stationID != pTransaction->stationID) )
+									continue;
+
+								if( _transactions[i].param1 == 0xFF )		// all channels off
+									return SendTurnOffAllZones(pTransaction->stationID, pTransaction->transactionID);
+
+								zonesMask |= 1 << _transactions[i].param1;
+							}
+							return SendZonesSet(pTransaction->stationID, zonesMask, pTransaction->param2, pTransaction->transactionID);
+						}
+
+		case FCODE_SENSORS_READ:
+						return SendReadSensors(pTransaction->stationID, pTransaction->transactionID);
+
+		case FCODE_SYSREGISTERS_READ:
+						return SendReadSystemRegisters(pTransaction->stationID, pTransaction->param1, pTransaction->param2, pTransaction->transactionID);
+
+		case FCODE_EVTMASTER_SET:
+						return SendRegisterEvtMaster(pTransaction->stationID, pTransaction->param1, pTransaction->transactionID);
+
+		case FCODE_SENSORS_REPORTCFG_SET:
+						return SendSensorsReportConfig(pTransaction->stationID, pTransaction->transactionID);
+
+		default:
+						return false;
+	}
+}
+
+// Find the first entry of the transaction group. stationID of 0xFF matches any station.
+// FindTransaction(0, 0xFF) returns free slot.
+int8_t RProtocolMaster::FindTransaction(uint8_t transactionID, uint8_t stationID)
+{
+	for( int8_t i=0; i<RPROTOCOL_MAX_TRANSACTIONS; i++ )
+	{
+		if( (_transactions[i].transactionID == transactionID) && ((stationID == 0xFF) || (_transactions[i].stationID == stationID)) )
+			return i;
+	}
+	return -1;
+}
+
+// Update state of all entries of the transaction group
+void RProtocolMaster::SetTransactionState(int8_t index, uint8_t state, uint8_t retries, unsigned long deadline)
+{
+	uint8_t		transactionID = _transactions[index].transactionID;
+	uint8_t		stationID = _transactions[index].stationID;
+
+	for( int8_t i=index; i<RPROTOCOL_MAX_TRANSACTIONS; i++ )
+	{
+		if( (_transactions[i].transactionID == transactionID) && (_transactions[i].stationID == stationID) )
+		{
+			_transactions[i].state = state;
+			_transactions[i].retries = retries;
+			_transactions[i].deadline = deadline;
+		}
+	}
+}
+
+// Release single transaction slot and report the outcome to the requester
+void RProtocolMaster::CompleteTransactionEntry(int8_t index, uint8_t result, void *pResponse)
+{
+	RTransaction	*pTransaction = &_transactions[index];
+	PTransactionCallback	callback = pTransaction->callback;
+
+	pTransaction->transactionID = 0;	// release the slot first, callback may start a new request
+
+	if( callback != 0 )
+		callback(pTransaction->stationID, pTransaction->ctx, result, pResponse);
+}
+
+// Complete all entries of the transaction group
+void RProtocolMaster::CompleteTransaction(int8_t index, uint8_t result, void *pResponse)
+{
+	uint8_t		transactionID = _transactions[index].transactionID;
+	uint8_t		stationID = _transactions[index].stationID;
+
+// update link statistics of the station - every re-send of the request counts as lost attempt
+
+	if( (stationID < MAX_STATIONS) && (result != RPROTOCOL_RESULT_CANCELLED) && (_transactions[index].state == RTRANSACTION_SENT) )
+	{
+		RLinkStats	*pStats = &_linkStats[stationID];
+		uint8_t		attempts = _transactions[index].retries + 1;
+
+		if( result == RPROTOCOL_RESULT_TIMEOUT )
+		{
+			pStats->timeouts++;
+			LinkLossSample(&pStats->reqLoss, attempts, attempts);
+		}
+		else
+		{
+			LinkLossSample(&pStats->reqLoss, attempts, attempts-1);
+
+			unsigned long	rtt = millis() - (_transactions[index].deadline - RPROTOCOL_RESPONSE_TIMEOUT);
+
+			if( (attempts == 1) && (rtt <= RPROTOCOL_RESPONSE_TIMEOUT) )		// response to the re-sent request can't be matched to the send time
+				pStats->rtt = (pStats->rtt == 0) ? uint16_t(rtt) : uint16_t(pStats->rtt + (long(rtt) - long(pStats->rtt)) / 8);
+		}
+	}
+
+	for( int8_t i=index; i<RPROTOCOL_MAX_TRANSACTIONS; i++ )
+	{
+		if( (_transactions[i].transactionID == transactionID) && (_transactions[i].stationID == stationID) )
+			CompleteTransactionEntry(i, result, pResponse);
+	}
+}
+
+// Transport reported that request packet was not delivered - no point to wait for the response, re-send it now
+void RProtocolMaster::TransportDone(uint8_t stationID, uint8_t transactionID, bool bSuccess)
+{
+	if( bSuccess || (transactionID == 0) )
+		return;
+
+	for( int8_t i=0; i<RPROTOCOL_MAX_TRANSACTIONS; i++ )		// stationID is the next hop, the request may be sent through the relay
+	{
+		if( (_transactions[i].transactionID == transactionID) && (_transactions[i].state == RTRANSACTION_SENT) && 
+			(NextHop(_transactions[i].stationID) == stationID) )
+		{
+			_transactions[i].deadline = millis();
+			break;
+		}
+	}
+}
+
+//
+//	Link statistics
+//
+
+// Add loss samples (one per attempt) to the smoothed loss value
+void RProtocolMaster::LinkLossSample(uint16_t *pLoss, uint8_t attempts, uint8_t lost)
+{
+	for( uint8_t i=0; i<attempts; i++ )
+	{
+		long	sample = (i < lost) ? RPROTOCOL_LINK_LOSS_100 : 0;
+
+		*pLoss = uint16_t(long(*pLoss) + (sample - long(*pLoss)) / 8);
+	}
+}
+
+// Transport reports the outcome of the frame sent to the station (next hop)
+void RProtocolMaster::LinkTxDone(uint8_t stationID, uint8_t retries, bool bSuccess)
+{
+	if( stationID >= MAX_STATIONS )
+		return;		// broadcast
+
+	RLinkStats	*pStats = &_linkStats[stationID];
+
+	pStats->txFrames++;
+	pStats->txRetries += retries;
+	if( !bSuccess )
+		pStats->txFailed++;
+
+	LinkLossSample(&pStats->txLoss, retries+1, bSuccess ? retries : retries+1);
+}
+
+// Transport dropped duplicate frame from the station
+void RProtocolMaster::LinkRxDuplicate(uint8_t stationID)
+{
+	if( stationID < MAX_STATIONS )
+		_linkStats[stationID].rxDuplicates++;
+}
+
+bool RProtocolMaster::LinkStats(uint8_t stationID, RLinkStats *pStats)
+{
+	if( stationID >= MAX_STATIONS )
+		return false;
+
+	memcpy(pStats, &_linkStats[stationID], sizeof(RLinkStats));
+	return true;
+}
+
+// Link health score, 0-100. Returns 0xFF if there is no data for the station yet.
+uint8_t RProtocolMaster::LinkHealth(uint8_t stationID)
+{
+	if( stationID >= MAX_STATIONS )
+		return 0xFF;
+
+	RLinkStats	*pStats = &_linkStats[stationID];
+
+	if( (pStats->txFrames == 0) && (pStats->requests == 0) )
+		return 0xFF;
+
+	uint16_t	loss = (pStats->txLoss > pStats->reqLoss) ? pStats->txLoss : pStats->reqLoss;
+	uint16_t	rttPenalty = pStats->rtt / RPROTOCOL_LINK_RTT_STEP;
+	int16_t		health;
+
+	if( rttPenalty > RPROTOCOL_LINK_RTT_MAX )
+		rttPenalty = RPROTOCOL_LINK_RTT_MAX;
+
+	health = 100 - int16_t((loss + 128) >> 8) - int16_t(rttPenalty);
+	return (health > 0) ? uint8_t(health) : 0;
+}
+
+const char *RProtocolMaster::LinkStatus(uint8_t stationID)
+{
+	uint8_t		health = LinkHealth(stationID);
+
+	if( health == 0xFF )						return PSTR("unknown");
+	else if( health >= RPROTOCOL_LINK_GOOD )	return PSTR("good");
+	else if( health >= RPROTOCOL_LINK_POOR )	return PSTR("fair");
+	else if( health >= RPROTOCOL_LINK_DOWN )	return PSTR("poor");
+	else										return PSTR("down");
+}
+
+// Number of re-sends for requests to the station. Lossy link gets one more re-send, but there is no point
+// to keep the transactions table busy re-sending requests to the station that seems to be down.
+uint8_t RProtocolMaster::RetryBudget(uint8_t stationID)
+{
+	uint8_t		health = LinkHealth(stationID);
+
+	if( (health == 0xFF) || (health >= RPROTOCOL_LINK_GOOD) )
+		return RPROTOCOL_MAX_RETRIES;
+	if( health >= RPROTOCOL_LINK_DOWN )
+		return RPROTOCOL_MAX_RETRIES+1;
+	return 1;
+}
+
+// Re-send requests that reached their deadline, fail requests that ran out of retries, and send queued requests
+void RProtocolMaster::CheckTransactions(void)
+{
+	unsigned long	timeNow = millis();
+	uint8_t			inFlight[MAX_STATIONS];
+
+	memset(inFlight, 0, sizeof(inFlight));
+
+	for( int8_t i=0; i<RPROTOCOL_MAX_TRANSACTIONS; i++ )
+	{
+		RTransaction	*pTransaction = &_transactions[i];
+
+		if( (pTransaction->transactionID == 0) || (pTransaction->state != RTRANSACTION_SENT) || 
+			(FindTransaction(pTransaction->transactionID, pTransaction->stationID) != i) )
+			continue;		// free, queued, or not the first entry of the group (group is handled by its first entry)
+
+		if( long(timeNow - pTransaction->deadline) < 0 )
+		{
+			inFlight[pTransaction->stationID]++;
+			continue;
+		}
+
+		if( pTransaction->retries < RetryBudget(pTransaction->stationID) )
+		{
+			SetTransactionState(i, RTRANSACTION_SENT, pTransaction->retries+1, timeNow + RPROTOCOL_RESPONSE_TIMEOUT);
+			inFlight[pTransaction->stationID]++;
+			_linkStats[pTransaction->stationID].requests++;
+
+			TRACE_INFO(F("RProtocol - re-sending request to station %d, FCode: %d\n"), int(pTransaction->stationID), int(pTransaction->fCode));
+			SendTransaction(i);		// if transport is busy, the request will be re-sent on the next deadline
+			continue;
+		}
+
+		SYSEVT_ERROR(F("RProtocol - no response from station %d, FCode: %d"), int(pTransaction->stationID), int(pTransaction->fCode));
+		CompleteTransaction(i, RPROTOCOL_RESULT_TIMEOUT, 0);
+	}
+
+// send queued requests - for each station that has room, pick the highest priority group, oldest first
+
+	for( int8_t i=0; i<RPROTOCOL_MAX_TRANSACTIONS; i++ )
+	{
+		RTransaction	*pTransaction = &_transactions[i];
+
+		if( (pTransaction->transactionID == 0) || (pTransaction->state != RTRANSACTION_QUEUED) || 
+			(inFlight[pTransaction->stationID] >= RPROTOCOL_STATION_MAX_INFLIGHT) )
+			continue;
+
+		int8_t	next = i;
+
+		for( int8_t j=i+1; j<RPROTOCOL_MAX_TRANSACTIONS; j++ )
+		{
+			RTransaction	*pCandidate = &_transactions[j];
+
+			if( (pCandidate->transactionID == 0) || (pCandidate->state != RTRANSACTION_QUEUED) || (pCandidate->stationID != pTransaction->stationID) )
+				continue;
+
+			uint8_t		nextPriority = RequestPriority(_transactions[next].fCode);
+			uint8_t		priority = RequestPriority(pCandidate->fCode);
+
+			if( (priority < nextPriority) || ((priority == nextPriority) && (long(pCandidate->deadline - _transactions[next].deadline) < 0)) )
+				next = j;
+		}
+
+		next = FindTransaction(_transactions[next].transactionID, pTransaction->stationID);		// send from the first entry of the group
+		SetTransactionState(next, RTRANSACTION_SENT, 0, timeNow + RPROTOCOL_RESPONSE_TIMEOUT);
+		inFlight[pTransaction->stationID]++;
+		_linkStats[pTransaction->stationID].requests++;
+
+		if( !SendTransaction(next) )		// transport is busy, the request will be re-sent on the deadline
+			TRACE_INFO(F("RProtocol - request to station %d is not sent, will retry\n"), int(pTransaction->stationID));
+	}
+}
+
+
+//
+//	Remote station requests
+//
+
+// Basic check that the station is valid, enabled and is reachable over RF network
+bool RProtocolMaster::StationReady(uint8_t stationID)
+{
+	ShortStation	sStation;
+
+	if( stationID >= MAX_STATIONS )
+	{
+		SYSEVT_ERROR(F("RProtocol - stationID %d outside of range"), (int)stationID);
+		return false;
+	}
+
+	LoadShortStation(stationID, &sStation);
+	if( !(sStation.stationFlags & STATION_FLAGS_VALID) || !(sStation.stationFlags & STATION_FLAGS_ENABLED) )
+	{
+		SYSEVT_ERROR(F("RProtocol - station %d is not enabled"), (int)stationID);
+		return false;
+	}
+
+	if( (sStation.networkID != NETWORK_ID_XBEE) && (sStation.networkID != NETWORK_ID_MOTEINORF) )
+	{
+		SYSEVT_ERROR(F("RProtocol - station %d is of a wrong type (not XBee or RFM69)"), (int)stationID);
+		return false;
+	}
+
+	return true;
+}
+
+//
+// Turn On/Off channels
+//
+
+bool RProtocolMaster::ChannelOn( uint8_t stationID, uint8_t chan, uint8_t ttr, PTransactionCallback callback, uint8_t ctx )
+{
+	TRACE_INFO(F("RProtocol - ChannelOn, stationID=%d, channel=%d, ttr=%d\n"), (int)stationID, (int)chan, (int)ttr);
+
+	if( !StationReady(stationID) )
+		return false;
+
+// OK, everything seems to be good. Send command.
+
+	return StartTransaction( stationID, FCODE_ZONES_SET, chan, ttr, callback, ctx );
+}
+
+bool RProtocolMaster::ChannelOff( uint8_t stationID, uint8_t chan, PTransactionCallback callback, uint8_t ctx )
+{
+	return ChannelOn( stationID, chan, 0, callback, ctx );
+}
+
+bool RProtocolMaster::AllChannelsOff(uint8_t stationID, PTransactionCallback callback, uint8_t ctx)
+{
+	if( !StationReady(stationID) )
+		return false;
+
+// OK, everything seems to be valid. Send command.
+
+	return StartTransaction( stationID, FCODE_ZONES_SET, 0xFF, 0, callback, ctx );
+}
+
+void RProtocolMaster::SendTimeBroadcast(void)
+{
+	static  time_t	nextBroadcastTime = 0;
+
+	if(nextBroadcastTime <= now()){
+
+		SendTimeBroadcastInt();
+
+		nextBroadcastTime = now() + 60; //  every 60 seconds
+	}  
+
+}
+
+bool RProtocolMaster::PollStationSensors(uint8_t stationID, PTransactionCallback callback, uint8_t ctx)
+{
+	if( !StationReady(stationID) )
+		return false;
+
+	TRACE_INFO(F("PollStationSensors - sending request to station %d\n"), stationID);
+
+// OK, everything seems to be ready. Send command.
+
+	return StartTransaction( stationID, FCODE_SENSORS_READ, 0, 0, callback, ctx );
+}
+
+bool RProtocolMaster::ReadSystemRegisters(uint8_t stationID, uint8_t startRegister, uint8_t numRegisters, PTransactionCallback callback, uint8_t ctx)
+{
+	if( !StationReady(stationID) )
+		return false;
+
+	return StartTransaction( stationID, FCODE_SYSREGISTERS_READ, startRegister, numRegisters, callback, ctx );
+}
+
+bool RProtocolMaster::SubscribeEvents( uint8_t stationID, PTransactionCallback callback, uint8_t ctx )
 {
 	{
 		ShortStation	sStation;
@@ -1425,7 +2665,134 @@ bool RProtocolMaster::SubscribeEvents( uint8_t stationID )
 		if( !(sStation.stationFlags & STATION_FLAGS_ENABLED) || ((sStation.networkID != NETWORK_ID_XBEE) && (sStation.networkID != NETWORK_ID_MOTEINORF)) )
 			return false;
 	}
-	return SendRegisterEvtMaster( stationID, EVTMASTER_FLAGS_REPORT_ALL, 0);
+	return StartTransaction( stationID, FCODE_EVTMASTER_SET, EVTMASTER_FLAGS_REPORT_ALL, 0, callback, ctx );
+}
+
+//
+//	Slotted sensors poll
+//
+//	Master polls sensors of all remote stations with one FCODE_SENSORS_POLL broadcast, and each polled station replies in 
+//	its own time slot (slots are assigned in stationID order), so the whole network is refreshed within one reply window.
+//	Broadcast is not acknowledged by the RF layer, stations that did not reply within the window are polled individually.
+//
+bool RProtocolMaster::PollSensorsSlotted(uint16_t stationsMask)
+{
+	RMESSAGE_SENSORS_POLL	*pMessage;
+	uint8_t					numSlots = 0;
+	uint8_t					lastStation = 0;
+
+	for( uint8_t i=0; i<MAX_STATIONS; i++ )
+	{
+		if( !(stationsMask & (1U << i)) )
+			continue;
+
+		if( StationReady(i) )
+		{
+			numSlots++;
+			lastStation = i;
+		}
+		else
+			stationsMask &= ~(1U << i);
+	}
+
+	if( numSlots == 0 )
+		return false;
+
+	if( numSlots == 1 )
+		return PollStationSensors(lastStation);		// single station - regular request is acknowledged and re-sent
+
+	if( _slotPollPending != 0 )
+		TRACE_INFO(F("PollSensorsSlotted - previous poll is not complete, stations mask: %x\n"), _slotPollPending);
+
+	_slotPollPending = 0;							// previous poll is superseded
+	_slotPollTID = NewTransactionID();
+
+	TRACE_INFO(F("PollSensorsSlotted - polling stations mask: %x\n"), stationsMask);
+
+	_slotPollPending = stationsMask;
+	_slotPollDeadline = millis() + (unsigned long)numSlots * RPROTOCOL_POLL_SLOT_TIME + RPROTOCOL_POLL_WINDOW_MARGIN;
+
+	pMessage = (RMESSAGE_SENSORS_POLL *)NewFrame(FCODE_SENSORS_POLL, MY_STATION_ID, STATIONID_BROADCAST, _slotPollTID);
+	if( pMessage != 0 )
+	{
+		pMessage->StationsMask = stationsMask;
+		pMessage->SlotTime = RPROTOCOL_POLL_SLOT_TIME;
+	}
+
+	if( (pMessage == 0) || !SendFrame(sizeof(RMESSAGE_SENSORS_POLL)) )
+		_slotPollDeadline = millis();				// not sent - poll the stations individually
+
+	return true;
+}
+
+// Schedule sensors report in reply to the slotted poll
+void RProtocolMaster::ScheduleSlottedReport(uint8_t transactionID, uint8_t toUnitID, uint16_t delay)
+{
+	_slotReplyTID = transactionID;
+	_slotReplyTo = toUnitID;
+	_slotReplyTime = millis() + delay;
+}
+
+// Send scheduled slotted poll reply, and poll individually stations that did not reply to the slotted poll
+void RProtocolMaster::CheckSlottedPoll(void)
+{
+	unsigned long	timeNow = millis();
+
+	if( (_slotReplyTID != 0) && (long(timeNow - _slotReplyTime) >= 0) )
+	{
+		SendSensorsReport(_slotReplyTID, GetMyStationID(), _slotReplyTo, 0, GetNumSensors());
+		_slotReplyTID = 0;
+	}
+
+	if( (_slotPollPending == 0) || (long(timeNow - _slotPollDeadline) < 0) )
+		return;
+
+// reply window is over. Poll remaining stations one by one, keeping half of the requests table free for other requests.
+
+	uint8_t		freeSlots = 0;
+
+	for( int8_t i=0; i<RPROTOCOL_MAX_TRANSACTIONS; i++ )
+	{
+		if( _transactions[i].transactionID == 0 )
+			freeSlots++;
+	}
+
+	if( freeSlots <= RPROTOCOL_MAX_TRANSACTIONS/2 )
+		return;
+
+	for( uint8_t i=0; i<MAX_STATIONS; i++ )
+	{
+		if( _slotPollPending & (1U << i) )
+		{
+			_slotPollPending &= ~(1U << i);
+
+			TRACE_INFO(F("PollSensorsSlotted - no reply from station %d\n"), int(i));
+			PollStationSensors(i);
+			break;
+		}
+	}
+}
+
+// Send push reporting config to the station, for the sensors connected to it.
+// Return value is false if the station has no sensors.
+bool RProtocolMaster::ConfigureSensorReports( uint8_t stationID, PTransactionCallback callback, uint8_t ctx )
+{
+	ShortSensor		sSensor;
+	bool			fFound = false;
+
+	if( !StationReady(stationID) )
+		return false;
+
+	for( uint8_t i=0; i<GetNumSensors(); i++ )
+	{
+		LoadShortSensor(i, &sSensor);
+		if( sSensor.sensorStationID == stationID )
+			fFound = true;
+	}
+	if( !fFound )
+		return false;
+
+	return StartTransaction( stationID, FCODE_SENSORS_REPORTCFG_SET, 0, 0, callback, ctx );
 }
 
 
@@ -1436,6 +2803,62 @@ bool RProtocolMaster::SubscribeEvents( uint8_t stationID )
 //
 
 
+// Free slot in the requests table for the request, or -1. Last RPROTOCOL_CONTROL_SLOTS slots are left for zone control requests.
+int8_t RProtocolMaster::FreeTransactionSlot(uint8_t fCode)
+{
+	int8_t	freeSlot = -1;
+	uint8_t	freeSlots = 0;
+
+	for( int8_t i=0; i<RPROTOCOL_MAX_TRANSACTIONS; i++ )
+	{
+		if( _transactions[i].transactionID == 0 )
+		{
+			if( freeSlot < 0 )
+				freeSlot = i;
+			freeSlots++;
+		}
+	}
+
+	if( (fCode != FCODE_ZONES_SET) && (freeSlots <= RPROTOCOL_CONTROL_SLOTS) )
+		return -1;
+
+	return freeSlot;
+}
+
+// Deferred requests of the FCode, or NULL if requests of this kind are not deferred
+RDeferred *RProtocolMaster::DeferredRequests(uint8_t fCode)
+{
+	switch( fCode )
+	{
+		case FCODE_EVTMASTER_SET:			return &_deferred[0];
+		case FCODE_SENSORS_REPORTCFG_SET:	return &_deferred[1];
+		default:							return NULL;
+	}
+}
+
+// Start deferred requests while there are free slots
+void RProtocolMaster::StartDeferred(void)
+{
+	static const uint8_t	fCodes[2] = { FCODE_EVTMASTER_SET, FCODE_SENSORS_REPORTCFG_SET };
+
+	for( uint8_t n=0; n<2; n++ )
+	{
+		RDeferred	*pDeferred = &_deferred[n];
+
+		for( uint8_t i=0; (i<MAX_STATIONS) && (pDeferred->stations != 0); i++ )
+		{
+			if( !(pDeferred->stations & (1U << i)) )
+				continue;
+
+			if( FreeTransactionSlot(fCodes[n]) < 0 )
+				return;
+
+			pDeferred->stations &= ~(1U << i);
+			StartTransaction(i, fCodes[n], pDeferred->param1, 0, pDeferred->callback, pDeferred->ctx);
+		}
+	}
+}
+
 void RProtocolMaster::loop(void)
 {
 #ifdef HW_ENABLE_XBEE
@@ -1445,6 +2868,11 @@ void RProtocolMaster::loop(void)
 #ifdef HW_ENABLE_MOTEINORF
 		MoteinoRF.loop();
 #endif //HW_ENABLE_MOTEINORF
+
+		CheckTransactions();
+		StartDeferred();
+		CheckSlottedPoll();
+		CheckFragments();
 }
 
 
@@ -32,6 +32,131 @@ Copyright 2014 tony-osp (http://tony-osp.dreamwidth.org/)
 typedef bool (*PTransportCallback)(uint8_t nStation, void *msg, uint8_t mSize);
 typedef bool (*PARPCallback)(uint8_t nStation, uint8_t *pNetAddress);
 
+// Transport packet send completion callback. bSuccess is false if the packet was not delivered (e.g. no ACK from the station).
+typedef void (*PTransportDoneCallback)(uint8_t nStation, uint8_t ctx, bool bSuccess);
+
+// Request outcome
+#define RPROTOCOL_RESULT_OK			0		// response received
+#define RPROTOCOL_RESULT_ERROR		1		// station replied with FCODE_RESPONSE_ERROR
+#define RPROTOCOL_RESULT_TIMEOUT	2		// no response after all retries
+#define RPROTOCOL_RESULT_CANCELLED	3		// request was still queued when it became obsolete (superseded by a newer request), not sent
+
+// Request priorities
+#define RPROTOCOL_PRIORITY_CONTROL		0	// zones control
+#define RPROTOCOL_PRIORITY_CONFIG		1	// events subscription, system registers
+#define RPROTOCOL_PRIORITY_TELEMETRY	2	// sensors and zones status polls
+
+// Request states
+#define RTRANSACTION_QUEUED			0		// waiting in the station queue
+#define RTRANSACTION_SENT			1		// sent, waiting for the response
+
+// Request completion callback. Called once for each request, with RPROTOCOL_RESULT_xxx outcome.
+// pResponse points to the response message (NULL on timeout or cancellation).
+// ctx is the caller-provided context value passed to the request routine.
+typedef void (*PTransactionCallback)(uint8_t stationID, uint8_t ctx, uint8_t result, void *pResponse);
+
+// Outstanding request
+struct RTransaction
+{
+	uint8_t					transactionID;		// 0 - slot is free. Coalesced requests share TransactionID.
+	uint8_t					stationID;
+	uint8_t					fCode;				// request FCode
+	uint8_t					param1;				// request parameters, used to (re)send the request
+	uint8_t					param2;
+	uint8_t					state;				// RTRANSACTION_xxx
+	uint8_t					retries;			// number of re-sends so far
+	uint8_t					ctx;
+	unsigned long			deadline;			// response deadline, millis(). For queued requests - time the request was queued.
+	PTransactionCallback	callback;
+};
+
+// Request that did not fit into the requests table, it is started from loop() once a slot is free.
+// Deferred requests of one kind (FCode) share the parameter, callback and context, bit per station.
+struct RDeferred
+{
+	uint16_t				stations;
+	uint8_t					param1;
+	PTransactionCallback	callback;
+	uint8_t					ctx;
+};
+
+// Link statistics of the station. Counters are kept since start, loss and round-trip time are smoothed (1/8 weight of each new sample).
+// Transport statistics are kept for the next hop, requests statistics - for the destination station.
+#define RPROTOCOL_LINK_LOSS_100		(100*256)	// 100% loss in RLinkStats units
+
+struct RLinkStats
+{
+	uint16_t				txFrames;			// frames sent to the station (transport)
+	uint16_t				txRetries;			// transport re-sends (no ACK)
+	uint16_t				txFailed;			// frames not delivered after all transport re-sends
+	uint16_t				rxFrames;			// frames received from the station
+	uint16_t				rxDuplicates;		// duplicate frames dropped (our ACK was lost)
+	uint16_t				requests;			// requests sent, including re-sends
+	uint16_t				timeouts;			// requests failed with no response
+	uint16_t				txLoss;				// transport loss per attempt, percent*256. XBee frames are sent without delivery confirmation.
+	uint16_t				reqLoss;			// requests loss per attempt, percent*256
+	uint16_t				rtt;				// request round-trip time, ms (0 - no samples yet)
+};
+
+// Multi-hop RF routes
+#define RPROTOCOL_ROUTE_DIRECT		0xFF	// station is reached directly, without relay
+
+// Recently seen relayed frame (duplicates suppression)
+struct RRelaySeen
+{
+	uint8_t					originID;
+	uint8_t					seqID;
+};
+
+// Outgoing frame buffer. Frame is built after the headroom reserved for the transport and relay headers, so that the headers
+// are prepended in place, without copying the frame.
+#define RFRAME_TRANSPORT_HEADROOM	1		// MoteinoRF packet sequence number
+#define RFRAME_HEADROOM				(RFRAME_TRANSPORT_HEADROOM + RMESSAGE_RELAY_OVERHEAD)
+
+#define RFRAME_FREE					0
+#define RFRAME_BUILDING				1		// frame is being built
+#define RFRAME_SENDING				2		// frame is queued by the transport, it is sent from the buffer
+
+struct RFrame
+{
+	uint8_t					len;				// frame length
+	uint8_t					state;				// RFRAME_xxx
+	uint8_t					transactionID;		// TransactionID of the packet given to the transport, see TransportDone()
+	uint8_t					buf[RFRAME_HEADROOM + RPROTOCOL_MAX_FRAME_SIZE];
+};
+
+// Outgoing fragmented message. Message is kept until the receiver confirms it, so that missing fragments can be re-sent.
+#define RMESSAGE_TX_FREE			0
+#define RMESSAGE_TX_BUILDING		1		// message is being built
+#define RMESSAGE_TX_SENDING			2		// fragments are being sent, waiting for the receiver to confirm
+
+struct RMessageTx
+{
+	uint8_t					state;				// RMESSAGE_TX_xxx
+	uint8_t					len;				// message length
+	uint8_t					msgID;
+	uint8_t					numFrags;
+	uint8_t					fragSize;			// fragment data size
+	uint8_t					toSend;				// bit per fragment to be sent
+	uint8_t					retries;			// retransmission rounds
+	unsigned long			deadline;			// time to ask the receiver for ACK, millis()
+};
+
+// Incoming fragmented message
+struct RMessageRx
+{
+	bool					bActive;			// reassembly is in progress
+	uint8_t					fromUnitID;
+	uint8_t					msgID;
+	uint8_t					numFrags;
+	uint8_t					received;			// bit per fragment received
+	uint8_t					len;				// message length (end of the furthest fragment received)
+	uint8_t					doneFromUnitID;		// last reassembled message - ACK is repeated if the sender did not get it
+	uint8_t					doneMsgID;
+	unsigned long			doneDeadline;		// last reassembled message is forgotten after this time, millis()
+	unsigned long			deadline;			// reassembly timeout, millis()
+};
+
 class RProtocolMaster {
 
 public:
@@ -43,25 +168,68 @@ public:
 
 			// Remote stations commands
 
-				bool	ChannelOn( uint8_t stationID, uint8_t chan, uint8_t ttr);
-				bool	ChannelOff( uint8_t stationID, uint8_t chan);
-				bool	AllChannelsOff(uint8_t stationID);
-				bool	PollStationSensors(uint8_t stationID);
-				bool	SubscribeEvents( uint8_t stationID );
+			// These routines queue the request and return immediately, the outcome is reported to the callback (if provided).
+			// Return value is false if the request could not be started (station is not valid, or too many outstanding requests).
+			// Events subscription and sensor reports config are deferred rather than dropped if the requests table is full.
+
+				bool	ChannelOn( uint8_t stationID, uint8_t chan, uint8_t ttr, PTransactionCallback callback = 0, uint8_t ctx = 0);
+				bool	ChannelOff( uint8_t stationID, uint8_t chan, PTransactionCallback callback = 0, uint8_t ctx = 0);
+				bool	AllChannelsOff(uint8_t stationID, PTransactionCallback callback = 0, uint8_t ctx = 0);
+				bool	PollStationSensors(uint8_t stationID, PTransactionCallback callback = 0, uint8_t ctx = 0);
+				bool	ReadSystemRegisters(uint8_t stationID, uint8_t startRegister, uint8_t numRegisters, PTransactionCallback callback = 0, uint8_t ctx = 0);
+				bool	SubscribeEvents( uint8_t stationID, PTransactionCallback callback = 0, uint8_t ctx = 0 );
+				bool	ConfigureSensorReports( uint8_t stationID, PTransactionCallback callback = 0, uint8_t ctx = 0 );
+
+			// Slotted sensors poll - one broadcast request to several stations, each station replies in its own time slot.
+			// Stations that did not reply within the window are polled individually.
+
+				bool	PollSensorsSlotted(uint16_t stationsMask);
 
 
 				bool	SendReadZonesStatus( uint8_t stationID, uint16_t transactionID );
 				bool	SendReadSystemRegisters( uint8_t stationID, uint8_t startRegister, uint8_t numRegisters, uint16_t transactionID );
 				bool	SendReadSensors( uint8_t stationID, uint16_t transactionID );
 				bool	SendForceSingleZone( uint8_t stationID, uint8_t channel, uint16_t ttr, uint16_t transactionID );
+				bool	SendZonesSet( uint8_t stationID, uint8_t zonesMask, uint16_t ttr, uint16_t transactionID );
 				bool	SendTurnOffAllZones( uint8_t stationID, uint16_t transactionID );
 				bool	SendSetName( uint8_t stationID, const char *str, uint16_t transactionID );
 				bool	SendRegisterEvtMaster( uint8_t stationID, uint8_t eventsMask, uint16_t transactionID);
+				bool	SendSensorsReportConfig( uint8_t stationID, uint16_t transactionID );
 
 				void	ProcessNewFrame(uint8_t *ptr, int len, uint8_t *pNetAddress);
+				void	TransportDone(uint8_t stationID, uint8_t transactionID, bool bSuccess);
+				void	FrameDone(uint8_t stationID, uint8_t nFrame, bool bSuccess);
+
+			// Multi-hop RF. Frames to stations with a route are sent through the relay station (wrapped into FCODE_RELAY frame).
+			// Routes are static (station config) or learned from relayed frames.
+
+				uint8_t	NextHop(uint8_t stationID);
+
+			// Outgoing frame. Message is written in place into the frame returned by NewFrame() (header is filled in), and then
+			// sent with SendFrame(). NewFrame() returns 0 if another frame is being sent.
+
+				void	*NewFrame(uint8_t fCode, uint8_t fromUnitID, uint8_t toUnitID, uint8_t transactionID);
+				bool	SendFrame(uint8_t mSize);
+				void	DropFrame(void);
+
+			// Outgoing message larger than one frame. NewMessage() returns the frame from NewFrame() if the message of mSize 
+			// fits into one frame, or the message buffer that is sent in fragments (unicast only). Message is sent with SendMessage().
+
+				void	*NewMessage(uint8_t fCode, uint8_t fromUnitID, uint8_t toUnitID, uint8_t transactionID, uint8_t mSize);
+				bool	SendMessage(void *pMessage, uint8_t mSize);
+				uint8_t	MaxFrameSize(uint8_t stationID);
 
 				void	SendTimeBroadcast(void);
 
+			// Link statistics. Transports report frames sent and duplicates dropped, RProtocol adds frames received, requests outcome 
+			// and round-trip time. Health score (0-100) is based on the packet loss and round-trip time.
+
+				void	LinkTxDone(uint8_t stationID, uint8_t retries, bool bSuccess);
+				void	LinkRxDuplicate(uint8_t stationID);
+				uint8_t	LinkHealth(uint8_t stationID);
+				const char *LinkStatus(uint8_t stationID);		// PROGMEM string - "good", "fair", "poor", "down" or "unknown"
+				bool	LinkStats(uint8_t stationID, RLinkStats *pStats);
+
 // Client routines
 				bool SendZonesReport(uint8_t transactionID, uint8_t fromUnitID, uint8_t toUnitID, uint8_t firstZone, uint8_t numZones);
 				bool SendSensorsReport(uint8_t transactionID, uint8_t fromUnitID, uint8_t toUnitID, uint8_t firstSensor, uint8_t numSensors);
@@ -70,12 +238,79 @@ public:
 				bool SendPingReply(uint8_t transactionID, uint8_t fromUnitID, uint8_t toUnitID, uint32_t cookie);
 				bool SendOKResponse(uint8_t transactionID, uint8_t fromUnitID, uint8_t toUnitID, uint8_t FCode);
 				bool SendErrorResponse(uint8_t transactionID, uint8_t fromUnitID, uint8_t toUnitID, uint8_t fCode, uint8_t errorCode);
+				void ScheduleSlottedReport(uint8_t transactionID, uint8_t toUnitID, uint16_t delay);
 
 				bool NotifySysEvent(uint8_t eventType, uint32_t timeStamp, uint16_t seqID, uint8_t flags, uint8_t eventDataLength, uint8_t *eventData);
 
 private:
+				bool	StationReady(uint8_t stationID);
+				bool	StartTransaction(uint8_t stationID, uint8_t fCode, uint8_t param1, uint8_t param2, PTransactionCallback callback, uint8_t ctx);
+				int8_t	FreeTransactionSlot(uint8_t fCode);
+				RDeferred *DeferredRequests(uint8_t fCode);
+				void	StartDeferred(void);
+				bool	SendTransaction(int8_t index);
+				int8_t	FindTransaction(uint8_t transactionID, uint8_t stationID);
+				void	SetTransactionState(int8_t index, uint8_t state, uint8_t retries, unsigned long deadline);
+				void	CompleteTransactionEntry(int8_t index, uint8_t result, void *pResponse);
+				void	CompleteTransaction(int8_t index, uint8_t result, void *pResponse);
+				uint8_t	NewTransactionID(void);
+				void	CheckTransactions(void);
+				void	CheckSlottedPoll(void);
+				uint8_t	RetryBudget(uint8_t stationID);
+				void	LinkLossSample(uint16_t *pLoss, uint8_t attempts, uint8_t lost);
+
+				int8_t	FreeFrame(void);
+				bool	SendTransportPacket(uint8_t stationID, uint8_t nFrame, void *pMessage, uint8_t mSize);
+				bool	RouteFrame(uint8_t stationID);
+				bool	SendRelayFrame(uint8_t nextHop, uint8_t seqID, uint8_t hopTransactionID);
+				void	ProcessRelayFrame(uint8_t *ptr);
+				void	LearnRoute(uint8_t stationID, uint8_t viaStationID);
+				bool	RelayFrameSeen(uint8_t originID, uint8_t seqID);
+
+				bool	SendFragments(void);
+				bool	SendFragmentAck(uint8_t toUnitID, uint8_t msgID, uint8_t missing);
+				void	ProcessFragment(uint8_t *ptr, uint8_t *pNetAddress);
+				void	ProcessFragmentAck(uint8_t *ptr);
+				void	CheckFragments(void);
+				bool	MessageBufFree(void)	{ return (_txMessage.state == RMESSAGE_TX_FREE) && !_rxMessage.bActive; }
+
 // ARP address update
 				PARPCallback		_ARPAddressUpdate;
+
+// Outstanding requests
+				RTransaction		_transactions[RPROTOCOL_MAX_TRANSACTIONS];
+				uint8_t				_lastTransactionID;
+				RDeferred			_deferred[2];							// FCODE_EVTMASTER_SET, FCODE_SENSORS_REPORTCFG_SET
+
+// Slotted sensors poll
+				uint16_t			_slotPollPending;						// master - bit per polled station that did not reply yet
+				uint8_t				_slotPollTID;
+				unsigned long		_slotPollDeadline;						// master - end of the reply window, millis()
+				uint8_t				_slotReplyTID;							// station - TransactionID of the scheduled reply, 0 - none
+				uint8_t				_slotReplyTo;
+				unsigned long		_slotReplyTime;							// station - time to send the scheduled reply, millis()
+
+// Multi-hop routes and relayed frames
+				uint8_t				_routeVia[MAX_STATIONS];				// next hop (relay station) for each station, or RPROTOCOL_ROUTE_DIRECT
+				uint16_t			_staticRoutes;							// bit per station - route is static (from station config), not learned
+				uint16_t			_knownRoutes;							// bit per station - route is static or learned (including direct)
+				RRelaySeen			_relaySeen[RPROTOCOL_RELAY_DUP_CACHE];
+				uint8_t				_relaySeenNext;
+				uint8_t				_relaySeqID;
+				bool				_bRelayedFrame;							// processing frame that arrived through a relay
+
+// Outgoing frames
+				RFrame				_txFrames[RPROTOCOL_TX_FRAMES];
+				uint8_t				_txFrameCur;							// frame being built (or the last one built)
+
+// Fragmented messages. Outgoing and incoming message share one buffer, only one of them is in progress at a time.
+				RMessageTx			_txMessage;
+				RMessageRx			_rxMessage;
+				uint8_t				_msgBuf[RPROTOCOL_MAX_MESSAGE_SIZE];
+				bool				_bReassembled;							// processing reassembled message
+
+// Link statistics
+				RLinkStats			_linkStats[MAX_STATIONS];
 };
 
 // Modbus holding registers area size
@@ -53,7 +53,8 @@ Copyright 2014 tony-osp (http://tony-osp.dreamwidth.org/)
 //   to take advantage of the transport reliability (when available). It is achieved by allowing requester to specify 
 //   desired response behaviour - positive acknowledgement of every message or negative acknowledgement.
 //
-// RProtocol maximum message length (including header) is XX bytes.
+// RProtocol maximum frame length (including header) is RPROTOCOL_MAX_FRAME_SIZE bytes. Larger messages (up to RPROTOCOL_MAX_MESSAGE_SIZE)
+//   are sent to a single station as a series of FCODE_FRAGMENT frames, and reassembled by the receiver (see FCODE_FRAGMENT).
 //
 // RProtocol usually will be running over transport that guarantees message integrity (transport-level CRC).
 // When running over transports that don't guarantee message integrity, validation code is appended to the message.
@@ -104,6 +105,12 @@ Copyright 2014 tony-osp (http://tony-osp.dreamwidth.org/)
 #define FCODE_SYSEVT_READ					15
 #define FCODE_SYSEVT_REPORT					16
 
+// Sensors push reporting config
+#define FCODE_SENSORS_REPORTCFG_SET			17
+
+// Slotted sensors poll of multiple stations
+#define FCODE_SENSORS_POLL					18
+
 // Other
 #define FCODE_SCAN							50
 #define FCODE_SCAN_REPLY					51
@@ -111,6 +118,9 @@ Copyright 2014 tony-osp (http://tony-osp.dreamwidth.org/)
 #define FCODE_PING_REPLY					53
 
 #define FCODE_TIME_BROADCAST				55
+#define FCODE_RELAY							56
+#define FCODE_FRAGMENT						57
+#define FCODE_FRAGMENT_ACK					58
 
 // Response 
 #define FCODE_RESPONSE_OK					127
@@ -274,6 +284,58 @@ struct RMESSAGE_SENSORS_REPORT
 									//       E.g. SensorsData[0] and [1] can be treated as one sensor with 32bit precision.
 };
 
+//
+//  FCODE_SENSORS_REPORTCFG_SET - configure unsolicited sensors reports
+//
+//  Station that has EvtMaster registered with EVTMASTER_FLAGS_REPORT_SENSORS flag sends FCODE_SENSORS_REPORT messages 
+//  (with TransactionID of 0) to the EvtMaster on its own, instead of waiting to be polled.
+//  Sensor is reported when its reading changed by Deadband or more since the last report, or when Interval minutes passed
+//  since the last report. Sensors that are due in the same sampling cycle are reported in one message.
+//
+//  Sensors with both Interval and Deadband set to 0 are not reported.
+//
+struct RSENSOR_REPORTCFG
+{
+	uint8_t		Interval;			// max time between reports, minutes. 0 - no periodic reports
+	uint16_t	Deadband;			// min reading change that triggers report. 0 - no change-triggered reports
+};
+
+struct RMESSAGE_SENSORS_REPORTCFG_SET
+{
+//  Header
+	RMESSAGE_HEADER	Header;
+	
+// PDU
+
+	uint8_t		Flags;				// This field carries various flags for this message.
+									// Most important are RMESSAGE_FLAGS_ACK_* flags that control acknowledgement/response.
+
+	uint8_t		FirstSensor;		// First Sensor to configure
+	uint8_t		NumSensors;			// Number of Sensors to configure
+	RSENSOR_REPORTCFG	SensorsCfg[1];	// Array of report config entries, one per sensor
+};
+
+//
+//  FCODE_SENSORS_POLL - Slotted sensors poll of multiple stations
+//
+//  This message is sent to STATIONID_BROADCAST. Each station listed in StationsMask replies with FCODE_SENSORS_REPORT 
+//    for all its sensors (with TransactionID of the request) in its own time slot, to avoid collisions with other replies. 
+//  Slot number is the number of polled stations with lower stationID, and the slot starts SlotNumber*SlotTime ms after 
+//    the request was received.
+//  Stations not listed in StationsMask, and stations without sensors, don't reply.
+//
+struct RMESSAGE_SENSORS_POLL
+{
+//  Header
+	RMESSAGE_HEADER	Header;
+	
+// PDU
+
+	uint16_t	StationsMask;		// bit per polled station
+	uint8_t		SlotTime;			// reply slot length, ms
+};
+
+
 //
 //  FCODE_SYSREGISTERS_READ - Read System Registers 
 //
@@ -412,7 +474,8 @@ struct RMESSAGE_SYSEVT_READ
 #define SYSEVENT_FLAG_CONTINUE			128	// high bit set means that the message is carrying continuation of the event started in the previous message
 #define SYSEVENT_FLAG_MORE				64	// this bit means that more events are available 
 
-#define SYSEVENT_MAX_STRING_LENGTH		40
+#define SYSEVENT_MAX_STRING_LENGTH		40	// max event string length of the single-frame report
+#define SYSEVENT_MAX_EVENT_LENGTH		100	// max event string length of the report sent as fragmented message
 
 //
 //  FCODE_SYSEVT_REPORT - Report Syslog event
@@ -424,7 +487,8 @@ struct RMESSAGE_SYSEVT_READ
 //  When sent in response to FCODE_SYSEVT_READ, TransactionID will be the same as in the request, 
 //    if sent unsolicited - it will be 0.
 //
-//  Note: maximum EvtString length is SYSEVENT_MAX_STRING_LENGTH
+//  Note: maximum EvtString length is SYSEVENT_MAX_EVENT_LENGTH (report longer than one frame is sent as fragmented message).
+//  Longer events are split into several reports, with SYSEVENT_FLAG_CONTINUE set on the continuation reports.
 //
 struct RMESSAGE_SYSEVT_REPORT
 {
@@ -596,6 +660,80 @@ struct RMESSAGE_TIME_BROADCAST
 	uint32_t	timeNow;
 };
 
+//
+//  FCODE_RELAY - frame forwarded through relay station(s)
+//
+//  Stations outside of the direct RF range of the master are reached through relay stations. The original RProtocol frame
+//  (with end-to-end ToUnitID/FromUnitID) is carried in the Data area, while the outer header addresses the current hop - 
+//  ToUnitID is the next hop (or STATIONID_BROADCAST), FromUnitID is the station that transmitted this hop.
+//  Outer TransactionID is hop-level and is not used for request/response matching.
+//
+//  Each hop decrements TTL, frame is dropped when TTL reaches zero. OriginID+SeqID identify the frame, relay stations
+//  remember recently seen frames and don't forward the same frame twice (bounds broadcast floods).
+//
+//  Stations that don't support relaying ignore this message.
+//
+struct RMESSAGE_RELAY
+{
+//  Header
+	RMESSAGE_HEADER	Header;
+
+// PDU
+
+	uint8_t		TTL;				// remaining number of hops
+	uint8_t		OriginID;			// station that originated the frame
+	uint8_t		SeqID;				// frame sequence number assigned by the originator
+	uint8_t		Data[1];			// original frame, including its header
+};
+
+#define RMESSAGE_RELAY_OVERHEAD		(sizeof(RMESSAGE_RELAY)-1)		// relay header size
+
+//
+//  FCODE_FRAGMENT - fragment of the message that does not fit into one frame
+//
+//  Message (including its header) is split into fragments, each fragment carries a slice of the message starting at Offset.
+//  The header addresses the end stations (fragments are relayed as any other frame), TransactionID is the TransactionID
+//  of the original message. MsgID identifies the message among other messages from the same sender.
+//
+//  Receiver reassembles the message and processes it as if it was received in one frame. Receiver replies with 
+//  FCODE_FRAGMENT_ACK when the message is complete, and also when the last fragment (FragIndex == NumFrags-1) arrives while 
+//  other fragments are still missing. Sender re-sends the fragments reported as missing, and re-sends the last fragment 
+//  if no ACK arrives in time (asking for the ACK with the current state of the reassembly).
+//
+//  Fragmented messages can't be broadcast.
+//
+struct RMESSAGE_FRAGMENT
+{
+//  Header
+	RMESSAGE_HEADER	Header;
+
+// PDU
+
+	uint8_t		MsgID;				// message ID assigned by the sender
+	uint8_t		FragIndex;			// fragment number, 0 to NumFrags-1
+	uint8_t		NumFrags;			// total number of fragments in the message
+	uint8_t		Offset;				// offset of the fragment data in the message
+	uint8_t		Data[1];			// fragment data
+};
+
+#define RMESSAGE_FRAGMENT_OVERHEAD	(sizeof(RMESSAGE_FRAGMENT)-1)	// fragment header size
+
+//
+//  FCODE_FRAGMENT_ACK - reassembly state of the fragmented message
+//
+//  Missing has a bit per fragment not received yet, zero means the message is complete.
+//
+struct RMESSAGE_FRAGMENT_ACK
+{
+//  Header
+	RMESSAGE_HEADER	Header;
+
+// PDU
+
+	uint8_t		MsgID;				// message ID from FCODE_FRAGMENT
+	uint8_t		Missing;			// bit per missing fragment
+};
+
 
 // Station types
 //
@@ -46,6 +46,7 @@ Some of the modules (nntp, tftp and few other pieces) came from Sprinklers_pi co
 #include "LocalBoard.h"
 #include <IniFile.h>
 #include "RProtocolMS.h"
+#include "sensors.h"
 
 #ifdef SG_WDT_ENABLED
 #include <avr/wdt.h>
@@ -59,6 +60,7 @@ Some of the modules (nntp, tftp and few other pieces) came from Sprinklers_pi co
 
 #ifdef HW_ENABLE_MOTEINORF
 #include "RFM69.h"
+#include "RFM69_ATC.h"
 #include "MoteinoRF.h"
 #endif //HW_ENABLE_MOTEINORF
 
@@ -83,6 +85,8 @@ void setup() {
 	wdt_disable();
 #endif // SG_WDT_ENABLED
 
+	PaintStack();
+
 	trace_setup(Serial, 115200);    
 	TRACE_CRIT(F("Start!\n"));
 
@@ -132,6 +136,8 @@ void setup() {
 	MoteinoRF.begin();
 #endif //HW_ENABLE_XBEE
 
+	rprotocol.begin();		// load RF routes
+
 #ifdef HW_ENABLE_ETHERNET
 
 	//pinMode(SS, OUTPUT); digitalWrite(SS, HIGH);	// prep SDI port and turn Off Moteino Mega receiver (it is sitting on SS)
@@ -174,6 +180,7 @@ void setup() {
 }
 
 void loop() {
+    LoopTick();
     mainLoop();
     localUI.loop();
 	rprotocol.loop();
@@ -184,6 +191,20 @@ void loop() {
 }
 
 
+// Remote station confirmed sensors push reporting config, from now on it reports its sensors on its own
+static void	SensorReportsConfigured(uint8_t stationID, uint8_t ctx, uint8_t result, void *pResponse)
+{
+		if( result == RPROTOCOL_RESULT_OK )
+			sensorsModule.EnableStationPush(stationID);
+}
+
+// Remote station registered us as EvtMaster, send it sensors push reporting config
+static void	RemoteEventsSubscribed(uint8_t stationID, uint8_t ctx, uint8_t result, void *pResponse)
+{
+		if( result == RPROTOCOL_RESULT_OK )
+			rprotocol.ConfigureSensorReports(stationID, SensorReportsConfigured);
+}
+
 // Go through remote stations and register myself as EvtMaster. Called as a part of the initialization sequence.
 //
 // (p.s. Really should have a separate remote stations manager, but can put it here for now)
@@ -192,6 +213,6 @@ void	RegisterRemoteEvents(void)
 {
 		for( uint8_t i=1; i<MAX_STATIONS; i++ )		// iterate through stations starting from 1, since station 0 is always local
 		{
-			rprotocol.SubscribeEvents( i );			// we are relying on the station enable and network type check inside SubscribeEvents()
+			rprotocol.SubscribeEvents( i, RemoteEventsSubscribed );	// we are relying on the station enable and network type check inside SubscribeEvents()
 		}
 }
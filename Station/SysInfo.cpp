@@ -16,6 +16,7 @@ Copyright 2014 tony-osp (http://tony-osp.dreamwidth.org/)
 #include "port.h"
 #include "settings.h"
 #include "XBeeRF.h"
+#include "MoteinoRF.h"
 
 
 // Main SysInfo function
@@ -69,6 +70,8 @@ bool SysInfo(FILE* stream_file)
 #else
 	fprintf_P( stream_file, PSTR("<td>%d bytes </td>\n"), GetFreeMemory());
 #endif
+	fprintf_P( stream_file, PSTR("</tr><tr>\n<td>Min free RAM</td>\n<td>%d bytes (stack high water mark)</td>\n"), GetMinFreeMemory());
+	fprintf_P( stream_file, PSTR("</tr><tr>\n<td>Max loop time</td>\n<td>%u ms (last 10-20 seconds)</td>\n"), GetMaxLoopTime());
 
 	fprintf_P( stream_file, PSTR("</tr><tr>\n<td>Network</td>\n<td>Ethernet W5100/W5500 (100 Mbps)</td>\n"));
 	fprintf_P( stream_file, PSTR("</tr><tr>\n<td>Storage</td>\n<td>MicroSD Card</td>\n</tr><tr>\n<td>Local LCD</td>\n<td>"));
@@ -81,6 +84,16 @@ bool SysInfo(FILE* stream_file)
 	fprintf_P( stream_file, PSTR("</tr><tr>\n<td>SeasonalAdj</td>\n<td>%i</td>\n"), (int)GetSeasonalAdjust());
 	fprintf_P( stream_file, PSTR("</tr></table>\n"));
 
+#ifdef HW_ENABLE_SD
+	fprintf_P( stream_file, PSTR("<h3 class=\"auto-style1\">Logging</h3>\n"
+						         "<table align=\"center\" border=\"1\" style=\"border:medium\"><tr>\n"));
+	fprintf_P( stream_file, PSTR("<td width=\"200\">SD Card</td>\n<td>%S</td>\n"), sdlog.logger_ready ? PSTR("Ready"):PSTR("Not available"));
+	fprintf_P( stream_file, PSTR("</tr><tr>\n<td>Spooled records</td>\n<td>%u (%u of %u bytes)</td>\n"), sdlog.spool_records, sdlog.spool_bytes, LOG_SPOOL_SIZE);
+	fprintf_P( stream_file, PSTR("</tr><tr>\n<td>Dropped records</td>\n<td>%lu</td>\n"), sdlog.spool_dropped);
+	fprintf_P( stream_file, PSTR("</tr><tr>\n<td>SD Card re-init</td>\n<td>%u</td>\n"), sdlog.sd_reinit_count);
+	fprintf_P( stream_file, PSTR("</tr></table>\n"));
+#endif //HW_ENABLE_SD
+
 	fprintf_P( stream_file, PSTR("<h3 class=\"auto-style1\">Network</h3>\n"
 								 "<table align=\"center\" border=\"1\" style=\"border:medium\"><tr>\n<td width=\"200\">IP</td>\n"));
 
@@ -92,6 +105,7 @@ bool SysInfo(FILE* stream_file)
 	ip = GetGateway();
 	fprintf_P( stream_file, PSTR("</tr><tr>\n<td>Gateway</td>\n<td>%i.%i.%i.%i</td>\n"), ip[0], ip[1], ip[2], ip[3]);
 	fprintf_P( stream_file, PSTR("</tr><tr>\n<td>WebPort</td>\n<td>%i</td>\n"), GetWebPort());
+	fprintf_P( stream_file, PSTR("</tr><tr>\n<td>Aborted Web Connections</td>\n<td>%u</td>\n"), webAbortedConnections);
 	ip = GetNTPIP();
 	fprintf_P( stream_file, PSTR("</tr><tr>\n<td>NTP Server</td>\n<td>%i.%i.%i.%i</td>\n</tr></table>"), ip[0], ip[1], ip[2], ip[3]);
 
@@ -158,7 +172,7 @@ bool SysInfo(FILE* stream_file)
 
 	fprintf_P( stream_file, PSTR("<h3 class=\"auto-style1\">Stations</h3>\n<p>Number of Stations:&nbsp; %i</p>\n"), (int)GetNumStations());
 	fprintf_P( stream_file, PSTR("<table align=\"center\" border=\"1\" style=\"border:medium\"><tr class=\"auto-style2\">\n"
-		"<td>&nbsp StationID&nbsp</td><td>&nbsp Name&nbsp</td><td>&nbsp Num Channels&nbsp</td><td>&nbsp NetworkID&nbsp</td><td>&nbsp NetworkAddress&nbsp</td><td>Last Contact</td><td>RSSI</td>\n"
+		"<td>&nbsp StationID&nbsp</td><td>&nbsp Name&nbsp</td><td>&nbsp Num Channels&nbsp</td><td>&nbsp NetworkID&nbsp</td><td>&nbsp NetworkAddress&nbsp</td><td>Last Contact</td><td>RSSI</td><td>Link Health</td><td>TX Power</td><td>RSSI History</td>\n"
 								 "</tr>\n"));
 
 	for( int i=0; i<MAX_STATIONS; i++ )
@@ -186,16 +200,41 @@ bool SysInfo(FILE* stream_file)
 				if( runState.sLastContactTime[i] != 0 )
 				{
 					unsigned long c_age = (millis()-runState.sLastContactTime[i]) / (time_t)60000;
-					fprintf_P( stream_file, PSTR("<td>%lu min. ago</td><td>%ddb</td></tr>\n"), c_age, runState.iLastReceivedRSSI[i]);
+					fprintf_P( stream_file, PSTR("<td>%lu min. ago</td><td>%ddb</td>"), c_age, runState.iLastReceivedRSSI[i]);
+				}
+				else
+				{
+					fprintf_P( stream_file, PSTR("<td>No contact</td><td></td>"));
+				}
+
+				if( rprotocol.LinkHealth(i) != 0xFF )
+					fprintf_P( stream_file, PSTR("<td>%u%% %S</td>"), uint16_t(rprotocol.LinkHealth(i)), rprotocol.LinkStatus(i));
+				else
+					fprintf_P( stream_file, PSTR("<td></td>"));
+
+				// RFM69 link budget - transmit power level (with ATC target and RSSI reported in the last ACK), and received RSSI history
+				if( (fStation.networkID == NETWORK_ID_MOTEINORF) && MoteinoRF.fMoteinoRFReady )
+				{
+					if( MoteinoRF.txPower[i] != MOTEINORF_POWER_UNKNOWN )
+						fprintf_P( stream_file, PSTR("<td>%u (target %ddb, ack %ddb)</td><td>"), uint16_t(MoteinoRF.txPower[i]), int16_t(MoteinoRF.targetRSSI[i]), int16_t(MoteinoRF.ackRSSI[i]));
+					else
+						fprintf_P( stream_file, PSTR("<td></td><td>"));
+
+					for( uint8_t j=0; j<MOTEINORF_RSSI_HISTORY; j++ )
+					{
+						if( MoteinoRF.rssiHistory[i][j] != 0 )
+							fprintf_P( stream_file, PSTR("%d "), int16_t(MoteinoRF.rssiHistory[i][j]));
+					}
+					fprintf_P( stream_file, PSTR("</td></tr>\n"));
 				}
 				else
 				{
-					fprintf_P( stream_file, PSTR("<td>No contact</td><td></td></tr>\n"));
+					fprintf_P( stream_file, PSTR("<td>N/A</td><td>N/A</td></tr>\n"));
 				}
 			}			
 			else
 			{
-				fprintf_P( stream_file, PSTR("<td>%u</td><td>N/A</td><td>N/A</td></tr>\n"), fStation.networkAddress);
+				fprintf_P( stream_file, PSTR("<td>%u</td><td>N/A</td><td>N/A</td><td>N/A</td><td>N/A</td><td>N/A</td></tr>\n"), fStation.networkAddress);
 			}
 		}
 	}
@@ -10,159 +10,253 @@
 #include "port.h"
 #include <string.h>
 #include <stdlib.h>
+#ifdef ARDUINO
+#include <utility/socket.h>
+#endif
 
-Weather::Weather(void)
-{
-}
+// Response parser states
+#define PARSE_FIND_QUOTE1		0
+#define PARSE_KEY				1
+#define PARSE_FIND_QUOTE2		2
+#define PARSE_VALUE				3
+#define PARSE_QVALUE			4
 
-static void ParseResponse(EthernetClient & client, Weather::ReturnVals * ret)
+void Weather::ParseResponse(const char * p, int len)
 {
-	freeMemory();
-	ret->valid = false;
-	enum
+	while (len-- > 0)
 	{
-		FIND_QUOTE1 = 0, PARSING_KEY, FIND_QUOTE2, PARSING_VALUE, PARSING_QVALUE, ERROR
-	} current_state = FIND_QUOTE1;
-	char recvbuf[100];
-	char * recvbufptr = recvbuf;
-	char * recvbufend = recvbuf;
-	char key[30], val[30];
-	char * keyptr = key;
-	char * valptr = val;
-	while (true)
-	{
-		if (recvbufptr >= recvbufend)
-		{
-			int len = client.read((uint8_t*) recvbuf, sizeof(recvbuf));
-//			SYSEVT_ERROR(F("Received Bytes:%d"), len);
-			if (len <= 0)
-			{
-				if (!client.connected())
-					break;
-				else
-					continue;  //TODO:  implement a timeout here.  Same in testing parse headers.
-			}
-			else
-			{
-				recvbufptr = recvbuf;
-				recvbufend = recvbuf + len;
-			}
-		}
-		char c = *(recvbufptr++);
+		char c = *(p++);
 
-		switch (current_state)
+		switch (m_state)
 		{
-		case FIND_QUOTE1:
+		case PARSE_FIND_QUOTE1:
 			if (c == '"')
 			{
-				current_state = PARSING_KEY;
-				keyptr = key;
+				m_state = PARSE_KEY;
+				m_keyLen = 0;
 			}
 			break;
-		case PARSING_KEY:
+		case PARSE_KEY:
 			if (c == '"')
 			{
-				current_state = FIND_QUOTE2;
-				*keyptr = 0;
+				m_state = PARSE_FIND_QUOTE2;
+				m_key[m_keyLen] = 0;
 			}
 			else
 			{
-				if ((keyptr - key) < (long)(sizeof(key) - 1))
-				{
-					*keyptr = c;
-					keyptr++;
-				}
+				if (m_keyLen < sizeof(m_key) - 1)
+					m_key[m_keyLen++] = c;
 			}
 			break;
-		case FIND_QUOTE2:
+		case PARSE_FIND_QUOTE2:
 			if (c == '"')
 			{
-				current_state = PARSING_QVALUE;
-				valptr = val;
+				m_state = PARSE_QVALUE;
+				m_valLen = 0;
 			}
 			else if (c == '{')
 			{
-				current_state = FIND_QUOTE1;
+				m_state = PARSE_FIND_QUOTE1;
 			}
 			else if ((c >= '0') && (c <= '9'))
 			{
-				current_state = PARSING_VALUE;
-				valptr = val;
-				*valptr = c;
-				valptr++;
+				m_state = PARSE_VALUE;
+				m_valLen = 0;
+				m_val[m_valLen++] = c;
 			}
 			break;
-		case PARSING_VALUE:
+		case PARSE_VALUE:
 			if (((c >= '0') && (c <= '9')) || (c == '.'))
 			{
-				*valptr = c;
-				valptr++;
+				if (m_valLen < sizeof(m_val) - 1)
+					m_val[m_valLen++] = c;
 			}
 			else
 			{
-				current_state = FIND_QUOTE1;
-				*valptr = 0;
+				m_state = PARSE_FIND_QUOTE1;
+				m_val[m_valLen] = 0;
 			}
 			break;
-		case PARSING_QVALUE:
+		case PARSE_QVALUE:
 			if (c == '"')
 			{
-				current_state = FIND_QUOTE1;
-				*valptr = 0;
-				//SYSEVT_ERROR("%s:%s\n", key, val);
-				if (strcmp(key, "maxhumidity") == 0)
+				m_state = PARSE_FIND_QUOTE1;
+				m_val[m_valLen] = 0;
+				//SYSEVT_ERROR("%s:%s\n", m_key, m_val);
+				if (strcmp_P(m_key, PSTR("maxhumidity")) == 0)
 				{
-					ret->valid = true;
-					ret->keynotfound = false;
-					ret->maxhumidity = atoi(val);
+					m_vals.valid = true;
+					m_vals.keynotfound = false;
+					m_vals.maxhumidity = atoi(m_val);
 				}
-				else if (strcmp(key, "minhumidity") == 0)
+				else if (strcmp_P(m_key, PSTR("minhumidity")) == 0)
 				{
-					ret->minhumidity = atoi(val);
+					m_vals.minhumidity = atoi(m_val);
 				}
-				else if (strcmp(key, "meantempi") == 0)
+				else if (strcmp_P(m_key, PSTR("meantempi")) == 0)
 				{
-					ret->meantempi = atoi(val);
+					m_vals.meantempi = atoi(m_val);
 				}
-				else if (strcmp(key, "precip_today_in") == 0)
+				else if (strcmp_P(m_key, PSTR("precip_today_in")) == 0)
 				{
-					ret->precip_today = (atof(val) * 100.0);
+					m_vals.precip_today = (atof(m_val) * 100.0);
 				}
-				else if (strcmp(key, "precipi") == 0)
+				else if (strcmp_P(m_key, PSTR("precipi")) == 0)
 				{
-					ret->precipi = (atof(val) * 100.0);
+					m_vals.precipi = (atof(m_val) * 100.0);
 				}
-				else if (strcmp(key, "UV") == 0)
+				else if (strcmp_P(m_key, PSTR("UV")) == 0)
 				{
-					ret->UV = (atof(val) * 10.0);
+					m_vals.UV = (atof(m_val) * 10.0);
 				}
-				else if (strcmp(key, "meanwindspdi") == 0)
+				else if (strcmp_P(m_key, PSTR("meanwindspdi")) == 0)
 				{
-					ret->windmph = (atof(val) * 10.0);
+					m_vals.windmph = (atof(m_val) * 10.0);
 				}
-				else if (strcmp(key, "type") == 0)
+				else if (strcmp_P(m_key, PSTR("type")) == 0)
 				{
-					if (strcmp(val, "keynotfound") == 0)
-						ret->keynotfound = true;
+					if (strcmp_P(m_val, PSTR("keynotfound")) == 0)
+						m_vals.keynotfound = true;
 				}
 
 			}
 			else
 			{
-				if ((valptr - val) < (long)(sizeof(val) - 1))
-				{
-					*valptr = c;
-					valptr++;
-				}
+				if (m_valLen < sizeof(m_val) - 1)
+					m_val[m_valLen++] = c;
 			}
 			break;
-		case ERROR:
-			break;
 		} // case
-	} // while (true)
+	} // while
 }
 
-int Weather::GetScale(const IPAddress & ip, const char * key, uint32_t zip, const char * pws, bool usePws) const
+bool Weather::Start(const IPAddress & ip, const char * key, uint32_t zip, const char * pws, bool usePws)
+{
+	static uint16_t srcport = 0;
+	uint8_t addr[4] = { ip[0], ip[1], ip[2], ip[3] };
+
+	freeMemory();
+	memset(&m_vals, 0, sizeof(m_vals));
+	m_phase = WEATHER_DONE;
+	m_bWaiting = false;
+	m_state = PARSE_FIND_QUOTE1;
+	strncpy(m_apikey, key, sizeof(m_apikey) - 1);
+	m_apikey[sizeof(m_apikey) - 1] = 0;
+	strncpy(m_pws, pws, sizeof(m_pws) - 1);
+	m_pws[sizeof(m_pws) - 1] = 0;
+	m_zip = zip;
+	m_usePws = usePws;
+
+	// free socket that is not used by the servers
+	for (m_sock = 0; m_sock < MAX_SOCK_NUM; m_sock++)
+		if ((W5100.readSnSR(m_sock) == SnSR::CLOSED) && (EthernetClass::_server_port[m_sock] == 0))
+			break;
+
+	if ((m_sock == MAX_SOCK_NUM) || !socket(m_sock, SnMR::TCP, WEATHER_SRC_PORT + (srcport++ & 0xFFF), 0) || !connect(m_sock, addr, 80))
+	{
+		SYSEVT_ERROR(F("connection failed"));
+		if (m_sock != MAX_SOCK_NUM)
+			close(m_sock);
+		return false;
+	}
+
+	// connection is established in the background, Poll() waits for it
+	m_phase = WEATHER_CONNECTING;
+	m_timer = millis();
+	return true;
+}
+
+bool Weather::Poll(void)
+{
+	EthernetClient client(m_sock);
+	uint8_t status;
+
+	m_bWaiting = true;
+	if (m_phase == WEATHER_DONE)
+		return true;
+	if (m_phase == WEATHER_IDLE)
+		return false;
+
+	status = client.status();
+	if (millis() - m_timer > WEATHER_RESPONSE_TIMEOUT)
+	{
+		SYSEVT_ERROR(F("Weather response timeout"));
+		Close();
+		return true;
+	}
+
+	if (m_phase == WEATHER_CONNECTING)
+	{
+		if (status == SnSR::CLOSED)
+		{
+			SYSEVT_ERROR(F("connection failed"));
+			Close();
+			return true;
+		}
+		if (status != SnSR::ESTABLISHED)
+			return false;
+
+		char getstring[128];
+		TRACE_VERBOSE(F("Weather::Poll - Connected\n"));
+		if (m_usePws)
+			snprintf_P(getstring, sizeof(getstring), PSTR("GET /api/%s/yesterday/conditions/q/pws:%s.json HTTP/1.0\n\n"), m_apikey, m_pws);
+		else
+			snprintf_P(getstring, sizeof(getstring), PSTR("GET /api/%s/yesterday/conditions/q/%ld.json HTTP/1.0\nHost: api.wunderground.com\n\n"), m_apikey, (long) m_zip);
+		TRACE_VERBOSE(getstring);
+		client.write((uint8_t*) getstring, strlen(getstring));
+		m_phase = WEATHER_RECEIVING;
+		m_bWaiting = false;
+		return false;
+	}
+
+	// WEATHER_RECEIVING
+	char recvbuf[64];
+	int len = client.available() ? client.read((uint8_t*) recvbuf, sizeof(recvbuf)) : 0;
+
+	if (len > 0)
+	{
+		ParseResponse(recvbuf, len);
+		m_bWaiting = false;
+		return false;
+	}
+	if (client.connected())
+		return false;
+
+	// server closed the connection - the response is complete
+	Close();
+	if (!m_vals.valid)
+	{
+		if (m_vals.keynotfound)
+		{
+			SYSEVT_ERROR(F("Invalid WUnderground Key"));
+		}
+		else
+		{
+			SYSEVT_ERROR(F("Bad WUnderground Response"));
+		}
+	}
+	return true;
+}
+
+// Close the connection without waiting for the graceful close
+void Weather::Close(void)
+{
+	if ((m_phase == WEATHER_CONNECTING) || (m_phase == WEATHER_RECEIVING))
+	{
+		disconnect(m_sock);
+		close(m_sock);
+	}
+	m_phase = WEATHER_DONE;
+	m_bWaiting = false;
+}
+
+void Weather::Abort(void)
+{
+	Close();
+	m_phase = WEATHER_IDLE;
+}
+
+int Weather::GetScale(const IPAddress & ip, const char * key, uint32_t zip, const char * pws, bool usePws)
 {
 	ReturnVals vals = GetVals(ip, key, zip, pws, usePws);
 	return GetScale(vals);
@@ -180,39 +274,12 @@ int Weather::GetScale(const ReturnVals & vals) const
 	return adj;
 }
 
-Weather::ReturnVals Weather::GetVals(const IPAddress & ip, const char * key, uint32_t zip, const char * pws, bool usePws) const
+Weather::ReturnVals Weather::GetVals(const IPAddress & ip, const char * key, uint32_t zip, const char * pws, bool usePws)
 {
-	ReturnVals vals = {0};
-	EthernetClient client;
-	if (client.connect(ip, 80))
-	{
-		char getstring[128];
-		TRACE_VERBOSE(F("Weather::GetVals - Connected\n"));
-		if (usePws)
-			snprintf(getstring, sizeof(getstring), "GET /api/%s/yesterday/conditions/q/pws:%s.json HTTP/1.0\n\n", key, pws);
-		else
-			snprintf(getstring, sizeof(getstring), "GET /api/%s/yesterday/conditions/q/%ld.json HTTP/1.0\nHost: api.wunderground.com\n\n", key, (long) zip);
-		TRACE_VERBOSE(getstring);
-		client.write((uint8_t*) getstring, strlen(getstring));
+	if (!Start(ip, key, zip, pws, usePws))
+		return m_vals;
 
-		ParseResponse(client, &vals);
-		client.stop();
-		if (!vals.valid)
-		{
-			if (vals.keynotfound)
-			{
-				SYSEVT_ERROR(F("Invalid WUnderground Key"));
-			}
-			else
-			{
-				SYSEVT_ERROR(F("Bad WUnderground Response"));
-			}
-		}
-	}
-	else
-	{
-		SYSEVT_ERROR(F("connection failed"));
-		client.stop();
-	}
-	return vals;
+	while (!Poll())
+		;
+	return m_vals;
 }
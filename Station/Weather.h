@@ -10,6 +10,18 @@
 
 #include "port.h"
 
+#define WEATHER_RESPONSE_TIMEOUT	10000		// max time of the weather service query (connect and receive the response), ms
+#define WEATHER_SRC_PORT			49152		// first local port of the weather service connections
+
+// Query phases
+#define WEATHER_IDLE				0
+#define WEATHER_CONNECTING			1
+#define WEATHER_RECEIVING			2
+#define WEATHER_DONE				3
+
+// Weather service query.
+// Query is non-blocking: Start() opens the connection, Poll() sends the request once connected and parses the response
+// as it arrives. GetVals() runs the whole query and waits for the result.
 class Weather
 {
 public:
@@ -26,10 +38,34 @@ public:
 		short UV;
 	};
 public:
-	Weather(void);
-	int GetScale(const IPAddress & ip, const char * key, uint32_t zip, const char * pws, bool usePws) const;
+	int GetScale(const IPAddress & ip, const char * key, uint32_t zip, const char * pws, bool usePws);
 	int GetScale(const ReturnVals & vals) const;
-	ReturnVals GetVals(const IPAddress & ip, const char * key, uint32_t zip, const char * pws, bool usePws) const;
+	ReturnVals GetVals(const IPAddress & ip, const char * key, uint32_t zip, const char * pws, bool usePws);
+
+	bool Start(const IPAddress & ip, const char * key, uint32_t zip, const char * pws, bool usePws);	// false if the connection cannot be opened
+	bool Poll(void);						// advance the query, returns true when it is complete (see Vals())
+	bool IsWaiting(void) const	{ return m_bWaiting; }	// last Poll() had nothing to do
+	void Abort(void);
+	const ReturnVals & Vals(void) const	{ return m_vals; }
+
+private:
+	void ParseResponse(const char * p, int len);
+	void Close(void);
+
+	uint8_t			m_sock;					// socket of the query
+	uint8_t			m_phase;				// WEATHER_xxx
+	bool			m_bWaiting;
+	unsigned long	m_timer;				// start of the query, millis()
+	char			m_apikey[17];			// request parameters, the request is sent once the connection is established
+	char			m_pws[12];
+	uint32_t		m_zip;
+	bool			m_usePws;
+
+	// response parser
+	uint8_t			m_state;
+	uint8_t			m_keyLen, m_valLen;
+	char			m_key[30], m_val[30];
+	ReturnVals		m_vals;
 };
 
 #endif
@@ -341,7 +341,9 @@ bool XBeeSendPacket(uint8_t nStation, void *msg, uint8_t mSize)
 
     xbee.send(tx);
 
-// No response from XBee is requested
+// No response from XBee is requested, so we can only count the frame. XBee link loss is seen by RProtocol as requests loss.
+
+	rprotocol.LinkTxDone(nStation, 0, true);
 
 	return true;
 }
@@ -42,6 +42,16 @@ LocalBoardSerial	lBoardSerial;		// local hardware handler for Serially-connected
 
 static uint8_t	zoneStateCache[MAX_ZONES] = {0};
 
+// Update zone state cache, and notify live web clients when zone state (upper nibble) changes
+static inline void setZoneState(uint8_t iNum, uint8_t state)
+{
+#ifdef HW_ENABLE_ETHERNET
+	if( (zoneStateCache[iNum] ^ state) & 0x0F0 )
+		WebNotify(WEB_EVT_ZONE, iNum);
+#endif //HW_ENABLE_ETHERNET
+	zoneStateCache[iNum] = state;
+}
+
 // Zone handler loop, it is called once a second
 
 void zoneHandlerLoop(void)
@@ -62,13 +72,13 @@ void zoneHandlerLoop(void)
 				if( t > 1 )
 				{
 					t--; 
-					zoneStateCache[i] = t + ZONE_STATE_STARTING;
+					setZoneState(i, t + ZONE_STATE_STARTING);
 				}
 				else
 				{
 					// we reached zero but have not received confirmation, assume that zone did not start.
 					// stop the timer and change the state.
-					zoneStateCache[i] = ZONE_STATE_OFF;
+					setZoneState(i, ZONE_STATE_OFF);
 				}
 			}
 			else if( z & ZONE_STATE_STOPPING ) 
@@ -77,13 +87,13 @@ void zoneHandlerLoop(void)
 				if( t > 1 )
 				{
 					t--; 
-					zoneStateCache[i] = t + ZONE_STATE_STOPPING;
+					setZoneState(i, t + ZONE_STATE_STOPPING);
 				}
 				else
 				{
 					// we reached zero but have not received confirmation, assume that zone stopped.
 					// stop the timer and change the state.
-					zoneStateCache[i] = ZONE_STATE_OFF;
+					setZoneState(i, ZONE_STATE_OFF);
 				}
 			}
 		}
@@ -121,6 +131,19 @@ int ActiveZoneNum(void)
 }
 
 
+// Completion of the remote zone On/Off request (ctx is the zone number, 0-based).
+// On success zone state is updated from the zones report carried in the response, and cancelled request was superseded by a newer one.
+// Here we handle failures only - the station did not confirm the command, so we stop waiting and treat the zone as Off 
+// (remote station has time-to-run backstop).
+static void RemoteZoneRequestDone(uint8_t stationID, uint8_t nZone, uint8_t result, void *pResponse)
+{
+	if( (result == RPROTOCOL_RESULT_OK) || (result == RPROTOCOL_RESULT_CANCELLED) )
+		return;
+
+	SYSEVT_ERROR(F("Remote station %d failed to confirm command for zone %d"), (uint16_t)stationID, (uint16_t)nZone);
+	if( nZone < MAX_ZONES )
+		setZoneState(nZone, ZONE_STATE_OFF);
+}
 
 void runStateClass::TurnOnZone(uint8_t nZone, uint8_t ttr)
 {
@@ -159,7 +182,7 @@ void runStateClass::TurnOnZone(uint8_t nZone, uint8_t ttr)
 		if( sStation.networkID == NETWORK_ID_LOCAL_PARALLEL )
 		{
 			if( lBoardParallel.ChannelOn(sStation.networkAddress+zone.channel) )
-				zoneStateCache[nZone] = ZONE_STATE_RUNNING;	// parallel stations go directly to running state
+				setZoneState(nZone, ZONE_STATE_RUNNING);	// parallel stations go directly to running state
 			else
 			{
 				SYSEVT_ERROR(F("TurnOnZone - lBoardParallel returned failure for zone %d"), (uint16_t)nZone);
@@ -172,7 +195,7 @@ void runStateClass::TurnOnZone(uint8_t nZone, uint8_t ttr)
 		else if( sStation.networkID == NETWORK_ID_LOCAL_SERIAL )
 		{
 			if( lBoardSerial.ChannelOn(sStation.networkAddress+zone.channel) )
-				zoneStateCache[nZone] = ZONE_STATE_RUNNING;	// serial stations go directly to running state
+				setZoneState(nZone, ZONE_STATE_RUNNING);	// serial stations go directly to running state
 			else
 			{
 				SYSEVT_ERROR(F("TurnOnZone - lBoardSerial returned failure for zone %d"), (uint16_t)nZone);
@@ -184,9 +207,9 @@ void runStateClass::TurnOnZone(uint8_t nZone, uint8_t ttr)
 		}
 		else if( (sStation.networkID == NETWORK_ID_XBEE) || (sStation.networkID == NETWORK_ID_MOTEINORF) )
 		{
-			if( rprotocol.ChannelOn(zone.stationID, zone.channel, ttr) )
+			if( rprotocol.ChannelOn(zone.stationID, zone.channel, ttr, RemoteZoneRequestDone, nZone) )
 			{
-				zoneStateCache[nZone] = ZONE_STATE_STARTING + ZONE_STATE_TIMEOUT;	// remote stations go to "starting" state first, and will transition to "running" state when response arrives
+				setZoneState(nZone, ZONE_STATE_STARTING + ZONE_STATE_TIMEOUT);	// remote stations go to "starting" state first, and will transition to "running" state when response arrives
 			}
 			else
 			{
@@ -242,7 +265,7 @@ void runStateClass::TurnOffZone(uint8_t nZone)
 		{
 			lBoardParallel.ChannelOff( sStation.networkAddress+zone.channel );
 
-			zoneStateCache[nZone] = ZONE_STATE_OFF;	
+			setZoneState(nZone, ZONE_STATE_OFF);	
 
         // Turn on the pump if necessary
 //			lBoard.PumpControl(zone.bPump);
@@ -251,16 +274,16 @@ void runStateClass::TurnOffZone(uint8_t nZone)
 		{
 			lBoardSerial.ChannelOff( sStation.networkAddress+zone.channel );
 
-			zoneStateCache[nZone] = ZONE_STATE_OFF;	
+			setZoneState(nZone, ZONE_STATE_OFF);	
 
 			// Turn on the pump if necessary
 //			lBoard.PumpControl(zone.bPump);
 		}
 		else if( (sStation.networkID == NETWORK_ID_XBEE) || (sStation.networkID == NETWORK_ID_MOTEINORF) )
 		{
-			if( rprotocol.ChannelOff(zone.stationID, zone.channel) )
+			if( rprotocol.ChannelOff(zone.stationID, zone.channel, RemoteZoneRequestDone, nZone) )
 			{
-				zoneStateCache[nZone] = ZONE_STATE_STOPPING + ZONE_STATE_TIMEOUT;	// remote stations go to "stopping" state first, and will transition to "running" state when response arrives
+				setZoneState(nZone, ZONE_STATE_STOPPING + ZONE_STATE_TIMEOUT);	// remote stations go to "stopping" state first, and will transition to "running" state when response arrives
 			}
 			else
 			{
@@ -386,7 +409,12 @@ void runStateClass::TurnOffZonesWorker()
 		}
 		m_iZone = -1;
 		if( m_iSchedule != -1 )
+		{
 			m_iSchedule = -1;
+#ifdef HW_ENABLE_ETHERNET
+			WebNotify(WEB_EVT_STATE);
+#endif //HW_ENABLE_ETHERNET
+		}
 }
 
 void runStateClass::ReportZoneStatus(uint8_t stationID, uint8_t channel, uint8_t z_status)
@@ -404,9 +432,9 @@ void runStateClass::ReportZoneStatus(uint8_t stationID, uint8_t channel, uint8_t
 		return;							// channel out of range for this zone
 
 	if( z_status != 0 )
-		zoneStateCache[sStation.startZone+channel] = ZONE_STATE_RUNNING;
+		setZoneState(sStation.startZone+channel, ZONE_STATE_RUNNING);
 	else
-		zoneStateCache[sStation.startZone+channel] = ZONE_STATE_OFF;
+		setZoneState(sStation.startZone+channel, ZONE_STATE_OFF);
 }
 
 void runStateClass::ReportStationZonesStatus(uint8_t stationID, uint8_t z_status)
@@ -423,9 +451,9 @@ void runStateClass::ReportStationZonesStatus(uint8_t stationID, uint8_t z_status
 	for( uint8_t i=0; i<sStation.numZoneChannels; i++ )
 	{
 		if( z_status & (1<<i) )
-			zoneStateCache[sStation.startZone+i] = ZONE_STATE_RUNNING;
+			setZoneState(sStation.startZone+i, ZONE_STATE_RUNNING);
 		else
-			zoneStateCache[sStation.startZone+i] = ZONE_STATE_OFF;
+			setZoneState(sStation.startZone+i, ZONE_STATE_OFF);
 	}
 }
 
@@ -466,6 +494,9 @@ void runStateClass::StopSchedule(void)
 {
         if( m_iSchedule != -1 )		// a schedule is already running, stop it
 		{
+#ifdef HW_ENABLE_ETHERNET
+			WebNotify(WEB_EVT_STATE);
+#endif //HW_ENABLE_ETHERNET
 			if( m_iZone >= 0 )
 				TurnOffZone(m_iZone+1);
 			
@@ -478,6 +509,9 @@ void runStateClass::StopSchedule(void)
 
 void runStateClass::SetPause(int time2pause)
 {
+#ifdef HW_ENABLE_ETHERNET
+	WebNotify(WEB_EVT_STATE);
+#endif //HW_ENABLE_ETHERNET
 	if( time2pause == 0 )
 	{
 		if( m_endPauseMillis != 0 ) 
@@ -523,6 +557,9 @@ void runStateClass::StartSchedule(bool fQuickSched, int8_t iSched)
 {
 		StopSchedule();	// stop currently running schedule if any
 		m_iWaterUsed = 0;	// zero out water usage counter
+#ifdef HW_ENABLE_ETHERNET
+		WebNotify(WEB_EVT_STATE);
+#endif //HW_ENABLE_ETHERNET
 
 		if( fQuickSched )
 		{
@@ -578,6 +615,21 @@ void runStateClass::StartSchedule(bool fQuickSched, int8_t iSched)
 // process scheduled events
 
 void runStateClass::ProcessScheduledEvents(void)
+{
+#ifdef HW_ENABLE_ETHERNET
+	int8_t	iSchedule = m_iSchedule;
+	int8_t	iZone = m_iZone;
+
+	ProcessScheduledEventsWorker();
+
+	if( (iSchedule != m_iSchedule) || (iZone != m_iZone) )	// schedule progressed, let live web clients know
+		WebNotify(WEB_EVT_STATE);
+#else
+	ProcessScheduledEventsWorker();
+#endif //HW_ENABLE_ETHERNET
+}
+
+void runStateClass::ProcessScheduledEventsWorker(void)
 {
 	if( !GetRunSchedules() )	// schedules are currently disabled
 	{
@@ -859,6 +911,10 @@ void mainLoop()
 			{
 				lBoardSerial.loop();			// refresh state of the serial (OS-style) outputs
 			}
+			else if( (tick_counter%10) == 8 )	// one-second block6
+			{
+				sdlog.loop();					// SD card re-init and spooled log records
+			}
 	   }
         
 #ifdef HW_ENABLE_ETHERNET
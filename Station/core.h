@@ -108,6 +108,7 @@ public:
 	int16_t	iLastReceivedRSSI[MAX_STATIONS];
 
 private:
+	void		ProcessScheduledEventsWorker();
 	void		LogSchedule();
 	void		LogEvent();
 	uint8_t		sAdj(uint8_t val);
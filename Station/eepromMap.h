@@ -58,6 +58,8 @@ Copyright 2014-2015 tony-osp (http://tony-osp.dreamwidth.org/)
 #define ADDR_NETWORK_MOTEINORF_PANID		141		// MoteinoRF PAN ID, 1 byte
 #define ADDR_NETWORK_MOTEINORF_NODEID		142		// MoteinoRF node logical address, one byte
 
+#define ADDR_SENSOR_REPORTCFG		160		// sensors push reporting config, 3 bytes per sensor (interval, deadband), interval 0xFF - not configured
+
 
 #define SCHEDULE_OFFSET 1536
 #define SCHEDULE_INDEX 128
@@ -90,6 +92,10 @@ Copyright 2014-2015 tony-osp (http://tony-osp.dreamwidth.org/)
 #error Number of Stations is too large
 #endif
 
+#if ADDR_SENSOR_REPORTCFG + (3 * MAX_SENSORS) > ADDR_NUM_SENSORS
+#error Sensors report config does not fit
+#endif
+
 #if SENSORS_OFFSET + (SENSORS_INDEX * MAX_SENSORS) > END_OF_SENSORS_BLOCK
 #error Number of Sensors is too large
 #endif
@@ -0,0 +1,191 @@
+/*
+
+Streaming JSON writer for SmartGarden web server.
+
+Creative Commons Attribution-ShareAlike 3.0 license
+Copyright 2026 SmartGarden contributors
+
+*/
+
+#include "jsonwriter.h"
+#include "port.h"
+
+JsonWriter::JsonWriter(JsonSink sink, void * ctx)
+	: m_sink(sink), m_ctx(ctx), m_len(0), m_depth(0), m_first(1), m_bAfterKey(false), m_bError(false)
+{
+}
+
+JsonWriter::~JsonWriter()
+{
+	Flush();
+}
+
+bool JsonWriter::Flush(void)
+{
+	if( m_len && !m_bError )
+	{
+		if( !m_sink(m_stage, m_len, m_ctx) )
+			m_bError = true;
+	}
+	m_len = 0;
+	return !m_bError;
+}
+
+inline void JsonWriter::Put(char c)
+{
+	if( m_len >= JSON_STAGE_SIZE )
+		Flush();
+	m_stage[m_len++] = c;
+}
+
+// Emit element separator if needed, and mark current container as non-empty
+void JsonWriter::Separator(void)
+{
+	if( m_bAfterKey )
+	{
+		m_bAfterKey = false;
+		return;
+	}
+	if( m_first & (1 << m_depth) )
+		m_first &= ~(1 << m_depth);
+	else
+		Put(',');
+}
+
+void JsonWriter::BeginObject(void)
+{
+	Separator();
+	Put('{');
+	if( m_depth < JSON_MAX_DEPTH-1 )
+		m_depth++;
+	m_first |= (1 << m_depth);
+}
+
+void JsonWriter::EndObject(void)
+{
+	if( m_depth > 0 )
+		m_depth--;
+	Put('}');
+}
+
+void JsonWriter::BeginArray(void)
+{
+	Separator();
+	Put('[');
+	if( m_depth < JSON_MAX_DEPTH-1 )
+		m_depth++;
+	m_first |= (1 << m_depth);
+}
+
+void JsonWriter::EndArray(void)
+{
+	if( m_depth > 0 )
+		m_depth--;
+	Put(']');
+}
+
+void JsonWriter::Key(const char * key_P)
+{
+	Separator();
+	Put('"');
+	char c;
+	while( (c = pgm_read_byte(key_P++)) != 0 )
+		PutEscaped(c);
+	Put('"');
+	Put(':');
+	m_bAfterKey = true;
+}
+
+void JsonWriter::PutEscaped(char c)
+{
+	if( (c == '"') || (c == '\\') )
+	{
+		Put('\\');
+		Put(c);
+	}
+	else if( (uint8_t)c < 0x20 )
+	{
+		Put('\\');
+		if( c == '\n' )			Put('n');
+		else if( c == '\r' )	Put('r');
+		else if( c == '\t' )	Put('t');
+		else
+		{
+			Put('u');	Put('0');	Put('0');
+			Put('0' + (c >> 4));
+			Put((c & 0x0F) < 10 ? '0' + (c & 0x0F) : 'a' - 10 + (c & 0x0F));
+		}
+	}
+	else
+		Put(c);
+}
+
+void JsonWriter::String(const char * str)
+{
+	Separator();
+	Put('"');
+	while( *str )
+		PutEscaped(*str++);
+	Put('"');
+}
+
+void JsonWriter::StringP(const char * str_P)
+{
+	Separator();
+	Put('"');
+	char c;
+	while( (c = pgm_read_byte(str_P++)) != 0 )
+		PutEscaped(c);
+	Put('"');
+}
+
+void JsonWriter::PutNumber(unsigned long val, bool bNegative)
+{
+	char buf[11];
+	uint8_t	i = sizeof(buf);
+
+	do
+	{
+		buf[--i] = '0' + (val % 10);
+		val /= 10;
+	} while( val );
+
+	if( bNegative )
+		Put('-');
+	while( i < sizeof(buf) )
+		Put(buf[i++]);
+}
+
+void JsonWriter::Number(long val)
+{
+	Separator();
+	if( val < 0 )	PutNumber(0ul - (unsigned long)val, true);
+	else			PutNumber(val, false);
+}
+
+void JsonWriter::NumberU(unsigned long val)
+{
+	Separator();
+	PutNumber(val, false);
+}
+
+void JsonWriter::QuotedNumber(long val)
+{
+	Separator();
+	Put('"');
+	if( val < 0 )	PutNumber(0ul - (unsigned long)val, true);
+	else			PutNumber(val, false);
+	Put('"');
+}
+
+void JsonWriter::OnOff(bool val)
+{
+	StringP(val ? PSTR("on") : PSTR("off"));
+}
+
+void JsonWriter::RawP(const char * str_P)
+{
+	char c;
+	while( (c = pgm_read_byte(str_P++)) != 0 )
+		Put(c);
+}
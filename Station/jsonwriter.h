@@ -0,0 +1,71 @@
+/*
+
+Streaming JSON writer for SmartGarden web server.
+
+Writer produces compact JSON directly into the output sink, taking care of separators, string escaping and number
+formatting (without printf). Output is staged in a small buffer and handed over to the sink in blocks, the sink
+(web server send buffer) then sends it out in full-packet chunks.
+
+Keys and constant strings are expected to be in PROGMEM.
+
+Creative Commons Attribution-ShareAlike 3.0 license
+Copyright 2026 SmartGarden contributors
+
+*/
+
+#ifndef _JSONWRITER_H
+#define _JSONWRITER_H
+
+#include <stdint.h>
+
+#define JSON_STAGE_SIZE			32		// staging buffer size
+#define JSON_MAX_DEPTH			16		// max nesting of objects and arrays
+
+// Output sink. Returns false if the data could not be sent (client disconnected).
+typedef bool (*JsonSink)(const char * p, uint16_t len, void * ctx);
+
+class JsonWriter
+{
+public:
+	JsonWriter(JsonSink sink, void * ctx);
+	~JsonWriter();
+
+	void BeginObject(void);
+	void EndObject(void);
+	void BeginArray(void);
+	void EndArray(void);
+
+	// Object member key, PROGMEM string. Must be followed by a value, object or array.
+	void Key(const char * key_P);
+
+	// Values
+	void String(const char * str);					// RAM string, escaped
+	void StringP(const char * str_P);				// PROGMEM string, escaped
+	void Number(long val);
+	void NumberU(unsigned long val);
+	void QuotedNumber(long val);					// number as a string, e.g. "12"
+	void OnOff(bool val);							// "on" or "off"
+	void RawP(const char * str_P);					// PROGMEM string, written as is
+
+	// Send out staged output. Must be called before anything else is written to the same output.
+	bool Flush(void);
+
+	bool IsOK(void)	{ return !m_bError; }
+
+private:
+	void Separator(void);
+	void Put(char c);
+	void PutNumber(unsigned long val, bool bNegative);
+	void PutEscaped(char c);
+
+	JsonSink	m_sink;
+	void		*m_ctx;
+	char		m_stage[JSON_STAGE_SIZE];
+	uint8_t		m_len;
+	uint8_t		m_depth;
+	uint16_t	m_first;		// bit per nesting level - next element is the first one in the container
+	bool		m_bAfterKey;	// key was written, value follows
+	bool		m_bError;
+};
+
+#endif //_JSONWRITER_H
@@ -0,0 +1,70 @@
+#!/bin/sh
+#
+# Produce gzip-compressed copies of the WEB UI files.
+#
+# Compressed files are placed into web.gz directory, which should be copied to the SD card root
+# next to /web. When the browser accepts gzip encoding, the web server sends the file from /web.gz
+# instead of the uncompressed one from /web.
+#
+# Only text files are compressed - images (jpg, gif, png) are already compressed, and gzip does not help there.
+# File is skipped if compression does not make it smaller.
+#
+# PNG images are recompressed in place instead (lossless), when optipng is installed. Large PNG images should be
+# stored as 256-color palette images - e.g. weather.png is a palette image with alpha, a third of its RGBA size.
+#
+# Usage: mkwebgz.sh [web_dir [output_dir]]
+#
+# Creative Commons Attribution-ShareAlike 3.0 license
+# Copyright 2026 SmartGarden contributors
+#
+
+SRC_DIR=${1:-$(dirname "$0")/web}
+DST_DIR=${2:-$(dirname "$0")/web.gz}
+
+if [ ! -d "$SRC_DIR" ]; then
+	echo "Directory $SRC_DIR not found" >&2
+	exit 1
+fi
+
+mkdir -p "$DST_DIR" || exit 1
+
+total_src=0
+total_dst=0
+
+for f in "$SRC_DIR"/*; do
+	[ -f "$f" ] || continue
+	name=$(basename "$f")
+
+	case "$name" in
+		*.htm|*.HTM|*.js|*.JS|*.css|*.CSS|*.ico|*.ICO)
+			;;
+		*.png|*.PNG)
+			if command -v optipng > /dev/null; then
+				src_size=$(wc -c < "$f")
+				optipng -quiet -o5 -strip all "$f" || exit 1
+				printf "%-16s %7d -> %7d (optipng)\n" "$name" "$src_size" "$(wc -c < "$f")"
+			fi
+			continue
+			;;
+		*)
+			continue
+			;;
+	esac
+
+	# -n: do not store name and timestamp, so that output is reproducible
+	gzip -9 -n -c "$f" > "$DST_DIR/$name" || exit 1
+
+	src_size=$(wc -c < "$f")
+	dst_size=$(wc -c < "$DST_DIR/$name")
+
+	if [ "$dst_size" -ge "$src_size" ]; then
+		rm -f "$DST_DIR/$name"
+		continue
+	fi
+
+	total_src=$((total_src + src_size))
+	total_dst=$((total_dst + dst_size))
+	printf "%-16s %7d -> %7d\n" "$name" "$src_size" "$dst_size"
+done
+
+echo "Total: $total_src -> $total_dst bytes"
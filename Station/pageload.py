@@ -0,0 +1,107 @@
+#!/usr/bin/env python3
+#
+# Page load bench for the Station web server.
+#
+# Loads a WEB UI page the way the browser does - the page itself, the local scripts, style sheets and images it
+# references, and the json/* calls found in the page - and reports the load time, with persistent (keep-alive)
+# connections and with a new connection per request ("Connection: close", the behavior before persistent connections).
+#
+# Resources are fetched one after another, over one connection in keep-alive mode. External resources (CDN scripts)
+# are not loaded.
+#
+# Usage: pageload.py [options] station_host
+#
+# Creative Commons Attribution-ShareAlike 3.0 license
+# Copyright 2026 SmartGarden contributors
+#
+
+import argparse
+import http.client
+import re
+import sys
+import time
+
+failed = set()		# resources that failed, reported once
+
+
+def resources(page, html):
+	"""Local resources referenced by the page, in document order, the page itself first."""
+	urls = ['/' + page]
+	for m in re.finditer(r'<(?:script|img)[^>]*\ssrc="([^"]+)"|<link[^>]*\shref="([^"]+\.css)"', html):
+		url = m.group(1) or m.group(2)
+		if '://' not in url and not url.startswith('#'):
+			urls.append('/' + url.lstrip('/'))
+	for url in re.findall(r'json/\w+', html):
+		if '/' + url not in urls:
+			urls.append('/' + url)
+	return urls
+
+
+def fetch(conn, url, keep_alive, gzip):
+	headers = {'Connection': 'keep-alive' if keep_alive else 'close'}
+	if gzip:
+		headers['Accept-Encoding'] = 'gzip'
+	conn.request('GET', url, headers=headers)
+	resp = conn.getresponse()
+	body = resp.read()
+	return resp.status, len(body)
+
+
+def load(args, urls, keep_alive):
+	"""Load all resources, returns (total time in ms, bytes, number of connections)."""
+	t = time.monotonic()
+	total = 0
+	conns = 0
+	conn = None
+	for url in urls:
+		if conn is None:
+			conn = http.client.HTTPConnection(args.host, args.port, timeout=args.timeout)
+			conns += 1
+		status, size = fetch(conn, url, keep_alive, args.gzip)
+		if (status != 200) and (url not in failed):
+			failed.add(url)
+			print('%s: HTTP %d' % (url, status))
+		total += size
+		if not keep_alive or conn.sock is None:		# closed by us, or by the server (request limit, error)
+			conn.close()
+			conn = None
+	if conn is not None:
+		conn.close()
+	return (time.monotonic() - t) * 1000, total, conns
+
+
+def main():
+	ap = argparse.ArgumentParser(description='Page load bench for the Station web server.')
+	ap.add_argument('host', help='Station address')
+	ap.add_argument('--port', type=int, default=80)
+	ap.add_argument('--page', default='Home.htm', help='page to load (default Home.htm)')
+	ap.add_argument('--runs', type=int, default=10, help='number of loads in each mode (default 10)')
+	ap.add_argument('--gzip', action='store_true', help='accept gzip encoding')
+	ap.add_argument('--timeout', type=float, default=30, help='socket timeout, seconds (default 30)')
+	args = ap.parse_args()
+
+	conn = http.client.HTTPConnection(args.host, args.port, timeout=args.timeout)
+	conn.request('GET', '/' + args.page, headers={'Connection': 'close'})
+	resp = conn.getresponse()
+	html = resp.read().decode('latin-1')
+	conn.close()
+	if resp.status != 200:
+		print('%s: HTTP %d' % (args.page, resp.status))
+		return 1
+
+	urls = resources(args.page, html)
+	print('%d requests: %s' % (len(urls), ' '.join(urls)))
+
+	for keep_alive in (False, True):
+		times = []
+		for _ in range(args.runs):
+			ms, size, conns = load(args, urls, keep_alive)
+			times.append(ms)
+		times.sort()
+		print('%-10s  %d bytes, %d connections  min=%.0f ms  median=%.0f ms  max=%.0f ms' % (
+			'keep-alive' if keep_alive else 'close', size, conns, times[0], times[len(times) // 2], times[-1]))
+	return 0
+
+
+if __name__ == '__main__':
+	sys.exit(main())
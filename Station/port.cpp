@@ -68,6 +68,68 @@ int GetFreeMemory(void)
 	return free_memory;
 }
 
+// Stack high water mark. Free RAM between the heap and the stack is filled with the pattern at startup, the lowest
+// free RAM seen since then is the number of pattern bytes the stack did not overwrite.
+#define STACK_PAINT_PATTERN		0xC5
+#define STACK_PAINT_MARGIN		32			// bytes below the current stack pointer that are left alone
+
+static uint8_t *HeapEnd(void)
+{
+	return (__brkval == 0) ? (uint8_t *)&__bss_end : (uint8_t *)__brkval;
+}
+
+void PaintStack(void)
+{
+	uint8_t	*p = HeapEnd();
+	uint8_t	*sp = (uint8_t *)&p - STACK_PAINT_MARGIN;
+
+	while( p < sp )
+		*p++ = STACK_PAINT_PATTERN;
+}
+
+int GetMinFreeMemory(void)
+{
+	uint8_t	*p = HeapEnd();
+	uint8_t	*sp = (uint8_t *)&p;
+	int		free_memory = 0;
+
+	while( (p < sp) && (*p++ == STACK_PAINT_PATTERN) )
+		free_memory++;
+
+	return free_memory;
+}
+
+// Main loop pass time (scheduling jitter). The longest pass is kept for the current and the previous LOOP_STATS_WINDOW,
+// so GetMaxLoopTime() covers the last one to two windows.
+#define LOOP_STATS_WINDOW		10000		// ms
+
+static unsigned long	loopPassStart = 0;
+static unsigned long	loopWindowStart = 0;
+static uint16_t			loopMaxCur = 0;
+static uint16_t			loopMaxPrev = 0;
+
+void LoopTick(void)
+{
+	unsigned long	t = millis();
+	unsigned long	pass = t - loopPassStart;
+
+	if( (loopPassStart != 0) && (pass > loopMaxCur) )
+		loopMaxCur = (pass > 0xFFFF) ? 0xFFFF : pass;
+
+	if( t - loopWindowStart >= LOOP_STATS_WINDOW )
+	{
+		loopMaxPrev = loopMaxCur;
+		loopMaxCur = 0;
+		loopWindowStart = t;
+	}
+	loopPassStart = t;
+}
+
+uint16_t GetMaxLoopTime(void)
+{
+	return (loopMaxCur > loopMaxPrev) ? loopMaxCur : loopMaxPrev;
+}
+
 void freeMemory()
 {
 	int freeMem = GetFreeMemory();
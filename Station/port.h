@@ -87,6 +87,10 @@ void trace_char(...)			{ ; }
 
 void freeMemory();
 int GetFreeMemory(void);
+void PaintStack(void);
+int GetMinFreeMemory(void);			// lowest free RAM since PaintStack() (stack high water mark)
+void LoopTick(void);				// called at the start of each main loop pass
+uint16_t GetMaxLoopTime(void);		// longest main loop pass in the last 10-20 seconds, ms
 void sysreset();
 
 #define EXIT_FAILURE 1
@@ -26,23 +26,168 @@ extern SdFat sd;
 
 #define CL_TMPB_SIZE  256    // size of the local temporary buffer
 
+// Pre-allocated log files are padded past the end of data with zeros (or 0xFF if the card erases to ones)
+#define LOG_IS_PADDING(s)	(((s)[0] == 0) || (uint8_t((s)[0]) == 0xFF))
+
 static FILE _syslog_file;
 
 #ifndef SG_STATION_MASTER
-static uint8_t  _syslog_EvtBuffer[SYSEVENT_MAX_STRING_LENGTH];
+static uint8_t  _syslog_EvtBuffer[SYSEVENT_MAX_EVENT_LENGTH];		// event longer than one frame is sent to the Master in fragments
 static uint8_t  _syslog_EvtType;
 static uint32_t  _syslog_EvtTimeStamp;
 static uint8_t  _syslog_EvtByteCounter;
 static uint8_t  _syslog_EvtContFlag;
 #endif
 
+#ifdef HW_ENABLE_SD
+
+// RAM spool for log records.
+//
+// When SD card is not available (card init failed, card removed, file open or write error) log records are stored in the RAM spool
+// instead of being dropped. Logging::loop() periodically re-initializes the card, and once the card is back spooled records are written
+// to the card in the original order. While the spool is not empty new records are also spooled, to preserve the order.
+// If the spool is full the oldest records are dropped.
+//
+// Spool is a ring buffer of variable size records, each record is LogSpoolHdr followed by the record-specific payload.
+
+#define LOG_SPOOL_SYSEVT		1		// system log event, payload is the formatted log string
+#define LOG_SPOOL_SCHED			2		// schedule run event, payload is LogSpoolSched
+#define LOG_SPOOL_ZONE			3		// zone watering event, payload is LogSpoolZone
+#define LOG_SPOOL_SENSOR		4		// sensor reading, payload is LogSpoolSensor
+
+struct LogSpoolHdr
+{
+	uint8_t		kind;			// LOG_SPOOL_xxx
+	uint8_t		len;			// payload length
+	uint32_t	t;				// record time stamp
+};
+
+struct LogSpoolSched
+{
+	uint32_t	start;
+	int16_t		duration;
+	uint16_t	water_used;
+	int16_t		schedule;
+	int16_t		sadj;
+	int16_t		wunderground;
+};
+
+struct LogSpoolZone
+{
+	uint32_t	start;
+	int16_t		zone;
+	int16_t		duration;
+	uint16_t	water_used;
+	int16_t		schedule;
+	int16_t		sadj;
+	int16_t		wunderground;
+};
+
+struct LogSpoolSensor
+{
+	int32_t		sensor_reading;
+	int16_t		sensor_id;
+	uint8_t		sensor_type;
+};
+
+static uint8_t		_spoolBuf[LOG_SPOOL_SIZE];
+static uint16_t		_spoolHead = 0;			// write position
+static uint16_t		_spoolTail = 0;			// read position (oldest record)
+static uint8_t		_spoolFailCount = 0;	// number of failed attempts to write the oldest record
+static bool			_logIOError = false;	// the last failed record write was a card I/O error (and not a problem with the record)
+
+static void spoolCopyIn(const void *src, uint8_t len)
+{
+	const uint8_t *p = (const uint8_t *)src;
+
+	while( len-- )
+	{
+		_spoolBuf[_spoolHead++] = *p++;
+		if( _spoolHead >= LOG_SPOOL_SIZE )
+			_spoolHead = 0;
+	}
+}
+
+static void spoolCopyOut(void *dst, uint16_t pos, uint8_t len)
+{
+	uint8_t *p = (uint8_t *)dst;
+
+	while( len-- )
+	{
+		*p++ = _spoolBuf[pos++];
+		if( pos >= LOG_SPOOL_SIZE )
+			pos = 0;
+	}
+}
+
+// Remove oldest record from the spool
+static void spoolPop(void)
+{
+	LogSpoolHdr	hdr;
+
+	if( sdlog.spool_records == 0 )
+		return;
+
+	spoolCopyOut(&hdr, _spoolTail, sizeof(hdr));
+	_spoolTail = (_spoolTail + sizeof(hdr) + hdr.len) % LOG_SPOOL_SIZE;
+	sdlog.spool_bytes -= sizeof(hdr) + hdr.len;
+	sdlog.spool_records--;
+	_spoolFailCount = 0;
+}
+
+// Add record to the spool, dropping the oldest records if necessary
+static void spoolPut(uint8_t kind, time_t t, const void *payload, uint8_t len)
+{
+	LogSpoolHdr	hdr;
+
+	if( sizeof(hdr) + len > LOG_SPOOL_SIZE )
+	{
+		sdlog.spool_dropped++;
+		return;
+	}
+	while( (LOG_SPOOL_SIZE - sdlog.spool_bytes) < (sizeof(hdr) + len) )
+	{
+		spoolPop();
+		sdlog.spool_dropped++;
+	}
+
+	hdr.kind = kind;  hdr.len = len;  hdr.t = t;
+	spoolCopyIn(&hdr, sizeof(hdr));
+	spoolCopyIn(payload, len);
+	sdlog.spool_bytes += sizeof(hdr) + len;
+	sdlog.spool_records++;
+}
+
+// Get oldest record from the spool. Payload buffer should be at least MAX_LOG_RECORD_SIZE bytes.
+static bool spoolPeek(LogSpoolHdr *hdr, void *payload)
+{
+	if( sdlog.spool_records == 0 )
+		return false;
+
+	spoolCopyOut(hdr, _spoolTail, sizeof(LogSpoolHdr));
+	spoolCopyOut(payload, (_spoolTail + sizeof(LogSpoolHdr)) % LOG_SPOOL_SIZE, min(hdr->len, MAX_LOG_RECORD_SIZE));
+	return true;
+}
+
+// Records are written to the card directly only if the card is available and there is nothing in the spool.
+static inline bool spoolActive(void)
+{
+	return !sdlog.logger_ready || (sdlog.spool_records != 0);
+}
+
+// Spooled system log event is collected in this buffer (allocated on syslog_evt() stack)
+static char		*_syslog_SpoolBuf = NULL;
+static uint8_t	_syslog_SpoolLen;
+
+#endif //HW_ENABLE_SD
+
 // local logger helper
 static int syslog_putchar(char c, FILE *stream)
 {
 	trace_char(c);				// directly output character into the trace channel
 
 #ifndef SG_STATION_MASTER
-	if( _syslog_EvtByteCounter < (SYSEVENT_MAX_STRING_LENGTH-1) )
+	if( _syslog_EvtByteCounter < (SYSEVENT_MAX_EVENT_LENGTH-1) )
 	{
 		_syslog_EvtBuffer[_syslog_EvtByteCounter] = c;
 		_syslog_EvtByteCounter++;
@@ -58,6 +203,12 @@ static int syslog_putchar(char c, FILE *stream)
 #endif
 
 #ifdef HW_ENABLE_SD	// local log on SD card
+	if( _syslog_SpoolBuf != NULL )
+	{
+		if( _syslog_SpoolLen < (MAX_LOG_RECORD_SIZE-1) )
+			_syslog_SpoolBuf[_syslog_SpoolLen++] = c;
+		return 1;
+	}
 	return sdlog.lfile.write(c);
 #endif //HW_ENABLE_SD
 
@@ -72,12 +223,10 @@ void syslog_evt(uint8_t event_type, const __FlashStringHelper * fmt, ...)
 
 #ifdef HW_ENABLE_SD	// local log on SD card
 
-	if( !sdlog.logger_ready )
-		return;
+	char spool_buf[MAX_LOG_RECORD_SIZE];		// used only if the event goes to the spool
 
-	// limit the scope of local variables to conserve stack space
+	if( !spoolActive() )
 	{
-   // temp buffer for log strings processing
 		char tmp_buf[20];
 
 		sprintf_P(tmp_buf, PSTR(SYSTEM_LOG_FNAME_FORMAT), month(t), year(t) );
@@ -87,8 +236,18 @@ void syslog_evt(uint8_t event_type, const __FlashStringHelper * fmt, ...)
             TRACE_ERROR(F("Cannot open system log file (%s)\n"), tmp_buf);
 
             sdlog.logger_ready = false;      // something is wrong with the log file, mark logger as "not ready"
-            return;    // failed to open/create log file
 		}
+	}
+
+	if( spoolActive() )
+	{
+		_syslog_SpoolBuf = spool_buf;
+		_syslog_SpoolLen = sprintf_P(spool_buf, PSTR("%u,%u:%u:%u,%d,"), day(t), hour(t), minute(t), second(t),int(event_type));
+	}
+	else
+	{
+		// limit the scope of local variables to conserve stack space
+		char tmp_buf[20];
 
 		sprintf_P(tmp_buf, PSTR("%u,%u:%u:%u,%d,"), day(t), hour(t), minute(t), second(t),int(event_type));
 		sdlog.lfile.print(tmp_buf);
@@ -130,8 +289,16 @@ void syslog_evt(uint8_t event_type, const __FlashStringHelper * fmt, ...)
 	va_end(parms);
 
 #ifdef HW_ENABLE_SD	// local log on SD card
-	sdlog.lfile.write('\n');	
-	sdlog.lfile.close();
+	if( _syslog_SpoolBuf != NULL )
+	{
+		_syslog_SpoolBuf = NULL;
+		spoolPut(LOG_SPOOL_SYSEVT, t, spool_buf, _syslog_SpoolLen);
+	}
+	else
+	{
+		sdlog.lfile.write('\n');	
+		sdlog.lfile.close();
+	}
 #endif //HW_ENABLE_SD
 
 	trace_char('\n');	
@@ -145,13 +312,17 @@ void syslog_evt(uint8_t event_type, const __FlashStringHelper * fmt, ...)
 #endif
 }
 
-
-
 Logging::Logging()
 {
 // initialize internal state
 
   logger_ready = false;
+  spool_records = spool_bytes = 0;
+  spool_dropped = 0;
+  sd_reinit_count = 0;
+  fat_read = true;
+  sd_retry_timer = 0;
+  memset(log_gen, 0, sizeof(log_gen));
 
 // prepare common Syslog event routine
   fdev_setup_stream(&_syslog_file, syslog_putchar, NULL, _FDEV_SETUP_WRITE);
@@ -163,6 +334,137 @@ Logging::~Logging()
 }
 
 
+// JSON response cache entries
+
+#ifdef HW_ENABLE_SD
+struct JCacheEntry
+{
+	uint32_t	key;		// query key
+	uint16_t	gen;		// log generation the response was built for
+	uint8_t		log_type;	// log type, 0 - free entry (or dropped entry that is still being read)
+	uint8_t		readers;	// number of connections sending the file
+};
+
+static JCacheEntry	_jcache[LOG_JCACHE_ENTRIES];
+static uint8_t		_jcacheNext = 0;		// next entry to replace when the cache is full
+
+static void jcacheReset(void)
+{
+	memset(_jcache, 0, sizeof(_jcache));
+	_jcacheNext = 0;
+}
+
+static int8_t jcacheFind(uint32_t key, uint8_t log_type)
+{
+	for( uint8_t i=0; i<LOG_JCACHE_ENTRIES; i++ )
+		if( (_jcache[i].log_type == log_type) && (_jcache[i].key == key) )
+			return i;
+	return -1;
+}
+
+static void jcacheRemove(uint32_t key)
+{
+	char fname[JCACHE_FNAME_SIZE];
+
+	sprintf_P(fname, PSTR(JCACHE_FNAME_FORMAT), key);
+	sd.remove(fname);
+}
+
+// Drop the entry. If the file is being sent, it is removed when the last reader is done (see cacheRelease()).
+static void jcacheDrop(uint8_t i)
+{
+	if( _jcache[i].readers == 0 )
+		jcacheRemove(_jcache[i].key);
+	_jcache[i].log_type = 0;
+}
+
+// true if the cache file with this key is being sent (by a valid or dropped entry)
+static bool jcacheBusy(uint32_t key)
+{
+	for( uint8_t i=0; i<LOG_JCACHE_ENTRIES; i++ )
+		if( (_jcache[i].readers != 0) && (_jcache[i].key == key) )
+			return true;
+	return false;
+}
+
+
+// Seek hints for incremental ("since") log queries.
+//
+// Log records are appended in time order, so if none of the records before some file position is newer than time t,
+// a query for records newer than since >= t can start reading the file at that position.
+// Each log scan remembers the position it reached, so the steady-state refresh only reads records added since the previous one.
+#define LOG_FILE_SCHED		0		// schedule log. Other log files are identified by LOG_TYPE_xxx
+#define LOG_FILE_NONE		0xFF
+
+struct LogSeekHint
+{
+	uint8_t		file_type;		// LOG_TYPE_xxx, LOG_FILE_SCHED or LOG_FILE_NONE
+	uint8_t		nmonth;
+	uint16_t	nyear;
+	int			log_id;
+	time_t		t;				// records before pos are not newer than t
+	uint32_t	pos;
+};
+
+static LogSeekHint	_seekHints[LOG_SEEK_HINTS];
+static uint8_t		_seekHintNext = 0;
+
+static void seekHintReset(void)
+{
+	for( uint8_t i=0; i<LOG_SEEK_HINTS; i++ )
+		_seekHints[i].file_type = LOG_FILE_NONE;
+	_seekHintNext = 0;
+}
+
+static int8_t seekHintFind(uint8_t file_type, int log_id, uint8_t nmonth, uint16_t nyear)
+{
+	for( uint8_t i=0; i<LOG_SEEK_HINTS; i++ )
+		if( (_seekHints[i].file_type == file_type) && (_seekHints[i].log_id == log_id) &&
+			(_seekHints[i].nmonth == nmonth) && (_seekHints[i].nyear == nyear) )
+			return i;
+	return -1;
+}
+
+// Position log file for reading records newer than since.
+// Returns true if the file was positioned using the hint, otherwise the file stays at the beginning (column headers line).
+static bool seekHintApply(SdFile & f, uint8_t file_type, int log_id, uint8_t nmonth, uint16_t nyear, time_t since)
+{
+	int8_t	i = seekHintFind(file_type, log_id, nmonth, nyear);
+	char	c = 0;
+
+	if( (since == 0) || (i < 0) || (_seekHints[i].t > since) )
+		return false;
+
+	// the hint must point to the beginning of a record, otherwise the file was replaced
+	if( f.seekSet(_seekHints[i].pos - 1) && (f.read(&c, 1) == 1) && (c == '\n') )
+		return true;
+
+	_seekHints[i].file_type = LOG_FILE_NONE;
+	f.seekSet(0);
+	return false;
+}
+
+static void seekHintSave(uint8_t file_type, int log_id, uint8_t nmonth, uint16_t nyear, time_t t, uint32_t pos)
+{
+	if( pos == 0 )
+		return;
+
+	int8_t i = seekHintFind(file_type, log_id, nmonth, nyear);
+	if( i < 0 )
+	{
+		i = _seekHintNext;
+		_seekHintNext = (_seekHintNext + 1) % LOG_SEEK_HINTS;
+	}
+	_seekHints[i].file_type = file_type;
+	_seekHints[i].log_id = log_id;
+	_seekHints[i].nmonth = nmonth;
+	_seekHints[i].nyear = nyear;
+	_seekHints[i].t = t;
+	_seekHints[i].pos = pos;
+}
+#endif //HW_ENABLE_SD
+
+
 // Start logging - open/create system log file, create initial "start" record. Note: uses time/date data, time/date should be available by now
 // Takes input string that will be used in the first log record
 // Returns true on success and false on failure
@@ -245,54 +547,738 @@ bool Logging::begin(void)
 
         TRACE_INFO(F("Pressure log directory not found, creating it.\n"));
 
-        if( !sd.mkdir(log_fname) ){
+        if( !sd.mkdir(log_fname) ){
+
+           TRACE_ERROR(F("Error creating Pressure log directory.\n"));
+        }
+  }
+  lfile.close();      // close the directory
+
+  // JSON response cache. Cached responses are not valid across restarts (or card replacement) - start with empty cache directory.
+  jcacheReset();
+  seekHintReset();
+  sprintf_P(log_fname, PSTR(JCACHE_DIR));
+  if( lfile.open(log_fname, O_READ) && !lfile.rmRfStar() ){
+
+        TRACE_ERROR(F("Error clearing JSON cache directory.\n"));
+  }
+  lfile.close();
+  if( !sd.mkdir(log_fname) ){
+
+        TRACE_ERROR(F("Error creating JSON cache directory.\n"));
+  }
+
+
+//  generate system log file name
+  sprintf_P(log_fname, PSTR(SYSTEM_LOG_FNAME_FORMAT), month(curr_time), year(curr_time) );
+  if( !lfile.open(log_fname, O_WRITE | O_APPEND | O_CREAT) ){
+
+        SYSEVT_ERROR(F("Cannot open system log file (%s)\n"), log_fname);
+        logger_ready = false;
+
+        return false;    // failed to open/create log file
+  }
+
+  lfile.close();
+  logger_ready = true;      // we are good to go
+
+  return true;
+#endif //!HW_ENABLE_SD
+}
+
+void Logging::Close()
+{
+   logger_ready = false;
+}
+
+
+#if defined(HW_ENABLE_SD) && defined(SG_LOG_CONTIGUOUS)
+
+// Pre-allocated contiguous log files.
+//
+// Monthly sensor and watering log files are created as contiguous files of fixed size on first use, and records are appended
+// using raw block writes from RAM block buffer. There are no FAT lookups or cluster allocations on the write path, so write latency
+// does not depend on file size. The unused part of the file is zero-filled (or erased to 0xFF), and log readers stop at the first
+// padding byte. Once the month is over the file is truncated to the actual data size.
+//
+// Tail position is not stored anywhere - first time the file is used after boot, its last used block is located
+// using binary search, and then the tail block is scanned for the end of data.
+//
+// The tail block stays in the RAM block buffer between appends, so appending to the same file is a single block write.
+// The block is read again only when appends to several files are interleaved.
+
+#define CLOG_OK				0
+#define CLOG_ERROR			1
+#define CLOG_FALLBACK		2		// contiguous logging is not possible for this file, use regular append
+#define CLOG_DROP			3		// the record can't be logged, the card is fine
+
+#define CLOG_BLOCK_SIZE		512
+
+struct ContigLogSlot
+{
+	uint32_t	bgnBlock;		// first block of the file
+	uint32_t	endBlock;		// last block of the file
+	uint32_t	wrPos;			// current end of data, bytes from the file start
+	int16_t		log_id;			// sensor ID, 0 for watering log
+	uint8_t		log_type;		// LOG_TYPE_xxx, 0 if the slot is free
+	uint8_t		month;
+	uint8_t		year;			// last two digits of the year
+	uint8_t		lru;
+};
+
+// Tail position of the file evicted from the slots
+struct ContigLogHint
+{
+	uint32_t	wrPos;
+	int16_t		log_id;
+	uint8_t		log_type;		// 0 if the entry is free
+	uint8_t		month;
+	uint8_t		year;
+};
+
+static ContigLogSlot	_clogSlots[LOG_CONTIG_MAX_FILES];
+static ContigLogHint	_clogHints[LOG_CONTIG_MAX_HINTS];
+static uint8_t			_clogHintNext = 0;
+static uint8_t			_clogBuf[CLOG_BLOCK_SIZE];			// RAM block buffer
+static uint32_t			_clogBufBlock = 0xFFFFFFFF;			// block currently loaded into _clogBuf
+static uint8_t			_clogLru = 0;
+
+// generate file name for the contiguous log file
+static bool clogFname(char *fname, uint8_t log_type, int log_id, uint8_t nmonth, uint8_t nyear)
+{
+	switch( log_type )
+	{
+	case LOG_TYPE_WATERING:		sprintf_P(fname, PSTR(WATERING_LOG_FNAME_FORMAT), nmonth, nyear);			 break;
+	case LOG_TYPE_TEMPERATURE:	sprintf_P(fname, PSTR(TEMPERATURE_LOG_FNAME_FORMAT), nmonth, nyear, log_id); break;
+	case LOG_TYPE_HUMIDITY:		sprintf_P(fname, PSTR(HUMIDITY_LOG_FNAME_FORMAT), nmonth, nyear, log_id);	 break;
+	case LOG_TYPE_PRESSURE:		sprintf_P(fname, PSTR(PRESSURE_LOG_FNAME_FORMAT), nmonth, nyear, log_id);	 break;
+	case LOG_TYPE_WATERFLOW:	sprintf_P(fname, PSTR(WFLOW_LOG_FNAME_FORMAT), nmonth, nyear, log_id);		 break;
+	default:
+		return false;
+	}
+	return true;
+}
+
+// Forget cached file locations, e.g. after SD card re-initialization
+static void clogReset(void)
+{
+	for( uint8_t i = 0; i < LOG_CONTIG_MAX_FILES; i++ )
+		_clogSlots[i].log_type = 0;
+	for( uint8_t i = 0; i < LOG_CONTIG_MAX_HINTS; i++ )
+		_clogHints[i].log_type = 0;
+
+	_clogBufBlock = 0xFFFFFFFF;
+}
+
+// Load block into the RAM block buffer
+static bool clogLoadBlock(uint32_t block)
+{
+	if( _clogBufBlock == block )
+		return true;
+
+	if( !sd.card()->readBlock(block, _clogBuf) )
+	{
+		_clogBufBlock = 0xFFFFFFFF;
+		return false;
+	}
+	_clogBufBlock = block;
+	return true;
+}
+
+// Locate end of data in the contiguous file - binary search for the last used block, then scan the tail block
+static bool clogRecover(ContigLogSlot *slot)
+{
+	uint32_t	lo = slot->bgnBlock, hi = slot->endBlock;
+
+	if( !clogLoadBlock(lo) )
+		return false;
+	if( LOG_IS_PADDING(_clogBuf) )
+	{
+		slot->wrPos = 0;		// empty file
+		return true;
+	}
+	while( lo < hi )			// invariant: block lo is used
+	{
+		uint32_t mid = lo + (hi - lo + 1)/2;
+
+		if( !clogLoadBlock(mid) )
+			return false;
+		if( LOG_IS_PADDING(_clogBuf) )
+			hi = mid - 1;
+		else
+			lo = mid;
+	}
+	if( !clogLoadBlock(lo) )
+		return false;
+
+	uint16_t	i;
+	for( i = 0; i < CLOG_BLOCK_SIZE; i++ )
+	{
+		if( LOG_IS_PADDING(_clogBuf+i) )
+			break;
+	}
+	slot->wrPos = (lo - slot->bgnBlock)*CLOG_BLOCK_SIZE + i;
+
+	TRACE_INFO(F("Contiguous log recovered, tail at %lu\n"), slot->wrPos);
+	return true;
+}
+
+// Fill contiguous file with zeros if the card cannot erase it
+static bool clogZeroFill(uint32_t bgnBlock, uint32_t endBlock)
+{
+	memset(_clogBuf, 0, CLOG_BLOCK_SIZE);
+	_clogBufBlock = 0xFFFFFFFF;
+
+	if( !sd.card()->writeStart(bgnBlock, endBlock - bgnBlock + 1) )
+		return false;
+	for( uint32_t b = bgnBlock; b <= endBlock; b++ )
+	{
+		if( !sd.card()->writeData(_clogBuf) )
+			return false;
+	}
+	return sd.card()->writeStop();
+}
+
+// Pre-allocated size of the contiguous file, in blocks
+static uint32_t clogBlocks(uint8_t log_type)
+{
+	return (log_type == LOG_TYPE_WATERING) ? LOG_CONTIG_WATERING_BLOCKS:LOG_CONTIG_SENSOR_BLOCKS;
+}
+
+// Check that the open file is the pre-allocated contiguous log file, and get its blocks range.
+// Regular log files (older firmware, or the fallback when the card was too fragmented) and contiguous files that were already
+// truncated to the data size are not written using raw block I/O, even if their clusters happen to be contiguous.
+static bool clogOpenedRange(SdFile & f, uint8_t log_type, ContigLogSlot *slot)
+{
+	uint32_t	nblocks = clogBlocks(log_type);
+
+	if( (f.fileSize() != nblocks*CLOG_BLOCK_SIZE) || !f.contiguousRange(&slot->bgnBlock, &slot->endBlock) )
+		return false;
+
+	slot->endBlock = slot->bgnBlock + nblocks - 1;		// the last cluster may be longer than the file
+	return true;
+}
+
+// Truncate contiguous file to the actual data size
+static void clogTruncate(uint8_t log_type, int log_id, uint8_t nmonth, uint8_t nyear, uint32_t wrPos)
+{
+	char	fname[32];
+
+	if( clogFname(fname, log_type, log_id, nmonth, nyear) )
+	{
+		if( sdlog.lfile.open(fname, O_RDWR) )
+		{
+			if( !sdlog.lfile.truncate(wrPos) )
+				TRACE_ERROR(F("Cannot truncate log file %s\n"), fname);
+			sdlog.lfile.close();
+		}
+	}
+}
+
+// Finalize contiguous file - truncate it to the actual data size. The file is appended through SdFat from now on,
+// so its tail block is not kept in the RAM block buffer.
+static void clogFinalize(ContigLogSlot *slot)
+{
+	clogTruncate(slot->log_type, slot->log_id, slot->month, slot->year, slot->wrPos);
+	slot->log_type = 0;
+	_clogBufBlock = 0xFFFFFFFF;
+}
+
+// Files evicted from the slots keep their tail position in the hints table. The file is not scanned again when it is used next time,
+// and it is finalized when the month is over even if it is not written anymore.
+static bool clogHintTake(uint8_t log_type, int log_id, uint8_t nmonth, uint8_t nyear, uint32_t *pWrPos)
+{
+	for( uint8_t i = 0; i < LOG_CONTIG_MAX_HINTS; i++ )
+	{
+		ContigLogHint *h = &_clogHints[i];
+
+		if( h->log_type == log_type && h->log_id == log_id && h->month == nmonth && h->year == nyear )
+		{
+			*pWrPos = h->wrPos;
+			h->log_type = 0;
+			return true;
+		}
+	}
+	return false;
+}
+
+static void clogHintPut(ContigLogSlot *slot)
+{
+	ContigLogHint	*h = &_clogHints[_clogHintNext];
+
+	for( uint8_t i = 0; i < LOG_CONTIG_MAX_HINTS; i++ )
+	{
+		if( _clogHints[i].log_type == 0 )
+		{
+			h = &_clogHints[i];
+			break;
+		}
+	}
+	if( h == &_clogHints[_clogHintNext] )
+		_clogHintNext = (_clogHintNext + 1) % LOG_CONTIG_MAX_HINTS;		// table is full, replace the oldest
+
+	h->wrPos = slot->wrPos;  h->log_id = slot->log_id;  h->log_type = slot->log_type;
+	h->month = slot->month;  h->year = slot->year;
+}
+
+// Month as a single number, for comparisons
+static inline uint16_t clogMonthKey(uint8_t nmonth, uint8_t nyear)
+{
+	return uint16_t(nyear)*12 + nmonth;
+}
+
+// Finalize files of the months before the given month
+static void clogFinalizeBefore(uint16_t key)
+{
+	for( uint8_t i = 0; i < LOG_CONTIG_MAX_FILES; i++ )
+	{
+		ContigLogSlot *s = &_clogSlots[i];
+
+		if( s->log_type != 0 && clogMonthKey(s->month, s->year) < key )
+			clogFinalize(s);		// the month is over
+	}
+	for( uint8_t i = 0; i < LOG_CONTIG_MAX_HINTS; i++ )
+	{
+		ContigLogHint *h = &_clogHints[i];
+
+		if( h->log_type != 0 && clogMonthKey(h->month, h->year) < key )
+		{
+			clogTruncate(h->log_type, h->log_id, h->month, h->year, h->wrPos);
+			h->log_type = 0;
+		}
+	}
+}
+
+// Finalize the file of the past month before the record is appended to it using regular append.
+// Returns false if the file could not be read.
+static bool clogFinalizePast(uint8_t log_type, int log_id, uint8_t nmonth, uint8_t nyear)
+{
+	ContigLogSlot	tmp;
+	char			fname[32];
+
+	for( uint8_t i = 0; i < LOG_CONTIG_MAX_FILES; i++ )
+	{
+		ContigLogSlot *s = &_clogSlots[i];
+
+		if( s->log_type == log_type && s->log_id == log_id && s->month == nmonth && s->year == nyear )
+		{
+			clogFinalize(s);
+			return true;
+		}
+	}
+	if( clogHintTake(log_type, log_id, nmonth, nyear, &tmp.wrPos) )
+	{
+		clogTruncate(log_type, log_id, nmonth, nyear, tmp.wrPos);
+		return true;
+	}
+
+	// file is not known (e.g. after reboot) - if it is still pre-allocated, locate the end of data
+	if( !clogFname(fname, log_type, log_id, nmonth, nyear) || !sdlog.lfile.open(fname, O_READ) )
+		return true;		// no file, regular append will create it
+
+	bool	fContiguous = clogOpenedRange(sdlog.lfile, log_type, &tmp);
+
+	sdlog.lfile.close();
+	if( !fContiguous )
+		return true;		// regular or already finalized file
+	if( !clogRecover(&tmp) )
+		return false;
+
+	clogTruncate(log_type, log_id, nmonth, nyear, tmp.wrPos);
+	return true;
+}
+
+// Append record to the pre-allocated contiguous log file. If the file does not exist yet, it is created and the header is written first.
+// Existing files that are not pre-allocated (e.g. created by older firmware), records of the past months and records that don't fit
+// into the file are reported as CLOG_FALLBACK and handled by regular append (the file is finalized first).
+//
+// Returns CLOG_OK, CLOG_FALLBACK, CLOG_ERROR (card I/O error) or CLOG_DROP (the record can't be logged, the card is fine).
+//
+uint8_t Logging::contigAppend(uint8_t log_type, int log_id, time_t t, const char *header, const char *rec)
+{
+	uint8_t			nmonth = month(t), nyear = year(t)%100;
+	uint16_t		key = clogMonthKey(nmonth, nyear);
+	ContigLogSlot	*slot = NULL;
+	ContigLogSlot	*victim = &_clogSlots[0];
+	time_t			timeNow = now();
+
+	// SdFat block cache may hold a copy of the block we are going to write, if log data was read through SdFat since
+	// the last raw write. Only then the cache is flushed and invalidated, otherwise the append is one block write.
+	if( fat_read )
+	{
+		if( sd.vol()->cacheClear() == 0 )
+			return CLOG_ERROR;
+		fat_read = false;
+	}
+
+	clogFinalizeBefore(key);
+
+	if( key < clogMonthKey(month(timeNow), year(timeNow)%100) )
+	{
+		// record of the past month (e.g. drained from the spool) - the file is not written anymore, finalize it and append
+		return clogFinalizePast(log_type, log_id, nmonth, nyear) ? CLOG_FALLBACK : CLOG_ERROR;
+	}
+
+	for( uint8_t i = 0; i < LOG_CONTIG_MAX_FILES; i++ )
+	{
+		ContigLogSlot *s = &_clogSlots[i];
+
+		if( s->log_type == log_type && s->log_id == log_id && s->month == nmonth && s->year == nyear )
+			slot = s;
+		else if( s->log_type == 0 || (victim->log_type != 0 && uint8_t(_clogLru - s->lru) > uint8_t(_clogLru - victim->lru)) )
+			victim = s;
+	}
+
+	if( slot == NULL )
+	{
+		char		fname[32];
+
+		if( !clogFname(fname, log_type, log_id, nmonth, nyear) )
+			return CLOG_DROP;
+
+		if( victim->log_type != 0 )
+		{
+			clogHintPut(victim);		// contiguous files are always written through, nothing to flush
+			victim->log_type = 0;
+		}
+
+		if( lfile.open(fname, O_READ) )
+		{
+			bool	fContiguous = clogOpenedRange(lfile, log_type, victim);
+
+			lfile.close();
+			if( !fContiguous )
+				return CLOG_FALLBACK;		// regular or already finalized log file
+
+			if( !clogHintTake(log_type, log_id, nmonth, nyear, &victim->wrPos) && !clogRecover(victim) )
+			{
+				TRACE_ERROR(F("Cannot recover log file %s\n"), fname);
+				return CLOG_ERROR;
+			}
+		}
+		else
+		{
+			uint32_t	nblocks = clogBlocks(log_type);
+
+			if( !lfile.createContiguous(sd.vwd(), fname, nblocks*CLOG_BLOCK_SIZE) )
+			{
+				TRACE_ERROR(F("Cannot pre-allocate log file %s\n"), fname);
+				return CLOG_FALLBACK;		// most likely the card is too fragmented
+			}
+			bool	fContiguous = clogOpenedRange(lfile, log_type, victim);
+
+			lfile.close();
+			if( !fContiguous )
+				return CLOG_FALLBACK;
+
+			_clogBufBlock = 0xFFFFFFFF;		// the blocks are erased
+			if( !sd.card()->erase(victim->bgnBlock, victim->endBlock) && !clogZeroFill(victim->bgnBlock, victim->endBlock) )
+			{
+				TRACE_ERROR(F("Cannot erase log file %s\n"), fname);
+				return CLOG_ERROR;
+			}
+			victim->wrPos = 0;
+			TRACE_INFO(F("Pre-allocated log file %s\n"), fname);
+		}
+		victim->log_type = log_type;  victim->log_id = log_id;
+		victim->month = nmonth;  victim->year = nyear;
+		slot = victim;
+	}
+	slot->lru = ++_clogLru;
+
+	const char	*parts[2] = { (slot->wrPos == 0) ? header:NULL, rec };	// new file starts with the header
+
+	if( slot->wrPos + (parts[0] ? strlen(parts[0]) : 0) + strlen(rec) > (slot->endBlock - slot->bgnBlock + 1)*CLOG_BLOCK_SIZE )
+	{
+		TRACE_ERROR(F("Contiguous log file is full, switching to regular append\n"));
+		clogFinalize(slot);			// truncate to the data, the rest of the month is appended to the file as usual
+		return CLOG_FALLBACK;
+	}
+
+	for( uint8_t p = 0; p < 2; p++ )
+	{
+		const char	*str = parts[p];
+
+		if( str == NULL )
+			continue;
+
+		uint16_t	len = strlen(str);
+
+		while( len > 0 )
+		{
+			uint32_t	block = slot->bgnBlock + slot->wrPos/CLOG_BLOCK_SIZE;
+			uint16_t	offs = slot->wrPos%CLOG_BLOCK_SIZE;
+			uint16_t	n = min(len, uint16_t(CLOG_BLOCK_SIZE - offs));
+
+			if( offs == 0 )
+			{
+				memset(_clogBuf, 0, CLOG_BLOCK_SIZE);		// new block
+				_clogBufBlock = block;
+			}
+			else if( !clogLoadBlock(block) )
+				return CLOG_ERROR;
+
+			memcpy(_clogBuf+offs, str, n);
+			if( !sd.card()->writeBlock(block, _clogBuf) )
+			{
+				_clogBufBlock = 0xFFFFFFFF;
+				TRACE_ERROR(F("Contiguous log block write failed\n"));
+				return CLOG_ERROR;
+			}
+			slot->wrPos += n;  str += n;  len -= n;
+		}
+	}
+	return CLOG_OK;
+}
+
+#endif //HW_ENABLE_SD && SG_LOG_CONTIGUOUS
+
+
+#ifdef HW_ENABLE_SD
+
+// (Re)initialize SD card
+static bool sdCardInit(void)
+{
+#ifdef SD_USE_CUSOM_SS
+	return sd.begin(SD_SS, SPI_FULL_SPEED);
+#else //SD_USE_CUSOM_SS
+	return sd.begin(4, SPI_HALF_SPEED);
+#endif //SD_USE_CUSOM_SS
+}
+
+#endif //HW_ENABLE_SD
+
+// Periodic logger processing, called once per second.
+//
+// If the logger is not ready (SD card failed or removed), try to re-initialize the card every LOG_SD_RETRY_INTERVAL seconds.
+// Once the card is available, write spooled records to the card, up to LOG_SPOOL_DRAIN_BATCH records per call.
+//
+void Logging::loop(void)
+{
+#ifdef HW_ENABLE_SD
+	if( !logger_ready )
+	{
+		if( ++sd_retry_timer < LOG_SD_RETRY_INTERVAL )
+			return;
+		sd_retry_timer = 0;
+
+		if( !sdCardInit() )
+		{
+			TRACE_VERBOSE(F("SD card re-init failed\n"));
+			return;
+		}
+#ifdef SG_LOG_CONTIGUOUS
+		// Card may have been replaced, forget cached file locations. The slots are not finalized - truncating the file by name
+		// could cut the file of the same name on another card, and block positions may be stale. Nothing is lost: the file keeps
+		// its padding (readers stop at the first padding byte), and when it is used again its tail is located by clogRecover(),
+		// or it is finalized by clogFinalizePast() when a record of that month arrives later.
+		clogReset();
+#endif //SG_LOG_CONTIGUOUS
+		if( !begin() )
+			return;
+
+		sd_reinit_count++;
+		TRACE_CRIT(F("SD card is back, %u spooled records, %lu dropped\n"), spool_records, spool_dropped);
+	}
+
+	for( uint8_t i = 0; (i < LOG_SPOOL_DRAIN_BATCH) && logger_ready; i++ )
+	{
+		LogSpoolHdr	hdr;
+		union
+		{
+			char			str[MAX_LOG_RECORD_SIZE];
+			LogSpoolSched	sched;
+			LogSpoolZone	zone;
+			LogSpoolSensor	sensor;
+		} rec;
+		bool		fOK = true;
+
+		if( !spoolPeek(&hdr, &rec) )
+			break;				// spool is empty
+
+		switch( hdr.kind )
+		{
+		case LOG_SPOOL_SYSEVT:
+			rec.str[hdr.len] = 0;
+			fOK = writeSysEvent(hdr.t, rec.str);
+			break;
+		case LOG_SPOOL_SCHED:
+			fOK = writeSchedEvent(hdr.t, rec.sched.start, rec.sched.duration, rec.sched.water_used, rec.sched.schedule, rec.sched.sadj, rec.sched.wunderground);
+			break;
+		case LOG_SPOOL_ZONE:
+			fOK = writeZoneEvent(hdr.t, rec.zone.start, rec.zone.zone, rec.zone.duration, rec.zone.water_used, rec.zone.schedule, rec.zone.sadj, rec.zone.wunderground);
+			break;
+		case LOG_SPOOL_SENSOR:
+			fOK = writeSensorReading(hdr.t, rec.sensor.sensor_type, rec.sensor.sensor_id, rec.sensor.sensor_reading);
+			break;
+		}
+
+		if( !fOK && _logIOError )
+		{
+			logger_ready = false;		// card failed again, retry later
+			if( ++_spoolFailCount < LOG_SPOOL_MAX_RETRIES )
+				break;
+
+			TRACE_ERROR(F("Dropping spooled log record, kind=%u\n"), hdr.kind);
+			spool_dropped++;
+		}
+		else if( !fOK )
+		{
+			TRACE_ERROR(F("Spooled log record can't be written, dropped, kind=%u\n"), hdr.kind);
+			spool_dropped++;
+		}
+		spoolPop();
+	}
+#endif //HW_ENABLE_SD
+}
+
+
+// Record schedule watering event
+//
+// Note: we open/close file on each event
+
+bool Logging::LogSchedEvent(time_t start, int duration, uint16_t water_used, int schedule, int sadj, int wunderground)
+{
+	  TRACE_VERBOSE(F("LogSchedEvent called, start=%lu, duration=%d, schedule=%d, sadj=%d, wunderground=%d\n"), start, duration, schedule, sadj, wunderground);
+
+#ifndef HW_ENABLE_SD
+	  return true;
+#else
+	  time_t t = now();
+
+	  if( !spoolActive() )
+	  {
+		  if( writeSchedEvent(t, start, duration, water_used, schedule, sadj, wunderground) )
+			  return true;
+		  if( !_logIOError )
+			  return false;			// the record can't be logged, the card is fine
+
+		  logger_ready = false;		// card failed, spool the record
+	  }
+
+	  LogSpoolSched rec;
+
+	  rec.start = start;  rec.duration = duration;  rec.water_used = water_used;
+	  rec.schedule = schedule;  rec.sadj = sadj;  rec.wunderground = wunderground;
+	  spoolPut(LOG_SPOOL_SCHED, t, &rec, sizeof(rec));
+	  return true;
+#endif //HW_ENABLE_SD
+}
+
+// Record zone watering event
+//
+// Note: for watering events we open/close file on each event
+
+bool Logging::LogZoneEvent(time_t start, int zone, int duration, uint16_t water_used, int schedule, int sadj, int wunderground)
+{
+	  time_t t = now();
+	  
+// Update running counters (in flash)
+// Running water counters are stored on per-day of week basis, and we also store the date when we last updated running water counter
+// When switching to the new day, we reset running water counter for that day and start new accumulation
+// Also when day change occurs, we are adding previously accumulated running water counter to the global lifetime water counter
+//
+	  {
+			register uint8_t	dow = weekday(t)-1;
+
+			SetWWCounter(dow, GetWWCounter(dow)+water_used);
+			//TRACE_CRIT(F("Updating WWCounter, dow=%d, duration=%d, zone.wfRate=%d, increment=%d\n"), int(dow), duration, szone.waterFlowRate, int(tmp32) );
+	  }
+
+#ifndef HW_ENABLE_SD
+	  return true;
+#else
+	  water_used = water_used/100; // water used is reported in 1/100 of a gallon. We use full precision value for WWCounters calculations, but round it to nearest gallon for logging.
+
+	  if( !spoolActive() )
+	  {
+		  if( writeZoneEvent(t, start, zone, duration, water_used, schedule, sadj, wunderground) )
+			  return true;
+		  if( !_logIOError )
+			  return false;			// the record can't be logged, the card is fine
+
+		  logger_ready = false;		// card failed, spool the record
+	  }
+
+	  LogSpoolZone rec;
+
+	  rec.start = start;  rec.zone = zone;  rec.duration = duration;  rec.water_used = water_used;
+	  rec.schedule = schedule;  rec.sadj = sadj;  rec.wunderground = wunderground;
+	  spoolPut(LOG_SPOOL_ZONE, t, &rec, sizeof(rec));
+	  return true;
+#endif //HW_ENABLE_SD
+}
+
+// Sensors logging - record sensor reading. 
+// Covers all types of basic pressure sensors that provide momentarily (immediate) readings.
+//
+// sensor_type       -  could be SENSOR_TYPE_TEMPERATURE or any other valid defines
+// sensor_id           -  numeric ID of the sensor, minimum 0, maximum 999
+// sensor_reading  -  actual sensor reading
+//
+// Returns true if successful and false if failure.
+//
+bool Logging::LogSensorReading(uint8_t sensor_type, int sensor_id, int32_t sensor_reading)
+{
+//	TRACE_ERROR(F("LogSensorReading - enter, sensor_type=%i, sensor_id=%i, sensor_reading=%ld\n"), (int)sensor_type, sensor_id, sensor_reading);
+
+#ifndef HW_ENABLE_SD
+	  return true;
+#else
+	time_t  t = now();
 
-           TRACE_ERROR(F("Error creating Pressure log directory.\n"));
-        }
-  }
-  lfile.close();      // close the directory
+	if( (sensor_type != SENSOR_TYPE_TEMPERATURE) && (sensor_type != SENSOR_TYPE_PRESSURE) &&
+		(sensor_type != SENSOR_TYPE_HUMIDITY) && (sensor_type != SENSOR_TYPE_WATERFLOW) )
+		return false;    // sensor_type not recognized
 
+	if( !spoolActive() )
+	{
+		if( writeSensorReading(t, sensor_type, sensor_id, sensor_reading) )
+			return true;
+		if( !_logIOError )
+			return false;			// the record can't be logged, the card is fine
 
-//  generate system log file name
-  sprintf_P(log_fname, PSTR(SYSTEM_LOG_FNAME_FORMAT), month(curr_time), year(curr_time) );
-  if( !lfile.open(log_fname, O_WRITE | O_APPEND | O_CREAT) ){
+		logger_ready = false;		// card failed, spool the record
+	}
 
-        SYSEVT_ERROR(F("Cannot open system log file (%s)\n"), log_fname);
-        logger_ready = false;
+	LogSpoolSensor rec;
 
-        return false;    // failed to open/create log file
-  }
+	rec.sensor_type = sensor_type;  rec.sensor_id = sensor_id;  rec.sensor_reading = sensor_reading;
+	spoolPut(LOG_SPOOL_SENSOR, t, &rec, sizeof(rec));
+	return true;
+#endif //HW_ENABLE_SD
+}
 
-  lfile.close();
-  logger_ready = true;      // we are good to go
 
-  return true;
-#endif //!HW_ENABLE_SD
-}
+#ifdef HW_ENABLE_SD
 
-void Logging::Close()
+// Write system log event, the string includes time stamp prefix
+bool Logging::writeSysEvent(time_t t, const char *str)
 {
-   logger_ready = false;
-}
+	char tmp_buf[20];
 
+	sprintf_P(tmp_buf, PSTR(SYSTEM_LOG_FNAME_FORMAT), month(t), year(t) );
 
-// Record schedule watering event
-//
-// Note: we open/close file on each event
+	if( !lfile.open(tmp_buf, O_WRITE | O_APPEND | O_CREAT) ){
 
-bool Logging::LogSchedEvent(time_t start, int duration, uint16_t water_used, int schedule, int sadj, int wunderground)
-{
-	  TRACE_VERBOSE(F("LogSchedEvent called, start=%lu, duration=%d, schedule=%d, sadj=%d, wunderground=%d\n"), start, duration, schedule, sadj, wunderground);
+		TRACE_ERROR(F("Cannot open system log file (%s)\n"), tmp_buf);
+		_logIOError = true;
+		return false;
+	}
+	lfile.write(str, strlen(str));
+	lfile.write('\n');
+	_logIOError = !lfile.close();
+	return !_logIOError;
+}
 
-#ifndef HW_ENABLE_SD
-	  return true;
-#else
-      if( !logger_ready ) return false;  //check if the logger is ready
-	
+bool Logging::writeSchedEvent(time_t t, time_t start, int duration, uint16_t water_used, int schedule, int sadj, int wunderground)
+{
 // temp buffer for log strings processing
       char tmp_buf[MAX_LOG_RECORD_SIZE];
 
-      sprintf_P(tmp_buf, PSTR(WATERING_SCH_LOG_FNAME_FORMAT), year(now()));
+      log_gen[LOG_TYPE_WATERING]++;		// cached log query responses are out of date
+
+      sprintf_P(tmp_buf, PSTR(WATERING_SCH_LOG_FNAME_FORMAT), year(t));
 
       if( !lfile.open(tmp_buf, O_WRITE | O_APPEND) ){    // we are trying to open existing log file for write/append
 
@@ -300,6 +1286,7 @@ bool Logging::LogSchedEvent(time_t start, int duration, uint16_t water_used, int
          if( !lfile.open(tmp_buf, O_WRITE | O_APPEND | O_CREAT) ){
 
                TRACE_ERROR(F("Cannot open watering log file (%s)\n"), tmp_buf);    // file create failed, return an error.
+               _logIOError = true;
                return false;    // failed to open/create file
          }
          lfile.println(F("Month,Day,Time,Schedule run time(min),Water used(gal),ScheduleID,Adjustment,WUAdjustment"));
@@ -308,41 +1295,32 @@ bool Logging::LogSchedEvent(time_t start, int duration, uint16_t water_used, int
       sprintf_P(tmp_buf, PSTR("%u,%u,%u:%u,%u,%u,%u,%i,%i"), month(start), day(start), hour(start), minute(start), duration, water_used, schedule, sadj, wunderground);
 
       lfile.println(tmp_buf);
-      lfile.close();
-
-      return true;
-#endif //HW_ENABLE_SD
+      _logIOError = !lfile.close();
+      return !_logIOError;
 }
 
-// Record zone watering event
-//
-// Note: for watering events we open/close file on each event
-
-bool Logging::LogZoneEvent(time_t start, int zone, int duration, uint16_t water_used, int schedule, int sadj, int wunderground)
+bool Logging::writeZoneEvent(time_t t, time_t start, int zone, int duration, uint16_t water_used, int schedule, int sadj, int wunderground)
 {
-	  time_t t = now();
-	  
-// Update running counters (in flash)
-// Running water counters are stored on per-day of week basis, and we also store the date when we last updated running water counter
-// When switching to the new day, we reset running water counter for that day and start new accumulation
-// Also when day change occurs, we are adding previously accumulated running water counter to the global lifetime water counter
-//
-	  {
-			register uint8_t	dow = weekday(t)-1;
+// temp buffer for log strings processing
+      char tmp_buf[MAX_LOG_RECORD_SIZE];
 
-			SetWWCounter(dow, GetWWCounter(dow)+water_used);
-			//TRACE_CRIT(F("Updating WWCounter, dow=%d, duration=%d, zone.wfRate=%d, increment=%d\n"), int(dow), duration, szone.waterFlowRate, int(tmp32) );
-	  }
+      log_gen[LOG_TYPE_WATERING]++;		// cached log query responses are out of date
 
-#ifndef HW_ENABLE_SD
-	  return true;
-#else
-	  water_used = water_used/100; // water used is reported in 1/100 of a gallon. We use full precision value for WWCounters calculations, but round it to nearest gallon for logging.
+#ifdef SG_LOG_CONTIGUOUS
+	  {
+		  char rec_buf[MAX_LOG_RECORD_SIZE];
 
-	  if( !logger_ready ) return false;  //check if the logger is ready
-	
-// temp buffer for log strings processing
-      char tmp_buf[MAX_LOG_RECORD_SIZE];
+		  strcpy_P(tmp_buf, PSTR("Day,Time,Run time(min),Water used(gal),ScheduleID,Adjustment,WUAdjustment\r\n"));
+		  sprintf_P(rec_buf, PSTR("%u,%u,%u:%u,%u,%u,%u,%i,%i\r\n"), zone, day(start), hour(start), minute(start), duration, water_used, schedule, sadj, wunderground);
+
+		  uint8_t rc = contigAppend(LOG_TYPE_WATERING, 0, t, tmp_buf, rec_buf);
+		  if( rc != CLOG_FALLBACK )
+		  {
+			  _logIOError = (rc == CLOG_ERROR);
+			  return rc == CLOG_OK;
+		  }
+	  }
+#endif //SG_LOG_CONTIGUOUS
 
       sprintf_P(tmp_buf, PSTR(WATERING_LOG_FNAME_FORMAT), (int)month(t), (int)(year(t)%100) );
 
@@ -352,6 +1330,7 @@ bool Logging::LogZoneEvent(time_t start, int zone, int duration, uint16_t water_
          if( !lfile.open(tmp_buf, O_WRITE | O_APPEND | O_CREAT) ){
 
                TRACE_ERROR(F("Cannot open watering log file (%s)\n"), tmp_buf);    // file create failed, return an error.
+               _logIOError = true;
                return false;    // failed to open/create file
          }
          lfile.println(F("Day,Time,Run time(min),Water used(gal),ScheduleID,Adjustment,WUAdjustment"));
@@ -360,36 +1339,17 @@ bool Logging::LogZoneEvent(time_t start, int zone, int duration, uint16_t water_
       sprintf_P(tmp_buf, PSTR("%u,%u,%u:%u,%u,%u,%u,%i,%i"), zone, day(start), hour(start), minute(start), duration, water_used, schedule, sadj, wunderground);
 
       lfile.println(tmp_buf);
-      lfile.close();
-
-      return true;
-#endif //HW_ENABLE_SD
+      _logIOError = !lfile.close();
+      return !_logIOError;
 }
 
-// Sensors logging - record sensor reading. 
-// Covers all types of basic pressure sensors that provide momentarily (immediate) readings.
-//
-// sensor_type       -  could be SENSOR_TYPE_TEMPERATURE or any other valid defines
-// sensor_id           -  numeric ID of the sensor, minimum 0, maximum 999
-// sensor_reading  -  actual sensor reading
-//
-// Returns true if successful and false if failure.
-//
-bool Logging::LogSensorReading(uint8_t sensor_type, int sensor_id, int32_t sensor_reading)
+bool Logging::writeSensorReading(time_t t, uint8_t sensor_type, int sensor_id, int32_t sensor_reading)
 {
-//	TRACE_ERROR(F("LogSensorReading - enter, sensor_type=%i, sensor_id=%i, sensor_reading=%ld\n"), (int)sensor_type, sensor_id, sensor_reading);
-
-#ifndef HW_ENABLE_SD
-	  return true;
-#else
-	if( !logger_ready ) return false;  //check if the logger is ready
-
-	time_t  t = now();
-
 // temp buffer for log strings processing
       char	tmp_buf[MAX_LOG_RECORD_SIZE];					
 
 	const char *sensorName;
+	uint8_t		log_type;
 
       switch (sensor_type){
       
@@ -397,30 +1357,54 @@ bool Logging::LogSensorReading(uint8_t sensor_type, int sensor_id, int32_t senso
           
                      sprintf_P(tmp_buf, PSTR(TEMPERATURE_LOG_FNAME_FORMAT), (int)month(t), (int)(year(t)%100), sensor_id );
                      sensorName = PSTR("Temperature(F)");
+                     log_type = LOG_TYPE_TEMPERATURE;
                      break; 
       
            case  SENSOR_TYPE_PRESSURE:
 
                      sprintf_P(tmp_buf, PSTR(PRESSURE_LOG_FNAME_FORMAT), (int)month(t), (int)(year(t)%100), sensor_id );
                      sensorName = PSTR("AirPressure");
+                     log_type = LOG_TYPE_PRESSURE;
                      break; 
       
            case  SENSOR_TYPE_HUMIDITY:
           
                      sprintf_P(tmp_buf, PSTR(HUMIDITY_LOG_FNAME_FORMAT), (int)month(t), (int)(year(t)%100), sensor_id );
                      sensorName = PSTR("Humidity");
+                     log_type = LOG_TYPE_HUMIDITY;
                      break; 
       
            case  SENSOR_TYPE_WATERFLOW:
           
                      sprintf_P(tmp_buf, PSTR(WFLOW_LOG_FNAME_FORMAT), (int)month(t), (int)(year(t)%100), sensor_id );
                      sensorName = PSTR("Waterflow");
+                     log_type = LOG_TYPE_WATERFLOW;
                      break; 
 
             default:
-                     return false;    // sensor_type not recognized
+                     return true;    // sensor_type not recognized, nothing to write
                      break;           
       }
+
+      log_gen[log_type]++;		// cached log query responses are out of date
+
+#ifdef SG_LOG_CONTIGUOUS
+	  {
+		  char hdr_buf[32];
+		  char rec_buf[24];
+
+		  sprintf_P(hdr_buf, PSTR("Day,Time,%S\n"), sensorName);
+		  sprintf_P(rec_buf, PSTR("%u,%u:%u,%ld\n"), day(t), hour(t), minute(t), sensor_reading);
+
+		  uint8_t rc = contigAppend(log_type, sensor_id, t, hdr_buf, rec_buf);
+		  if( rc != CLOG_FALLBACK )
+		  {
+			  _logIOError = (rc == CLOG_ERROR);
+			  return rc == CLOG_OK;
+		  }
+	  }
+#endif //SG_LOG_CONTIGUOUS
+
       TRACE_VERBOSE(F("LogSensorReading - about to open file: %s, len=%d\n"), tmp_buf, strlen(tmp_buf));
 
       if( !lfile.open(tmp_buf, O_WRITE | O_APPEND) ){    // we are trying to open existing log file for write/append
@@ -429,6 +1413,7 @@ bool Logging::LogSensorReading(uint8_t sensor_type, int sensor_id, int32_t senso
          if( !lfile.open(tmp_buf, O_WRITE | O_APPEND | O_CREAT) ){
 
                TRACE_ERROR(F("Cannot open or create sensor  log file %s\n"), tmp_buf);    // file create failed, return an error.
+               _logIOError = true;
                return false;    // failed to open/create file
          }
 		 // write header line
@@ -444,55 +1429,74 @@ bool Logging::LogSensorReading(uint8_t sensor_type, int sensor_id, int32_t senso
 //	  TRACE_VERBOSE(F("Writing log string %s, len=%d\n"), tmp_buf, strlen(tmp_buf));
 	  lfile.write(tmp_buf, strlen(tmp_buf));
 
-      lfile.close();
+      _logIOError = !lfile.close();
+      return !_logIOError;    // standard exit-success
+}
 
-      return true;    // standard exit-success
 #endif //HW_ENABLE_SD
-}
 
 
+void Logging::scanBegin(LogScan & scan, time_t start, time_t end, time_t since)
+{
+		memset(&scan, 0, sizeof(scan));
+
+		if (start == 0)
+				start = now();
+
+		scan.start = start;
+		scan.end = max(start,end) + 24*3600;  // add 1 day to end time.
+		scan.since = since;
+		scan.hwm = since;
+		scan.nyear = year(start);
+		scan.nmonth = month(start);
+		scan.zone.xsched = -1;
+}
 
-bool Logging::TableZone(FILE* stream_file, time_t start, time_t end)
+bool Logging::TableZone(JsonWriter & jw, LogScan & scan)
 {
 #ifndef HW_ENABLE_SD
 	  return false;
 #else
         char tmp_buf[MAX_LOG_RECORD_SIZE];
+		uint8_t	records = 0;
 
-		fprintf_P(stream_file, PSTR("{\n\t\"logs\": [\n"));
-        
-		if (start == 0)
-                start = now();
-
-        unsigned int    nyear=year(start);
+		if( scan.bDone )
+			return false;
 
-        end = max(start,end) + 24*3600;  // add 1 day to end time.
+        fat_read = true;
 
-        int  nmend = month(end);
-        int  ndayend = day(end);
-		int  nmstart = month(start);
-		int  xsched = -1;
+        int  nmend = month(scan.end);
+        int  ndayend = day(scan.end);
 
-//		TRACE_ERROR(F("TableZone - entering, start year=%u, month=%u, day=%u\n"), year(start), month(start), day(start));
-
-        if( year(end) != year(start) ){     // currently we cannot handle queries that span multiple years. Truncate the query to the year end.
+        if( year(scan.end) != scan.nyear ){     // currently we cannot handle queries that span multiple years. Truncate the query to the year end.
              nmend = 12;    ndayend = 31;
         }
 
-		uint8_t	n_zones = GetNumZones();
 		time_t  evt_time = 0;
-		time_t  prev_evtEnd = 0;
 
-        for( int nmonth = nmstart; nmonth <= nmend; nmonth++ ){  // iterate over months (watering logs are stored one file per month)
+        for( ; scan.nmonth <= nmend; scan.nmonth++, scan.pos = 0 ){  // iterate over months (watering logs are stored one file per month)
+
+                if( records >= LOG_SCAN_RECORDS )
+                     return true;
+                records++;
 
-                sprintf_P(tmp_buf, PSTR(WATERING_LOG_FNAME_FORMAT), nmonth, (int)(nyear%100) );
+                sprintf_P(tmp_buf, PSTR(WATERING_LOG_FNAME_FORMAT), scan.nmonth, (int)(scan.nyear%100) );
 
                 if( lfile.open(tmp_buf, O_READ) ){  
 
-                     char bFirstRow = true;
-   					TRACE_VERBOSE(F("TableZone - reading file %s\n"), tmp_buf);
+					if( scan.pos == 0 )
+					{
+	   					TRACE_VERBOSE(F("TableZone - reading file %s\n"), tmp_buf);
 
-                     lfile.fgets(tmp_buf, MAX_LOG_RECORD_SIZE-1);  // skip first line in the file - column headers
+						scan.hint_t = 0;
+						scan.hint_pos = 0;
+						if( seekHintApply(lfile, LOG_TYPE_WATERING, 0, scan.nmonth, scan.nyear, scan.since) )
+							scan.hint_t = scan.since;
+						else
+							lfile.fgets(tmp_buf, MAX_LOG_RECORD_SIZE-1);  // skip first line in the file - column headers
+					}
+					else
+						lfile.seekSet(scan.pos);	// continue where the previous step stopped
 
 
 // OK, we opened required watering log file. Iterate over records, filtering out necessary dates range
@@ -503,8 +1507,16 @@ bool Logging::TableZone(FILE* stream_file, time_t start, time_t end)
                             int  nsadj = 0, nwunderground = 0, nzone = 0;
 							uint16_t  nduration = 0, nwater_used = 0;
 
+							if( records >= LOG_SCAN_RECORDS )
+							{
+								scan.pos = lfile.curPosition();
+								lfile.close();
+								return true;
+							}
+							records++;
+
                             int bytes = lfile.fgets(tmp_buf, MAX_LOG_RECORD_SIZE-1);
-                            if (bytes <= 0)
+                            if( (bytes <= 0) || LOG_IS_PADDING(tmp_buf) )
                                        break;
    							TRACE_VERBOSE(F("TableZone - got string %s\n"), tmp_buf);
 
@@ -513,23 +1525,29 @@ bool Logging::TableZone(FILE* stream_file, time_t start, time_t end)
 							sscanf_P( tmp_buf, PSTR("%u,%u,%u:%u,%u,%u,%i,%i,%i"),
                                                             &nzone, &nday, &nhour, &nminute, &nduration, &nwater_used, &nschedule, &nsadj, &nwunderground);
 
-                            if( (nmonth == nmend) && (nday > ndayend) ){    // check for the end date
+                            if( (scan.nmonth == nmend) && (nday > ndayend) ){    // check for the end date
 			   					
 								TRACE_VERBOSE(F("TableZone - date is beyond requested range, stop processing file\n"));
 								break;
 							}
 
 							{
-								tmElements_t tm;   tm.Day = nday;  tm.Month = nmonth; tm.Year = nyear - 1970;  tm.Hour = nhour;  tm.Minute = nminute;  tm.Second = 0;
+								tmElements_t tm;   tm.Day = nday;  tm.Month = scan.nmonth; tm.Year = scan.nyear - 1970;  tm.Hour = nhour;  tm.Minute = nminute;  tm.Second = 0;
 								evt_time = makeTime(tm);
 							}
-                            if( evt_time >= start ){        // the record is within required range.
+							scan.hint_pos = lfile.curPosition();
+							scan.hint_t = max(scan.hint_t, evt_time);
+
+                            if( (evt_time >= scan.start) && (evt_time > scan.since) ){        // the record is within required range.
 // we have something to output.
 
-                                    if( (nschedule != xsched) || (evt_time > prev_evtEnd) ){
+                                    if( (nschedule != scan.zone.xsched) || (evt_time > scan.zone.prev_evtEnd) ){
                                       
-                                         if( xsched != -1 ) 
-                                                   fprintf_P(stream_file, PSTR("\n\t\t\t\t\t]\n\t\t\t\t},\n"));   // if this is not the first schedule, close previous one
+                                         if( scan.zone.xsched != -1 ) 
+                                         {
+                                                   jw.EndArray();   // if this is not the first schedule, close previous one
+                                                   jw.EndObject();
+                                         }
                                          
 										 Schedule sched;
 										 memset(&sched.name, 0, sizeof(sched.name));
@@ -537,71 +1555,92 @@ bool Logging::TableZone(FILE* stream_file, time_t start, time_t end)
 											 strcpy_P(sched.name, PSTR("Manual"));
 										 else
 											LoadSchedule(nschedule, &sched);
-                                         fprintf_P(stream_file, PSTR("\n\t\t\t\t { \n\t\t\t\t \"scheduleID\": %i,\n\t\t\t\t \"scheduleName\": \"%s\",\n\t\t\t\t \"entries\": ["), nschedule, sched.name);   // JSON schedule header
-                                         xsched = nschedule;
-                                         bFirstRow = true;
+                                         jw.BeginObject();   // JSON schedule header
+                                         jw.Key(PSTR("scheduleID"));	jw.Number(nschedule);
+                                         jw.Key(PSTR("scheduleName"));	jw.String(sched.name);
+                                         jw.Key(PSTR("entries"));
+                                         jw.BeginArray();
+                                         scan.zone.xsched = nschedule;
                                     }
 									
-									prev_evtEnd = evt_time + uint32_t(nduration+1)*60ul;
-
-                                    fprintf_P(stream_file, PSTR("%s \n\t\t\t\t\t { \"date\":%lu, \"zone\":%i, \"duration\":%u, \"water_used\":%u, \"seasonal\":%i, \"wunderground\":%i}"),
-                                                                       bFirstRow ? "":",",
-                                                                       evt_time, nzone, nduration, nwater_used, nsadj, nwunderground );
-
-                                     bFirstRow = false;
+									scan.zone.prev_evtEnd = evt_time + uint32_t(nduration+1)*60ul;
+
+                                    jw.BeginObject();
+                                    jw.Key(PSTR("date"));			jw.NumberU(evt_time);
+                                    jw.Key(PSTR("zone"));			jw.Number(nzone);
+                                    jw.Key(PSTR("duration"));		jw.NumberU(nduration);
+                                    jw.Key(PSTR("water_used"));		jw.NumberU(nwater_used);
+                                    jw.Key(PSTR("seasonal"));		jw.Number(nsadj);
+                                    jw.Key(PSTR("wunderground"));	jw.Number(nwunderground);
+                                    jw.EndObject();
+
+                                    scan.hwm = max(scan.hwm, evt_time);
                             }
 							else
 							{
-   								TRACE_VERBOSE(F("TableZone - record date %u:%u before start date of %u:%u, skipping\n"), nmonth, nday, int(month(start)), int(day(start)));
+   								TRACE_VERBOSE(F("TableZone - record date %u:%u before start date of %u:%u, skipping\n"), scan.nmonth, nday, int(month(scan.start)), int(day(scan.start)));
 							}
                      }   // while
                      lfile.close();
+					 seekHintSave(LOG_TYPE_WATERING, 0, scan.nmonth, scan.nyear, scan.hint_t, scan.hint_pos);
                 }
 				else
 				{
 					TRACE_ERROR(F("TableZone - cannot open log file %s\n"), tmp_buf);
 				}
-        }   // for( int nmonth = nmstart; nmonth <= nmend; nmonth++ )
+        }   // for( ; scan.nmonth <= nmend; scan.nmonth++ )
 
-        if( xsched != -1)
-                     fprintf_P(stream_file, PSTR("\n\t\t\t\t\t ] \n\t\t\t\t } \n"));    // close the last zone if we emitted
+        if( scan.zone.xsched != -1)
+        {
+                     jw.EndArray();    // close the last zone if we emitted
+                     jw.EndObject();
+        }
 
-		fprintf_P(stream_file, PSTR("\t]\n}"));
-        return true;
+        scan.bDone = true;
+        return false;
 #endif //HW_ENABLE_SD
 }
 
 
-bool Logging::TableSchedule(FILE* stream_file, time_t start, time_t end)
+bool Logging::TableSchedule(JsonWriter & jw, LogScan & scan)
 {
 #ifndef HW_ENABLE_SD
 	  return false;
 #else 
         char tmp_buf[MAX_LOG_RECORD_SIZE];
+		uint8_t	records = 0;
 
-        if (start == 0)
-                start = now();
-
-        unsigned int    nyear=year(start);
+		if( scan.bDone )
+			return false;
 
-        end = max(start,end) + 24*3600;  // add 1 day to end time.
+        fat_read = true;
 
-        int  nmend = month(end);
-        int  ndayend = day(end);
+        int  nmend = month(scan.end);
+        int  ndayend = day(scan.end);
+        int  nmstart = month(scan.start);
+        int  ndaystart = day(scan.start);
 
-//		TRACE_ERROR(F("TableSchedule - entering, start year=%u, month=%u, day=%u\n"), year(start), month(start), day(start));
+//		TRACE_ERROR(F("TableSchedule - entering, start year=%u, month=%u, day=%u\n"), scan.nyear, nmstart, ndaystart);
 
-        if( year(end) != year(start) ){     // currently we cannot handle queries that span multiple years. Truncate the query to the year end.
+        if( year(scan.end) != scan.nyear ){     // currently we cannot handle queries that span multiple years. Truncate the query to the year end.
              nmend = 12;    ndayend = 31;
         }
 
-        char bFirstRow = true;
-                    
-                sprintf_P(tmp_buf, PSTR(WATERING_SCH_LOG_FNAME_FORMAT), nyear );
+                sprintf_P(tmp_buf, PSTR(WATERING_SCH_LOG_FNAME_FORMAT), scan.nyear );
 
                 if( lfile.open(tmp_buf, O_READ) ){  // logs for each zone are stored in a separate file, with the file name based on the year and zone number. Try to open it.
 
-                     lfile.fgets(tmp_buf, MAX_LOG_RECORD_SIZE-1);  // skip first line in the file - column headers
+					if( scan.pos == 0 )
+					{
+						scan.hint_t = 0;
+						scan.hint_pos = 0;
+						if( seekHintApply(lfile, LOG_FILE_SCHED, 0, 0, scan.nyear, scan.since) )
+							scan.hint_t = scan.since;
+						else
+							lfile.fgets(tmp_buf, MAX_LOG_RECORD_SIZE-1);  // skip first line in the file - column headers
+					}
+					else
+						lfile.seekSet(scan.pos);	// continue where the previous step stopped
 
 // OK, we opened required schedule watering log file. Iterate over records, filtering out necessary dates range
                   
@@ -611,6 +1650,14 @@ bool Logging::TableSchedule(FILE* stream_file, time_t start, time_t end)
                             int  nsadj = 0, nwunderground = 0;
 							uint16_t  nwater_used = 0, nduration = 0;
 
+							if( records >= LOG_SCAN_RECORDS )
+							{
+								scan.pos = lfile.curPosition();
+								lfile.close();
+								return true;
+							}
+							records++;
+
                             int bytes = lfile.fgets(tmp_buf, MAX_LOG_RECORD_SIZE-1);
                             if (bytes <= 0)
                                        break;
@@ -623,10 +1670,16 @@ bool Logging::TableSchedule(FILE* stream_file, time_t start, time_t end)
                             if( (nmonth > nmend) || ((nmonth == nmend) && (nday > ndayend)) )    // check for the end date
                                          break;
 
-                            if( (nmonth > month(start)) || ((nmonth == month(start)) && (nday >= day(start)) )  ){        // the record is within required range. nmonth is the month, nday is the day of the month, xzone is the zone we are currently emitting
+							scan.hint_pos = lfile.curPosition();
+							scan.sched.last_month = nmonth;  scan.sched.last_day = nday;  scan.sched.last_hour = nhour;  scan.sched.last_minute = nminute;
+
+                            tmElements_t tm;   tm.Day = nday;  tm.Month = nmonth; tm.Year = scan.nyear - 1970;  tm.Hour = nhour;  tm.Minute = nminute;  tm.Second = 0;
+                            time_t  rec_time;
+
+                            if( ((nmonth > nmstart) || ((nmonth == nmstart) && (nday >= ndaystart) )) &&
+								((rec_time = makeTime(tm)) > scan.since) ){        // the record is within required range. nmonth is the month, nday is the day of the month, xzone is the zone we are currently emitting
 
 // we have something to output.
-                                    tmElements_t tm;   tm.Day = nday;  tm.Month = nmonth; tm.Year = nyear - 1970;  tm.Hour = nhour;  tm.Minute = nminute;  tm.Second = 0;
 									Schedule	sched;
 
 									if( nschedule == 100 )
@@ -639,21 +1692,37 @@ bool Logging::TableSchedule(FILE* stream_file, time_t start, time_t end)
 										LoadSchedule(uint8_t(nschedule), &sched);
 									}
                             
-                                    fprintf_P(stream_file, PSTR("%s \n\t\t\t\t\t { \"date\":%lu, \"duration\":%u, \"water_used\":%u, \"scheduleID\":%i, \"scheduleName\":\"%s\", \"seasonal\":%i, \"wunderground\":%i}"),
-                                                                       bFirstRow ? "":",",
-                                                                       makeTime(tm), nduration, nwater_used, nschedule, sched.name, nsadj, nwunderground );
-
-                                     bFirstRow = false;
+                                    jw.BeginObject();
+                                    jw.Key(PSTR("date"));			jw.NumberU(rec_time);
+                                    jw.Key(PSTR("duration"));		jw.NumberU(nduration);
+                                    jw.Key(PSTR("water_used"));		jw.NumberU(nwater_used);
+                                    jw.Key(PSTR("scheduleID"));		jw.Number(nschedule);
+                                    jw.Key(PSTR("scheduleName"));	jw.String(sched.name);
+                                    jw.Key(PSTR("seasonal"));		jw.Number(nsadj);
+                                    jw.Key(PSTR("wunderground"));	jw.Number(nwunderground);
+                                    jw.EndObject();
+
+                                    scan.hwm = max(scan.hwm, rec_time);
                             }
                      }   // while
                      lfile.close();
+
+					 if( scan.hint_pos != 0 )	// records are in time order, the last one is the newest
+					 {
+						 tmElements_t tm;   tm.Day = scan.sched.last_day;  tm.Month = scan.sched.last_month; tm.Year = scan.nyear - 1970;
+						 tm.Hour = scan.sched.last_hour;  tm.Minute = scan.sched.last_minute;  tm.Second = 0;
+						 time_t  last_time = makeTime(tm);
+
+						 seekHintSave(LOG_FILE_SCHED, 0, 0, scan.nyear, max(scan.hint_t, last_time), scan.hint_pos);
+					 }
                 }
 				else
 				{
 //					TRACE_ERROR(F("TableSchedule - cannot open log file %s\n"), tmp_buf);
 				}
 
-        return true;
+        scan.bDone = true;
+        return false;
 #endif //HW_ENABLE_SD
 }
 
@@ -694,9 +1763,10 @@ void emitDirectoryListing(SdFile &dir, char *folder, FILE *pFile)
 // "/logs*" URL handler.
 // This handler provides access and WEB UI management for various logs.
 // This includes directory listing, displaying individual log files, and deleting unwanted log files
+// logfile is the response file of the web connection, it is used both for directory listing and for the log file itself.
 //
 
-void Logging::LogsHandler(char *sPage, FILE *pFile, EthernetClient client)
+void Logging::LogsHandler(char *sPage, FILE *pFile, EthernetClient client, SdFile & logfile)
 {
 #ifndef HW_ENABLE_SD
 	  return;
@@ -706,8 +1776,6 @@ void Logging::LogsHandler(char *sPage, FILE *pFile, EthernetClient client)
    if( sPage[4] == 0 || sPage[4] == ' ' || (sPage[4] == '/' && sPage[5] == 0)){    // this is log listing - the string is either /logs or /logs/
 
 // this is log listing request
-        SdFile logfile;
-
         if( !logfile.open(sPage, O_READ) ){
 
             TRACE_ERROR(F("Cannot open logs directory\n"));
@@ -715,7 +1783,7 @@ void Logging::LogsHandler(char *sPage, FILE *pFile, EthernetClient client)
             return;    // failed to open logs directory
         }
         
-		ServeHeader(pFile, 200, PSTR("OK"), false);  // note: no caching on logs directory rendering        
+		ServeHeader(pFile, 200, PSTR("OK"), WEB_CACHE_NOCACHE);  // note: no caching on logs directory rendering        
         fprintf_P( pFile, PSTR("<html>\n<head>\n<title>SmartGarden Logs</title></head>\n<body>\n<div style=\"text-align: center\"><h2>SmartGarden System</h2>\n<h3>Directory listing of /logs</h3></div>\n"));
 		fprintf_P( pFile, PSTR("<p><b>System Logs:</b><p>\n")); 
         
@@ -750,8 +1818,6 @@ void Logging::LogsHandler(char *sPage, FILE *pFile, EthernetClient client)
 	   }
 
 
-		SdFile logfile;
-
 		if( !logfile.open(path, O_READ) ){
 
 			TRACE_ERROR(F("Cannot open %s file or directory\n"), path);
@@ -761,7 +1827,7 @@ void Logging::LogsHandler(char *sPage, FILE *pFile, EthernetClient client)
 
 		if( logfile.isDir() )
 		{
-			ServeHeader(pFile, 200, PSTR("OK"), false);  // note: no caching on logs directory rendering
+			ServeHeader(pFile, 200, PSTR("OK"), WEB_CACHE_NOCACHE);  // note: no caching on logs directory rendering
 			fprintf_P( pFile, PSTR("<html>\n<head>\n<title>SmartGarden Logs</title></head>\n<body>\n<div style=\"text-align: center\"><h2>SmartGarden System</h2>\n<h3>Directory listing of %s</h3></div>\n"), sPage);
 			
 			emitDirectoryListing(logfile, path, pFile);
@@ -773,44 +1839,320 @@ void Logging::LogsHandler(char *sPage, FILE *pFile, EthernetClient client)
 
 //			TRACE_ERROR(F("Serving log file: %s\n"), path);
 
-			ServeFile(pFile, sPage, logfile, client);
-			logfile.close();
+			ServeFile(pFile, sPage, logfile, client, false, logDataSize(logfile));		// note: ServeFile closes the file once it is sent
 	   }
    }
 #endif //HW_ENABLE_SD
 }
 
+// Length of log data in the file.
+// Pre-allocated contiguous log files are padded up to their full size, for them the end of data is located
+//  the same way as when the file is opened for writing. This way range requests for the tail of the log get the latest records.
+uint32_t Logging::logDataSize(SdFile & f)
+{
+	uint32_t	size = f.fileSize();
+
+#if defined(HW_ENABLE_SD) && defined(SG_LOG_CONTIGUOUS)
+	ContigLogSlot	slot;
+	char			c = 0;
+
+	fat_read = true;
+
+	// quick check - if the last byte is not padding, the whole file is data
+	if( (size == 0) || !f.seekSet(size-1) || (f.read(&c, 1) != 1) || !LOG_IS_PADDING(&c) )
+	{
+		f.seekSet(0);
+		return size;
+	}
+	f.seekSet(0);
+
+	if( f.contiguousRange(&slot.bgnBlock, &slot.endBlock) )
+	{
+		slot.endBlock = slot.bgnBlock + (size-1)/CLOG_BLOCK_SIZE;		// the last cluster may be longer than the file
+		if( clogRecover(&slot) && (slot.wrPos < size) )
+			size = slot.wrPos;
+	}
+#endif //HW_ENABLE_SD && SG_LOG_CONTIGUOUS
+
+	return size;
+}
+
+#ifdef HW_ENABLE_SD
+// Emit one data point of the sensor log. Time is in JavaScript format (milliseconds), time_t * 1000 does not fit into 32 bits
+// so it is written as seconds followed by "000".
+static void jsonSensorPoint(JsonWriter & jw, time_t t, int value)
+{
+		jw.BeginArray();
+		jw.NumberU(t);
+		jw.RawP(PSTR("000"));
+		jw.Number(value);
+		jw.EndArray();
+}
+
+// Min/max per bucket downsampling of the sensor series.
+//
+// Requested time span is split into points/2 equal buckets, and for each bucket only the lowest and the highest
+// readings are emitted (in time order), so peaks and dips of the chart are preserved while the number of points is bounded.
+// Points arrive in time order, so only the current bucket is kept.
+static void dsInit(SensorDownsampler & ds, time_t start, time_t end, uint16_t points)
+{
+		ds.start = start;
+		ds.width = 0;
+		ds.bucket = -1;
+		if( points == 0 )
+				return;
+
+		uint16_t nbuckets = (points < 2) ? 1 : points/2;
+		ds.width = (end - start + nbuckets - 1) / nbuckets;
+		if( ds.width == 0 )
+				ds.width = 1;
+}
+
+static void dsFlush(JsonWriter & jw, SensorDownsampler & ds)
+{
+		if( ds.bucket < 0 )
+				return;
+
+		if( ds.tMin == ds.tMax )
+				jsonSensorPoint(jw, ds.tMin, ds.vMin);
+		else if( ds.tMin < ds.tMax )
+		{
+				jsonSensorPoint(jw, ds.tMin, ds.vMin);
+				jsonSensorPoint(jw, ds.tMax, ds.vMax);
+		}
+		else
+		{
+				jsonSensorPoint(jw, ds.tMax, ds.vMax);
+				jsonSensorPoint(jw, ds.tMin, ds.vMin);
+		}
+		ds.bucket = -1;
+}
+
+static void dsPoint(JsonWriter & jw, SensorDownsampler & ds, time_t t, int value)
+{
+		if( ds.width == 0 )
+		{
+				jsonSensorPoint(jw, t, value);
+				return;
+		}
+
+		long bucket = (t > ds.start) ? (t - ds.start) / ds.width : 0;
+		if( bucket != ds.bucket )
+		{
+				dsFlush(jw, ds);
+				ds.bucket = bucket;
+				ds.tMin = ds.tMax = t;
+				ds.vMin = ds.vMax = value;
+		}
+		else if( value < ds.vMin )
+		{
+				ds.tMin = t;	ds.vMin = value;
+		}
+		else if( value > ds.vMax )
+		{
+				ds.tMax = t;	ds.vMax = value;
+		}
+}
+#endif //HW_ENABLE_SD
+
+// JSON response cache
+
+int8_t Logging::cacheLookup(uint32_t key, uint8_t log_type, char *fname)
+{
+#ifndef HW_ENABLE_SD
+	return -1;
+#else
+	if( !logger_ready || (log_type == 0) || (log_type > LOG_TYPE_PRESSURE) )
+		return -1;
+
+	int8_t i = jcacheFind(key, log_type);
+	if( i < 0 )
+		return -1;
+
+	if( _jcache[i].gen != log_gen[log_type] )		// log changed since the response was cached
+	{
+		jcacheDrop(i);
+		return -1;
+	}
+
+	_jcache[i].readers++;
+	sprintf_P(fname, PSTR(JCACHE_FNAME_FORMAT), key);
+	return i;
+#endif //HW_ENABLE_SD
+}
+
+void Logging::cacheRelease(int8_t entry)
+{
+#ifdef HW_ENABLE_SD
+	if( (entry < 0) || (entry >= LOG_JCACHE_ENTRIES) || (_jcache[entry].readers == 0) )
+		return;
+
+	_jcache[entry].readers--;
+	if( (_jcache[entry].readers == 0) && (_jcache[entry].log_type == 0) )
+		jcacheRemove(_jcache[entry].key);		// entry was dropped while the file was being sent
+#endif //HW_ENABLE_SD
+}
+
+bool Logging::cacheCreate(uint32_t key, uint8_t log_type, SdFile & f)
+{
+#ifndef HW_ENABLE_SD
+	return false;
+#else
+	char fname[JCACHE_FNAME_SIZE];
+
+	if( !logger_ready || (log_type == 0) || (log_type > LOG_TYPE_PRESSURE) )
+		return false;
+
+	int8_t i = jcacheFind(key, log_type);
+	if( i >= 0 )
+		jcacheDrop(i);
+
+	if( jcacheBusy(key) )		// old copy is still being sent - don't truncate it under the reader
+		return false;
+
+	sprintf_P(fname, PSTR(JCACHE_FNAME_FORMAT), key);
+	return f.open(fname, O_RDWR | O_CREAT | O_TRUNC);
+#endif //HW_ENABLE_SD
+}
+
+int8_t Logging::cacheCommit(uint32_t key, uint8_t log_type, uint16_t gen, SdFile & f, bool bOK)
+{
+#ifndef HW_ENABLE_SD
+	return -1;
+#else
+	if( !f.isOpen() )
+		return -1;
+
+	if( !f.sync() || !bOK || !f.seekSet(0) )
+	{
+		f.close();
+		jcacheRemove(key);		// incomplete response
+		return -1;
+	}
+
+	uint8_t i;
+	for( i=0; i<LOG_JCACHE_ENTRIES; i++ )
+		if( (_jcache[i].log_type == 0) && (_jcache[i].readers == 0) )
+			break;
+
+	if( i == LOG_JCACHE_ENTRIES )		// cache is full, replace the oldest entry that is not being sent
+	{
+		uint8_t n;
+		for( n=0; n<LOG_JCACHE_ENTRIES; n++ )
+		{
+			i = _jcacheNext;
+			_jcacheNext = (_jcacheNext + 1) % LOG_JCACHE_ENTRIES;
+			if( _jcache[i].readers == 0 )
+				break;
+		}
+		if( n == LOG_JCACHE_ENTRIES )		// all entries are busy, don't cache this response
+		{
+			f.close();
+			jcacheRemove(key);
+			return -1;
+		}
+		jcacheDrop(i);
+	}
+
+	_jcache[i].key = key;
+	_jcache[i].gen = gen;
+	_jcache[i].log_type = log_type;
+	_jcache[i].readers = 1;
+	return i;
+#endif //HW_ENABLE_SD
+}
+
+bool Logging::cacheScratch(uint8_t n, SdFile & f)
+{
+#ifndef HW_ENABLE_SD
+	return false;
+#else
+	char fname[JCACHE_FNAME_SIZE];
+
+	if( !logger_ready )
+		return false;
+
+	sprintf_P(fname, PSTR(JCACHE_SCRATCH_FNAME_FORMAT), n);
+	return f.open(fname, O_RDWR | O_CREAT | O_TRUNC);
+#endif //HW_ENABLE_SD
+}
+
+void Logging::cacheInvalidate(uint8_t log_type)
+{
+	if( (log_type != 0) && (log_type <= LOG_TYPE_PRESSURE) )
+		log_gen[log_type]++;
+}
+
+uint8_t Logging::sensorLogType(uint8_t sensor_type)
+{
+	switch( sensor_type )
+	{
+	case SENSOR_TYPE_TEMPERATURE:	return LOG_TYPE_TEMPERATURE;
+	case SENSOR_TYPE_PRESSURE:		return LOG_TYPE_PRESSURE;
+	case SENSOR_TYPE_HUMIDITY:		return LOG_TYPE_HUMIDITY;
+	case SENSOR_TYPE_WATERFLOW:		return LOG_TYPE_WATERFLOW;
+	default:						return 0;
+	}
+}
+
+void Logging::scanBegin(LogScan & scan, time_t start, time_t end, time_t since, char sensor_type, int sensor_id, char summary_type, uint16_t points)
+{
+        scanBegin(scan, start, end, since);
+
+        memset(&scan.sensor, 0, sizeof(scan.sensor));
+        scan.sensor.sensor_type = sensor_type;
+        scan.sensor.sensor_id = sensor_id;
+        scan.sensor.summary_type = summary_type;
+        scan.sensor.bHeader = true;
+#ifdef HW_ENABLE_SD
+        dsInit(scan.sensor.ds, scan.start, scan.end, points);
+#endif //HW_ENABLE_SD
+}
+
 // emit sensor log as JSON
-bool Logging::EmitSensorLog(FILE* stream_file, time_t start, time_t end, char sensor_type, int sensor_id, char summary_type)
+bool Logging::EmitSensorLog(JsonWriter & jw, LogScan & scan)
 {
 #ifndef HW_ENABLE_SD
 	  return false;
 #else 
         char tmp_buf[MAX_LOG_RECORD_SIZE];
         char *sensor_name;
+        uint8_t records = 0;
+        char sensor_type = scan.sensor.sensor_type;
+        int sensor_id = scan.sensor.sensor_id;
+        char summary_type = scan.sensor.summary_type;
+        uint8_t log_type = sensorLogType(sensor_type);
 
-        if (start == 0)
-                start = now();
+        if( scan.bDone )
+              return false;
 
-        end = max(start,end) + 24*3600;  // add 1 day to end time.
+        fat_read = true;
 
-        int    nyear, nyearend=year(end), nyearstart=year(start);
-        int    nmonth, nmend = month(end), nmstart=month(start);
-        int    ndayend = day(end), ndaystart=day(start);
+        int    nyearend=year(scan.end);
+        int    nmend = month(scan.end), nmstart=month(scan.start);
+        int    ndayend = day(scan.end), ndaystart=day(scan.start);
 
-        char bFirstRow = true, bHeader = true;
+//  TRACE_ERROR(F("EmitSensorLog - entering, nyear=%d, nmonth=%d, ndaystart=%d, nyearend=%d, nmend=%d, ndayend=%d\n"), scan.nyear, scan.nmonth, ndaystart, nyearend, nmend, ndayend );
 
-//  TRACE_ERROR(F("EmitSensorLog - entering, nyearstart=%d, nmstart=%d, ndaystart=%d, nyearend=%d, nmend=%d, ndayend=%d\n"), nyearstart, nmstart, ndaystart, nyearend, nmend, ndayend );
-
-        fprintf_P(stream_file, PSTR("\"series\": ["));   // JSON opening header
+        if( !scan.sensor.bStarted )
+        {
+              jw.Key(PSTR("series"));   // JSON opening header
+              jw.BeginArray();
+              scan.sensor.bStarted = true;
+        }
 
-        for( nyear=nyearstart; nyear<=nyearend; nyear++ )
+        for( ; scan.nyear<=nyearend; scan.nyear++, scan.nmonth = nmstart )
         {
-          for( nmonth=nmstart; nmonth<=nmend; nmonth++ )
+          for( ; scan.nmonth<=nmend; scan.nmonth++, scan.pos = 0 )
             {
+                int nyear = scan.nyear, nmonth = scan.nmonth;
 
 //  TRACE_ERROR(F("EmitSensorLog - processing month=%d\n"), nmonth );
 
+                if( records >= LOG_SCAN_RECORDS )
+                       return true;
+                records++;
+
                 if( sensor_type == SENSOR_TYPE_TEMPERATURE )
                 {
                        sprintf_P(tmp_buf, PSTR(TEMPERATURE_LOG_FNAME_FORMAT), nmonth, nyear%100, sensor_id );
@@ -834,6 +2176,8 @@ bool Logging::EmitSensorLog(FILE* stream_file, time_t start, time_t end, char se
                 else  
                 {
                      SYSEVT_ERROR(F("EmitSensorLog - requested sensor type not recognized\n"));
+                     jw.EndArray();
+                     scan.bDone = true;
                      return false;
                 }
 
@@ -841,15 +2185,26 @@ bool Logging::EmitSensorLog(FILE* stream_file, time_t start, time_t end, char se
                 {
 
 // OK, we opened the data file.
-                
-                    long int  sensor_sum = 0;
-                    long int  sensor_c = 0;
-                    int          sensor_stamp = -1;
-                    int          sensor_stamp_h, sensor_stamp_d, sensor_stamp_m, sensor_stamp_y;                    
-
-                    sensor_stamp_h = -1, sensor_stamp_d = sensor_stamp_m = sensor_stamp_y = -1;
-
-                    lfile.fgets(tmp_buf, MAX_LOG_RECORD_SIZE-1);  // skip first line in the file - column headers
+                    if( scan.pos == 0 )
+                    {
+                          scan.sensor.sum = 0;
+                          scan.sensor.count = 0;
+                          scan.sensor.stamp = -1;
+                          scan.sensor.stamp_d = scan.sensor.stamp_m = scan.sensor.stamp_y = -1;
+                          scan.sensor.last_day = scan.sensor.last_hour = scan.sensor.last_minute = 0;
+                          scan.sensor.bEmitted = false;
+                          scan.sensor.open_t = 0;
+                          scan.sensor.open_pos = 0;
+                          scan.hint_t = 0;
+                          scan.hint_pos = 0;
+
+                          if( seekHintApply(lfile, log_type, sensor_id, nmonth, nyear, scan.since) )
+                                scan.hint_t = scan.since;
+                          else
+                                lfile.fgets(tmp_buf, MAX_LOG_RECORD_SIZE-1);  // skip first line in the file - column headers
+                    }
+                    else
+                          lfile.seekSet(scan.pos);      // continue where the previous step stopped
 
 // OK, we opened required watering log file. Iterate over records, filtering out necessary dates range
                   
@@ -857,9 +2212,18 @@ bool Logging::EmitSensorLog(FILE* stream_file, time_t start, time_t end, char se
 
                             int  nday = 0, nhour = 0, nminute = 0;
                             int  sensor_reading = 0;
+                            uint32_t  rec_pos = lfile.curPosition();
+
+                            if( records >= LOG_SCAN_RECORDS )
+                            {
+                                    scan.pos = rec_pos;
+                                    lfile.close();
+                                    return true;
+                            }
+                            records++;
 
                             int bytes = lfile.fgets(tmp_buf, MAX_LOG_RECORD_SIZE);
-                            if (bytes <= 0)
+                            if( (bytes <= 0) || LOG_IS_PADDING(tmp_buf) )
                                        break;
 
 // Parse the string into fields. First field (up to two digits) is the day of the month
@@ -870,132 +2234,168 @@ bool Logging::EmitSensorLog(FILE* stream_file, time_t start, time_t end, char se
                             if( (nmonth > nmend) || ((nmonth == nmend) && (nday > ndayend)) )    // check for the end date
                                          break;
 
+                            scan.hint_pos = lfile.curPosition();
+                            scan.sensor.last_day = nday;  scan.sensor.last_hour = nhour;  scan.sensor.last_minute = nminute;
+
+                            if( scan.since != 0 )
+                            {
+                                    tmElements_t tm;   tm.Day = nday;  tm.Month = nmonth; tm.Year = nyear - 1970;  tm.Hour = nhour;  tm.Minute = nminute;  tm.Second = 0;
+                                    if( makeTime(tm) <= scan.since )
+                                            continue;       // reading was already sent
+                            }
+
                             if( (nmonth > nmstart) || ((nmonth == nmstart) && (nday >= ndaystart) )  ){        // the record is within required range. nmonth is the month, nday is the day of the month, xzone is the zone we are currently emitting
 
 // we have something to output.
+                                    scan.sensor.bEmitted = true;
 
-                                    if( bHeader ){
+                                    if( scan.sensor.bHeader ){
                                       
-                                         fprintf_P(stream_file, PSTR("{\n\t\t\t \"name\": \"%S readings, Sensor: %d\", \n\t\t\t\t \"data\": [\n"), sensor_name, sensor_id);   // JSON series header
-                                         bHeader = false;
-                                         bFirstRow = true;
+                                         sprintf_P(tmp_buf, PSTR("%S readings, Sensor: %d"), sensor_name, sensor_id);
+                                         jw.BeginObject();   // JSON series header
+                                         jw.Key(PSTR("name"));	jw.String(tmp_buf);
+                                         jw.Key(PSTR("data"));
+                                         jw.BeginArray();
+                                         scan.sensor.bHeader = false;
                                     }
 
                                     if( summary_type == LOG_SUMMARY_HOUR )
                                     {
-                                           if( sensor_stamp == -1 )    // this is the very first record, start generating summary
+                                           if( scan.sensor.stamp == -1 )    // this is the very first record, start generating summary
                                            {
-                                                 sensor_sum = sensor_reading;
-                                                 sensor_c      = 1;
-                                                 sensor_stamp = nhour;
-                                                 sensor_stamp_d = nday;  sensor_stamp_m = nmonth; sensor_stamp_y = nyear;
+                                                 scan.sensor.sum = sensor_reading;
+                                                 scan.sensor.count = 1;
+                                                 scan.sensor.stamp = nhour;
+                                                 scan.sensor.stamp_d = nday;  scan.sensor.stamp_m = nmonth; scan.sensor.stamp_y = nyear;
                                            }
-                                           else if( (sensor_stamp == nhour) && (sensor_stamp_d == nday) && (sensor_stamp_m == nmonth) && (sensor_stamp_y == nyear) )   // continue accumulation current sum
+                                           else if( (scan.sensor.stamp == nhour) && (scan.sensor.stamp_d == nday) && (scan.sensor.stamp_m == nmonth) && (scan.sensor.stamp_y == nyear) )   // continue accumulation current sum
                                            {                                             
-                                                 sensor_sum += sensor_reading;
-                                                 sensor_c++;
+                                                 scan.sensor.sum += sensor_reading;
+                                                 scan.sensor.count++;
                                            }
                                            else   // close previous sum and start a new one
                                            {
-                                                int sensor_average = int(sensor_sum/sensor_c);
+                                                int sensor_average = int(scan.sensor.sum/scan.sensor.count);
 
-                                                tmElements_t tm;   tm.Day = sensor_stamp_d;  tm.Month = sensor_stamp_m; tm.Year = sensor_stamp_y - 1970;  tm.Hour = sensor_stamp;  tm.Minute = 0;  tm.Second = 0;
-                                                fprintf_P(stream_file, PSTR("%s \n\t\t\t\t\t [ %lu000, %d ]"),
-                                                                                              bFirstRow ? "":",",
-                                                                                              makeTime(tm), sensor_average );   // note: month should be in JavaScript format (starting from 0)
-                                                bFirstRow = false;
+                                                tmElements_t tm;   tm.Day = scan.sensor.stamp_d;  tm.Month = scan.sensor.stamp_m; tm.Year = scan.sensor.stamp_y - 1970;  tm.Hour = scan.sensor.stamp;  tm.Minute = 0;  tm.Second = 0;
+                                                dsPoint(jw, scan.sensor.ds, makeTime(tm), sensor_average);
    
-                                                 sensor_sum = sensor_reading;   // start new sum
-                                                 sensor_c      = 1;
-                                                 sensor_stamp = nhour;
-                                                 sensor_stamp_d = nday;  sensor_stamp_m = nmonth; sensor_stamp_y = nyear;
+                                                 scan.sensor.sum = sensor_reading;   // start new sum
+                                                 scan.sensor.count = 1;
+                                                 scan.sensor.stamp = nhour;
+                                                 scan.sensor.stamp_d = nday;  scan.sensor.stamp_m = nmonth; scan.sensor.stamp_y = nyear;
                                            }
                                     }
                                     else if( summary_type == LOG_SUMMARY_DAY )
                                     {
-                                           if( sensor_stamp == -1 )    // this is the very first record, start generating summary
+                                           if( scan.sensor.stamp == -1 )    // this is the very first record, start generating summary
                                            {
-                                                 sensor_sum = sensor_reading;
-                                                 sensor_c      = 1;
-                                                 sensor_stamp = nday;
-                                                 sensor_stamp_m = nmonth; sensor_stamp_y = nyear;
+                                                 scan.sensor.sum = sensor_reading;
+                                                 scan.sensor.count = 1;
+                                                 scan.sensor.stamp = nday;
+                                                 scan.sensor.stamp_m = nmonth; scan.sensor.stamp_y = nyear;
                                            }
-                                           else if( (sensor_stamp == nday) && (sensor_stamp_m == nmonth) && (sensor_stamp_y == nyear) )   // continue accumulation current sum
+                                           else if( (scan.sensor.stamp == nday) && (scan.sensor.stamp_m == nmonth) && (scan.sensor.stamp_y == nyear) )   // continue accumulation current sum
                                            {                                             
-                                                 sensor_sum += sensor_reading;
-                                                 sensor_c++;
+                                                 scan.sensor.sum += sensor_reading;
+                                                 scan.sensor.count++;
                                            }
                                            else   // close previous sum and start a new one
                                            {
-                                                int sensor_average = (int)(sensor_sum/sensor_c);
+                                                int sensor_average = (int)(scan.sensor.sum/scan.sensor.count);
                                                 
-                                                tmElements_t tm;   tm.Day = sensor_stamp;  tm.Month = sensor_stamp_m; tm.Year = sensor_stamp_y - 1970;  tm.Hour = 0;  tm.Minute = 0;  tm.Second = 0;
-
-                                                fprintf_P(stream_file, PSTR("%s \n\t\t\t\t\t [ %lu000, %d ]"),
-                                                                                              bFirstRow ? "":",",
-                                                                                              makeTime(tm), sensor_average );   // note: month should be in JavaScript format (starting from 0)
+                                                tmElements_t tm;   tm.Day = scan.sensor.stamp;  tm.Month = scan.sensor.stamp_m; tm.Year = scan.sensor.stamp_y - 1970;  tm.Hour = 0;  tm.Minute = 0;  tm.Second = 0;
 
-                                                bFirstRow = false;
+                                                dsPoint(jw, scan.sensor.ds, makeTime(tm), sensor_average);
    
-                                                 sensor_sum = sensor_reading;   // start new sum
-                                                 sensor_c      = 1;
-                                                 sensor_stamp = nday;
-                                                 sensor_stamp_m = nmonth; sensor_stamp_y = nyear;
+                                                 scan.sensor.sum = sensor_reading;   // start new sum
+                                                 scan.sensor.count = 1;
+                                                 scan.sensor.stamp = nday;
+                                                 scan.sensor.stamp_m = nmonth; scan.sensor.stamp_y = nyear;
                                            }
                                     }
                                     else if( summary_type == LOG_SUMMARY_MONTH )
                                     {
-                                           if( sensor_stamp == -1 )    // this is the very first record, start generating summary
+                                           if( scan.sensor.stamp == -1 )    // this is the very first record, start generating summary
                                            {
-                                                 sensor_sum = sensor_reading;
-                                                 sensor_c      = 1;
-                                                 sensor_stamp = nmonth;
-                                                 sensor_stamp_y = nyear;
+                                                 scan.sensor.sum = sensor_reading;
+                                                 scan.sensor.count = 1;
+                                                 scan.sensor.stamp = nmonth;
+                                                 scan.sensor.stamp_y = nyear;
                                            }
-                                           else if( (sensor_stamp == nmonth) && (sensor_stamp_y == nyear) )   // continue accumulation current sum
+                                           else if( (scan.sensor.stamp == nmonth) && (scan.sensor.stamp_y == nyear) )   // continue accumulation current sum
                                            {                                             
-                                                 sensor_sum += sensor_reading;
-                                                 sensor_c++;
+                                                 scan.sensor.sum += sensor_reading;
+                                                 scan.sensor.count++;
                                            }
                                            else   // close previous sum and start a new one
                                            {
-                                                int sensor_average = int(sensor_sum/sensor_c);
+                                                int sensor_average = int(scan.sensor.sum/scan.sensor.count);
 
-                                                tmElements_t tm;   tm.Day = 0;  tm.Month = sensor_stamp; tm.Year = sensor_stamp_y - 1970;  tm.Hour = 0;  tm.Minute = 0;  tm.Second = 0;
-                                                fprintf_P(stream_file, PSTR("%s \n\t\t\t\t\t [ %lu000, %d ]"),
-                                                                                              bFirstRow ? "":",",
-                                                                                              makeTime(tm), sensor_average );  
-                                                bFirstRow = false;
+                                                tmElements_t tm;   tm.Day = 0;  tm.Month = scan.sensor.stamp; tm.Year = scan.sensor.stamp_y - 1970;  tm.Hour = 0;  tm.Minute = 0;  tm.Second = 0;
+                                                dsPoint(jw, scan.sensor.ds, makeTime(tm), sensor_average);
    
-                                                 sensor_sum = sensor_reading;   // start new sum
-                                                 sensor_c      = 1;
-                                                 sensor_stamp = nmonth;
-                                                 sensor_stamp_y = nyear;
+                                                 scan.sensor.sum = sensor_reading;   // start new sum
+                                                 scan.sensor.count = 1;
+                                                 scan.sensor.stamp = nmonth;
+                                                 scan.sensor.stamp_y = nyear;
                                            }
                                     }
                                     else  
                                     {  // no summarization, just output readings as-is
 
                                                 tmElements_t tm;   tm.Day = nday;  tm.Month = nmonth; tm.Year = nyear - 1970;  tm.Hour = nhour;  tm.Minute = nminute;  tm.Second = 0;
-                                                fprintf_P(stream_file, PSTR("%s \n\t\t\t\t\t [ %lu000, %d ]"),
-                                                                                              bFirstRow ? "":",",
-                                                                                              makeTime(tm), sensor_reading );  
-                                    
-                                                bFirstRow = false;
+                                                dsPoint(jw, scan.sensor.ds, makeTime(tm), sensor_reading);
+                                    }
+
+                                    if( (summary_type != LOG_SUMMARY_NONE) && (scan.sensor.count == 1) )    // the reading started new summary bucket
+                                    {
+                                                tmElements_t tm;   tm.Day = (summary_type == LOG_SUMMARY_MONTH) ? 1 : nday;  tm.Month = nmonth; tm.Year = nyear - 1970;
+                                                tm.Hour = (summary_type == LOG_SUMMARY_HOUR) ? nhour : 0;  tm.Minute = 0;  tm.Second = 0;
+                                                scan.sensor.open_t = makeTime(tm);
+                                                scan.sensor.open_pos = rec_pos;
                                     }
                             }  
                      }   // while
                      lfile.close();
+
+                     if( scan.hint_pos != 0 )    // readings are in time order, the last one is the newest
+                     {
+                           tmElements_t tm;   tm.Day = scan.sensor.last_day;  tm.Month = nmonth; tm.Year = nyear - 1970;
+                           tm.Hour = scan.sensor.last_hour;  tm.Minute = scan.sensor.last_minute;  tm.Second = 0;
+                           time_t  last_time = makeTime(tm);
+                           time_t  open_t = scan.sensor.open_t;
+
+                           if( open_t != 0 )    // the last bucket is not emitted, next "since" query has to read it from its start
+                           {
+                                 if( open_t > scan.since )    // otherwise the bucket started before since, hwm stays
+                                 {
+                                       seekHintSave(log_type, sensor_id, nmonth, nyear, open_t - 1, scan.sensor.open_pos);
+                                       if( scan.sensor.bEmitted )
+                                             scan.hwm = max(scan.hwm, open_t - 1);
+                                 }
+                           }
+                           else
+                           {
+                                 seekHintSave(log_type, sensor_id, nmonth, nyear, max(scan.hint_t, last_time), scan.hint_pos);
+                                 if( scan.sensor.bEmitted )
+                                       scan.hwm = max(scan.hwm, last_time);
+                           }
+                     }
                 }  // file open
-            }  //for( nmonth=nmstart; nmonth<=nmend; nmonth++ )
-        }  //for( nyear=nyearstart; nyear<=nyearend; nyear++ )
+            }  //for( ; scan.nmonth<=nmend; scan.nmonth++ )
+        }  //for( ; scan.nyear<=nyearend; scan.nyear++ )
 
-        if( !bHeader )   // header flag was reset, it means we output at least one line
+        if( !scan.sensor.bHeader )   // header flag was reset, it means we output at least one line
         {
-               fprintf_P(stream_file, PSTR("\n\t\t\t\t ] \n \t }]\n"));
+               dsFlush(jw, scan.sensor.ds);
+               jw.EndArray();
+               jw.EndObject();
         }
+        jw.EndArray();
 
-    return true; 
+        scan.bDone = true;
+        return false; 
 #endif //HW_ENABLE_SD
 }
 
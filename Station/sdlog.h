@@ -20,6 +20,7 @@ Copyright 2014 tony-osp (http://tony-osp.dreamwidth.org/)
 #include "port.h"
 #include <Time.h>
 #include "SGRProtocol.h"
+#include "jsonwriter.h"
 
 //
 // Log directories
@@ -56,6 +57,12 @@ Copyright 2014 tony-osp (http://tony-osp.dreamwidth.org/)
 #define PRESSURE_LOG_DIR_LEN	  13
 #define PRESSURE_LOG_FNAME_FORMAT "/pressure.log/pre%2.2u-%2.2u.%3.3u"
 
+// JSON response cache directory and file name format (KKKKKKKK.jsn, K - query key)
+#define JCACHE_DIR				"/jcache"
+#define JCACHE_FNAME_FORMAT		"/jcache/%8.8lX.jsn"
+#define JCACHE_FNAME_SIZE		22
+#define JCACHE_SCRATCH_FNAME_FORMAT	"/jcache/gen%u.jsn"	// responses that are not cached, one file per web connection
+
 
 #ifdef notdef
 
@@ -150,6 +157,62 @@ void syslog_evt(uint8_t event_type, const __FlashStringHelper * fmt, ...);
 #define LOG_TYPE_PRESSURE				6
 
 
+// Min/max per bucket downsampling state of the sensor series (see EmitSensorLog())
+struct SensorDownsampler
+{
+		time_t		start;
+		time_t		width;				// bucket width, seconds. 0 - downsampling is off
+		long		bucket;				// current bucket, -1 if none
+		time_t		tMin, tMax;
+		int			vMin, vMax;
+};
+
+// Log query scan.
+// Log queries are emitted in steps of up to LOG_SCAN_RECORDS records, the scan keeps the position between the steps.
+// Log file is closed between the steps, the scan continues from the remembered position.
+struct LogScan
+{
+		time_t		start;
+		time_t		end;				// end of the range (end date plus one day)
+		time_t		since;				// emit only records newer than since
+		time_t		hwm;				// time of the newest emitted record (or since)
+		uint16_t	nyear;				// current log file
+		uint8_t		nmonth;
+		uint32_t	pos;				// position of the next record in the current file, 0 - the file is not opened yet
+		time_t		hint_t;				// seek hint of the current file, saved when the file is done
+		uint32_t	hint_pos;
+		bool		bDone;				// scan is complete
+
+		union
+		{
+			struct						// TableZone()
+			{
+				int			xsched;		// schedule of the open group of entries, -1 if none
+				time_t		prev_evtEnd;
+			} zone;
+			struct						// TableSchedule()
+			{
+				uint8_t		last_month, last_day, last_hour, last_minute;
+			} sched;
+			struct						// EmitSensorLog()
+			{
+				char		sensor_type;
+				int			sensor_id;
+				char		summary_type;
+				bool		bStarted;	// "series" array is opened
+				bool		bHeader;	// series header is not emitted yet
+				bool		bEmitted;	// current file - a reading was emitted
+				long		sum;		// current file - summary bucket being accumulated
+				long		count;
+				int			stamp, stamp_d, stamp_m, stamp_y;
+				uint8_t		last_day, last_hour, last_minute;
+				time_t		open_t;		// current file - start of the summary bucket that is not closed yet (it is not emitted)
+				uint32_t	open_pos;	// file position of its first reading
+				SensorDownsampler	ds;
+			} sensor;
+		};
+};
+
 
 class Logging
 {
@@ -159,32 +222,78 @@ public:
         ~Logging();
         bool begin(void);
         void Close();
+		// Periodic processing - SD card re-initialization and draining of spooled log records. Expected to be called once per second.
+		void loop(void);
         // Watering activity logging. Note: signature is deliberately compatible with sprinklers_pi control program
         bool LogZoneEvent(time_t start, int zone, int duration, uint16_t water_used, int schedule, int sadj, int wunderground);
 		// Log whole schedule event
 		bool LogSchedEvent(time_t start, int duration, uint16_t water_used, int schedule, int sadj, int wunderground);
 
+        // Start log query scan of the records from start to end date. since - emit only records newer than since (0 - all records in the range),
+        // scan.hwm is the time of the newest emitted record when the scan is complete.
+        void scanBegin(LogScan & scan, time_t start, time_t end, time_t since);
+        // Start sensor log scan. points - if not 0, the series is downsampled to at most that many points (see SensorDownsampler)
+        void scanBegin(LogScan & scan, time_t start, time_t end, time_t since, char sensor_type, int sensor_id, char summary_type, uint16_t points);
+
+        // Scan steps. Each call emits the next part of the query, returns true if the scan is not complete yet.
         // Emit zone log watering data 
-        bool TableZone(FILE* stream_file, time_t start, time_t end);
+        bool TableZone(JsonWriter & jw, LogScan & scan);
 
         // Emit schedue watering data suitable for putting into a table
-        bool TableSchedule(FILE* stream_file, time_t start, time_t end);
+        bool TableSchedule(JsonWriter & jw, LogScan & scan);
 
         // Sensors logging. It covers all types of basic sensors (e.g. temperature, pressure etc) that provide momentarily (immediate) readings
         bool LogSensorReading(uint8_t sensor_type, int sensor_id, int32_t sensor_reading);
 
-	bool EmitSensorLog(FILE* stream_file, time_t sdate, time_t edate, char sensor_type, int sensor_id, char summary_type);
+	bool EmitSensorLog(JsonWriter & jw, LogScan & scan);
         
         void HandleWebRq(char *sPage, FILE *pFile);
-		void LogsHandler(char *sPage, FILE *stream_file, EthernetClient client);
+		void LogsHandler(char *sPage, FILE *stream_file, EthernetClient client, SdFile & logfile);
+		// Length of log data in the file (pre-allocated log files are longer than the data they hold)
+		uint32_t logDataSize(SdFile & f);
+
+		// JSON response cache.
+		// Responses to log queries are cached on the card, keyed by the query key. Each log type has a generation counter
+		// that is bumped when a record is written to the log of that type, cached responses built for an older generation are dropped.
+		// Cache file that is being sent is not removed or overwritten until the reader releases it.
+		int8_t cacheLookup(uint32_t key, uint8_t log_type, char *fname);	// entry of the valid cached response (fname is its file name), or -1
+		void cacheRelease(int8_t entry);									// reader of the entry returned by cacheLookup() is done
+		// Cached response is built over several main loop passes. It is stored for the log generation at its start (see cacheGen()),
+		// if the log changes in the meantime, the response is sent but not used again.
+		bool cacheCreate(uint32_t key, uint8_t log_type, SdFile & f);		// start new cached response
+		uint16_t cacheGen(uint8_t log_type)	{ return log_gen[log_type]; }	// current generation of the log type
+		// Complete cached response (or discard it if !bOK). Returns the entry (as cacheLookup()), the file stays open and is positioned
+		// at the start for sending. -1 if the response is discarded, the file is closed.
+		int8_t cacheCommit(uint32_t key, uint8_t log_type, uint16_t gen, SdFile & f, bool bOK);
+		bool cacheScratch(uint8_t n, SdFile & f);							// open scratch file n for a response that is not cached
+		void cacheInvalidate(uint8_t log_type);								// drop cached responses of the log type
+		uint8_t sensorLogType(uint8_t sensor_type);							// log type of the sensor type, 0 if none
 
 // Data
 		bool	logger_ready;
 		SdFile  lfile;
 
-private:
-
+		// RAM spool statistics
+		uint16_t	spool_records;		// number of records currently in the spool
+		uint16_t	spool_bytes;		// spool bytes in use
+		uint32_t	spool_dropped;		// records dropped because the spool was full or the record could not be written
+		uint16_t	sd_reinit_count;	// number of successful SD card re-initializations
+		bool		fat_read;			// log data was read through SdFat block cache since the last raw block write
 
+private:
+		uint8_t		sd_retry_timer;
+		uint16_t	log_gen[LOG_TYPE_PRESSURE+1];	// log generation counters, indexed by log type
+
+		// Write log records to the card. Records are either written directly, or drained from the RAM spool.
+		bool writeSysEvent(time_t t, const char *str);
+		bool writeSchedEvent(time_t t, time_t start, int duration, uint16_t water_used, int schedule, int sadj, int wunderground);
+		bool writeZoneEvent(time_t t, time_t start, int zone, int duration, uint16_t water_used, int schedule, int sadj, int wunderground);
+		bool writeSensorReading(time_t t, uint8_t sensor_type, int sensor_id, int32_t sensor_reading);
+
+#ifdef SG_LOG_CONTIGUOUS
+		// Append record to the pre-allocated contiguous log file
+		uint8_t contigAppend(uint8_t log_type, int log_id, time_t t, const char *header, const char *rec);
+#endif //SG_LOG_CONTIGUOUS
 };
 
 extern Logging sdlog;
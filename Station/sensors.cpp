@@ -33,6 +33,10 @@ Copyright 2014-2018 tony-osp (http://tony-osp.dreamwidth.org/)
 #include "TimerOne.h"
 #endif //SENSOR_ENABLE_COUNTERMETER
 
+#ifdef HW_ENABLE_ETHERNET
+#include "web.h"
+#endif //HW_ENABLE_ETHERNET
+
 #ifdef SENSOR_ENABLE_THERMISTOR
 #include "thermistor.h"
 #endif
@@ -96,8 +100,11 @@ byte Sensors::begin(void)
 				}
 				SensorsList[i].lastReading = 0;
 				SensorsList[i].lastReadingTimestamp = (time_t)(MAX_ULONG/2);
+				pushAge[i] = SENSOR_PUSH_NEVER;
 			}
 		}
+		pushPending = 0;
+		pushStations = pushedStations = 0;
 
 // generate the list of remote stations to poll
 
@@ -272,14 +279,25 @@ void Sensors::loop(void)
 //
 void Sensors::poll_MinTimer(void)
 {
+	bool	fPush = (GetEvtMasterFlags() & EVTMASTER_FLAGS_REPORT_SENSORS) ? true:false;	// we report our sensors to the EvtMaster on our own
+
 	pollMinutesCounter--;
 	if( pollMinutesCounter <= 0 )  // required repeat interval check
 	{
-			pollMinutesCounter = SENSORS_POLL_DEFAULT_REPEAT;	// reload counter
+			// with push reporting local sensors are sampled more often, report config decides what is sent
+			pollMinutesCounter = fPush ? SENSORS_PUSH_SAMPLE_REPEAT : SENSORS_POLL_DEFAULT_REPEAT;	// reload counter
 			nPoll = 0;
 	}
 
-	if( nPoll < numStationsToPoll  )			// we will poll remote sensors next minute after the local sensors. Signal to poll remote sensors will be set by the poll minutes counter logic above.
+	for( uint8_t i=0; i<GetNumSensors(); i++ )
+	{
+		if( pushAge[i] < SENSOR_PUSH_NEVER-1 )
+			pushAge[i]++;
+	}
+
+	uint16_t	pollMask = 0;			// remote stations to poll
+
+	while( nPoll < numStationsToPoll  )		// sample local sensors and poll all remote stations at once. Signal to poll will be set by the poll minutes counter logic above.
 	{
 		if( stationsToPollList[nPoll] == GetMyStationID() )	// poll local sensors
 		{
@@ -421,13 +439,110 @@ void Sensors::poll_MinTimer(void)
 		}
 		else
 		{
-			// poll remote stations
+			// poll remote stations. Stations that report sensors on their own are polled only if they were silent for the whole cycle.
+
+			uint16_t	stationBit = 1U << stationsToPollList[nPoll];
 
-			rprotocol.PollStationSensors(stationsToPollList[nPoll]);
+			if( (pushStations & pushedStations & stationBit) == 0 )
+				pollMask |= stationBit;
+
+			pushedStations &= ~stationBit;
 		}
 
 		nPoll++;
 	}
+
+	if( pollMask != 0 )
+		rprotocol.PollSensorsSlotted(pollMask);		// one broadcast request, stations reply in their own time slots
+
+	if( fPush )
+		PushSensorReports();
+}
+
+//
+// Sensors push reporting
+//
+// Remote station with EvtMaster subscribed to sensor events (EVTMASTER_FLAGS_REPORT_SENSORS) reports its sensors on its own,
+// using per-sensor report interval and deadband configured by the Master (FCODE_SENSORS_REPORTCFG_SET).
+// Sensors that are due are collected during the sampling cycle and sent in one FCODE_SENSORS_REPORT message.
+//
+// The Master keeps polling the station until the station confirms report config, and then polls it only if no report
+// came from the station for the whole polling cycle (e.g. the station was reset to defaults).
+//
+
+// Check if the local sensor is due to be reported
+bool Sensors::PushDue(uint8_t sensorID, int32_t sensorReading)
+{
+	uint8_t		interval = GetSensorReportInterval(sensorID);
+	uint16_t	deadband = GetSensorReportDeadband(sensorID);
+
+	if( (interval == 0) && (deadband == 0) )
+		return false;					// sensor is not reported
+
+	if( pushAge[sensorID] == SENSOR_PUSH_NEVER )
+		return true;
+
+	if( (interval != 0) && (pushAge[sensorID] >= interval) )
+		return true;
+
+	if( deadband != 0 )
+	{
+		int32_t		delta = int32_t(int16_t(sensorReading)) - pushedReading[sensorID];		// note: readings are 16bit on the wire
+
+		if( (delta >= deadband) || (delta <= -int32_t(deadband)) )
+			return true;
+	}
+
+	return false;
+}
+
+// Send pending sensor reports to the EvtMaster. Pending sensors are reported as one continuous range.
+void Sensors::PushSensorReports(void)
+{
+	uint8_t		first = MAX_SENSORS, last = 0;
+
+	if( pushPending == 0 )
+		return;
+
+	for( uint8_t i=0; i<MAX_SENSORS; i++ )
+	{
+		if( pushPending & (1U << i) )
+		{
+			if( first == MAX_SENSORS )
+				first = i;
+			last = i;
+		}
+	}
+	pushPending = 0;
+
+	TRACE_INFO(F("Pushing sensors %d-%d to station %d\n"), int(first), int(last), int(GetEvtMasterStationID()));
+
+	if( rprotocol.SendSensorsReport(0, GetMyStationID(), GetEvtMasterStationID(), first, last-first+1) )
+	{
+		for( uint8_t i=first; i<=last; i++ )
+		{
+			pushedReading[i] = int16_t(SensorsList[i].lastReading);
+			pushAge[i] = 0;
+		}
+	}
+}
+
+void Sensors::ResetSensorPush(uint8_t sensorID)
+{
+	if( sensorID < MAX_SENSORS )
+		pushAge[sensorID] = SENSOR_PUSH_NEVER;
+}
+
+void Sensors::EnableStationPush(uint8_t stationID)
+{
+	if( stationID < MAX_STATIONS )
+		pushStations |= (1U << stationID);
+}
+
+void Sensors::ReportStationPush(uint8_t stationID)
+{
+	if( stationID < MAX_STATIONS )
+		pushedStations |= (1U << stationID);
 }
 
 #ifdef SENSOR_ENABLE_BMP180
@@ -501,6 +616,9 @@ void Sensors::ReportSensorReading( uint8_t stationID, uint8_t sensorChannel, int
 				
 				SensorsList[i].lastReading = sensorReading;
 				SensorsList[i].lastReadingTimestamp = millis();
+#ifdef HW_ENABLE_ETHERNET
+				WebNotify(WEB_EVT_SENSOR, i);
+#endif //HW_ENABLE_ETHERNET
 
 				if( iLCDTempIndex == i )
 				{
@@ -511,13 +629,20 @@ void Sensors::ReportSensorReading( uint8_t stationID, uint8_t sensorChannel, int
 					Humidity = sensorReading;
 				}
 
-// Proactively report sensor reading to Master only for Watermeter counter and if the counter changed since last report. For all other sensor types let master poll
-				if( (SensorsList[i].config.sensorType == SENSOR_TYPE_WATERFLOW) && (SensorsList[i].lastReading != prevReading) )
+// Proactively report local sensor reading to Master. Watermeter counter is reported right away if the counter changed since last report,
+// other sensors are checked against report config and reported together at the end of the sampling cycle.
+				if( (stationID == GetMyStationID()) && (GetEvtMasterFlags() & EVTMASTER_FLAGS_REPORT_SENSORS) )
 				{
-					if( GetEvtMasterFlags() & EVTMASTER_FLAGS_REPORT_SENSORS )
+					if( SensorsList[i].config.sensorType == SENSOR_TYPE_WATERFLOW )
 					{
-						rprotocol.SendSensorsReport(0, GetMyStationID(), GetEvtMasterStationID(), i, 1);
+						if( (SensorsList[i].lastReading != prevReading) && rprotocol.SendSensorsReport(0, GetMyStationID(), GetEvtMasterStationID(), i, 1) )
+						{
+							pushedReading[i] = int16_t(sensorReading);
+							pushAge[i] = 0;
+						}
 					}
+					else if( PushDue(i, sensorReading) )
+						pushPending |= (1U << i);
 				}
 
 				sdlog.LogSensorReading( SensorsList[i].config.sensorType, (int)i, sensorReading );
@@ -534,47 +659,45 @@ void Sensors::ReportSensorReading( uint8_t stationID, uint8_t sensorChannel, int
 // Emit last reported sensors reading (as JSON)
 //
 
-bool Sensors::TableLastSensorsData(FILE* stream_file)
+bool Sensors::TableLastSensorsData(JsonWriter & jw)
 {
 		uint8_t			numS = GetNumSensors();
 		FullSensor		fullSensor;
 		FullStation		fullStation;
 		char			tmp_buf[MAX_SENSOR_NAME_LENGTH+1];
 		
-		if( numS == 0 )	// no sensors to display
-		{
-			fprintf_P(stream_file, PSTR("\n\t{\n\t}\n"));   // empty list
-			return true;
-		}
-		
-		// we have something to output
-		
-        fprintf_P(stream_file, PSTR("\n\t \"sensors\" : [\n"));    // open the list
+        jw.Key(PSTR("sensors"));    // open the list
+        jw.BeginArray();
 
 		for( uint8_t i=0; i<numS; i++ )
 		{
 			LoadSensor(i, &fullSensor);
 			LoadStation( fullSensor.sensorStationID, &fullStation);
 
-			if( i!= 0 )
-				fprintf_P(stream_file, PSTR("\n\t\t },"));	// close previous sensor record if this is not the first one
-			
+			jw.BeginObject();
 			memcpy( tmp_buf, fullSensor.name, 20 );
-            fprintf_P(stream_file, PSTR("\n\t { \n\t\t \"sensorID\": %u,\n\t\t \"sensorName\": \"%s\","), (unsigned int)i, tmp_buf);
-			
-			if( fullSensor.sensorType == SENSOR_TYPE_TEMPERATURE )	  strcpy_P(tmp_buf, PSTR("Temperature"));
-			else if( fullSensor.sensorType == SENSOR_TYPE_HUMIDITY )  strcpy_P(tmp_buf, PSTR("Humidity"));
-			else if( fullSensor.sensorType == SENSOR_TYPE_PRESSURE )  strcpy_P(tmp_buf, PSTR("Pressure"));
-			else if( fullSensor.sensorType == SENSOR_TYPE_WATERFLOW ) strcpy_P(tmp_buf, PSTR("Waterflow"));
-			else if( fullSensor.sensorType == SENSOR_TYPE_VOLTAGE )   strcpy_P(tmp_buf, PSTR("Voltage"));
-			else													  strcpy_P(tmp_buf, PSTR("Unknown"));
-            fprintf_P(stream_file, PSTR("\n\t\t \"sensorType\": \"%s\","), tmp_buf);
+			tmp_buf[MAX_SENSOR_NAME_LENGTH] = 0;
+			jw.Key(PSTR("sensorID"));		jw.NumberU(i);
+			jw.Key(PSTR("sensorName"));		jw.String(tmp_buf);
+
+			jw.Key(PSTR("sensorType"));
+			if( fullSensor.sensorType == SENSOR_TYPE_TEMPERATURE )	  jw.StringP(PSTR("Temperature"));
+			else if( fullSensor.sensorType == SENSOR_TYPE_HUMIDITY )  jw.StringP(PSTR("Humidity"));
+			else if( fullSensor.sensorType == SENSOR_TYPE_PRESSURE )  jw.StringP(PSTR("Pressure"));
+			else if( fullSensor.sensorType == SENSOR_TYPE_WATERFLOW ) jw.StringP(PSTR("Waterflow"));
+			else if( fullSensor.sensorType == SENSOR_TYPE_VOLTAGE )   jw.StringP(PSTR("Voltage"));
+			else													  jw.StringP(PSTR("Unknown"));
 
 			memcpy( tmp_buf, fullStation.name, 20 );
-			fprintf_P(stream_file, PSTR("\n\t\t \"stationID\": %u, \n\t\t \"stationName\": \"%s\","), (unsigned int)(fullSensor.sensorStationID), tmp_buf);
-			fprintf_P(stream_file, PSTR("\n\t\t \"sensorChannel\": %u, \n\t\t \"lastReading\": %ld,\n\t\t \"readingAge\": %lu"), fullSensor.sensorChannel, SensorsList[i].lastReading, (millis() - SensorsList[i].lastReadingTimestamp)/1000);
+			tmp_buf[MAX_SENSOR_NAME_LENGTH] = 0;
+			jw.Key(PSTR("stationID"));		jw.NumberU(fullSensor.sensorStationID);
+			jw.Key(PSTR("stationName"));	jw.String(tmp_buf);
+			jw.Key(PSTR("sensorChannel"));	jw.NumberU(fullSensor.sensorChannel);
+			jw.Key(PSTR("lastReading"));	jw.Number(SensorsList[i].lastReading);
+			jw.Key(PSTR("readingAge"));		jw.NumberU((millis() - SensorsList[i].lastReadingTimestamp)/1000);
+			jw.EndObject();
 		}
-        fprintf_P(stream_file, PSTR("\n\t\t }\n\t ]\n"));    // close the last sensor if we emitted and the list
+        jw.EndArray();    // close the list
 
         return true;
 }
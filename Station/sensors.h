@@ -42,6 +42,8 @@ Copyright 2014 tony-osp (http://tony-osp.dreamwidth.org/)
 #include <DHT.h>
 #endif
 
+#define SENSOR_PUSH_NEVER		0xFF		// pushAge value - sensor was not reported yet
+
 struct SensorStruct 
 {
 	ShortSensor		config;
@@ -62,7 +64,12 @@ public:
   void loop(void);								 // Main loop. Intended to be called regularly and frequently to handle sensors reading and logging. Usually  this will be called from Arduino loop()
   
   void ReportSensorReading( uint8_t stationID, uint8_t sensorChannel, int32_t sensorReading );
-  bool TableLastSensorsData(FILE* stream_file);
+  bool TableLastSensorsData(JsonWriter & jw);
+
+  // Sensors push reporting
+  void ResetSensorPush(uint8_t sensorID);				// station - report config of the local sensor changed, report it on the next sampling cycle
+  void EnableStationPush(uint8_t stationID);			// master - remote station accepted push reporting config
+  void ReportStationPush(uint8_t stationID);			// master - unsolicited sensors report received from the station
 
 // Data
 
@@ -82,7 +89,18 @@ private:
 	uint8_t			iLCDTempIndex;
 	uint8_t			iLCDHumidIndex;
 
+	// push reporting - station side
+	int16_t			pushedReading[MAX_SENSORS];		// last reported reading
+	uint8_t			pushAge[MAX_SENSORS];			// minutes since the last report, SENSOR_PUSH_NEVER if not reported yet
+	uint16_t		pushPending;					// bit per sensor - sensor is due to be reported at the end of the sampling cycle
+
+	// push reporting - master side, bit per station
+	uint16_t		pushStations;					// station reports its sensors on its own
+	uint16_t		pushedStations;					// station reported sensors since its last poll cycle
+
 	void			poll_MinTimer(void);
+	bool			PushDue(uint8_t sensorID, int32_t sensorReading);
+	void			PushSensorReports(void);
 };
 
 extern Sensors sensorsModule;
@@ -512,90 +512,136 @@ static IPAddress decodeIP(const char * value)
                 return INADDR_NONE;
 }
 
+// Streaming form setters.
+//
+// Form fields are collected as they are parsed into a small fixed form state, and saved by the Apply function
+// called once the request is complete - request that is rejected or times out changes nothing. The zones editor is
+// the exception - each zone is saved as soon as the request moves on to the next zone.
+// Each setter has a field handler (called with key == NULL at the start of the request) and an Apply function.
+// Long values arrive in pieces (see WebFormHandler), numeric fields use the first piece only.
+// Only one request is parsed at a time, so the state is static.
+
+static struct
+{
+        Schedule	sched;
+        int			sched_num;
+        bool		time_enable[4];
+        bool		bError;
+} schedForm;
+
+static struct
+{
+        FullZone	zone;
+        int			zn;				// zone loaded into zone, -1 if none
+        bool		bChanged;
+        bool		bError;
+} zoneForm;
+
+// Store piece of a string field value, the field is zero padded as with strncpy()
+static void FormString(char * field, uint8_t size, const char * value, uint16_t offs)
+{
+		if( offs == 0 )
+			memset(field, 0, size);
+		while( (offs < size) && *value )
+			field[offs++] = *value++;
+}
+
 //************************************
-// Method:    SetSchedule
-// FullName:  SetSchedule
+// Method:    SetScheduleField
+// FullName:  SetScheduleField
 // Access:    public
-// Returns:   bool
+// Returns:   void
 // Qualifier:
-// Parameter: const KVPairs & key_value_pairs
+// Parameter: const char * key, const char * value, uint16_t offs
 //************************************
-bool SetSchedule(const KVPairs & key_value_pairs)
+void SetScheduleField(const char * key, const char * value, uint16_t offs)
 {
-        freeMemory();
-        Schedule sched;
-        int sched_num = -1;
-        sched.day = 0;
-        sched.time[0] = -1;
-        sched.time[1] = -1;
-        sched.time[2] = -1;
-        sched.time[3] = -1;
-        bool time_enable[4] = {0};
+        Schedule & sched = schedForm.sched;
 
-        // Iterate through the kv pairs and update the appropriate structure values.
-        for (int i = 0; i < key_value_pairs.num_pairs; i++)
+        if (key == NULL)
         {
-                const char * key = key_value_pairs.keys[i];
-                const char * value = key_value_pairs.values[i];
-                if (strcmp_P(key, PSTR("id")) == 0)
-                {
-                        sched_num = atoi(value);
-                }
-                else if (strcmp_P(key, PSTR("type")) == 0)
-                        sched.SetInterval(strcmp_P(value, PSTR("on")) != 0);
-                else if (strcmp_P(key, PSTR("enable")) == 0)
-                        sched.SetEnabled(strcmp_P(value, PSTR("on")) == 0);
-                else if (strcmp_P(key, PSTR("wadj")) == 0)
-                        sched.SetWAdj(strcmp_P(value, PSTR("on")) == 0);
-                else if (strcmp_P(key, PSTR("name")) == 0)
-                        strncpy(sched.name, value, sizeof(sched.name));
-                else if (strcmp_P(key, PSTR("interval")) == 0)
-                {
-                        if (sched.IsInterval())
-                                sched.interval = atoi(value);
-                }
-                else if ((key[0] == 'd') && (key[2] == 0) && ((key[1] >= '1') && (key[1] <= '7')) && !(sched.IsInterval()))
-                {
-                        if (strcmp_P(value, PSTR("on")) == 0)
-                                sched.day = sched.day | 0x01 << (key[1] - '1');
-                        else
-                                sched.day = sched.day & ~(0x01 << (key[1] - '1'));
-                }
-                else if ((key[0] == 't') && (key[2] == 0) && ((key[1] >= '1') && (key[1] <= '4')))
+                freeMemory();
+                sched = Schedule();
+                schedForm.sched_num = -1;
+                memset(schedForm.time_enable, 0, sizeof(schedForm.time_enable));
+                schedForm.bError = false;
+                return;
+        }
+
+        if (strcmp_P(key, PSTR("name")) == 0)
+        {
+                FormString(sched.name, sizeof(sched.name), value, offs);
+                return;
+        }
+        if (offs != 0)
+                return;
+
+        if (strcmp_P(key, PSTR("id")) == 0)
+        {
+                schedForm.sched_num = atoi(value);
+        }
+        else if (strcmp_P(key, PSTR("type")) == 0)
+                sched.SetInterval(strcmp_P(value, PSTR("on")) != 0);
+        else if (strcmp_P(key, PSTR("enable")) == 0)
+                sched.SetEnabled(strcmp_P(value, PSTR("on")) == 0);
+        else if (strcmp_P(key, PSTR("wadj")) == 0)
+                sched.SetWAdj(strcmp_P(value, PSTR("on")) == 0);
+        else if (strcmp_P(key, PSTR("interval")) == 0)
+        {
+                if (sched.IsInterval())
+                        sched.interval = atoi(value);
+        }
+        else if ((key[0] == 'd') && (key[2] == 0) && ((key[1] >= '1') && (key[1] <= '7')) && !(sched.IsInterval()))
+        {
+                if (strcmp_P(value, PSTR("on")) == 0)
+                        sched.day = sched.day | 0x01 << (key[1] - '1');
+                else
+                        sched.day = sched.day & ~(0x01 << (key[1] - '1'));
+        }
+        else if ((key[0] == 't') && (key[2] == 0) && ((key[1] >= '1') && (key[1] <= '4')))
+        {
+                const char * colon_loc = strstr(value, ":");
+                if (colon_loc > 0)
                 {
-                        const char * colon_loc = strstr(value, ":");
-                        if (colon_loc > 0)
+                        int hour = strtol(value, NULL, 10);
+                        int minute = strtol(colon_loc + 1, NULL, 10);
+                        bool bIsPM = strstr(value, "PM") || strstr(value, "pm");
+                        if (bIsPM)
+                                hour += 12;
+                        if ((hour >= 24) || (hour < 0) || (minute >= 60) || (minute < 0))
                         {
-                                int hour = strtol(value, NULL, 10);
-                                int minute = strtol(colon_loc + 1, NULL, 10);
-                                bool bIsPM = strstr(value, "PM") || strstr(value, "pm");
-                                if (bIsPM)
-                                        hour += 12;
-                                if ((hour >= 24) || (hour < 0) || (minute >= 60) || (minute < 0))
-                                {
-                                        SYSEVT_ERROR(F("Invalid Date Input"));
-                                        return false;
-                                }
-                                sched.time[key[1] - '1'] = hour * 60 + minute;
+                                SYSEVT_ERROR(F("Invalid Date Input"));
+                                schedForm.bError = true;
+                                return;
                         }
+                        sched.time[key[1] - '1'] = hour * 60 + minute;
                 }
-                else if ((key[0] == 'e') && (key[2] == 0) && ((key[1] >= '1') && (key[1] <= '4')))
-                {
-                        if (strcmp_P(value, PSTR("on")) == 0)
-                                time_enable[key[1] - '1'] = true;
-                        else
-                                time_enable[key[1] - '1'] = false;
-                }
-                else if ((key[0] == 'z') && (key[2] == 0) && ((key[1] >= 'b') && (key[1] <= ('a' + GetNumZones()))))
-                {
-                        sched.zone_duration[key[1] - 'b'] = atoi(value);
-                }
         }
+        else if ((key[0] == 'e') && (key[2] == 0) && ((key[1] >= '1') && (key[1] <= '4')))
+        {
+                if (strcmp_P(value, PSTR("on")) == 0)
+                        schedForm.time_enable[key[1] - '1'] = true;
+                else
+                        schedForm.time_enable[key[1] - '1'] = false;
+        }
+        else if ((key[0] == 'z') && (key[2] == 0) && ((key[1] >= 'b') && (key[1] <= ('a' + GetNumZones()))))
+        {
+                sched.zone_duration[key[1] - 'b'] = atoi(value);
+        }
+}
+
+bool SetScheduleApply(void)
+{
+        Schedule & sched = schedForm.sched;
+        int sched_num = schedForm.sched_num;
+
+        if (schedForm.bError)
+                return false;
 
         // cycle through the time enable bits and set our special code for disabled times:
         for (int i = 0; i < 4; i++)
         {
-                if (!time_enable[i])
+                if (!schedForm.time_enable[i])
                         sched.time[i] = -1;
         }
 
@@ -661,154 +707,257 @@ bool DeleteSchedule(const KVPairs & key_value_pairs)
         return true;
 }
 
-bool SetZones(const KVPairs & key_value_pairs)
+// Save the zone being edited, if it was changed
+static void FormZoneSave(void)
 {
-		uint8_t		n_zones = GetNumZones();
-		
-		FullZone	fullZone;
+		if( (zoneForm.zn >= 0) && zoneForm.bChanged )
+			SaveZone(zoneForm.zn, &zoneForm.zone);
+		zoneForm.bChanged = false;
+}
+
+// Zones editor. Fields are z<zone code><field>, where zone code is 'b' for the first zone, 'c' for the second etc.
+// Fields of one zone come together, the zone is saved when the request moves on to the next zone (or completes).
+void SetZonesField(const char * key, const char * value, uint16_t offs)
+{
+		FullZone & fullZone = zoneForm.zone;
+
+		if( key == NULL )
+		{
+			zoneForm.zn = -1;
+			zoneForm.bChanged = false;
+			return;
+		}
+
+		if( (key[0] != 'z') || (key[1] < 'b') )
+			return;
+
+		int zn = key[1] - 'b';
+		if( zn >= GetNumZones() )
+			return;
 
-		for( int zn=0; zn<n_zones; zn++ )
+		if( zn != zoneForm.zn )
 		{
-			char  zcode = 'b' + zn;
+			FormZoneSave();
 			LoadZone(zn, &fullZone);
-			bool  fzChanged = false;
+			zoneForm.zn = zn;
+		}
 
-			for (int i = 0; i < key_value_pairs.num_pairs; i++)
-			{
-                const char * key = key_value_pairs.keys[i];
-                const char * value = key_value_pairs.values[i];
-                
-				if( (key[0] == 'z') && (key[1] == zcode) )	// zone found in kvpairs
-                {
-						fzChanged = true;
-                    
-						if (memcmp(key + 2, "name", 5) == 0)
-                                strncpy(fullZone.name, value, sizeof(fullZone.name));
-                        else if ((key[2] == 'e') && (key[3] == 0))
-                        {
-                                if (strcmp_P(value, PSTR("on")) == 0)
-                                        fullZone.bEnabled = true;
-                                else
-                                        fullZone.bEnabled = false;
-                        }
-                }
-			}
-			if( fzChanged ) SaveZone(zn, &fullZone);
+		if (memcmp(key + 2, "name", 5) == 0)
+		{
+				FormString(fullZone.name, sizeof(fullZone.name), value, offs);
+				zoneForm.bChanged = true;
+		}
+		else if ((key[2] == 'e') && (key[3] == 0) && (offs == 0))
+		{
+				fullZone.bEnabled = (strcmp_P(value, PSTR("on")) == 0);
+				zoneForm.bChanged = true;
 		}
+}
 
+bool SetZonesApply(void)
+{
+		FormZoneSave();
         return true;
 }
 
-bool SetOneZones(const KVPairs & key_value_pairs)
+// Single zone editor, zone is selected by the "id" field.
+void SetOneZoneField(const char * key, const char * value, uint16_t offs)
 {
-		FullZone	fullZone;
-		bool		fzChanged = false;
-		int			zn;
+		FullZone & fullZone = zoneForm.zone;
 
-			for (int i = 0; i < key_value_pairs.num_pairs; i++)
+		if( key == NULL )
+		{
+			zoneForm.zn = -1;
+			zoneForm.bChanged = false;
+			zoneForm.bError = false;
+			return;
+		}
+
+		if( strcmp_P(key, PSTR("name")) == 0)
+		{
+			FormString(fullZone.name, sizeof(fullZone.name), value, offs);
+			return;
+		}
+		if( offs != 0 )
+			return;
+
+		if( strcmp_P(key, PSTR("id")) == 0)
+		{
+			int zn = atoi(value);
+			if( (zn<0) || (zn>=GetNumZones()) )
 			{
-                const char * key = key_value_pairs.keys[i];
-                const char * value = key_value_pairs.values[i];
-                
-				if( strcmp_P(key, PSTR("id")) == 0)
-				{
-					zn = atoi(value);
-					if( (zn<0) || (zn>=GetNumZones()) )
-						return false;	// wrong zone number
-					
-					LoadZone(zn, &fullZone);
-					fzChanged = true;
-				}
-				else if( strcmp_P(key, PSTR("name")) == 0)
-				{
-                    strncpy(fullZone.name, value, sizeof(fullZone.name));
-				}
-				else if( strcmp_P(key, PSTR("enabled")) == 0)
-				{
-                    if (strcmp_P(value, PSTR("on")) == 0)
-                         fullZone.bEnabled = true;
-                    else
-                         fullZone.bEnabled = false;
-				}
-				else if( strcmp_P(key, PSTR("wfrate")) == 0)
-				{
-					int wfrate = atoi(value);
-					if( wfrate>=0 )
-					{
-						fullZone.waterFlowRate = wfrate;
-					}
-				}
+				zoneForm.bError = true;	// wrong zone number
+				return;
+			}
+
+			LoadZone(zn, &fullZone);
+			zoneForm.zn = zn;
+			zoneForm.bChanged = true;
+		}
+		else if( strcmp_P(key, PSTR("enabled")) == 0)
+		{
+            if (strcmp_P(value, PSTR("on")) == 0)
+                 fullZone.bEnabled = true;
+            else
+                 fullZone.bEnabled = false;
+		}
+		else if( strcmp_P(key, PSTR("wfrate")) == 0)
+		{
+			int wfrate = atoi(value);
+			if( wfrate>=0 )
+			{
+				fullZone.waterFlowRate = wfrate;
 			}
+		}
+}
 
-			if( fzChanged ) SaveZone(zn, &fullZone);
+bool SetOneZoneApply(void)
+{
+		if( zoneForm.bError )
+			return false;
 
+		FormZoneSave();
         return true;
 }
 
 
-bool SetSettings(const KVPairs & key_value_pairs)
-{
-		for (int i = 0; i < key_value_pairs.num_pairs; i++)
-        {
-                const char * key = key_value_pairs.keys[i];
-                const char * value = key_value_pairs.values[i];
+// Settings are collected field by field and saved together when the request is complete
+#define SETF_IP			0x0001
+#define SETF_NETMASK	0x0002
+#define SETF_GATEWAY	0x0004
+#define SETF_WUIP		0x0008
+#define SETF_APIKEY		0x0010
+#define SETF_ZIP		0x0020
+#define SETF_NTPIP		0x0040
+#define SETF_NTPOFFSET	0x0080
+#define SETF_OT			0x0100
+#define SETF_WEBPORT	0x0200
+#define SETF_SADJ		0x0400
+#define SETF_PWS		0x0800
+#define SETF_WUTYPE		0x1000
+
+static struct
+{
+        uint16_t	fields;			// SETF_xxx - fields present in the request
+        IPAddress	ip;
+        IPAddress	netmask;
+        IPAddress	gateway;
+        IPAddress	wuip;
+        IPAddress	ntpip;
+        uint32_t	zip;
+        uint16_t	webport;
+        int8_t		ntpoffset;
+        uint8_t		ot;
+        uint8_t		sadj;
+        bool		bUsePWS;
+        char		apikey[16+2];	// 16 hex digits, the extra byte keeps longer key invalid (see SetApiKey())
+        char		pws[11];		// SetPWS() takes 11 bytes, zero padded
+} settingsForm;
+
+void SetSettingsField(const char * key, const char * value, uint16_t offs)
+{
+                if (key == NULL)
+                {
+                        settingsForm.fields = 0;
+                        return;
+                }
+
+                if (strcmp_P(key, PSTR("apikey")) == 0)
+                {
+                        FormString(settingsForm.apikey, sizeof(settingsForm.apikey)-1, value, offs);
+                        settingsForm.apikey[sizeof(settingsForm.apikey)-1] = 0;
+                        settingsForm.fields |= SETF_APIKEY;
+                        return;
+                }
+                if (strcmp_P(key, PSTR("pws")) == 0)
+                {
+                        FormString(settingsForm.pws, sizeof(settingsForm.pws), value, offs);
+                        settingsForm.fields |= SETF_PWS;
+                        return;
+                }
+                if (offs != 0)
+                        return;
+
                 if (strcmp_P(key, PSTR("ip")) == 0)
                 {
-                        SetIP(decodeIP(value));
+                        settingsForm.ip = decodeIP(value);
+                        settingsForm.fields |= SETF_IP;
                 }
                 else if (strcmp_P(key, PSTR("netmask")) == 0)
                 {
-                        SetNetmask(decodeIP(value));
+                        settingsForm.netmask = decodeIP(value);
+                        settingsForm.fields |= SETF_NETMASK;
                 }
                 else if (strcmp_P(key, PSTR("gateway")) == 0)
                 {
-                        SetGateway(decodeIP(value));
+                        settingsForm.gateway = decodeIP(value);
+                        settingsForm.fields |= SETF_GATEWAY;
                 }
                 else if (strcmp_P(key, PSTR("wuip")) == 0)
                 {
-                        SetWUIP(decodeIP(value));
-                }
-                else if (strcmp_P(key, PSTR("apikey")) == 0)
-                {
-                        SetApiKey(value);
+                        settingsForm.wuip = decodeIP(value);
+                        settingsForm.fields |= SETF_WUIP;
                 }
                 else if (strcmp_P(key, PSTR("zip")) == 0)
                 {
-                        SetZip(strtoul(value, 0, 10));
+                        settingsForm.zip = strtoul(value, 0, 10);
+                        settingsForm.fields |= SETF_ZIP;
                 }
                 else if (strcmp_P(key, PSTR("NTPip")) == 0)
                 {
-                        SetNTPIP(decodeIP(value));
+                        settingsForm.ntpip = decodeIP(value);
+                        settingsForm.fields |= SETF_NTPIP;
                 }
                 else if (strcmp_P(key, PSTR("NTPoffset")) == 0)
                 {
-                        SetNTPOffset(atoi(value));
-						nntpTimeServer.flagCheckTime();
-
+                        settingsForm.ntpoffset = atoi(value);
+                        settingsForm.fields |= SETF_NTPOFFSET;
                 }
                 else if (strcmp_P(key, PSTR("ot")) == 0)
                 {
-                        SetOT((EOT)atoi(value));
+                        settingsForm.ot = atoi(value);
+                        settingsForm.fields |= SETF_OT;
                 }
                 else if (strcmp_P(key, PSTR("webport")) == 0)
                 {
-                        SetWebPort(atoi(value));
+                        settingsForm.webport = atoi(value);
+                        settingsForm.fields |= SETF_WEBPORT;
                 }
                 else if (strcmp_P(key, PSTR("sadj")) == 0)
                 {
-                        SetSeasonalAdjust(atoi(value));
-                }
-                else if (strcmp_P(key, PSTR("pws")) == 0)
-                {
-                        SetPWS(value);
+                        settingsForm.sadj = atoi(value);
+                        settingsForm.fields |= SETF_SADJ;
                 }
                 else if (strcmp_P(key, PSTR("wutype")) == 0)
                 {
-                        SetUsePWS(strcmp_P(value, PSTR("pws")) == 0);
+                        settingsForm.bUsePWS = (strcmp_P(value, PSTR("pws")) == 0);
+                        settingsForm.fields |= SETF_WUTYPE;
                 }
+}
 
+bool SetSettingsApply(void)
+{
+        uint16_t	fields = settingsForm.fields;
+
+        if (fields & SETF_IP)			SetIP(settingsForm.ip);
+        if (fields & SETF_NETMASK)		SetNetmask(settingsForm.netmask);
+        if (fields & SETF_GATEWAY)		SetGateway(settingsForm.gateway);
+        if (fields & SETF_WUIP)			SetWUIP(settingsForm.wuip);
+        if (fields & SETF_APIKEY)		SetApiKey(settingsForm.apikey);
+        if (fields & SETF_ZIP)			SetZip(settingsForm.zip);
+        if (fields & SETF_NTPIP)		SetNTPIP(settingsForm.ntpip);
+        if (fields & SETF_OT)			SetOT((EOT)settingsForm.ot);
+        if (fields & SETF_WEBPORT)		SetWebPort(settingsForm.webport);
+        if (fields & SETF_SADJ)			SetSeasonalAdjust(settingsForm.sadj);
+        if (fields & SETF_PWS)			SetPWS(settingsForm.pws);
+        if (fields & SETF_WUTYPE)		SetUsePWS(settingsForm.bUsePWS);
+        if (fields & SETF_NTPOFFSET)
+        {
+                SetNTPOffset(settingsForm.ntpoffset);
+                nntpTimeServer.flagCheckTime();
         }
 
+        settingsForm.fields = 0;
         return true;
 }
 
@@ -1094,6 +1243,7 @@ void ResetEEPROM()
 			uint16_t		netID;
 			uint16_t		numChannels = 0;
 			uint16_t		netAddr;
+			uint16_t		relayID;
 			uint8_t			fEnableRAccess = false;
 
 			for( uint16_t i=0; i<numStations; i++ )
@@ -1168,6 +1318,14 @@ void ResetEEPROM()
 						fEnableRAccess = true;
 				}
 
+				relayID = 0;		// optional static route through the relay station
+				strcpy_P(keyName, PSTR("RelayVia"));
+				if( ini.getValue(sectionName, keyName, buffer, bufferLen, relayID) && ((relayID >= MAX_STATIONS) || (relayID == stationID)) )
+				{
+					SYSEVT_ERROR(F("LoadIniEEPROM - invalid RelayVia %d for Station %d, ignoring"), relayID, i);
+					relayID = 0;
+				}
+
 				memset(&fullStation,0,sizeof(fullStation));
 				if( fEnableRAccess )	// allow remote access (via RF) to this station
 					fullStation.stationFlags = STATION_FLAGS_VALID | STATION_FLAGS_ENABLED | STATION_FLAGS_RSTATUS | STATION_FLAGS_RCONTROL;
@@ -1177,6 +1335,7 @@ void ResetEEPROM()
 				fullStation.networkID = netID;
 				fullStation.networkAddress = netAddr;
 				fullStation.numZoneChannels = numChannels;
+				fullStation.relayStationID = relayID;
 
 				sprintf_P(fullStation.name, PSTR("Station %d"), stationID);
 
@@ -1219,6 +1378,8 @@ skip_Station:;
 			uint8_t			sensID = 0;
 			uint16_t			sensStation;
 			uint16_t			sensChannel;
+			uint16_t			reportInterval;
+			uint16_t			reportDeadband;
 
 			for( uint16_t i=1; i<=numSensors; i++ )
 			{
@@ -1290,6 +1451,22 @@ skip_Station:;
 
 					SaveSensor(sensID, &fullSens);	// save the sensor
 
+// optional push reporting config (used if the sensor is connected to a remote station)
+
+					reportInterval = SENSORS_PUSH_DEFAULT_INTERVAL;
+					strcpy_P(keyName, PSTR("ReportInterval"));
+					if( ini.getValue(sectionName, keyName, buffer, bufferLen, reportInterval) && (reportInterval > 254) )
+					{
+						SYSEVT_ERROR(F("LoadIniEEPROM - ReportInterval is too high for Sensor%d, truncating to 254"), i);
+						reportInterval = 254;
+					}
+
+					reportDeadband = SENSORS_PUSH_DEFAULT_DEADBAND;
+					strcpy_P(keyName, PSTR("ReportDeadband"));
+					ini.getValue(sectionName, keyName, buffer, bufferLen, reportDeadband);
+
+					SetSensorReportConfig(sensID, reportInterval, reportDeadband);
+
 					SYSEVT_ERROR(F("LoadIniEEPROM - Saving sensor %d"), (int)sensID);
 
 					sensID++;
@@ -1490,6 +1667,9 @@ void 	ResetEEPROM_NoSD(uint8_t  defStationID)
 		// Sensors definitions
 		SetNumSensors(0);	// initial default
 
+		for( uint8_t ii=0; ii<MAX_SENSORS; ii++ )
+			SetSensorReportConfig(ii, 0, 0);		// sensors are not pushed until Master sends report config
+
 		{
 			uint8_t			sensID = 0;
 
@@ -1949,6 +2129,44 @@ void SetNumSensors(uint8_t numSensors)
 	EEPROM.write(ADDR_NUM_SENSORS, numSensors);
 }
 
+// Sensors push reporting config. On the Master it is the config to send to the station the sensor is connected to,
+// on the remote station it is the config received from the Master.
+// Interval 255 is reserved - it is erased EEPROM (config area was not initialized, e.g. after firmware upgrade),
+// such sensor is not reported.
+#define SENSOR_REPORTCFG_ERASED		0xFF
+
+uint8_t GetSensorReportInterval(uint8_t num)
+{
+	if( num >= MAX_SENSORS )
+		return 0;
+
+	uint8_t interval = EEPROM.read(ADDR_SENSOR_REPORTCFG + num*3);
+	if( interval == SENSOR_REPORTCFG_ERASED )
+		return 0;
+
+	return interval;
+}
+
+uint16_t GetSensorReportDeadband(uint8_t num)
+{
+	if( (num >= MAX_SENSORS) || (EEPROM.read(ADDR_SENSOR_REPORTCFG + num*3) == SENSOR_REPORTCFG_ERASED) )
+		return 0;
+
+	return getEEPROM2bytes(ADDR_SENSOR_REPORTCFG + num*3 + 1);
+}
+
+void SetSensorReportConfig(uint8_t num, uint8_t interval, uint16_t deadband)
+{
+	if( num >= MAX_SENSORS )
+		return;
+
+	if( interval == SENSOR_REPORTCFG_ERASED )
+		interval--;
+
+	EEPROM.write(ADDR_SENSOR_REPORTCFG + num*3, interval);
+	setEEPROM2bytes(ADDR_SENSOR_REPORTCFG + num*3 + 1, deadband);
+}
+
 // get number of valid and enabled stations
 uint8_t GetNumStations(void)
 {
@@ -130,6 +130,9 @@ struct FullStation
 	uint8_t		numWaterflowSensors;	// number of waterflow sensors
 
 	char		name[20];				// station name
+
+	uint8_t		relayStationID;			// multi-hop RF - static route, station is reached through this relay station.
+										// 0 (or invalid StationID) - station is reached directly, or through learned route.
 };
 
 
@@ -268,6 +271,9 @@ void SaveSensor(uint8_t num, FullSensor * pSensor);
 void SaveShortSensor(uint8_t num, ShortSensor * pSensor);
 uint8_t GetNumSensors(void);
 void SetNumSensors(uint8_t numSensors);
+uint8_t GetSensorReportInterval(uint8_t num);
+uint16_t GetSensorReportDeadband(uint8_t num);
+void SetSensorReportConfig(uint8_t num, uint8_t interval, uint16_t deadband);
 
 // water counters
 void SetWWCounter(uint8_t cID, uint16_t value);
@@ -305,12 +311,18 @@ void SetMoteinoRFPANID(uint8_t panID);
 void SetMoteinoRFAddr(uint8_t addr);
 
 
+// Streaming form setters (see WebFormHandler)
+void SetScheduleField(const char * key, const char * value, uint16_t offs);
+bool SetScheduleApply(void);
+void SetZonesField(const char * key, const char * value, uint16_t offs);
+bool SetZonesApply(void);
+void SetOneZoneField(const char * key, const char * value, uint16_t offs);
+bool SetOneZoneApply(void);
+void SetSettingsField(const char * key, const char * value, uint16_t offs);
+bool SetSettingsApply(void);
+
 // KV Pairs Setters
-bool SetSchedule(const KVPairs & key_value_pairs);
-bool SetZones(const KVPairs & key_value_pairs);
 bool DeleteSchedule(const KVPairs & key_value_pairs);
-bool SetSettings(const KVPairs & key_value_pairs);
-bool SetOneZones(const KVPairs & key_value_pairs);
 
 // Misc
 bool IsFirstBoot();
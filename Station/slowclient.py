@@ -0,0 +1,249 @@
+#!/usr/bin/env python3
+#
+# Slow-client test for the Station web server.
+#
+# Loads the web server with misbehaving clients and long-running requests, and measures the effect on the main loop:
+#
+#  - slowloris: connections that send the request header one byte at a time and never finish it
+#  - slow readers: connections that request a large file and read the response a few bytes at a time
+#  - idle: connections that are opened and never send anything
+#  - heavy: back-to-back json/sens, json/tlogs, json/schlogs and json/wcheck requests
+#
+# Meanwhile json/state is polled several times per second. The reply carries "loopMax", the longest main loop pass the
+# Station saw in the last 10-20 seconds (see LoopTick()). The max of loopMax over the run is the scheduler jitter caused by
+# the web server; json/state round-trip time shows how long a well-behaved client waits while the server is loaded.
+#
+# Exits with status 1 if loopMax exceeded the limit (--limit), or if json/state stopped answering.
+#
+# Usage: slowclient.py [options] station_host
+#
+# Creative Commons Attribution-ShareAlike 3.0 license
+# Copyright 2026 SmartGarden contributors
+#
+
+import argparse
+import json
+import socket
+import sys
+import threading
+import time
+
+stop = threading.Event()
+lock = threading.Lock()
+stats = {
+	'state_rtt': [],		# json/state round-trip times, ms
+	'state_fail': 0,
+	'loop_max': [],			# loopMax values reported by the Station, ms
+	'heavy': {},			# url -> list of response times, ms
+	'heavy_fail': {},		# url -> number of failed requests
+	'slow_bytes': 0,		# bytes received by slow readers
+}
+
+
+def connect(args, timeout):
+	s = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+	s.settimeout(timeout)
+	s.connect((args.host, args.port))
+	return s
+
+
+def http_get(args, url, timeout):
+	"""Plain HTTP/1.0 GET, returns the response body (bytes)."""
+	s = connect(args, timeout)
+	try:
+		s.sendall(('GET /%s HTTP/1.0\r\nHost: %s\r\n\r\n' % (url, args.host)).encode())
+		data = b''
+		while True:
+			chunk = s.recv(1024)
+			if not chunk:
+				break
+			data += chunk
+	finally:
+		s.close()
+	head, _, body = data.partition(b'\r\n\r\n')
+	if not head.startswith(b'HTTP/1.') or head.split(b' ', 2)[1] != b'200':
+		raise IOError('bad response: %r' % head[:40])
+	return body
+
+
+def state_poller(args):
+	while not stop.is_set():
+		t = time.monotonic()
+		try:
+			body = http_get(args, 'json/state', args.timeout)
+			rtt = (time.monotonic() - t) * 1000
+			loop_max = int(json.loads(body.decode()).get('loopMax', -1))
+			with lock:
+				stats['state_rtt'].append(rtt)
+				stats['loop_max'].append(loop_max)
+		except (OSError, ValueError):
+			with lock:
+				stats['state_fail'] += 1
+		stop.wait(args.interval)
+
+
+def slowloris(args):
+	req = ('GET /json/state HTTP/1.1\r\nHost: %s\r\nUser-Agent: slowclient\r\n' % args.host).encode()
+	while not stop.is_set():
+		try:
+			s = connect(args, args.timeout)
+			try:
+				for b in req:
+					if stop.wait(args.drip):
+						break
+					s.send(bytes([b]))
+				while not stop.wait(args.drip):
+					s.send(b'X')	# header line that never ends
+			finally:
+				s.close()
+		except OSError:
+			stop.wait(1)
+
+
+def slow_reader(args):
+	while not stop.is_set():
+		try:
+			s = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+			s.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, 256)
+			s.settimeout(args.timeout)
+			s.connect((args.host, args.port))
+			try:
+				s.sendall(('GET /%s HTTP/1.1\r\nHost: %s\r\n\r\n' % (args.file, args.host)).encode())
+				while not stop.wait(args.drip):
+					chunk = s.recv(16)
+					if not chunk:
+						break
+					with lock:
+						stats['slow_bytes'] += len(chunk)
+			finally:
+				s.close()
+		except OSError:
+			stop.wait(1)
+
+
+def idle(args):
+	while not stop.is_set():
+		try:
+			s = connect(args, args.timeout)
+			try:
+				# wait until the Station drops the connection, or the test ends
+				s.settimeout(1)
+				while not stop.is_set():
+					try:
+						if not s.recv(64):
+							break
+					except socket.timeout:
+						pass
+			finally:
+				s.close()
+		except OSError:
+			stop.wait(1)
+
+
+def heavy(args, urls):
+	n = 0
+	while not stop.is_set():
+		url = urls[n % len(urls)]
+		n += 1
+		t = time.monotonic()
+		try:
+			http_get(args, url, args.timeout)
+			with lock:
+				stats['heavy'].setdefault(url, []).append((time.monotonic() - t) * 1000)
+		except OSError:
+			with lock:
+				stats['heavy_fail'][url] = stats['heavy_fail'].get(url, 0) + 1
+			stop.wait(1)
+
+
+def pct(values, p):
+	v = sorted(values)
+	return v[min(len(v) - 1, int(len(v) * p / 100))]
+
+
+def summary(name, values):
+	if not values:
+		return '%-40s no samples' % name
+	return '%-40s n=%-5d min=%-6.0f p50=%-6.0f p95=%-6.0f max=%.0f' % (
+		name, len(values), min(values), pct(values, 50), pct(values, 95), max(values))
+
+
+def main():
+	ap = argparse.ArgumentParser(description='Slow-client and scheduler jitter test for the Station web server.')
+	ap.add_argument('host', help='Station address')
+	ap.add_argument('--port', type=int, default=80)
+	ap.add_argument('--duration', type=float, default=60, help='test duration, seconds (default 60)')
+	ap.add_argument('--slowloris', type=int, default=1, help='number of slowloris connections (default 1)')
+	ap.add_argument('--slowread', type=int, default=1, help='number of slow reader connections (default 1)')
+	ap.add_argument('--idle', type=int, default=1, help='number of idle connections (default 1)')
+	ap.add_argument('--heavy', type=int, default=1, help='number of heavy request clients (default 1)')
+	ap.add_argument('--file', default='weather.png', help='file read by slow readers (default weather.png)')
+	ap.add_argument('--days', type=int, default=365, help='log range of heavy requests, days (default 365)')
+	ap.add_argument('--sensor', default='type=1&id=1', help='sensor of json/sens requests (default type=1&id=1)')
+	ap.add_argument('--drip', type=float, default=1, help='slow client send/receive interval, seconds (default 1)')
+	ap.add_argument('--interval', type=float, default=0.25, help='json/state poll interval, seconds (default 0.25)')
+	ap.add_argument('--timeout', type=float, default=30, help='socket timeout, seconds (default 30)')
+	ap.add_argument('--limit', type=int, default=100, help='max acceptable loopMax, ms (default 100)')
+	args = ap.parse_args()
+
+	edate = int(time.time())
+	sdate = edate - args.days * 24 * 3600
+	urls = [
+		'json/sens?sdate=%d&edate=%d&%s' % (sdate, edate, args.sensor),
+		'json/sens?sdate=%d&edate=%d&%s&sum=h' % (sdate, edate, args.sensor),
+		'json/tlogs?sdate=%d&edate=%d' % (sdate, edate),
+		'json/schlogs?sdate=%d&edate=%d' % (sdate, edate),
+		'json/wcheck',
+	]
+
+	# baseline: loopMax of the idle Station
+	try:
+		base = json.loads(http_get(args, 'json/state', args.timeout).decode()).get('loopMax')
+	except (OSError, ValueError) as e:
+		print('json/state failed: %s' % e)
+		return 1
+	print('baseline loopMax: %s ms' % base)
+
+	threads = [threading.Thread(target=state_poller, args=(args,))]
+	threads += [threading.Thread(target=slowloris, args=(args,)) for _ in range(args.slowloris)]
+	threads += [threading.Thread(target=slow_reader, args=(args,)) for _ in range(args.slowread)]
+	threads += [threading.Thread(target=idle, args=(args,)) for _ in range(args.idle)]
+	threads += [threading.Thread(target=heavy, args=(args, urls)) for _ in range(args.heavy)]
+	for t in threads:
+		t.daemon = True
+		t.start()
+
+	try:
+		stop.wait(args.duration)
+	except KeyboardInterrupt:
+		pass
+	stop.set()
+	for t in threads:
+		t.join(args.timeout)
+
+	with lock:
+		print(summary('json/state round-trip, ms', stats['state_rtt']))
+		print(summary('loopMax (Station main loop pass), ms', [float(v) for v in stats['loop_max'] if v >= 0]))
+		print('json/state failures: %d' % stats['state_fail'])
+		for url in urls:
+			name = url.split('?')[0] + (' (hourly)' if '&sum=h' in url else '')
+			print(summary(name + ', ms', stats['heavy'].get(url, [])),
+				  ' failed=%d' % stats['heavy_fail'].get(url, 0))
+		print('slow readers received %d bytes' % stats['slow_bytes'])
+
+		if not stats['state_rtt']:
+			print('FAIL: json/state did not answer')
+			return 1
+		if -1 in stats['loop_max']:
+			print('FAIL: firmware does not report loopMax')
+			return 1
+		worst = max(stats['loop_max'])
+		if worst > args.limit:
+			print('FAIL: loopMax %d ms exceeds the limit of %d ms' % (worst, args.limit))
+			return 1
+		print('PASS: loopMax %d ms is within the limit of %d ms' % (worst, args.limit))
+	return 0
+
+
+if __name__ == '__main__':
+	sys.exit(main())
@@ -10,6 +10,7 @@
 #include "settings.h"
 #ifdef ARDUINO
 #include "nntp.h"
+#include <utility/socket.h>
 #endif
 
 #include "Weather.h"
@@ -17,9 +18,12 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include "sensors.h"
+#include "jsonwriter.h"
+#include "RProtocolMS.h"
 
 
 bool SysInfo(FILE* stream_file);
+static void WebBuildRouteIndex(void);
 
 
 web::web(void)
@@ -40,6 +44,15 @@ bool web::Init()
 	if ((port > 65000) || (port < 80))
 		port = 80;
 	TRACE_INFO(F("Listening on Port %u\n"), port);
+	WebBuildRouteIndex();
+	for (uint8_t n = 0; n < WEB_MAX_CONNECTIONS; n++)
+	{
+		webConn[n].phase = WEB_CONN_FREE;
+		webConn[n].sock = MAX_SOCK_NUM;
+		webConn[n].cacheEntry = -1;
+	}
+	webGen.conn = -1;
+	m_port = port;
 	m_server = new EthernetServer(port);
 #ifdef ARDUINO
 	m_server->begin();
@@ -50,17 +63,111 @@ bool web::Init()
 }
 
 static char sendbuf[512];
+static bool bKeepAlive = false;		// current request is on a persistent connection
+
+// Additional header fields of the file response, set by ServeFile()
+static struct
+{
+	bool			bFile;			// response is a file
+	bool			bGzip;			// response body is gzip-compressed
+	bool			bRange;			// response is a byte range of the file (206 or 416)
+	const dir_t		*fileEntry;		// directory entry of the response file, used for cache validators
+	uint32_t		rangeFirst;
+	uint32_t		rangeLast;
+	uint32_t		length;			// full length of the file
+} respInfo;
+static WebConn webConn[WEB_MAX_CONNECTIONS];
+static WebConn * activeConn = NULL;	// connection being dispatched (used by ServeFile)
+static KVPairs key_value_pairs;
+static WebRequest rq;				// current request
+
+uint16_t webAbortedConnections = 0;
 
 #ifdef ARDUINO
+
+// Response body framing.
+//
+// Responses with known length (files) are sent with Content-Length and go out directly (RESP_DIRECT).
+// For generated responses on a persistent connection the header is kept in the send buffer until the body
+// is complete (RESP_DEFERRED), so that Content-Length can be inserted. If the body does not fit into the buffer,
+// the response switches to chunked transfer encoding (RESP_CHUNKED), one chunk per send buffer.
+//
+#define RESP_DIRECT			0
+#define RESP_DEFERRED		1
+#define RESP_CHUNKED		2
+
+#define CHUNK_PREFIX_SIZE	5		// "XXX\r\n" - chunk size is always three hex digits
+#define CHUNK_SUFFIX_SIZE	7		// "\r\n" after the chunk plus "0\r\n\r\n" closing the body
+
 static char * sendbufptr;
+static uint8_t respMode = RESP_DIRECT;
+static char * respBodyStart;		// end of the header in the send buffer (RESP_DEFERRED)
+
 static inline void setup_sendbuf()
 {
-	sendbufptr = sendbuf;
+	sendbufptr = (respMode == RESP_CHUNKED) ? sendbuf + CHUNK_PREFIX_SIZE : sendbuf;
+}
+
+static inline char * end_sendbuf()
+{
+	return (respMode == RESP_CHUNKED) ? sendbuf + sizeof(sendbuf) - CHUNK_SUFFIX_SIZE : sendbuf + sizeof(sendbuf);
+}
+
+static int send_chunk(EthernetClient & client, bool bLast)
+{
+	int len = sendbufptr - (sendbuf + CHUNK_PREFIX_SIZE);
+	char * start = sendbuf;
+
+	if (len > 0)
+	{
+		char prefix[CHUNK_PREFIX_SIZE+1];
+		sprintf_P(prefix, PSTR("%03X\r\n"), len);
+		memcpy(sendbuf, prefix, CHUNK_PREFIX_SIZE);
+		memcpy_P(sendbufptr, PSTR("\r\n"), 2);
+		sendbufptr += 2;
+	}
+	else
+		start = sendbufptr;		// nothing in this chunk
+
+	if (bLast)
+	{
+		memcpy_P(sendbufptr, PSTR("0\r\n\r\n"), 5);
+		sendbufptr += 5;
+	}
+
+	int ret = (sendbufptr > start) ? client.write((uint8_t*)start, sendbufptr - start) : 0;
+	setup_sendbuf();
+	return ret;
+}
+
+// Header of the deferred response does not fit - send it and switch to chunked encoding
+static bool start_chunked(EthernetClient & client)
+{
+	int body_len = sendbufptr - respBodyStart;
+
+	if (!client.write((uint8_t*)sendbuf, respBodyStart - sendbuf))
+		return false;
+	client.print(F("Transfer-Encoding: chunked\r\n\r\n"));
+
+	respMode = RESP_CHUNKED;
+	memmove(sendbuf + CHUNK_PREFIX_SIZE, respBodyStart, body_len);
+	setup_sendbuf();
+	sendbufptr += body_len;
+	return true;
 }
 
 static int flush_sendbuf(EthernetClient & client)
 {
 	int ret = 0;
+	if (respMode == RESP_CHUNKED)
+		return send_chunk(client, false);
+
+	if ((respMode == RESP_DEFERRED) && !start_chunked(client))
+		return 0;
+
+	if (respMode == RESP_CHUNKED)
+		return send_chunk(client, false);
+
 	if (sendbufptr > sendbuf)
 	{
 		ret = client.write((uint8_t*)sendbuf, sendbufptr-sendbuf);
@@ -69,31 +176,214 @@ static int flush_sendbuf(EthernetClient & client)
 	return ret;
 }
 
+// Complete the response - insert Content-Length or close chunked body, and send whatever is left in the buffer
+static void finish_response(EthernetClient & client)
+{
+	if (respMode == RESP_DEFERRED)
+	{
+		char cl_line[32];
+		int body_len = sendbufptr - respBodyStart;
+		int cl_len = sprintf_P(cl_line, PSTR("Content-Length: %d\r\n\r\n"), body_len);
+
+		if (sendbufptr + cl_len <= sendbuf + sizeof(sendbuf))
+		{
+			memmove(respBodyStart + cl_len, respBodyStart, body_len);
+			memcpy(respBodyStart, cl_line, cl_len);
+			sendbufptr += cl_len;
+		}
+		else
+		{
+			client.write((uint8_t*)sendbuf, respBodyStart - sendbuf);
+			client.write((uint8_t*)cl_line, cl_len);
+			memmove(sendbuf, respBodyStart, body_len);
+			sendbufptr = sendbuf + body_len;
+		}
+		respMode = RESP_DIRECT;
+	}
+
+	if (respMode == RESP_CHUNKED)
+		send_chunk(client, true);
+	else
+		flush_sendbuf(client);
+
+	respMode = RESP_DIRECT;
+	setup_sendbuf();
+}
+
 static int stream_putchar(char c, FILE *stream)
 {
-	if (sendbufptr >= sendbuf + sizeof(sendbuf))
+	if (sendbufptr >= end_sendbuf())
 	{
-		int send_len = ((EthernetClient*)(stream->udata))->write((uint8_t*)sendbuf, sizeof(sendbuf));
+		int send_len = flush_sendbuf(*(EthernetClient*)(stream->udata));
 		if (!send_len)
 		return 0;
-		setup_sendbuf();
 	}
 	*(sendbufptr++) = c;
 	return 1;
 }
+
+// JSON writer sink - copy the data straight into the send buffer, the buffer goes out to the client when it is full
+static bool stream_write(const char * p, uint16_t len, void * ctx)
+{
+	EthernetClient & client = *(EthernetClient*)(((FILE*)ctx)->udata);
+
+	while (len)
+	{
+		if ((sendbufptr >= end_sendbuf()) && !flush_sendbuf(client))
+			return false;
+
+		uint16_t n = end_sendbuf() - sendbufptr;
+		if (n > len)
+			n = len;
+		memcpy(sendbufptr, p, n);
+		sendbufptr += n;
+		p += n;
+		len -= n;
+	}
+	return true;
+}
 #endif
 
+// JSON writer sink for generated responses - writes the data into the response file
+static bool gen_write(const char * p, uint16_t len, void * ctx)
+{
+	return ((SdFile*)ctx)->write(p, len) == len;
+}
+
+
+// Cache validators
+//
+// ETag and Last-Modified of static files are derived from the file size and last write time in the directory entry.
+// Note: FAT timestamps have no time zone, they are treated as GMT.
+
+static const char webDayNames[] PROGMEM = "SunMonTueWedThuFriSat";
+static const char webMonthNames[] PROGMEM = "JanFebMarAprMayJunJulAugSepOctNovDec";
+
+static time_t WebFatTime(const dir_t & d)
+{
+	tmElements_t tm;
+
+	tm.Year = FAT_YEAR(d.lastWriteDate) - 1970;
+	tm.Month = FAT_MONTH(d.lastWriteDate);
+	tm.Day = FAT_DAY(d.lastWriteDate);
+	tm.Hour = FAT_HOUR(d.lastWriteTime);
+	tm.Minute = FAT_MINUTE(d.lastWriteTime);
+	tm.Second = FAT_SECOND(d.lastWriteTime);
+	return makeTime(tm);
+}
+
+static void WebFormatETag(char * buf, const dir_t & d)
+{
+	sprintf_P(buf, PSTR("\"%lx-%lx%S\""), (unsigned long)d.fileSize, (unsigned long)WebFatTime(d), respInfo.bGzip ? PSTR("-gz") : PSTR(""));
+}
+
+static void WebFormatHttpDate(char * buf, time_t t)
+{
+	tmElements_t tm;
+
+	breakTime(t, tm);
+	sprintf_P(buf, PSTR("%.3S, %02u %.3S %04u %02u:%02u:%02u GMT"), webDayNames + (tm.Wday-1)*3, tm.Day,
+				webMonthNames + (tm.Month-1)*3, tm.Year + 1970, tm.Hour, tm.Minute, tm.Second);
+}
+
+// Parse HTTP date (If-Modified-Since), returns 0 if the date cannot be parsed
+static time_t WebParseHttpDate(const char * str)
+{
+	char month[4];
+	unsigned int day, year, hour, minute, second;
+	tmElements_t tm;
+
+	str = strchr(str, ',');		// skip day of the week
+	if (str == NULL)
+		return 0;
+	if (sscanf_P(str+1, PSTR("%u %3s %u %u:%u:%u"), &day, month, &year, &hour, &minute, &second) != 6)
+		return 0;
+
+	for (tm.Month = 1; tm.Month <= 12; tm.Month++)
+		if (strncasecmp_P(month, webMonthNames + (tm.Month-1)*3, 3) == 0)
+			break;
+	if ((tm.Month > 12) || (year < 1970))
+		return 0;
+
+	tm.Year = year - 1970;
+	tm.Day = day;
+	tm.Hour = hour;
+	tm.Minute = minute;
+	tm.Second = second;
+	return makeTime(tm);
+}
+
+// Check request validators against the file, returns true if the browser copy is up to date
+static bool WebNotModified(const dir_t & d)
+{
+	if (rq.etag[0] != 0)		// If-None-Match takes precedence over If-Modified-Since
+	{
+		char etag[WEB_ETAG_SIZE];
+
+		if (rq.etag[0] == '*')
+			return true;
+		WebFormatETag(etag, d);
+		return strstr(rq.etag, etag) != NULL;
+	}
+	if (rq.ims != 0)
+		return WebFatTime(d) <= rq.ims;
+	return false;
+}
 
-void ServeHeader(FILE * stream_file, int code, const char * pReason, bool cache, char * type)
+// Emit response header.
+//	contentLength is the length of the body, or -1 if it is not known in advance (generated response).
+void ServeHeader(FILE * stream_file, int code, const char * pReason, uint8_t cache, const char * type, long contentLength)
 {
-	fprintf_P(stream_file, PSTR("HTTP/1.1 %d %S\nContent-Type: %S\nConnection: close\n"), code, pReason, type);
-	if (cache)
-		fprintf_P(stream_file, PSTR("Last-Modified: Fri, 02 Jun 2006 09:46:32 GMT\nExpires: Sun, 17 Jan 2038 19:14:07 GMT\r\n\r\n"));
+	fprintf_P(stream_file, PSTR("HTTP/1.1 %d %S\r\nContent-Type: %S\r\nConnection: %S\r\n"), code, pReason, type, bKeepAlive ? PSTR("keep-alive"):PSTR("close"));
+	if (respInfo.bFile)
+		fprintf_P(stream_file, PSTR("Accept-Ranges: bytes\r\n"));
+	if (respInfo.bGzip)
+		fprintf_P(stream_file, PSTR("Content-Encoding: gzip\r\nVary: Accept-Encoding\r\n"));
+	if (respInfo.bRange)
+	{
+		if (respInfo.rangeFirst <= respInfo.rangeLast)
+			fprintf_P(stream_file, PSTR("Content-Range: bytes %lu-%lu/%lu\r\n"), respInfo.rangeFirst, respInfo.rangeLast, respInfo.length);
+		else
+			fprintf_P(stream_file, PSTR("Content-Range: bytes */%lu\r\n"), respInfo.length);
+	}
+	if (respInfo.fileEntry != NULL)
+	{
+		char buf[WEB_HTTP_DATE_SIZE];
+
+		WebFormatETag(buf, *respInfo.fileEntry);
+		fprintf_P(stream_file, PSTR("ETag: %s\r\n"), buf);
+		WebFormatHttpDate(buf, WebFatTime(*respInfo.fileEntry));
+		fprintf_P(stream_file, PSTR("Last-Modified: %s\r\n"), buf);
+	}
+	if (cache == WEB_CACHE_STATIC)
+		fprintf_P(stream_file, PSTR("Cache-Control: max-age=%u\r\n"), WEB_STATIC_MAX_AGE);
+	else if (cache == WEB_CACHE_NOSTORE)
+		fprintf_P(stream_file, PSTR("Cache-Control: no-store\r\n"));
+	else
+		fprintf_P(stream_file, PSTR("Cache-Control: no-cache\r\n"));
+
+	if (code == 304)
+		fprintf_P(stream_file, PSTR("\r\n"));		// 304 response never has a body
+	else if (contentLength >= 0)
+		fprintf_P(stream_file, PSTR("Content-Length: %ld\r\n\r\n"), contentLength);
+#ifdef ARDUINO
+	else if (bKeepAlive)
+	{
+		// Content-Length will be inserted when the response is complete
+		respMode = RESP_DEFERRED;
+		respBodyStart = sendbufptr;
+	}
+#endif
 	else
-		fprintf_P(stream_file, PSTR("Cache-Control: no-cache\r\n\r\n"));
+		fprintf_P(stream_file, PSTR("\r\n"));
+}
+
+void ServeHeader(FILE * stream_file, int code, const char * pReason, uint8_t cache, char * type)
+{
+	ServeHeader(stream_file, code, pReason, cache, type, -1);
 }
 
-void ServeHeader(FILE * stream_file, int code, const char * pReason, bool cache)
+void ServeHeader(FILE * stream_file, int code, const char * pReason, uint8_t cache)
 {
      ServeHeader(stream_file, code, pReason, cache, PSTR("text/html"));
 }
@@ -103,69 +393,314 @@ void ServeHeader(FILE * stream_file, int code, const char * pReason, bool cache)
 
 void Serve404(FILE * stream_file)
 {
-	ServeHeader(stream_file, 404, PSTR("NOT FOUND"), false);
+	ServeHeader(stream_file, 404, PSTR("NOT FOUND"), WEB_CACHE_NOCACHE);
 	fprintf_P(stream_file, PSTR("NOT FOUND"));
 }
 
 static void ServeError(FILE * stream_file)
 {
-	ServeHeader(stream_file, 405, PSTR("NOT ALLOWED"), false);
+	ServeHeader(stream_file, 405, PSTR("NOT ALLOWED"), WEB_CACHE_NOCACHE);
 	fprintf_P(stream_file, PSTR("NOT ALLOWED"));
 }
 
 
-static void JSONSchedules(const KVPairs & key_value_pairs, FILE * stream_file)
+// Log query response cache.
+//
+// json/tlogs, json/schlogs and json/sens responses are cached on the SD card (see Logging::cacheLookup()).
+// Query key is the hash of the route and parsed query parameters, so the order or formatting of the parameters does not matter.
+// Queries relative to the current time (no start date) and incremental queries (since) are not cached.
+
+struct WebCacheQuery
+{
+	int8_t		route;
+	char		sensor_type;
+	int			sensor_id;
+	char		summary_type;
+	time_t		sdate;
+	time_t		edate;
+	uint16_t	points;
+};
+
+static uint32_t WebCacheKey(const WebCacheQuery & q)
+{
+	const uint8_t * p = (const uint8_t *)&q;
+	uint32_t h = 2166136261UL;		// FNV-1a
+
+	for (uint8_t i = 0; i < sizeof(q); i++)
+		h = (h ^ p[i]) * 16777619UL;
+	return h;
+}
+
+// Send opened response file. entry - cache entry of the file (see Logging::cacheLookup()), or -1 if the response is not cached.
+static void WebCacheSend(WebRequest & rq, FILE * stream_file, const char * fname, int8_t entry)
+{
+	ServeFile(stream_file, fname, *rq.file, *rq.client);
+	if (entry < 0)
+		return;
+	if (rq.file->isOpen() && (activeConn != NULL))
+		activeConn->cacheEntry = entry;		// body is sent asynchronously, released by WebConnCloseFile()
+	else
+		sdlog.cacheRelease(entry);
+}
+
+// Serve the response from the cache. Returns false if there is no valid cached response.
+static bool WebCacheServe(WebRequest & rq, FILE * stream_file, uint32_t key, uint8_t log_type)
+{
+	char fname[JCACHE_FNAME_SIZE];
+	int8_t entry = sdlog.cacheLookup(key, log_type, fname);
+
+	if (entry < 0)
+		return false;
+	if (!rq.file->open(fname, O_READ))
+	{
+		sdlog.cacheRelease(entry);
+		return false;
+	}
+
+	WebCacheSend(rq, stream_file, fname, entry);
+	return true;
+}
+
+
+// Response generator.
+//
+// json/tlogs, json/schlogs, json/sens (unless the response is cached) and json/wcheck take long to produce, their responses
+// are generated in steps by the connection state machine (WEB_CONN_GEN), so the main loop keeps running.
+// Log query response is written into the response file - the cache file, or the scratch file of the connection if
+// the query is not cached - and is sent from the file when complete, so a slow client does not hold up the log scan.
+// One response is generated at a time, requests of the other connections for these routes wait (WEB_CONN_QUEUED).
+
+#define WEB_GEN_DONE		0		// response is complete
+#define WEB_GEN_MORE		1		// step made progress, more steps follow
+#define WEB_GEN_WAIT		2		// nothing to do yet (waiting for the network)
+
+// Generator step, returns WEB_GEN_xxx. The last step emits the response (or starts sending the response file).
+typedef uint8_t (*WebGenStep)(FILE * stream_file);
+// Log query step. Emits the next part of the JSON response (bFirst - the first step), returns true if there is more.
+typedef bool (*WebLogStep)(JsonWriter & jw, bool bFirst);
+
+static struct
+{
+	int8_t		conn;				// generating connection, -1 if none
+	WebGenStep	step;
+	WebLogStep	logStep;			// log query
+	bool		bFirst;
+	uint32_t	key;				// cache key of the response (see WebCacheKey())
+	uint8_t		log_type;			// log type of the cached response, 0 if the response goes to the scratch file
+	uint16_t	gen;				// log generation at the start of the response
+	union
+	{
+		LogScan		scan;			// json/tlogs, json/schlogs, json/sens
+		Weather		weather;		// json/wcheck
+	};
+} webGen;
+static JsonWriter webGenWriter(gen_write, NULL);
+
+static void WebGenStart(WebGenStep step)
+{
+	webGen.conn = activeConn - webConn;
+	webGen.step = step;
+	activeConn->phase = WEB_CONN_GEN;
+}
+
+static uint8_t WebGenLogStep(FILE * stream_file)
+{
+	char fname[JCACHE_FNAME_SIZE];
+	int8_t entry = -1;
+	bool bFirst = webGen.bFirst;
+
+	webGen.bFirst = false;
+	if (webGen.logStep(webGenWriter, bFirst))
+		return WEB_GEN_MORE;
+
+	bool bOK = webGenWriter.Flush();
+	if (webGen.log_type != 0)
+	{
+		entry = sdlog.cacheCommit(webGen.key, webGen.log_type, webGen.gen, *rq.file, bOK);
+		bOK = (entry >= 0);
+		sprintf_P(fname, PSTR(JCACHE_FNAME_FORMAT), webGen.key);
+	}
+	else
+	{
+		bOK = bOK && rq.file->seekSet(0);
+		sprintf_P(fname, PSTR(JCACHE_SCRATCH_FNAME_FORMAT), webGen.conn);
+	}
+
+	if (!bOK)
+	{
+		if (rq.file->isOpen())
+			rq.file->close();
+		ServeHeader(stream_file, 500, PSTR("Internal Server Error"), WEB_CACHE_NOSTORE, PSTR("text/plain"), 0);
+		return WEB_GEN_DONE;
+	}
+	WebCacheSend(rq, stream_file, fname, entry);
+	return WEB_GEN_DONE;
+}
+
+// Start log query response. The scan (webGen.scan) is set up by the caller.
+static void WebGenLog(WebRequest & rq, FILE * stream_file, WebLogStep step, uint32_t key, uint8_t log_type, bool bCache)
+{
+	webGen.key = key;
+	webGen.log_type = 0;
+	webGen.logStep = step;
+	webGen.bFirst = true;
+
+	if (bCache && sdlog.cacheCreate(key, log_type, *rq.file))
+	{
+		webGen.log_type = log_type;
+		webGen.gen = sdlog.cacheGen(log_type);
+	}
+	else if (!sdlog.cacheScratch(activeConn - webConn, *rq.file))
+	{
+		// response file cannot be opened (no card, so there are no logs to scan either) - emit the response at once
+		ServeHeader(stream_file, 200, PSTR("OK"), rq.cache, PSTR("text/plain"));
+		JsonWriter jw(stream_write, stream_file);
+		for (bool bFirst = true; step(jw, bFirst); bFirst = false)
+			;
+		return;
+	}
+
+	webGenWriter = JsonWriter(gen_write, rq.file);
+	WebGenStart(WebGenLogStep);
+}
+
+// Drop the response being generated (the connection is closed)
+static void WebGenAbort(void)
+{
+	if (webGen.step == WebGenLogStep)
+	{
+		if (webGen.log_type != 0)
+			sdlog.cacheCommit(webGen.key, webGen.log_type, webGen.gen, webConn[webGen.conn].file, false);
+	}
+	else
+		webGen.weather.Abort();
+	webGen.conn = -1;
+}
+
+static void JSONSchedules(WebRequest & rq, FILE * stream_file)
 {
-	ServeHeader(stream_file, 200, PSTR("OK"), false, PSTR("text/plain"));
+	ServeHeader(stream_file, 200, PSTR("OK"), rq.cache, PSTR("text/plain"));
+	JsonWriter jw(stream_write, stream_file);
 	int iNumSchedules = GetNumSchedules();
-	fprintf_P(stream_file, PSTR("{\n\"Table\" : [\n"));
 	Schedule sched;
+
+	jw.BeginObject();
+	jw.Key(PSTR("Table"));
+	jw.BeginArray();
 	for (int i = 0; i < iNumSchedules; i++)
 	{
 		LoadSchedule(i, &sched);
-		fprintf_P(stream_file, PSTR("%s\t{\"id\" : %d, \"name\" : \"%s\", \"e\" : \"%s\" }"), (i == 0) ? "" : ",\n", i, sched.name,
-				(sched.IsEnabled()) ? "on" : "off");
+		jw.BeginObject();
+		jw.Key(PSTR("id"));		jw.Number(i);
+		jw.Key(PSTR("name"));	jw.String(sched.name);
+		jw.Key(PSTR("e"));		jw.OnOff(sched.IsEnabled());
+		jw.EndObject();
 	}
-	fprintf_P(stream_file, PSTR("\n]}"));
+	jw.EndArray();
+	jw.EndObject();
 }
 
 
-static void JSONZones(const KVPairs & key_value_pairs, FILE * stream_file)
+static void JSONZones(WebRequest & rq, FILE * stream_file)
 {
-	ServeHeader(stream_file, 200, PSTR("OK"), false, PSTR("text/plain"));
-	fprintf_P(stream_file, PSTR("{\n\"zones\" : [\n"));
+	ServeHeader(stream_file, 200, PSTR("OK"), rq.cache, PSTR("text/plain"));
+	JsonWriter jw(stream_write, stream_file);
 	FullZone zone = {0};
+	char loc[8];
+
+	jw.BeginObject();
+	jw.Key(PSTR("zones"));
+	jw.BeginArray();
 	for (int i = 0; i < GetNumZones(); i++)
 	{
 		LoadZone(i, &zone);
-		fprintf_P(stream_file, PSTR("%s\t{\"name\" : \"%s\", \"enabled\" : \"%s\", \"state\" : \"%s\", \"loc\" : \"%d:%d\", \"wfrate\" : \"%d\" }"), (i == 0) ? "" : ",\n", zone.name,
-				zone.bEnabled ? "on" : "off", (GetZoneState(i + 1)==ZONE_STATE_OFF) ? "off" : "on", int(zone.stationID), int(zone.channel), zone.waterFlowRate);
+		jw.BeginObject();
+		jw.Key(PSTR("name"));		jw.String(zone.name);
+		jw.Key(PSTR("enabled"));	jw.OnOff(zone.bEnabled);
+		jw.Key(PSTR("state"));		jw.OnOff(GetZoneState(i + 1) != ZONE_STATE_OFF);
+		sprintf_P(loc, PSTR("%d:%d"), int(zone.stationID), int(zone.channel));
+		jw.Key(PSTR("loc"));		jw.String(loc);
+		jw.Key(PSTR("wfrate"));		jw.QuotedNumber(zone.waterFlowRate);
+		jw.EndObject();
 	}
-	fprintf_P(stream_file, PSTR("\n]}"));
+	jw.EndArray();
+	jw.EndObject();
 }
 
 
-static void JSONSensorsNow(FILE * stream_file)
+static void JSONSensorsNow(WebRequest & rq, FILE * stream_file)
 {
-	ServeHeader(stream_file, 200, PSTR("OK"), false, PSTR("text/plain"));
+	ServeHeader(stream_file, 200, PSTR("OK"), rq.cache, PSTR("text/plain"));
+	JsonWriter jw(stream_write, stream_file);
+
+	jw.BeginObject();
+	sensorsModule.TableLastSensorsData(jw);
+	jw.EndObject();
+}
 
-	fprintf_P(stream_file, PSTR("{\n"));
-	sensorsModule.TableLastSensorsData(stream_file);
-	fprintf_P(stream_file, PSTR("}"));
 
+// Link statistics of the remote stations
+static void JSONLinks(WebRequest & rq, FILE * stream_file)
+{
+	ServeHeader(stream_file, 200, PSTR("OK"), rq.cache, PSTR("text/plain"));
+	JsonWriter jw(stream_write, stream_file);
+	FullStation	fStation;
+	RLinkStats	stats;
+
+	jw.BeginObject();
+	jw.Key(PSTR("links"));
+	jw.BeginArray();
+	for (uint8_t i = 0; i < MAX_STATIONS; i++)
+	{
+		LoadStation(i, &fStation);
+		if (!(fStation.stationFlags & STATION_FLAGS_VALID) || !(fStation.stationFlags & STATION_FLAGS_ENABLED) ||
+			((fStation.networkID != NETWORK_ID_XBEE) && (fStation.networkID != NETWORK_ID_MOTEINORF)))
+			continue;
+
+		rprotocol.LinkStats(i, &stats);
+		uint8_t	health = rprotocol.LinkHealth(i);
+
+		jw.BeginObject();
+		jw.Key(PSTR("stationID"));		jw.Number(i);
+		jw.Key(PSTR("name"));			jw.String(fStation.name);
+		jw.Key(PSTR("network"));		jw.StringP(fStation.networkID == NETWORK_ID_XBEE ? PSTR("XBee") : PSTR("RFM69"));
+		jw.Key(PSTR("lastContact"));	jw.Number(runState.sLastContactTime[i] ? long((millis() - runState.sLastContactTime[i])/1000ul) : -1);
+		jw.Key(PSTR("rssi"));			jw.Number(runState.iLastReceivedRSSI[i]);
+		jw.Key(PSTR("health"));			jw.Number(health == 0xFF ? -1 : health);
+		jw.Key(PSTR("status"));			jw.StringP(rprotocol.LinkStatus(i));
+		jw.Key(PSTR("txFrames"));		jw.NumberU(stats.txFrames);
+		jw.Key(PSTR("txRetries"));		jw.NumberU(stats.txRetries);
+		jw.Key(PSTR("txFailed"));		jw.NumberU(stats.txFailed);
+		jw.Key(PSTR("rxFrames"));		jw.NumberU(stats.rxFrames);
+		jw.Key(PSTR("rxDuplicates"));	jw.NumberU(stats.rxDuplicates);
+		jw.Key(PSTR("requests"));		jw.NumberU(stats.requests);
+		jw.Key(PSTR("timeouts"));		jw.NumberU(stats.timeouts);
+		jw.Key(PSTR("txLoss"));			jw.NumberU((stats.txLoss + 128) >> 8);
+		jw.Key(PSTR("reqLoss"));		jw.NumberU((stats.reqLoss + 128) >> 8);
+		jw.Key(PSTR("rtt"));			jw.NumberU(stats.rtt);
+		jw.EndObject();
+	}
+	jw.EndArray();
+	jw.EndObject();
 }
 
 
-static void JSONWWCounters(const KVPairs & key_value_pairs, FILE * stream_file)
+static void JSONWWCounters(WebRequest & rq, FILE * stream_file)
 {
-	ServeHeader(stream_file, 200, PSTR("OK"), false, PSTR("text/plain"));
+	ServeHeader(stream_file, 200, PSTR("OK"), rq.cache, PSTR("text/plain"));
+	JsonWriter jw(stream_write, stream_file);
 
 	uint8_t		dow = weekday(now())-1;
 	uint8_t		index = dow;
 	uint16_t	cc;
-	bool		bFirstRow = true;
 
-	fprintf_P(stream_file, PSTR("{\n\"series\" : [{\n\t\"name\": \"Water usage\",\n\t\"data\": ["));
+	jw.BeginObject();
+	jw.Key(PSTR("series"));
+	jw.BeginArray();
+	jw.BeginObject();
+	jw.Key(PSTR("name"));	jw.StringP(PSTR("Water usage"));
+	jw.Key(PSTR("data"));
+	jw.BeginArray();
 
 	for( uint8_t i=0; i<7; i++ )
 	{
@@ -173,26 +708,61 @@ static void JSONWWCounters(const KVPairs & key_value_pairs, FILE * stream_file)
 		if( index > 0 ) index--;
 		else			index = 6;
 
-		fprintf_P(stream_file, PSTR("%s\n\t\t\t[-%d, %u]"), bFirstRow ? "":",", int(i), cc/100);
-		bFirstRow = false;
+		jw.BeginArray();
+		jw.Number(-int(i));
+		jw.NumberU(cc/100);
+		jw.EndArray();
 	}
 
-	fprintf_P(stream_file, PSTR("\n\t\t]\n\t}]\n}\n"));
+	jw.EndArray();
+	jw.EndObject();
+	jw.EndArray();
+	jw.EndObject();
 }
 
 
 // Query sensor readings
 
-static void JSONSensor(const KVPairs & key_value_pairs, FILE * stream_file)
+// Incremental log queries.
+//
+// json/tlogs, json/schlogs and json/sens accept "since" parameter, and return "hwm" (high-water mark) - time of the newest
+// record in the response. Dashboard passes hwm of the previous response as "since" to get only the new records.
+// Reading of the log file starts at the position remembered by the previous query (see seek hints in sdlog.cpp),
+// so the cost of the refresh is proportional to the amount of new data.
+// Log records have minute resolution, records are returned if they are strictly newer than "since".
+static void WebSinceRange(time_t since, time_t & sdate, time_t & edate)
+{
+	if (since == 0)
+		return;
+	if (sdate < since)
+		sdate = since;
+	if (edate == 0)
+		edate = now();
+}
+
+static bool JSONSensorStep(JsonWriter & jw, bool bFirst)
+{
+	if (bFirst)
+		jw.BeginObject();
+	if (sdlog.EmitSensorLog(jw, webGen.scan))
+		return true;
+	jw.Key(PSTR("hwm"));
+	jw.NumberU(webGen.scan.hwm);
+	jw.EndObject();
+	return false;
+}
+
+static void JSONSensor(WebRequest & rq, FILE * stream_file)
 {
-	ServeHeader(stream_file, 200, PSTR("OK"), false, PSTR("text/plain"));
-	fprintf_P(stream_file, PSTR("{\n"));
+	const KVPairs & key_value_pairs = *rq.key_value_pairs;
 
 	time_t sdate = 0;
 	time_t edate = 0;
         char  sensor_type = 0;
         int     sensor_id     = 0;
         char  summary_type = LOG_SUMMARY_NONE;
+	uint16_t points = 0;		// max number of chart points, 0 - all readings
+	time_t since = 0;			// incremental query - only readings newer than since
 
 	// Iterate through the kv pairs and search for the start and end dates.
 	for (int i = 0; i < key_value_pairs.num_pairs; i++)
@@ -224,18 +794,59 @@ static void JSONSensor(const KVPairs & key_value_pairs, FILE * stream_file)
 			else if (value[0] == 'm')
 				summary_type = LOG_SUMMARY_MONTH;
 		}
+		else if (strcmp_P(key, PSTR("points")) == 0)
+		{
+			points = strtoul(value, 0, 10);
+		}
+		else if (strcmp_P(key, PSTR("since")) == 0)
+		{
+			since = strtoul(value, 0, 10);
+		}
 	}
+	WebSinceRange(since, sdate, edate);
+
+	WebCacheQuery q = {0};
+	q.route = rq.route;
+	q.sensor_type = sensor_type;
+	q.sensor_id = sensor_id;
+	q.summary_type = summary_type;
+	q.sdate = sdate;
+	q.edate = edate;
+	q.points = points;
+	uint32_t ckey = WebCacheKey(q);
+	uint8_t log_type = sdlog.sensorLogType(sensor_type);
+	bool bCache = sdate && !since;
+	if (bCache && WebCacheServe(rq, stream_file, ckey, log_type))
+		return;
 
-	sdlog.EmitSensorLog(stream_file, sdate, edate, sensor_type, sensor_id, summary_type);
-	fprintf_P(stream_file, PSTR("}"));
+	sdlog.scanBegin(webGen.scan, sdate, edate, since, sensor_type, sensor_id, summary_type, points);
+	WebGenLog(rq, stream_file, JSONSensorStep, ckey, log_type, bCache);
 }
 
 
-static void JSONtLogs(const KVPairs & key_value_pairs, FILE * stream_file)
+static bool JSONtLogsStep(JsonWriter & jw, bool bFirst)
 {
-	ServeHeader(stream_file, 200, PSTR("OK"), false, PSTR("text/plain"));
-	time_t sdate = 0;
-	time_t edate = 0;
+	if (bFirst)
+	{
+		jw.BeginObject();
+		jw.Key(PSTR("logs"));
+		jw.BeginArray();
+	}
+	if (sdlog.TableZone(jw, webGen.scan))
+		return true;
+	jw.EndArray();
+	jw.Key(PSTR("hwm"));
+	jw.NumberU(webGen.scan.hwm);
+	jw.EndObject();
+	return false;
+}
+
+static void JSONtLogs(WebRequest & rq, FILE * stream_file)
+{
+	const KVPairs & key_value_pairs = *rq.key_value_pairs;
+
+	WebCacheQuery q = {0};
+	time_t since = 0;		// incremental query - only records newer than since
 	// Iterate through the kv pairs and search for the start and end dates.
 	for (int i = 0; i < key_value_pairs.num_pairs; i++)
 	{
@@ -243,22 +854,52 @@ static void JSONtLogs(const KVPairs & key_value_pairs, FILE * stream_file)
 		const char * value = key_value_pairs.values[i];
 		if (strcmp_P(key, PSTR("sdate")) == 0)
 		{
-			sdate = strtol(value, 0, 10);
+			q.sdate = strtol(value, 0, 10);
 		}
 		else if (strcmp_P(key, PSTR("edate")) == 0)
 		{
-			edate = strtol(value, 0, 10);
+			q.edate = strtol(value, 0, 10);
+		}
+		else if (strcmp_P(key, PSTR("since")) == 0)
+		{
+			since = strtoul(value, 0, 10);
 		}
 	}
-	sdlog.TableZone(stream_file, sdate, edate);
+	WebSinceRange(since, q.sdate, q.edate);
+
+	q.route = rq.route;
+	uint32_t ckey = WebCacheKey(q);
+	bool bCache = q.sdate && !since;
+	if (bCache && WebCacheServe(rq, stream_file, ckey, LOG_TYPE_WATERING))
+		return;
+
+	sdlog.scanBegin(webGen.scan, q.sdate, q.edate, since);
+	WebGenLog(rq, stream_file, JSONtLogsStep, ckey, LOG_TYPE_WATERING, bCache);
 }
 
-static void JSONScheduleLogs(const KVPairs & key_value_pairs, FILE * stream_file)
+static bool JSONScheduleLogsStep(JsonWriter & jw, bool bFirst)
 {
-	ServeHeader(stream_file, 200, PSTR("OK"), false, PSTR("text/plain"));
-	fprintf_P(stream_file, PSTR("{\n\t\"logs\": [\n"));
-	time_t sdate = 0;
-	time_t edate = 0;
+	if (bFirst)
+	{
+		jw.BeginObject();
+		jw.Key(PSTR("logs"));
+		jw.BeginArray();
+	}
+	if (sdlog.TableSchedule(jw, webGen.scan))
+		return true;
+	jw.EndArray();
+	jw.Key(PSTR("hwm"));
+	jw.NumberU(webGen.scan.hwm);
+	jw.EndObject();
+	return false;
+}
+
+static void JSONScheduleLogs(WebRequest & rq, FILE * stream_file)
+{
+	const KVPairs & key_value_pairs = *rq.key_value_pairs;
+
+	WebCacheQuery q = {0};
+	time_t since = 0;		// incremental query - only records newer than since
 	// Iterate through the kv pairs and search for the start and end dates.
 	for (int i = 0; i < key_value_pairs.num_pairs; i++)
 	{
@@ -266,92 +907,131 @@ static void JSONScheduleLogs(const KVPairs & key_value_pairs, FILE * stream_file
 		const char * value = key_value_pairs.values[i];
 		if (strcmp_P(key, PSTR("sdate")) == 0)
 		{
-			sdate = strtol(value, 0, 10);
+			q.sdate = strtol(value, 0, 10);
 		}
 		else if (strcmp_P(key, PSTR("edate")) == 0)
 		{
-			edate = strtol(value, 0, 10);
+			q.edate = strtol(value, 0, 10);
+		}
+		else if (strcmp_P(key, PSTR("since")) == 0)
+		{
+			since = strtoul(value, 0, 10);
 		}
 	}
-	sdlog.TableSchedule(stream_file, sdate, edate);
-	fprintf_P(stream_file, PSTR("\n\t]\n}"));
+	WebSinceRange(since, q.sdate, q.edate);
+
+	q.route = rq.route;
+	uint32_t ckey = WebCacheKey(q);
+	bool bCache = q.sdate && !since;
+	if (bCache && WebCacheServe(rq, stream_file, ckey, LOG_TYPE_WATERING))
+		return;
+
+	sdlog.scanBegin(webGen.scan, q.sdate, q.edate, since);
+	WebGenLog(rq, stream_file, JSONScheduleLogsStep, ckey, LOG_TYPE_WATERING, bCache);
+}
+
+// Emit IP address member as "a.b.c.d" string
+static void JSONIPMember(JsonWriter & jw, const char * key_P, const IPAddress & ip)
+{
+	char buf[16];
+	sprintf_P(buf, PSTR("%d.%d.%d.%d"), ip[0], ip[1], ip[2], ip[3]);
+	jw.Key(key_P);
+	jw.String(buf);
 }
 
-static void JSONSettings(const KVPairs & key_value_pairs, FILE * stream_file)
+static void JSONSettings(WebRequest & rq, FILE * stream_file)
 {
-	ServeHeader(stream_file, 200, PSTR("OK"), false, PSTR("text/plain"));
-	IPAddress ip;
-	fprintf_P(stream_file, PSTR("{\n"));
+	ServeHeader(stream_file, 200, PSTR("OK"), rq.cache, PSTR("text/plain"));
+	JsonWriter jw(stream_write, stream_file);
+	jw.BeginObject();
 #ifdef ARDUINO
-	ip = GetIP();
-	fprintf_P(stream_file, PSTR("\t\"ip\" : \"%d.%d.%d.%d\",\n"), ip[0], ip[1], ip[2], ip[3]);
-	ip = GetNetmask();
-	fprintf_P(stream_file, PSTR("\t\"netmask\" : \"%d.%d.%d.%d\",\n"), ip[0], ip[1], ip[2], ip[3]);
-	ip = GetGateway();
-	fprintf_P(stream_file, PSTR("\t\"gateway\" : \"%d.%d.%d.%d\",\n"), ip[0], ip[1], ip[2], ip[3]);
-	ip = GetNTPIP();
-	fprintf_P(stream_file, PSTR("\t\"NTPip\" : \"%d.%d.%d.%d\",\n"), ip[0], ip[1], ip[2], ip[3]);
-	fprintf_P(stream_file, PSTR("\t\"NTPoffset\" : \"%d\",\n"), GetNTPOffset());
+	JSONIPMember(jw, PSTR("ip"), GetIP());
+	JSONIPMember(jw, PSTR("netmask"), GetNetmask());
+	JSONIPMember(jw, PSTR("gateway"), GetGateway());
+	JSONIPMember(jw, PSTR("NTPip"), GetNTPIP());
+	jw.Key(PSTR("NTPoffset"));	jw.QuotedNumber(GetNTPOffset());
 #endif
-	fprintf_P(stream_file, PSTR("\t\"webport\" : \"%u\",\n"), GetWebPort());
-	fprintf_P(stream_file, PSTR("\t\"ot\" : \"%d\",\n"), GetOT());
-	ip = GetWUIP();
-	fprintf_P(stream_file, PSTR("\t\"wuip\" : \"%d.%d.%d.%d\",\n"), ip[0], ip[1], ip[2], ip[3]);
-	fprintf_P(stream_file, PSTR("\t\"wutype\" : \"%s\",\n"), GetUsePWS() ? "pws" : "zip");
-	fprintf_P(stream_file, PSTR("\t\"zip\" : \"%ld\",\n"), (long) GetZip());
-	fprintf_P(stream_file, PSTR("\t\"sadj\" : \"%ld\",\n"), (long) GetSeasonalAdjust());
+	jw.Key(PSTR("webport"));	jw.QuotedNumber(GetWebPort());
+	jw.Key(PSTR("ot"));			jw.QuotedNumber(GetOT());
+	JSONIPMember(jw, PSTR("wuip"), GetWUIP());
+	jw.Key(PSTR("wutype"));		jw.StringP(GetUsePWS() ? PSTR("pws") : PSTR("zip"));
+	jw.Key(PSTR("zip"));		jw.QuotedNumber((long) GetZip());
+	jw.Key(PSTR("sadj"));		jw.QuotedNumber((long) GetSeasonalAdjust());
 	char ak[17];
 	GetApiKey(ak);
-	fprintf_P(stream_file, PSTR("\t\"apikey\" : \"%s\",\n"), ak);
+	jw.Key(PSTR("apikey"));		jw.String(ak);
 	GetPWS(ak);
 	ak[11] = 0;
-	fprintf_P(stream_file, PSTR("\t\"pws\" : \"%s\"\n"), ak);
-	fprintf_P(stream_file, PSTR("}"));
+	jw.Key(PSTR("pws"));		jw.String(ak);
+	jw.EndObject();
 }
 
-static void JSONwCheck(const KVPairs & key_value_pairs, FILE * stream_file)
+// Weather check response. Runs as the generator step while the weather service query is in progress.
+static uint8_t JSONwCheckStep(FILE * stream_file)
 {
-	Weather w;
-	ServeHeader(stream_file, 200, PSTR("OK"), false, PSTR("text/plain"));
-	char key[17];
-	GetApiKey(key);
-	char pws[12] = {0};
-	GetPWS(pws);
+	Weather & w = webGen.weather;
 
-	const Weather::ReturnVals vals = w.GetVals(GetWUIP(), key, GetZip(), pws, GetUsePWS());
+	if (!w.Poll())
+		return w.IsWaiting() ? WEB_GEN_WAIT : WEB_GEN_MORE;
+
+	const Weather::ReturnVals & vals = w.Vals();
 	const int scale = w.GetScale(vals);
 
 	TRACE_VERBOSE(F("JSONwCheck - GetVals complete. Scale=%d\n"), scale);
 
-	fprintf_P(stream_file, PSTR("{\n"));
-	fprintf_P(stream_file, PSTR("\t\"valid\" : \"%s\",\n"), vals.valid ? "true" : "false");
-	fprintf_P(stream_file, PSTR("\t\"keynotfound\" : \"%s\",\n"), vals.keynotfound ? "true" : "false");
-	fprintf_P(stream_file, PSTR("\t\"minhumidity\" : \"%d\",\n"), vals.minhumidity);
-	fprintf_P(stream_file, PSTR("\t\"maxhumidity\" : \"%d\",\n"), vals.maxhumidity);
-	fprintf_P(stream_file, PSTR("\t\"meantempi\" : \"%d\",\n"), vals.meantempi);
-	fprintf_P(stream_file, PSTR("\t\"precip_today\" : \"%d\",\n"), vals.precip_today);
-	fprintf_P(stream_file, PSTR("\t\"precip\" : \"%d\",\n"), vals.precipi);
-	fprintf_P(stream_file, PSTR("\t\"wind_mph\" : \"%d\",\n"), vals.windmph);
-	fprintf_P(stream_file, PSTR("\t\"UV\" : \"%d\",\n"), vals.UV);
-	fprintf_P(stream_file, PSTR("\t\"scale\" : \"%d\"\n"), scale);
-	fprintf_P(stream_file, PSTR("}"));
+	ServeHeader(stream_file, 200, PSTR("OK"), WEB_CACHE_NOCACHE, PSTR("text/plain"));
+	JsonWriter jw(stream_write, stream_file);
+	jw.BeginObject();
+	jw.Key(PSTR("valid"));			jw.StringP(vals.valid ? PSTR("true") : PSTR("false"));
+	jw.Key(PSTR("keynotfound"));	jw.StringP(vals.keynotfound ? PSTR("true") : PSTR("false"));
+	jw.Key(PSTR("minhumidity"));	jw.QuotedNumber(vals.minhumidity);
+	jw.Key(PSTR("maxhumidity"));	jw.QuotedNumber(vals.maxhumidity);
+	jw.Key(PSTR("meantempi"));		jw.QuotedNumber(vals.meantempi);
+	jw.Key(PSTR("precip_today"));	jw.QuotedNumber(vals.precip_today);
+	jw.Key(PSTR("precip"));			jw.QuotedNumber(vals.precipi);
+	jw.Key(PSTR("wind_mph"));		jw.QuotedNumber(vals.windmph);
+	jw.Key(PSTR("UV"));				jw.QuotedNumber(vals.UV);
+	jw.Key(PSTR("scale"));			jw.QuotedNumber(scale);
+	jw.EndObject();
+	return WEB_GEN_DONE;
 }
 
-static void JSONState(const KVPairs & key_value_pairs, FILE * stream_file)
+static void JSONwCheck(WebRequest & rq, FILE * stream_file)
 {
-	ServeHeader(stream_file, 200, PSTR("OK"), false, PSTR("text/plain"));
+	char key[17];
+	GetApiKey(key);
+	char pws[12] = {0};
+	GetPWS(pws);
+
+	if (webGen.weather.Start(GetWUIP(), key, GetZip(), pws, GetUsePWS()))
+		WebGenStart(JSONwCheckStep);
+	else
+		JSONwCheckStep(stream_file);		// connection failed, reply with invalid values right away
+}
+
+static void JSONState(WebRequest & rq, FILE * stream_file)
+{
+	ServeHeader(stream_file, 200, PSTR("OK"), rq.cache, PSTR("text/plain"));
+	JsonWriter jw(stream_write, stream_file);
+
+	jw.BeginObject();
+	jw.Key(PSTR("version"));		jw.QuotedNumber(SG_FIRMWARE_VERSION);
+	jw.Key(PSTR("run"));			jw.OnOff(GetRunSchedules());
+	jw.Key(PSTR("zones"));			jw.QuotedNumber(GetNumEnabledZones());
+	jw.Key(PSTR("schedules"));		jw.QuotedNumber(GetNumSchedules());
+	jw.Key(PSTR("stations"));		jw.QuotedNumber(GetNumStations());
+	jw.Key(PSTR("timenow"));		jw.QuotedNumber(now());
+	jw.Key(PSTR("locationZip"));	jw.QuotedNumber(GetZip());
+	jw.Key(PSTR("loopMax"));		jw.QuotedNumber(GetMaxLoopTime());
 
-	fprintf_P(stream_file,
-			PSTR("{\n\t\"version\" : \"%u\",\n\t\"run\" : \"%s\",\n\t\"zones\" : \"%d\",\n\t\"schedules\" : \"%d\",\n\t\"stations\" : \"%d\",\n\t\"timenow\" : \"%lu\",\n\t\"locationZip\" : \"%lu\","),
-			uint16_t(SG_FIRMWARE_VERSION), GetRunSchedules() ? "on" : "off", GetNumEnabledZones(), int(GetNumSchedules()), int(GetNumStations()), now(), GetZip());
-	
 	if( runState.isPaused() )
 	{
-		fprintf_P(stream_file, PSTR("\n\t\"paused\" : \"on\",\n\t\"remainingPauseTime\" : \"%d\""), runState.getRemainingPauseTime());
+		jw.Key(PSTR("paused"));				jw.OnOff(true);
+		jw.Key(PSTR("remainingPauseTime"));	jw.QuotedNumber(runState.getRemainingPauseTime());
 	}
 	else
 	{
-		fprintf_P(stream_file, PSTR("\n\t\"paused\" : \"off\""));
+		jw.Key(PSTR("paused"));				jw.OnOff(false);
 	}
 	
 	if( runState.isSchedule() )
@@ -366,7 +1046,10 @@ static void JSONState(const KVPairs & key_value_pairs, FILE * stream_file)
 
 		if( runState.getSchedule() == 100 )  // manual
 			strcpy_P(sched.name, PSTR("Manual"));
-		fprintf_P(stream_file, PSTR(",\n\t\"onZoneName\" : \"%s\",\n\t\"offTime\" : \"%d\",\n\t\"onSchedID\" : \"%d\",\n\t\"onSchedName\" : \"%s\""), zone.name, runState.getRemainingTime(), int(runState.getSchedule()), sched.name);
+		jw.Key(PSTR("onZoneName"));		jw.String(zone.name);
+		jw.Key(PSTR("offTime"));		jw.QuotedNumber(runState.getRemainingTime());
+		jw.Key(PSTR("onSchedID"));		jw.QuotedNumber(runState.getSchedule());
+		jw.Key(PSTR("onSchedName"));	jw.String(sched.name);
 	}
 
 	uint8_t	 nextSchedID, nextZoneID;
@@ -374,24 +1057,28 @@ static void JSONState(const KVPairs & key_value_pairs, FILE * stream_file)
 
 	if( GetNextEvent(&nextSchedID, &nextZoneID, &nextTime) )
 	{
-		short nextHour, nextMinute;
-		nextHour = nextTime/60;
-		nextMinute = nextTime - nextHour*60;
+		char	 nextTimeStr[6];
+		sprintf_P(nextTimeStr, PSTR("%2.2u:%2.2u"), nextTime/60, nextTime%60);
 
         Schedule sched;
         LoadSchedule( nextSchedID, &sched );
 		FullZone zone;
 		LoadZone(nextZoneID, &zone);
 
-		fprintf_P(stream_file, PSTR(",\n\t\"nextSchedID\" : \"%u\",\n\t\"nextSchedName\" : \"%s\",\n\t\"nextZoneID\" : \"%u\",\n\t\"nextZoneName\" : \"%s\",\n\t\"NextEventTime\" : \"%2.2u:%2.2u\""), 
-									short(nextSchedID), sched.name, short(nextZoneID), zone.name, nextHour, nextMinute);
+		jw.Key(PSTR("nextSchedID"));	jw.QuotedNumber(nextSchedID);
+		jw.Key(PSTR("nextSchedName"));	jw.String(sched.name);
+		jw.Key(PSTR("nextZoneID"));		jw.QuotedNumber(nextZoneID);
+		jw.Key(PSTR("nextZoneName"));	jw.String(zone.name);
+		jw.Key(PSTR("NextEventTime"));	jw.String(nextTimeStr);
 	}
 
-	fprintf_P(stream_file, (PSTR("\n}")));
+	jw.EndObject();
 }
 
-static void JSONSchedule(const KVPairs & key_value_pairs, FILE * stream_file)
+static void JSONSchedule(WebRequest & rq, FILE * stream_file)
 {
+	const KVPairs & key_value_pairs = *rq.key_value_pairs;
+
 	int sched_num = -1;
 	freeMemory();
 
@@ -415,74 +1102,99 @@ static void JSONSchedule(const KVPairs & key_value_pairs, FILE * stream_file)
 	}
 
 	// Now construct the response and send it
-	ServeHeader(stream_file, 200, PSTR("OK"), false, PSTR("text/plain"));
+	ServeHeader(stream_file, 200, PSTR("OK"), rq.cache, PSTR("text/plain"));
+	JsonWriter jw(stream_write, stream_file);
 	Schedule sched;
 	LoadSchedule(sched_num, &sched);
-	fprintf_P(stream_file,
-			PSTR("{\n\t\"name\" : \"%s\",\n\t\"enabled\" : \"%s\",\n\t\"wadj\" : \"%s\",\n\t\"type\" : \"%s\",\n\t\"d1\" : \"%s\",\n\t\"d2\" : \"%s\""),
-			sched.name, sched.IsEnabled() ? "on" : "off", sched.IsWAdj() ? "on" : "off", sched.IsInterval() ? "off" : "on", sched.day & 0x01 ? "on" : "off",
-			sched.day & 0x02 ? "on" : "off");
-	fprintf_P(stream_file,
-			PSTR(",\n\t\"d3\" : \"%s\",\n\t\"d4\" : \"%s\",\n\t\"d5\" : \"%s\",\n\t\"d6\" : \"%s\",\n\t\"d7\" : \"%s\",\n\t\"interval\" : \"%d\",\n\t\"times\" : [\n"),
-			sched.day & 0x04 ? "on" : "off", sched.day & 0x08 ? "on" : "off", sched.day & 0x10 ? "on" : "off", sched.day & 0x20 ? "on" : "off",
-			sched.day & 0x40 ? "on" : "off", sched.interval);
+
+	static const char dayKeys[] PROGMEM = "d1\0d2\0d3\0d4\0d5\0d6\0d7";
+
+	jw.BeginObject();
+	jw.Key(PSTR("name"));		jw.String(sched.name);
+	jw.Key(PSTR("enabled"));	jw.OnOff(sched.IsEnabled());
+	jw.Key(PSTR("wadj"));		jw.OnOff(sched.IsWAdj());
+	jw.Key(PSTR("type"));		jw.OnOff(!sched.IsInterval());
+	for (uint8_t d = 0; d < 7; d++)
+	{
+		jw.Key(dayKeys + d*3);	jw.OnOff(sched.day & (1 << d));
+	}
+	jw.Key(PSTR("interval"));	jw.QuotedNumber(sched.interval);
+	jw.Key(PSTR("times"));
+	jw.BeginArray();
 	for (int i = 0; i < 4; i++)
 	{
+		char t[6];
+
 		if (sched.time[i] == -1)
-		{
-			fprintf_P(stream_file, PSTR("%s\t\t{\"t\" : \"00:00\", \"e\" : \"off\" }"), (i == 0) ? "" : ",\n");
-		}
+			strcpy_P(t, PSTR("00:00"));
 		else
-		{
-			fprintf_P(stream_file, PSTR("%s\t\t{\"t\" : \"%02d:%02d\", \"e\" : \"on\" }"), (i == 0) ? "" : ",\n", sched.time[i] / 60, sched.time[i] % 60);
-		}
+			sprintf_P(t, PSTR("%02d:%02d"), sched.time[i] / 60, sched.time[i] % 60);
+
+		jw.BeginObject();
+		jw.Key(PSTR("t"));	jw.String(t);
+		jw.Key(PSTR("e"));	jw.OnOff(sched.time[i] != -1);
+		jw.EndObject();
 	}
-	fprintf_P(stream_file, PSTR("\n\t],\n\t\"zones\" : [\n"));
+	jw.EndArray();
+	jw.Key(PSTR("zones"));
+	jw.BeginArray();
 	for (int i = 0; i < GetNumZones(); i++)
 	{
 		FullZone zone;
 		LoadZone(i, &zone);
-		fprintf_P(stream_file, PSTR("%s\t\t{\"name\" : \"%s\", \"e\":\"%s\", \"duration\" : %d}"), (i == 0) ? "" : ",\n", zone.name, zone.bEnabled ? "on" : "off",
-				sched.zone_duration[i]);
+		jw.BeginObject();
+		jw.Key(PSTR("name"));		jw.String(zone.name);
+		jw.Key(PSTR("e"));			jw.OnOff(zone.bEnabled);
+		jw.Key(PSTR("duration"));	jw.Number(sched.zone_duration[i]);
+		jw.EndObject();
 	}
-	fprintf_P(stream_file, PSTR(" ]\n}"));
+	jw.EndArray();
+	jw.EndObject();
 }
 
-static bool SetQSched(const KVPairs & key_value_pairs)
-{
-
-	// So, we first end any schedule that's currently running by turning things off then on again.
-	runState.StopSchedule();
+// Quick schedule form. Durations are collected and copied to the quick schedule only when the request is complete.
+static int qSchedNum;
+static uint8_t qSchedDuration[MAX_ZONES];
 
-	int sched = -1;
-
-	// Iterate through the kv pairs and update the appropriate structure values.
-	for (int i = 0; i < key_value_pairs.num_pairs; i++)
+static void QSchedField(const char * key, const char * value, uint16_t offs)
+{
+	if (key == NULL)
 	{
-		const char * key = key_value_pairs.keys[i];
-		const char * value = key_value_pairs.values[i];
-		if ((key[0] == 'z') && (key[1] > 'a') && (key[1] <= ('a' + GetNumZones())) && (key[2] == 0))
-		{
-			quickSchedule.zone_duration[key[1] - 'b'] = atoi(value);
-		}
-		if (strcmp_P(key, PSTR("sched")) == 0)
-		{
-			sched = atoi(value);
-		}
+		memcpy(qSchedDuration, quickSchedule.zone_duration, sizeof(qSchedDuration));
+		qSchedNum = -1;
+		return;
+	}
+	if (offs != 0)
+		return;			// all fields are numbers
+
+	if ((key[0] == 'z') && (key[1] > 'a') && (key[1] <= ('a' + GetNumZones())) && (key[2] == 0))
+	{
+		qSchedDuration[key[1] - 'b'] = atoi(value);
+	}
+	if (strcmp_P(key, PSTR("sched")) == 0)
+	{
+		qSchedNum = atoi(value);
 	}
+}
+
+static bool QSchedApply(void)
+{
+	// So, we first end any schedule that's currently running by turning things off then on again.
+	runState.StopSchedule();
+	memcpy(quickSchedule.zone_duration, qSchedDuration, sizeof(quickSchedule.zone_duration));
 
-	if (sched == -1)
+	if (qSchedNum == -1)
 		runState.StartSchedule(true);
 	else
-		runState.StartSchedule(false, sched);
+		runState.StartSchedule(false, qSchedNum);
 
 	return true;
 }
 
 
-static void ServeSysInfoPage(FILE * stream_file)
+static void ServeSysInfoPage(WebRequest & rq, FILE * stream_file)
 {
-	ServeHeader(stream_file, 200, PSTR("OK"), false);
+	ServeHeader(stream_file, 200, PSTR("OK"), rq.cache);
 	freeMemory();
 	SysInfo(stream_file);
 }
@@ -512,7 +1224,12 @@ static bool RunSchedules(const KVPairs & key_value_pairs)
 }
 
 
-void ServeFile(FILE * stream_file, const char * fname, SdFile & theFile, EthernetClient & client)
+// Serve opened file. ServeFile takes ownership of the file and closes it once it is sent.
+//	If the file is the response file of the current connection, file body is sent asynchronously.
+//	fname is used to determine content type, bGzip indicates that the file is a gzip-compressed copy.
+//	dataSize is the length of data in the file, if it is different from the file size (e.g. pre-allocated logs).
+//	Single byte range requests (including suffix ranges) are served with 206 Partial Content.
+void ServeFile(FILE * stream_file, const char * fname, SdFile & theFile, EthernetClient & client, bool bGzip, uint32_t dataSize)
 {
 	freeMemory();
 	const char * ext;
@@ -522,43 +1239,395 @@ void ServeFile(FILE * stream_file, const char * fname, SdFile & theFile, Etherne
 			ext++;
 			break;
 		}
+	const char * type = PSTR("text/html");
+	uint8_t cache = WEB_CACHE_STATIC;
 	if (ext > fname)
 	{
 		if (strcmp_P(ext, PSTR("htm")) == 0)                    // accelerate checks for common case - HTML
-			ServeHeader(stream_file, 200, PSTR("OK"), true);
+			;
 		else if (strcmp_P(ext, PSTR("js")) == 0)
-			ServeHeader(stream_file, 200, PSTR("OK"), true, PSTR("application/javascript"));
+			type = PSTR("application/javascript");
 		else if (strcmp_P(ext, PSTR("jpg")) == 0)
-			ServeHeader(stream_file, 200, PSTR("OK"), true, PSTR("image/jpeg"));
+			type = PSTR("image/jpeg");
 		else if (strcmp_P(ext, PSTR("gif")) == 0)
-			ServeHeader(stream_file, 200, PSTR("OK"), true, PSTR("image/gif"));
+			type = PSTR("image/gif");
 		else if (strcmp_P(ext, PSTR("css")) == 0)
-			ServeHeader(stream_file, 200, PSTR("OK"), true, PSTR("text/css"));
+			type = PSTR("text/css");
 		else if (strcmp_P(ext, PSTR("ico")) == 0)
-			ServeHeader(stream_file, 200, PSTR("OK"), true, PSTR("image/x-icon"));
-		else if ( (strcmp_P(ext, PSTR("log")) == 0) || (strcmp_P(ext, PSTR("LOG")) == 0))
-			ServeHeader(stream_file, 200, PSTR("OK"), false, PSTR("text/plain"));
-		else if ( ext[0] >= '0' && ext[0] <= '9')
-			ServeHeader(stream_file, 200, PSTR("OK"), false, PSTR("text/plain"));
+			type = PSTR("image/x-icon");
+		else if (strcmp_P(ext, PSTR("png")) == 0)
+			type = PSTR("image/png");
+		else if (strcmp_P(ext, PSTR("jsn")) == 0)
+		{
+			type = PSTR("text/plain");		// cached JSON response
+			cache = WEB_CACHE_NOCACHE;
+		}
+		else if ( (strcmp_P(ext, PSTR("log")) == 0) || (strcmp_P(ext, PSTR("LOG")) == 0) || (ext[0] >= '0' && ext[0] <= '9'))
+		{
+			type = PSTR("text/plain");
+			cache = WEB_CACHE_NOCACHE;		// no validators - pre-allocated log files do not change size
+		}
+	}
+	uint32_t flength = (dataSize != WEB_FILE_SIZE_AUTO) ? dataSize : theFile.fileSize();
+	uint32_t fsize = flength - theFile.curPosition();
+	dir_t dirEntry;
+
+	memset(&respInfo, 0, sizeof(respInfo));
+	respInfo.bFile = true;
+	respInfo.bGzip = bGzip;
+	if ((cache == WEB_CACHE_STATIC) && theFile.dirEntry(&dirEntry))
+		respInfo.fileEntry = &dirEntry;
+
+	if ((respInfo.fileEntry != NULL) && (activeConn != NULL) && WebNotModified(dirEntry))
+	{
+		// browser copy is up to date, body is not needed
+		ServeHeader(stream_file, 304, PSTR("Not Modified"), cache, type, 0);
+		memset(&respInfo, 0, sizeof(respInfo));
+		theFile.close();
+		return;
+	}
+
+	if ((activeConn != NULL) && (rq.range != WEB_RANGE_NONE))
+	{
+		respInfo.bRange = true;
+		respInfo.length = flength;
+		respInfo.rangeLast = flength - 1;
+		if (rq.range == WEB_RANGE_SUFFIX)
+			respInfo.rangeFirst = (rq.rangeFirst < flength) ? flength - rq.rangeFirst : 0;
+		else
+		{
+			respInfo.rangeFirst = rq.rangeFirst;
+			if (rq.rangeLast < respInfo.rangeLast)
+				respInfo.rangeLast = rq.rangeLast;
+		}
+
+		if ((flength == 0) || (respInfo.rangeFirst >= flength) || !theFile.seekSet(respInfo.rangeFirst))
+		{
+			respInfo.rangeFirst = 1;		// unsatisfiable range, reported as "*/length"
+			respInfo.rangeLast = 0;
+			ServeHeader(stream_file, 416, PSTR("Range Not Satisfiable"), WEB_CACHE_NOCACHE, PSTR("text/plain"), 0);
+			fsize = 0;
+		}
 		else
-			ServeHeader(stream_file, 200, PSTR("OK"), true);
+		{
+			fsize = respInfo.rangeLast - respInfo.rangeFirst + 1;
+			ServeHeader(stream_file, 206, PSTR("Partial Content"), cache, type, fsize);
+		}
 	}
 	else
-		ServeHeader(stream_file, 200, PSTR("OK"), true);
-
+		ServeHeader(stream_file, 200, PSTR("OK"), cache, type, fsize);
+	memset(&respInfo, 0, sizeof(respInfo));
 
 #ifdef ARDUINO
 	flush_sendbuf(client);
+	if ((activeConn != NULL) && (&theFile == &activeConn->file))
+	{
+		// file body is sent by the connection state machine, in slices
+		if (fsize > 0)
+		{
+			activeConn->remaining = fsize;
+			activeConn->phase = WEB_CONN_BODY;
+		}
+		else
+			theFile.close();
+		return;
+	}
 #else
 	fflush(stream_file);
 #endif
-	while (theFile.available())
+	while (fsize > 0)
 	{
-		int bytes = theFile.read(sendbuf, 512);
+		int bytes = theFile.read(sendbuf, (fsize < sizeof(sendbuf)) ? fsize : sizeof(sendbuf));
 		if (bytes <= 0)
 			break;
 		client.write((uint8_t*) sendbuf, bytes);
+		fsize -= bytes;
+	}
+	if (fsize > 0)
+		bKeepAlive = false;		// file is shorter than advertised Content-Length, connection cannot be reused
+	theFile.close();
+}
+
+// Live event stream.
+//
+// Server-Sent Events stream with changes of the run state, zones, sensor readings and remote stations contact.
+// The stream starts with the full snapshot of the state, so a client that reconnects (after "retry" delay)
+// is always up to date. Events are sent from the connection state machine, see WebEmitEvent().
+static void JSONEvents(WebRequest & rq, FILE * stream_file)
+{
+	uint8_t nStreams = 0;
+
+	for (uint8_t n = 0; n < WEB_MAX_CONNECTIONS; n++)
+		if (webConn[n].phase == WEB_CONN_EVENTS)
+			nStreams++;
+
+	if ((activeConn == NULL) || (nStreams >= WEB_MAX_EVENT_STREAMS))
+	{
+		ServeHeader(stream_file, 503, PSTR("Service Unavailable"), WEB_CACHE_NOSTORE, PSTR("text/plain"));
+		fprintf_P(stream_file, PSTR("Too many event streams"));
+		return;
+	}
+
+	bKeepAlive = false;		// stream is terminated by closing the connection
+	ServeHeader(stream_file, 200, PSTR("OK"), WEB_CACHE_NOSTORE, PSTR("text/event-stream"));
+	fprintf_P(stream_file, PSTR("retry: %u\n\n"), WEB_EVENTS_RETRY);
+
+	activeConn->evtState = true;
+	memset(activeConn->evtZones, 0xFF, sizeof(activeConn->evtZones));
+	memset(activeConn->evtSensors, 0xFF, sizeof(activeConn->evtSensors));
+	memset(activeConn->evtStations, 0xFF, sizeof(activeConn->evtStations));
+	activeConn->phase = WEB_CONN_EVENTS;
+	activeConn->timer = millis();
+}
+
+// Send result of the configuration/control request
+static void ServeResult(WebRequest & rq, FILE * stream_file, bool bResult)
+{
+	if (bResult)
+		ServeHeader(stream_file, 200, PSTR("OK"), rq.cache);
+	else
+		ServeError(stream_file);
+}
+
+static void BinSetSched(WebRequest & rq, FILE * stream_file)
+{
+	sdlog.cacheInvalidate(LOG_TYPE_WATERING);		// watering log responses include schedule names
+	ServeResult(rq, stream_file, SetScheduleApply());
+}
+
+static void BinSetOneZone(WebRequest & rq, FILE * stream_file)
+{
+	ServeResult(rq, stream_file, SetOneZoneApply());
+}
+
+static void BinSetZones(WebRequest & rq, FILE * stream_file)
+{
+	ServeResult(rq, stream_file, SetZonesApply());
+}
+
+static void BinDelSched(WebRequest & rq, FILE * stream_file)
+{
+	bool bResult = DeleteSchedule(*rq.key_value_pairs);
+
+	sdlog.cacheInvalidate(LOG_TYPE_WATERING);
+
+	if (bResult && GetRunSchedules())
+	{
+		runState.StopSchedule();
+		runState.ProcessScheduledEvents();
+	}
+	ServeResult(rq, stream_file, bResult);
+}
+
+static void BinSetQSched(WebRequest & rq, FILE * stream_file)
+{
+	ServeResult(rq, stream_file, QSchedApply());
+}
+
+static void BinSettings(WebRequest & rq, FILE * stream_file)
+{
+	bool bResult = SetSettingsApply();
+
+	if (bResult && GetRunSchedules())
+	{
+		runState.StopSchedule();
+		runState.ProcessScheduledEvents();
+	}
+	ServeResult(rq, stream_file, bResult);
+}
+
+static void BinRun(WebRequest & rq, FILE * stream_file)
+{
+	bool bResult = RunSchedules(*rq.key_value_pairs);
+
+	if (bResult)
+		runState.ProcessScheduledEvents();
+	ServeResult(rq, stream_file, bResult);
+}
+
+static void BinFactory(WebRequest & rq, FILE * stream_file)
+{
+	if (GetRunSchedules())
+		runState.StopSchedule();
+	ResetEEPROM();
+	sdlog.cacheInvalidate(LOG_TYPE_WATERING);
+	ServeResult(rq, stream_file, true);
+}
+
+static void BinReset(WebRequest & rq, FILE * stream_file)
+{
+	ServeResult(rq, stream_file, true);
+	rq.bReset = true;
+}
+
+// access system logs directory
+static void ServeLogs(WebRequest & rq, FILE * stream_file)
+{
+	freeMemory();
+	sdlog.LogsHandler(rq.sPage, stream_file, *rq.client, *rq.file);
+}
+
+// This is the "catch all" case, that also serves static HTML files, *.js etc.
+static void ServeStaticFile(WebRequest & rq, FILE * stream_file)
+{
+	char *sPage = rq.sPage;
+
+	if (strlen(sPage) == 0){
+
+		TRACE_INFO(F("Serving: web root\n"));
+		strcpy_P(sPage, PSTR("index.htm"));
+	}
+	SdFile & theFile = *rq.file;
+
+	// if the client accepts gzip, look for the pre-compressed copy first
+	if (rq.bAcceptGzip)
+	{
+		char gzPage[WEB_PAGE_SIZE + WEB_GZ_DIR_LEN];
+
+		strcpy_P(gzPage, PSTR(WEB_GZ_DIR));
+		strcpy(gzPage + WEB_GZ_DIR_LEN, sPage);
+		if (theFile.open(gzPage, O_READ))
+		{
+			if (theFile.isFile())
+			{
+				TRACE_INFO(F("Serving file: %s\n"), gzPage);
+				ServeFile(stream_file, gzPage, theFile, *rq.client, true);
+				return;
+			}
+			theFile.close();
+		}
+	}
+
+	// prepend path
+	memmove(sPage + WEB_DIR_LEN, sPage, WEB_PAGE_SIZE - WEB_DIR_LEN);
+	memcpy_P(sPage, PSTR(WEB_DIR), WEB_DIR_LEN);
+	sPage[WEB_PAGE_SIZE-1] = 0;
+	TRACE_INFO(F("Serving file: %s\n"), sPage);
+	if (!theFile.open(sPage, O_READ))
+		Serve404(stream_file);
+	else
+	{
+		if (theFile.isFile())
+			ServeFile(stream_file, sPage, theFile, *rq.client);
+		else
+		{
+			Serve404(stream_file);
+			theFile.close();
+		}
+	}
+}
+
+
+// Routes table.
+//
+// Each route is defined by the path (without leading '/'), flags (accepted methods, cacheability etc), the handler
+// and optional form handler that receives request parameters as they are parsed.
+// Requests that do not match any route are served as static files from the /web directory.
+// To add new endpoint just add a line here.
+//
+static const WebRoute webRoutes[] PROGMEM =
+{
+	{ "bin/setSched",	WEB_ROUTE_GET | WEB_ROUTE_POST | WEB_ROUTE_NOSTORE,	BinSetSched,	SetScheduleField },
+	{ "bin/set1Zone",	WEB_ROUTE_GET | WEB_ROUTE_POST | WEB_ROUTE_NOSTORE,	BinSetOneZone,	SetOneZoneField },
+	{ "bin/setZones",	WEB_ROUTE_GET | WEB_ROUTE_POST | WEB_ROUTE_NOSTORE,	BinSetZones,	SetZonesField },
+	{ "bin/delSched",	WEB_ROUTE_GET | WEB_ROUTE_POST | WEB_ROUTE_NOSTORE,	BinDelSched },
+	{ "bin/setQSched",	WEB_ROUTE_GET | WEB_ROUTE_POST | WEB_ROUTE_NOSTORE,	BinSetQSched,	QSchedField },
+	{ "bin/settings",	WEB_ROUTE_GET | WEB_ROUTE_POST | WEB_ROUTE_NOSTORE,	BinSettings,	SetSettingsField },
+	{ "bin/run",		WEB_ROUTE_GET | WEB_ROUTE_POST | WEB_ROUTE_NOSTORE,	BinRun },
+	{ "bin/factory",	WEB_ROUTE_GET | WEB_ROUTE_POST | WEB_ROUTE_NOSTORE,	BinFactory },
+	{ "bin/reset",		WEB_ROUTE_GET | WEB_ROUTE_POST | WEB_ROUTE_NOSTORE,	BinReset },
+
+	{ "json/schedules",	WEB_ROUTE_GET,						JSONSchedules },
+	{ "json/zones",		WEB_ROUTE_GET,						JSONZones },
+	{ "json/settings",	WEB_ROUTE_GET,						JSONSettings },
+	{ "json/state",		WEB_ROUTE_GET,						JSONState },
+	{ "json/schedule",	WEB_ROUTE_GET,						JSONSchedule },
+	{ "json/wcheck",	WEB_ROUTE_GET | WEB_ROUTE_GEN,		JSONwCheck },
+	{ "json/tlogs",		WEB_ROUTE_GET | WEB_ROUTE_GEN,		JSONtLogs },
+	{ "json/schlogs",	WEB_ROUTE_GET | WEB_ROUTE_GEN,		JSONScheduleLogs },
+// Sensors 
+	{ "json/sens",		WEB_ROUTE_GET | WEB_ROUTE_GEN,		JSONSensor },
+	{ "json/sensNow",	WEB_ROUTE_GET,						JSONSensorsNow },
+	{ "json/wCounters",	WEB_ROUTE_GET,						JSONWWCounters },
+	{ "json/links",		WEB_ROUTE_GET,						JSONLinks },
+	{ "json/events",	WEB_ROUTE_GET | WEB_ROUTE_NOSTORE,	JSONEvents },
+
+	{ "SysInfo",		WEB_ROUTE_GET,						ServeSysInfoPage },
+	{ "logs",			WEB_ROUTE_GET | WEB_ROUTE_PREFIX,	ServeLogs }
+};
+
+#define NUM_WEB_ROUTES			(sizeof(webRoutes)/sizeof(WebRoute))
+
+// Route lookup.
+//
+// Path hash is calculated while the path is parsed, and the route is found through the small open-addressing hash index
+// built at startup. Dispatch cost does not depend on the number of routes - one index probe (rarely more) and one strcmp_P() to confirm.
+
+#define WEB_ROUTE_BUCKETS		64		// must be power of 2 and larger than the number of routes
+#define WEB_HASH_INIT			5381
+
+static uint8_t	webRouteIndex[WEB_ROUTE_BUCKETS];		// route number + 1, 0 means empty bucket
+
+static inline uint16_t WebHashStep(uint16_t h, char c)
+{
+	return (h << 5) + h + uint8_t(c);
+}
+
+static uint16_t WebHashRoute(uint8_t n)
+{
+	uint16_t	h = WEB_HASH_INIT;
+	const char	*p = webRoutes[n].path;
+	char		c;
+
+	while ((c = pgm_read_byte(p++)) != 0)
+		h = WebHashStep(h, c);
+
+	return h;
+}
+
+static void WebBuildRouteIndex(void)
+{
+	memset(webRouteIndex, 0, sizeof(webRouteIndex));
+
+	for (uint8_t n = 0; n < NUM_WEB_ROUTES; n++)
+	{
+		uint8_t b = WebHashRoute(n) & (WEB_ROUTE_BUCKETS-1);
+
+		while (webRouteIndex[b] != 0)
+			b = (b + 1) & (WEB_ROUTE_BUCKETS-1);
+		webRouteIndex[b] = n + 1;
+	}
+}
+
+// Find the route for the path. hash is the hash of the full path, seg_hash is the hash of the first path segment.
+// Prefix routes are indexed by their full path, which is the first segment of the paths they match.
+static int8_t WebFindRoute(const char * sPage, uint16_t hash, uint16_t seg_hash)
+{
+	for (uint8_t pass = 0; pass < 2; pass++)
+	{
+		uint16_t	h = (pass == 0) ? hash : seg_hash;
+		uint8_t		b = h & (WEB_ROUTE_BUCKETS-1);
+
+		while (webRouteIndex[b] != 0)
+		{
+			uint8_t	n = webRouteIndex[b] - 1;
+
+			if (pass == 0)
+			{
+				if (strcmp_P(sPage, webRoutes[n].path) == 0)
+					return n;
+			}
+			else if (pgm_read_byte(&webRoutes[n].flags) & WEB_ROUTE_PREFIX)
+			{
+				size_t len = strlen_P(webRoutes[n].path);
+
+				if ((strncmp_P(sPage, webRoutes[n].path, len) == 0) && ((sPage[len] == 0) || (sPage[len] == '/')))
+					return n;
+			}
+			b = (b + 1) & (WEB_ROUTE_BUCKETS-1);
+		}
 	}
+	return WEB_ROUTE_NONE;
 }
 
 // change a character represented hex digit (0-9, a-f, A-F) to the numeric value
@@ -580,35 +1649,307 @@ static inline char hex2int(const char ch)
 		return 0;
 }
 
-//  Pass in a connected client, and this function will parse the HTTP header and return the requested page 
-//   and a KV pairs structure for the variable assignments.
-static bool ParseHTTPHeader(EthernetClient & client, KVPairs * key_value_pairs, char * sPage, int iPageSize)
-{
-	enum
-	{
-		INITIALIZED = 0, PARSING_PAGE, PARSING_KEY, PARSING_VALUE, PARSING_VALUE_PERCENT, PARSING_VALUE_PERCENT1, LOOKING_FOR_BLANKLINE, FOUND_BLANKLINE, DONE, ERROR
-	} current_state = INITIALIZED;
-	// an http request ends with a blank line
-	static const char get_text[] = "GET /";
-	const char * gettext_ptr = get_text;
-	char * page_ptr = sPage;
-	key_value_pairs->num_pairs = 0;
-	char * key_ptr = key_value_pairs->keys[0];
-	char * value_ptr = key_value_pairs->values[0];
-	char recvbuf[100];  // note:  trial and error has shown that it doesn't help to increase this number.. few ms at the most.
-	char * recvbufptr = recvbuf;
-	char * recvbufend = recvbuf;
+// Receive buffer. It is kept between requests, since on a persistent connection the buffer may already
+//  hold the beginning of the next (pipelined) request.
+static char recvbuf[100];  // note:  trial and error has shown that it doesn't help to increase this number.. few ms at the most.
+static char * recvbufptr = recvbuf;
+static char * recvbufend = recvbuf;
+
+// Parse Range header. Only single byte range is supported, for anything else the whole file is sent.
+static void WebParseRange(WebRequest * rq, const char * str)
+{
+	char * end;
+
+	while (*str == ' ')
+		str++;
+	if ((strncasecmp_P(str, PSTR("bytes="), 6) != 0) || (strchr(str, ',') != NULL))
+		return;
+	str += 6;
+
+	if (*str == '-')		// suffix range - last N bytes of the file
+	{
+		rq->rangeFirst = strtoul(str+1, &end, 10);
+		if ((end != str+1) && (rq->rangeFirst > 0))
+			rq->range = WEB_RANGE_SUFFIX;
+		return;
+	}
+
+	rq->rangeFirst = strtoul(str, &end, 10);
+	if ((end == str) || (*end != '-'))
+		return;
+	str = end + 1;
+	if ((*str >= '0') && (*str <= '9'))
+		rq->rangeLast = strtoul(str, NULL, 10);
+	else
+		rq->rangeLast = 0xFFFFFFFF;		// open-ended range
+	if (rq->rangeLast >= rq->rangeFirst)
+		rq->range = WEB_RANGE_BYTES;
+}
+
+// Process one request header line (other than the request line itself).
+static void ParseHeaderLine(WebRequest * rq, const char * line)
+{
+	if (strncasecmp_P(line, PSTR("Connection:"), 11) == 0)
+	{
+		if (strcasestr_P(line+11, PSTR("close")) != NULL)
+			rq->bKeepAlive = false;
+		else if (strcasestr_P(line+11, PSTR("keep-alive")) != NULL)
+			rq->bKeepAlive = true;
+	}
+	else if (strncasecmp_P(line, PSTR("Accept-Encoding:"), 16) == 0)
+	{
+		if (strcasestr_P(line+16, PSTR("gzip")) != NULL)
+			rq->bAcceptGzip = true;
+	}
+	else if (strncasecmp_P(line, PSTR("If-None-Match:"), 14) == 0)
+	{
+		line += 14;
+		while (*line == ' ')
+			line++;
+		strncpy(rq->etag, line, WEB_ETAG_SIZE-1);
+		rq->etag[WEB_ETAG_SIZE-1] = 0;
+	}
+	else if (strncasecmp_P(line, PSTR("If-Modified-Since:"), 18) == 0)
+		rq->ims = WebParseHttpDate(line + 18);
+	else if (strncasecmp_P(line, PSTR("Range:"), 6) == 0)
+		WebParseRange(rq, line + 6);
+	else if (strncasecmp_P(line, PSTR("Content-Length:"), 15) == 0)
+		rq->contentLength = strtoul(line + 15, NULL, 10);
+	else if (strncasecmp_P(line, PSTR("Content-Type:"), 13) == 0)
+		rq->bFormBody = (strcasestr_P(line + 13, PSTR("application/x-www-form-urlencoded")) != NULL);
+}
+
+// Request parser.
+//
+// The parser is resumable - it consumes whatever request data has arrived so far, and returns WEB_PARSE_MORE
+//  if the request is not complete yet. Form handlers and KV pairs are shared, therefore there is only one parser
+//  (and one receive buffer), owned by one connection at a time.
+// Request size is limited (WEB_MAX_URI_SIZE, WEB_MAX_HEADER_SIZE), and each phase of the request has a deadline
+//  (parser.timer/timeout, enforced by the connection), so a slow or hostile client cannot hold the parser for long.
+#define WEB_PARSE_MORE				0
+#define WEB_PARSE_DONE				1
+#define WEB_PARSE_ERROR				2		// malformed request, or client disconnected
+#define WEB_PARSE_URI_TOO_LONG		3
+#define WEB_PARSE_HEADER_TOO_LARGE	4
+#define WEB_PARSE_TIMEOUT			5		// request was not received in time (reported by the connection, not the parser)
+
+struct WebParser
+{
+	uint8_t		state;
+	uint8_t		line_len;
+	bool		bSegHash;
+	char		*page_ptr;
+	uint16_t	page_hash;
+	uint16_t	seg_hash;
+	uint16_t	uri_len;						// request path and query length so far
+	uint16_t	header_len;						// request header size so far
+	uint32_t	body_left;						// request body bytes still to be received
+	unsigned long	timer;						// start of the current request phase (header or body), millis()
+	uint16_t	timeout;						// max duration of the current request phase, ms
+	char		line[WEB_HEADER_LINE_SIZE];		// current header line (truncated if longer)
+
+	// form (query string or urlencoded body) decoder
+	uint8_t		form_state;
+	uint8_t		key_len;
+	uint8_t		value_len;
+	uint16_t	value_offs;					// position of value[] in the whole value (long values are passed in pieces)
+	char		pct;						// high nibble of the %xx escape being decoded
+	char		key[KEY_SIZE];
+	char		value[VALUE_SIZE];
+};
+
+static WebParser	parser;
+static int8_t		parserOwner = -1;		// connection owning the parser and the receive buffer
+
+// Form decoder.
+//
+// Query string and application/x-www-form-urlencoded request body are decoded as the data arrives, one pair at a time.
+// Complete pairs are passed to the form handler of the route, or (for routes without form handler) collected into
+// the KV pairs. Pairs with keys longer than KEY_SIZE-1 are dropped. Values longer than VALUE_SIZE-1 are passed to the form
+// handler in pieces (see WebFormHandler), pairs of routes without form handler are dropped if the value does not fit.
+#define FORM_KEY			0
+#define FORM_VALUE			1
+#define FORM_PERCENT		2
+#define FORM_PERCENT1		3
+#define FORM_SKIP			4
+
+static inline void WebFormStart(void)
+{
+	parser.form_state = FORM_KEY;
+	parser.key_len = 0;
+	parser.value_len = 0;
+	parser.value_offs = 0;
+}
+
+// Complete current pair and pass it on
+static void WebFormPair(WebRequest * rq)
+{
+	bool bSkip = (parser.form_state == FORM_SKIP) || (parser.key_len == 0);
+	uint16_t offs = parser.value_offs;
+
+	parser.key[parser.key_len] = 0;
+	parser.value[parser.value_len] = 0;
+	WebFormStart();
+	if (bSkip)
+		return;
+
+	TRACE_VERBOSE(F("Found a KV pair : %s -> %s\n"), parser.key, parser.value);
+
+	if (rq->form != NULL)
+		rq->form(parser.key, parser.value, offs);
+	else
+	{
+		KVPairs * key_value_pairs = rq->key_value_pairs;
+
+		if (key_value_pairs->num_pairs < NUM_KEY_VALUES)
+		{
+			strcpy(key_value_pairs->keys[key_value_pairs->num_pairs], parser.key);
+			strcpy(key_value_pairs->values[key_value_pairs->num_pairs], parser.value);
+			key_value_pairs->num_pairs++;
+		}
+	}
+}
+
+// Append decoded character to the value. If the value buffer is full, its content is passed to the form handler first.
+static void WebFormValueChar(WebRequest * rq, char c)
+{
+	if (parser.value_len >= VALUE_SIZE - 1)
+	{
+		if (rq->form == NULL)
+		{
+			parser.form_state = FORM_SKIP;		// value does not fit into the KV pairs, drop the pair
+			return;
+		}
+		parser.key[parser.key_len] = 0;
+		parser.value[parser.value_len] = 0;
+		rq->form(parser.key, parser.value, parser.value_offs);
+		parser.value_offs += parser.value_len;
+		parser.value_len = 0;
+	}
+	parser.value[parser.value_len++] = c;
+}
+
+static void WebFormChar(WebRequest * rq, char c)
+{
+	if (c == '&')
+	{
+		WebFormPair(rq);
+		return;
+	}
+	if ((c <= 32) || (c >= 127))
+		return;
+
+	switch (parser.form_state)
+	{
+	case FORM_KEY:
+		if (c == '=')
+			parser.form_state = FORM_VALUE;
+		else if (parser.key_len >= KEY_SIZE - 1)
+			parser.form_state = FORM_SKIP;		// unknown (too long) key, drop the pair
+		else
+			parser.key[parser.key_len++] = c;
+		break;
+
+	case FORM_VALUE:
+		if (c == '%')
+		{
+			parser.form_state = FORM_PERCENT;
+			break;
+		}
+		WebFormValueChar(rq, (c == '+') ? ' ' : c);
+		break;
+
+	case FORM_PERCENT:
+	case FORM_PERCENT1:
+		if (!isxdigit(c))
+		{
+			parser.form_state = FORM_VALUE;
+			break;
+		}
+		if (parser.form_state == FORM_PERCENT)
+		{
+			parser.pct = hex2int(c) << 4;
+			parser.form_state = FORM_PERCENT1;
+		}
+		else
+		{
+			char v = parser.pct + hex2int(c);
+
+			// let's check this value to see if it's legal
+			if (((v >= 0 ) && (v < 32)) || (v == 127) || (v == '"') || (v == '\\'))
+				v = ' ';
+			parser.form_state = FORM_VALUE;
+			WebFormValueChar(rq, v);
+		}
+		break;
+
+	default:
+		break;
+	}
+}
+
+//  Pass in a connected client, and this function will parse the HTTP request and return the requested page.
+//   Route lookup is done as soon as the page path is parsed. Query string and urlencoded POST body
+//   are decoded as they arrive (see WebFormPair()).
+static uint8_t ParseHTTPHeader(EthernetClient & client, WebRequest * rq)
+{
+	enum parse_state
+	{
+		START = 0, INITIALIZED, PARSING_URI, PARSING_PAGE, PARSING_QUERY, PARSING_VERSION, PARSING_HEADER, PARSING_BODY, DONE, ERROR,
+		ERROR_URI, ERROR_HEADER
+	} current_state = (parse_state)parser.state;
+	unsigned long slice_start = millis();
+	char * sPage = rq->sPage;
+	const int iPageSize = WEB_PAGE_SIZE;
+	char * & page_ptr = parser.page_ptr;
+	uint16_t & page_hash = parser.page_hash;	// hash of the path
+	uint16_t & seg_hash = parser.seg_hash;		// hash of the first segment of the path
+	bool & bSegHash = parser.bSegHash;
+	char * line = parser.line;
+	uint8_t & line_len = parser.line_len;
+
+	if (current_state == START)
+	{
+		page_ptr = sPage;
+		page_hash = WEB_HASH_INIT;
+		seg_hash = 0;
+		bSegHash = false;
+		rq->method = 0;
+		rq->route = WEB_ROUTE_NONE;
+		rq->form = NULL;
+		rq->bKeepAlive = false;
+		rq->bAcceptGzip = false;
+		rq->bFormBody = false;
+		rq->contentLength = 0;
+		rq->etag[0] = 0;
+		rq->ims = 0;
+		rq->range = WEB_RANGE_NONE;
+		rq->key_value_pairs->num_pairs = 0;
+		line_len = 0;
+		parser.uri_len = 0;
+		parser.header_len = 0;
+		parser.timer = slice_start;
+		parser.timeout = WEB_REQUEST_TIMEOUT;
+		current_state = INITIALIZED;
+	}
+
 	while (true)
 	{
 		if (recvbufptr >= recvbufend)
 		{
+			// client that keeps sending data (e.g. endless header) must not hold the main loop
+			if (millis() - slice_start > WEB_TIME_SLICE)
+			{
+				parser.state = current_state;
+				return WEB_PARSE_MORE;
+			}
+
 			int len = client.read((uint8_t*) recvbuf, sizeof(recvbuf));
 			if (len <= 0)
 			{
-				if (!client.connected())
-					break;
-				else
-					continue;
+				// no more data for now, continue on the next pass
+				parser.state = current_state;
+				return client.connected() ? WEB_PARSE_MORE : WEB_PARSE_ERROR;
 			}
 			else
 			{
@@ -621,398 +1962,704 @@ static bool ParseHTTPHeader(EthernetClient & client, KVPairs * key_value_pairs,
 
 		switch (current_state)
 		{
-		case INITIALIZED:
-			if (c == *gettext_ptr)
+		case INITIALIZED:		// request method
+			if (c == ' ')
 			{
-				gettext_ptr++;
-				if (gettext_ptr - get_text >= (long)sizeof(get_text) - 1)
+				line[line_len] = 0;
+				line_len = 0;
+				if (strcmp_P(line, PSTR("GET")) == 0)
+					rq->method = WEB_METHOD_GET;
+				else if (strcmp_P(line, PSTR("POST")) == 0)
+					rq->method = WEB_METHOD_POST;
+				else
 				{
-					current_state = PARSING_PAGE;
+					current_state = ERROR;
+					break;
 				}
+				current_state = PARSING_URI;
 			}
-
-			break;
-		case PARSING_PAGE:
-			if (c == '?')
+			else if ((c == '\r') || (c == '\n'))
 			{
-				*page_ptr = 0;
-				current_state = PARSING_KEY;
+				if (line_len != 0)
+					current_state = ERROR;		// blank lines between requests are skipped
 			}
-			else if (c == ' ')
-			{
-				*page_ptr = 0;
-				current_state = LOOKING_FOR_BLANKLINE;
+			else if (line_len < 7)
+				line[line_len++] = c;
+			else
+				current_state = ERROR;
+			break;
+
+		case PARSING_URI:
+			current_state = (c == '/') ? PARSING_PAGE : ERROR;
+			break;
+
+		case PARSING_PAGE:
+			if (++parser.uri_len > WEB_MAX_URI_SIZE)
+			{
+				current_state = ERROR_URI;
+				break;
 			}
-			else if (c == '\n')
+			if ((c == '?') || (c == ' ') || (c == '\n'))
 			{
 				*page_ptr = 0;
-				current_state = FOUND_BLANKLINE;
+				if (!bSegHash)
+					seg_hash = page_hash;
+				rq->route = WebFindRoute(sPage, page_hash, seg_hash);
+				if (rq->route != WEB_ROUTE_NONE)
+				{
+					rq->form = (WebFormHandler)pgm_read_word(&webRoutes[rq->route].form);
+					if (rq->form != NULL)
+						rq->form(NULL, NULL, 0);		// new request - reset form handler state
+				}
+
+				if (c == '?')
+				{
+					WebFormStart();
+					current_state = PARSING_QUERY;
+				}
+				else if (c == ' ')
+					current_state = PARSING_VERSION;
+				else
+					current_state = PARSING_HEADER;
 			}
 			else if ((c > 32) && (c < 127))
 			{
 				if (page_ptr - sPage >= iPageSize - 1)
 				{
-					current_state = ERROR;
+					current_state = ERROR_URI;		// no page or route has path that long
 				}
 				else
+				{
+					if ((c == '/') && !bSegHash)
+					{
+						seg_hash = page_hash;
+						bSegHash = true;
+					}
+					page_hash = WebHashStep(page_hash, c);
 					*page_ptr++ = c;
+				}
 			}
 			break;
-		case PARSING_KEY:
-			if (c == ' ')
-				current_state = LOOKING_FOR_BLANKLINE;
-			else if (c == '\n')
-			{
-				current_state = FOUND_BLANKLINE;
-			}
-			else if (c == '&')
-			{
-				current_state = ERROR;
-			}
-			else if (c == '=')
-			{
-				*key_ptr = 0;
-				current_state = PARSING_VALUE;
-			}
-			else if ((c > 32) && (c < 127))
+
+		case PARSING_QUERY:
+			if (++parser.uri_len > WEB_MAX_URI_SIZE)
+				current_state = ERROR_URI;
+			else if ((c == ' ') || (c == '\n'))
 			{
-				if (key_ptr - key_value_pairs->keys[key_value_pairs->num_pairs] >= KEY_SIZE - 1)
-				{
-					current_state = ERROR;
-				}
-				else
-					*key_ptr++ = c;
+				WebFormPair(rq);
+				current_state = (c == ' ') ? PARSING_VERSION : PARSING_HEADER;
 			}
+			else
+				WebFormChar(rq, c);
 			break;
-		case PARSING_VALUE:
-		case PARSING_VALUE_PERCENT:
-		case PARSING_VALUE_PERCENT1:
-			if ((c == ' ') || c == '&')
-			{
-				*value_ptr = 0;
-				TRACE_VERBOSE(F("Found a KV pair : %s -> %s\n"), key_value_pairs->keys[key_value_pairs->num_pairs], key_value_pairs->values[key_value_pairs->num_pairs]);
-
-				if ((c == '&') && (key_value_pairs->num_pairs >= NUM_KEY_VALUES - 1))
-				{
 
-// drop KV pairs that exceed our buffers (necessary for large number of zones support)
-
-					return true;
-
-					current_state = ERROR;
-					break;
-				}
-				if (c == '&')
-				{
-					key_value_pairs->num_pairs++;
-					key_ptr = key_value_pairs->keys[key_value_pairs->num_pairs];
-					value_ptr = key_value_pairs->values[key_value_pairs->num_pairs];
-					current_state = PARSING_KEY;
-				}
-				else
-				{
-					key_value_pairs->num_pairs++;
-					current_state = LOOKING_FOR_BLANKLINE;
-				}
-				break;
-			}
-			else if ((c > 32) && (c < 127))
+		case PARSING_VERSION:
+		case PARSING_HEADER:
+			if (++parser.header_len > WEB_MAX_HEADER_SIZE)
+				current_state = ERROR_HEADER;
+			else if (c == '\n')
 			{
-				if (value_ptr - key_value_pairs->values[key_value_pairs->num_pairs] >= VALUE_SIZE - 1)
+				line[line_len] = 0;
+				if (current_state == PARSING_VERSION)
 				{
-					current_state = ERROR;
-					break;
+					// HTTP/1.1 connections are persistent by default
+					rq->bKeepAlive = (strstr_P(line, PSTR("HTTP/1.1")) != NULL);
+					current_state = PARSING_HEADER;
 				}
-				switch (current_state)
+				else if (line_len == 0)
 				{
-				case PARSING_VALUE_PERCENT:
-					if (isxdigit(c))
-					{
-						*value_ptr = hex2int(c) << 4;
-						current_state = PARSING_VALUE_PERCENT1;
-					}
+					// end of the header
+					parser.body_left = (rq->method == WEB_METHOD_POST) ? rq->contentLength : 0;
+					if (parser.body_left == 0)
+						current_state = DONE;
 					else
-						current_state = PARSING_VALUE;
-					break;
-				case PARSING_VALUE_PERCENT1:
-					if (isxdigit(c))
 					{
-						*value_ptr += hex2int(c);
-						// let's check this value to see if it's legal
-						if (((*value_ptr >= 0 ) && (*value_ptr < 32)) || (*value_ptr == 127) || (*value_ptr == '"') || (*value_ptr == '\\'))
-							*value_ptr = ' ';
-						value_ptr++;
+						WebFormStart();
+						parser.timer = millis();
+						parser.timeout = WEB_BODY_TIMEOUT;
+						current_state = PARSING_BODY;
 					}
-					current_state = PARSING_VALUE;
-					break;
-				default:
-					if (c == '+')
-						*value_ptr++ = ' ';
-					else if (c == '%')
-						current_state = PARSING_VALUE_PERCENT;
-					else
-						*value_ptr++ = c;
-					break;
 				}
+				else
+					ParseHeaderLine(rq, line);
+				line_len = 0;
 			}
-			else
-				current_state = ERROR;
+			else if ((c != '\r') && (line_len < WEB_HEADER_LINE_SIZE - 1))
+				line[line_len++] = c;
 			break;
-		case LOOKING_FOR_BLANKLINE:
-			if (c == '\n')
-				current_state = FOUND_BLANKLINE;
-			break;
-		case FOUND_BLANKLINE:
-			if (c == '\n')
+
+		case PARSING_BODY:
+			// body of other types is consumed (to keep persistent connection in sync), but not parsed
+			if (rq->bFormBody)
+				WebFormChar(rq, c);
+			if (--parser.body_left == 0)
+			{
+				if (rq->bFormBody)
+					WebFormPair(rq);
 				current_state = DONE;
-			else if (c != '\r')
-				current_state = LOOKING_FOR_BLANKLINE;
+			}
 			break;
+
 		default:
 			break;
 		} // switch
 		if (current_state == DONE)
-			return true;
-		else if (current_state == ERROR)
-			return false;
+		{
+			parser.state = START;		// ready for the next request on this connection
+			return WEB_PARSE_DONE;
+		}
+		else if (current_state >= ERROR)
+		{
+			parser.state = START;
+			if (current_state == ERROR_URI)
+				return WEB_PARSE_URI_TOO_LONG;
+			if (current_state == ERROR_HEADER)
+				return WEB_PARSE_HEADER_TOO_LARGE;
+			return WEB_PARSE_ERROR;
+		}
 	} // true
-	return false;
 }
 
-void web::ProcessWebClients()
+// Client connections.
+//
+// Each connection is served by a small state machine, so that several clients are served concurrently and
+//  a slow client or a big file does not hold the main loop. Request header is parsed as data arrives,
+//  generated (JSON etc) responses are produced in one go, and files are sent in slices limited
+//  by the free space in the socket TX buffer.
+static void WebConnCloseFile(WebConn & conn)
 {
-	// listen for incoming clients
-	EthernetClient client = m_server->available();
-	if (client)
+	if (conn.file.isOpen())
+		conn.file.close();
+	if (conn.cacheEntry >= 0)
 	{
-		bool bReset = false;
-#ifdef ARDUINO
-		FILE stream_file;
-		FILE * pFile = &stream_file;
-		setup_sendbuf();
-		fdev_setup_stream(pFile, stream_putchar, NULL, _FDEV_SETUP_WRITE);
-		stream_file.udata = &client;
-#else
-		FILE * pFile = fdopen(client.GetSocket(), "w");
-#endif
-		 freeMemory();
-		 TRACE_INFO(F("Got a client\n"));
-		 //ShowSockStatus();
-		 KVPairs key_value_pairs;
-		 char sPage[35];
-
-		 if (!ParseHTTPHeader(client, &key_value_pairs, sPage, sizeof(sPage)))
-		 {
-			SYSEVT_ERROR(F("ERROR!"));
-			ServeError(pFile);
-		 }
-		 else
-		 {
-
-			TRACE_INFO(F("Page:%s\n"), sPage);
-			//ShowSockStatus();
-
-            if( strncmp_P(sPage, PSTR("bin/"), 4) == 0 )       // We do the check in two phases. 
-                                                               // First we check that the URL starts with "bin/" to identify the block of bin requests, 
-                                                               // and then we check for a specific request in the bin/ block
-                                                               //
-                                                               // This optimization speeds up request decoding, allowing to reduce the number of strcmp() 
-															   // each request goes through as well as the string lengh to check
-                                                               //
-            {
-                 char *xP4 = sPage + 4;
-
-     			 if (strcmp_P(xP4, PSTR("setSched")) == 0)
-			     {
-				     if (SetSchedule(key_value_pairs))
-				     {
-					     ServeHeader(pFile, 200, PSTR("OK"), false);
-				     }
-				     else
-					     ServeError(pFile);
-			     }
-			     else if (strcmp_P(xP4, PSTR("set1Zone")) == 0)
-			     {
-				     if (SetOneZones(key_value_pairs))
-				     {
-					     ServeHeader(pFile, 200, PSTR("OK"), false);
-				     }
-				     else
-					     ServeError(pFile);
-			     }
-			     else if (strcmp_P(xP4, PSTR("setZones")) == 0)
-			     {
-				     if (SetZones(key_value_pairs))
-				     {
-					     ServeHeader(pFile, 200, PSTR("OK"), false);
-				     }
-				     else
-					     ServeError(pFile);
-			     }
-			     else if (strcmp_P(xP4, PSTR("delSched")) == 0)
-  			     {
-				     if (DeleteSchedule(key_value_pairs))
-				     {
-					     if (GetRunSchedules()){
-							 runState.StopSchedule();
-							 runState.ProcessScheduledEvents();
-						 }
-					     ServeHeader(pFile, 200, PSTR("OK"), false);
-				     }
-				     else
-					     ServeError(pFile);
-			     }
-			     else if (strcmp_P(xP4, PSTR("setQSched")) == 0)
-			     {
-				     if (SetQSched(key_value_pairs))
-				     {
-					     ServeHeader(pFile, 200, PSTR("OK"), false);
-				     }
-				     else
-					     ServeError(pFile);
-			     }
-			     else if (strcmp_P(xP4, PSTR("settings")) == 0)
-			     {
-				     if (SetSettings(key_value_pairs))
-				     {
-					     if (GetRunSchedules()){
-							 runState.StopSchedule();
-							 runState.ProcessScheduledEvents();
-						 }
-					     ServeHeader(pFile, 200, PSTR("OK"), false);
-				     }
-				     else
-					     ServeError(pFile);
-			     }
-			     else if (strcmp_P(xP4, PSTR("run")) == 0)
-			     {
-				     if (RunSchedules(key_value_pairs))
-				     {
-						 runState.ProcessScheduledEvents();
-					     ServeHeader(pFile, 200, PSTR("OK"), false);
-				     }
-				     else
-					     ServeError(pFile);
-			     }
-			     else if (strcmp_P(xP4, PSTR("factory")) == 0)
-			     {
-				     if (GetRunSchedules()){
-						 runState.StopSchedule();
-					 }
-				     ResetEEPROM();
-				     ServeHeader(pFile, 200, PSTR("OK"), false);
-			     }
-			     else if (strcmp_P(xP4, PSTR("reset")) == 0)
-			     {
-				     ServeHeader(pFile, 200, PSTR("OK"), false);
-				     bReset = true;
-			     }
-              }
-            else if( strncmp_P(sPage, PSTR("json/"), 5) == 0 )      // We do the check in two phases. 
-                                                                    // First we check that the URL starts with "json/" to identify the block of json requests, 
-                                                                    // and then each request in the block checks the rest of the URL to determine specific request
-            {
-                 char *xP5 = sPage + 5;
-                             
-			     if (strcmp_P(xP5, PSTR("schedules")) == 0)
-			     {
-				     JSONSchedules(key_value_pairs, pFile);
-			     }
-			     else if (strcmp_P(xP5, PSTR("zones")) == 0)
-			     {
-				     JSONZones(key_value_pairs, pFile);
-			     }
-			     else if (strcmp_P(xP5, PSTR("settings")) == 0)
-			     {
-				     JSONSettings(key_value_pairs, pFile);
-			     }
-			     else if (strcmp_P(xP5, PSTR("state")) == 0)
-			     {
-				     JSONState(key_value_pairs, pFile);
-			     }
-			     else if (strcmp_P(xP5, PSTR("schedule")) == 0)
-			     {
-				     JSONSchedule(key_value_pairs, pFile);
-			     }
-			     else if (strcmp_P(xP5, PSTR("wcheck")) == 0)
-			     {
-				     JSONwCheck(key_value_pairs, pFile);
-			     }
-			     else if (strcmp_P(xP5, PSTR("tlogs")) == 0)
-			     {
-				     JSONtLogs(key_value_pairs, pFile);
-			     }
-			     else if (strcmp_P(xP5, PSTR("schlogs")) == 0)
-			     {
-				     JSONScheduleLogs(key_value_pairs, pFile);
-			     }
+		sdlog.cacheRelease(conn.cacheEntry);		// cached response is sent, the cache may replace it now
+		conn.cacheEntry = -1;
+	}
+}
 
-// Sensors 
-			     else if (strcmp_P(xP5, PSTR("sens")) == 0)
-			     {
-			 	      JSONSensor(key_value_pairs, pFile);
-			     }
-			     else if (strcmp_P(xP5, PSTR("sensNow")) == 0)
-			     {
-					JSONSensorsNow(pFile);
-			     }
-			     else if (strcmp_P(xP5, PSTR("wCounters")) == 0)
-			     {
-					JSONWWCounters(key_value_pairs, pFile);
-			     }
-
-            }
-			// Access sysinfo page
-			else if (strncmp_P(sPage, PSTR("SysInfo"), 7) == 0)
-			{
-				ServeSysInfoPage( pFile );
-			}
-// access system logs directory
-			else if (strncmp_P(sPage, PSTR("logs"), 4) == 0)
-			{
-  				freeMemory();
-				sdlog.LogsHandler(sPage, pFile, client);
-			}
+static void WebConnRelease(int8_t n)
+{
+	WebConn & conn = webConn[n];
+
+	if (webGen.conn == n)
+		WebGenAbort();
+	WebConnCloseFile(conn);
+	if (parserOwner == n)
+	{
+		parserOwner = -1;
+		parser.state = 0;
+		recvbufptr = recvbufend = recvbuf;
+	}
+}
+
+// Start graceful close of the connection
+static void WebConnClose(int8_t n)
+{
+	WebConnRelease(n);
+	disconnect(webConn[n].sock);
+	webConn[n].phase = WEB_CONN_CLOSING;
+	webConn[n].timer = millis();
+}
+
+static void WebConnFree(int8_t n)
+{
+	WebConnRelease(n);
+	webConn[n].phase = WEB_CONN_FREE;
+	webConn[n].sock = MAX_SOCK_NUM;
+}
+
+// Response is completely sent - wait for the next request, or close the connection
+static void WebConnEndResponse(int8_t n)
+{
+	if (webConn[n].bKeepAlive)
+	{
+		webConn[n].phase = WEB_CONN_IDLE;
+		webConn[n].timer = millis();
+	}
+	else
+		WebConnClose(n);
+}
+
+// Pick up new client connections
+static void WebAcceptClients(uint16_t port)
+{
+	for (uint8_t sock = 0; sock < MAX_SOCK_NUM; sock++)
+	{
+		if (EthernetClass::_server_port[sock] != port)
+			continue;
+
+		EthernetClient client(sock);
+		uint8_t status = client.status();
+		if (((status != SnSR::ESTABLISHED) && (status != SnSR::CLOSE_WAIT)) || !client.available())
+			continue;
+
+		int8_t free_slot = -1;
+		bool bKnown = false;
+		for (int8_t n = 0; n < WEB_MAX_CONNECTIONS; n++)
+		{
+			if (webConn[n].phase == WEB_CONN_FREE)
+				free_slot = n;
+			else if (webConn[n].sock == sock)
+				bKnown = true;
+		}
+		if (bKnown)
+			continue;
+		if (free_slot < 0)
+			break;			// all connection slots are busy, the client will be picked up later
+
+		WebConn & conn = webConn[free_slot];
+		conn.sock = sock;
+		conn.phase = WEB_CONN_REQUEST;
+		conn.nRequests = 0;
+		conn.bKeepAlive = false;
+		conn.timer = millis();
+		conn.cacheEntry = -1;
+		TRACE_INFO(F("Got a client\n"));
+	}
+}
+
+// Reply to the request that could not be parsed (see WEB_PARSE_xxx). Connection is closed after the reply.
+static void ServeRequestError(FILE * stream_file, uint8_t result)
+{
+	switch (result)
+	{
+	case WEB_PARSE_TIMEOUT:
+		ServeHeader(stream_file, 408, PSTR("Request Timeout"), WEB_CACHE_NOSTORE, PSTR("text/plain"), 0);
+		break;
+	case WEB_PARSE_URI_TOO_LONG:
+		ServeHeader(stream_file, 414, PSTR("URI Too Long"), WEB_CACHE_NOSTORE, PSTR("text/plain"), 0);
+		break;
+	case WEB_PARSE_HEADER_TOO_LARGE:
+		ServeHeader(stream_file, 431, PSTR("Request Header Fields Too Large"), WEB_CACHE_NOSTORE, PSTR("text/plain"), 0);
+		break;
+	default:
+		ServeHeader(stream_file, 400, PSTR("Bad Request"), WEB_CACHE_NOSTORE, PSTR("text/plain"), 0);
+		break;
+	}
+}
+
+// Dispatch parsed request to the handler
+static void WebDispatch(int8_t n, EthernetClient & client, uint8_t result)
+{
+	WebConn & conn = webConn[n];
+	FILE stream_file;
+	FILE * pFile = &stream_file;
+	unsigned long start_time = millis();
+
+	freeMemory();
+	setup_sendbuf();
+	fdev_setup_stream(pFile, stream_putchar, NULL, _FDEV_SETUP_WRITE);
+	stream_file.udata = &client;
+
+	rq.client = &client;
+	rq.file = &conn.file;
+	rq.bReset = false;
+	activeConn = &conn;
+
+	if (result != WEB_PARSE_DONE)
+	{
+		TRACE_ERROR(F("Web request aborted (%u)\n"), result);
+		bKeepAlive = false;
+		webAbortedConnections++;
+		if (client.connected())
+			ServeRequestError(pFile, result);
+	}
+	else
+	{
+		TRACE_INFO(F("Page:%s\n"), rq.sPage);
+		//ShowSockStatus();
+
+		conn.nRequests++;
+		bKeepAlive = rq.bKeepAlive && (conn.nRequests < WEB_KEEPALIVE_MAX_REQUESTS);
+
+		if (rq.route == WEB_ROUTE_NONE)
+		{
+			rq.cache = WEB_CACHE_STATIC;
+			if (rq.method != WEB_METHOD_GET)
+				ServeError(pFile);
+			else
+				ServeStaticFile(rq, pFile);
+		}
+		else
+		{
+			uint8_t flags = pgm_read_byte(&webRoutes[rq.route].flags);
+
+			if ((flags & rq.method) == 0)
+				ServeError(pFile);
 			else
-// This is the "catch all" case, that also serves static HTML files, *.js etc.
 			{
-  				if (strlen(sPage) == 0){
-    
- 			        TRACE_INFO(F("Serving: web root\n"));
-					strcpy(sPage, "index.htm");
-                }
-				// prepend path
-				memmove(sPage + 5, sPage, sizeof(sPage) - 5);
-				memcpy(sPage, "/web/", 5);
-				sPage[sizeof(sPage)-1] = 0;
-				TRACE_INFO(F("Serving file: %s\n"), sPage);
-				SdFile theFile;
-				if (!theFile.open(sPage, O_READ))
-					Serve404(pFile);
+				WebHandler handler = (WebHandler)pgm_read_word(&webRoutes[rq.route].handler);
+
+				if (flags & WEB_ROUTE_CACHE)
+					rq.cache = WEB_CACHE_STATIC;
+				else if (flags & WEB_ROUTE_NOSTORE)
+					rq.cache = WEB_CACHE_NOSTORE;
 				else
-				{
-					if (theFile.isFile())
-						ServeFile(pFile, sPage, theFile, client);
-					else
-						Serve404(pFile);
-					theFile.close();
-				}
+					rq.cache = WEB_CACHE_NOCACHE;
+				handler(rq, pFile);
 			}
 		}
+	}
 
-#ifdef ARDUINO
-		flush_sendbuf(client);
+	finish_response(client);
+	activeConn = NULL;
+	conn.bKeepAlive = bKeepAlive;
+	bKeepAlive = false;
+	TRACE_INFO(F("Served in %lums\n"), millis() - start_time);
+
+	if (rq.bReset)
+	{
 		// give the web browser time to receive the data
 		delay(1);
-#else
-		fflush(pFile);
-		fclose(pFile);
-#endif
-		// close the connection:
 		client.stop();
+		sysreset();
+	}
+
+	if ((conn.phase != WEB_CONN_BODY) && (conn.phase != WEB_CONN_EVENTS) && (conn.phase != WEB_CONN_GEN))
+		WebConnEndResponse(n);
+}
+
+// Request for the generated route waits while another response is being generated. Returns true if the request is queued.
+static bool WebGenQueue(int8_t n)
+{
+	if ((webGen.conn < 0) || (rq.route == WEB_ROUTE_NONE) || !(pgm_read_byte(&webRoutes[rq.route].flags) & WEB_ROUTE_GEN))
+		return false;
+
+	parserOwner = n;		// parser holds the request
+	webConn[n].phase = WEB_CONN_QUEUED;
+	webConn[n].timer = millis();
+	return true;
+}
+
+// Run the step of the response generator. Returns true if there was any progress.
+static bool WebGenService(int8_t n, EthernetClient & client)
+{
+	WebConn & conn = webConn[n];
+	FILE stream_file;
+	FILE * pFile = &stream_file;
+	uint8_t range = rq.range;
+	uint8_t result;
+
+	setup_sendbuf();
+	fdev_setup_stream(pFile, stream_putchar, NULL, _FDEV_SETUP_WRITE);
+	stream_file.udata = &client;
+
+	rq.client = &client;
+	rq.file = &conn.file;
+	rq.range = WEB_RANGE_NONE;		// rq may hold the request being parsed on another connection, generated response is sent whole
+	activeConn = &conn;
+	bKeepAlive = conn.bKeepAlive;
+
+	result = webGen.step(pFile);
+
+	rq.range = range;
+	if (result == WEB_GEN_DONE)
+	{
+		finish_response(client);
+		webGen.conn = -1;
+		conn.bKeepAlive = bKeepAlive;
+		if (conn.phase == WEB_CONN_GEN)
+			WebConnEndResponse(n);		// otherwise the response file is being sent
+	}
+	activeConn = NULL;
+	bKeepAlive = false;
+	conn.timer = millis();
+	return result != WEB_GEN_WAIT;
+}
+
+// Find and clear the first set bit among first n bits of the change bitmap
+static bool WebTakeBit(uint8_t * bits, uint8_t n, uint8_t * pIndex)
+{
+	for (uint8_t i = 0; i < n; i++)
+	{
+		if (bits[i >> 3] & (1 << (i & 7)))
+		{
+			bits[i >> 3] &= ~(1 << (i & 7));
+			*pIndex = i;
+			return true;
+		}
+	}
+	return false;
+}
+
+void WebNotify(uint8_t evt, uint8_t index)
+{
+	for (uint8_t n = 0; n < WEB_MAX_CONNECTIONS; n++)
+	{
+		WebConn & conn = webConn[n];
+
+		if (conn.phase != WEB_CONN_EVENTS)
+			continue;
+
+		switch (evt)
+		{
+		case WEB_EVT_STATE:
+			conn.evtState = true;
+			break;
+		case WEB_EVT_ZONE:
+			if (index < MAX_ZONES)
+				conn.evtZones[index >> 3] |= 1 << (index & 7);
+			break;
+		case WEB_EVT_SENSOR:
+			if (index < MAX_SENSORS)
+				conn.evtSensors[index >> 3] |= 1 << (index & 7);
+			break;
+		case WEB_EVT_STATION:
+			if (index < MAX_STATIONS)
+				conn.evtStations[index >> 3] |= 1 << (index & 7);
+			break;
+		}
+	}
+}
+
+// Send one pending event (or heartbeat) to the event stream. Returns true if anything was sent.
+static bool WebEmitEvent(WebConn & conn, EthernetClient & client)
+{
+	FILE stream_file;
+	FILE * pFile = &stream_file;
+	uint8_t i;
+	bool bSent = false;
+
+	setup_sendbuf();
+	fdev_setup_stream(pFile, stream_putchar, NULL, _FDEV_SETUP_WRITE);
+	stream_file.udata = &client;
+
+	if (conn.evtState)
+	{
+		conn.evtState = false;
+		fprintf_P(pFile, PSTR("event: state\ndata: {\"run\":\"%S\",\"paused\":\"%S\",\"schedule\":%d,\"zone\":%d,\"offTime\":%d}\n\n"),
+				GetRunSchedules() ? PSTR("on") : PSTR("off"), runState.isPaused() ? PSTR("on") : PSTR("off"),
+				int(runState.getSchedule()), int(runState.getZone()), runState.isSchedule() ? runState.getRemainingTime() : 0);
+		bSent = true;
+	}
+	else if (WebTakeBit(conn.evtZones, GetNumZones(), &i))
+	{
+		fprintf_P(pFile, PSTR("event: zone\ndata: {\"zone\":%u,\"state\":\"%S\"}\n\n"), i,
+				(GetZoneState(i + 1) == ZONE_STATE_OFF) ? PSTR("off") : PSTR("on"));
+		bSent = true;
+	}
+	else
+	{
+		while (!bSent && WebTakeBit(conn.evtSensors, GetNumSensors(), &i))
+		{
+			SensorStruct & sensor = sensorsModule.SensorsList[i];
+
+			if ((sensor.config.sensorType == SENSOR_TYPE_NONE) || (sensor.lastReadingTimestamp == 0))
+				continue;
+			fprintf_P(pFile, PSTR("event: sensor\ndata: {\"sensorID\":%u,\"reading\":%ld,\"age\":%lu}\n\n"), i,
+					sensor.lastReading, (millis() - sensor.lastReadingTimestamp)/1000ul);
+			bSent = true;
+		}
+		while (!bSent && WebTakeBit(conn.evtStations, MAX_STATIONS, &i))
+		{
+			if (runState.sLastContactTime[i] == 0)
+				continue;
+			uint8_t	health = rprotocol.LinkHealth(i);
+
+			fprintf_P(pFile, PSTR("event: station\ndata: {\"stationID\":%u,\"lastContact\":%lu,\"rssi\":%d,\"health\":%d}\n\n"), i,
+					(millis() - runState.sLastContactTime[i])/1000ul, runState.iLastReceivedRSSI[i], (health == 0xFF) ? -1 : int(health));
+			bSent = true;
+		}
+	}
+
+	if (!bSent)
+	{
+		if (millis() - conn.timer < WEB_EVENTS_HEARTBEAT)
+			return false;
+		fprintf_P(pFile, PSTR(": ping\n\n"));		// comment line, keeps the connection alive
+	}
+
+	flush_sendbuf(client);
+	conn.timer = millis();
+	return true;
+}
+
+// Serve one step of the connection. Returns true if there was any progress.
+static bool WebServiceConn(int8_t n, uint16_t port)
+{
+	WebConn & conn = webConn[n];
+	uint8_t result;
+
+	if (conn.phase == WEB_CONN_FREE)
+		return false;
 
-		if (bReset)
-			sysreset();
+	EthernetClient client(conn.sock);
+	uint8_t status = client.status();
+
+	if (conn.phase == WEB_CONN_CLOSING)
+	{
+		if ((status == SnSR::CLOSED) || (millis() - conn.timer > WEB_CLOSE_TIMEOUT))
+		{
+			if (status != SnSR::CLOSED)
+				close(conn.sock);
+			EthernetClass::_server_port[conn.sock] = 0;
+			WebConnFree(n);
+			return true;
+		}
+		return false;
+	}
+
+	// socket was closed underneath us (connection reset, or stopped by the server library)
+	if ((EthernetClass::_server_port[conn.sock] != port) || (status == SnSR::CLOSED) || (status == SnSR::LISTEN))
+	{
+		WebConnFree(n);
+		return true;
+	}
+
+	switch (conn.phase)
+	{
+	case WEB_CONN_IDLE:
+		if (!client.available() && !((parserOwner == n) && (recvbufptr < recvbufend)))
+		{
+			if (!client.connected() || (millis() - conn.timer > WEB_KEEPALIVE_TIMEOUT))
+				WebConnClose(n);
+			return false;
+		}
+		conn.phase = WEB_CONN_REQUEST;
+		conn.timer = millis();
+		// fall through
+
+	case WEB_CONN_REQUEST:
+		if (parserOwner != n)
+		{
+			if (parserOwner >= 0)
+			{
+				// parser is busy with another connection, request data waits in the socket buffer
+				conn.timer = millis();
+				return false;
+			}
+			parserOwner = n;
+			parser.state = 0;
+			recvbufptr = recvbufend = recvbuf;
+			rq.key_value_pairs = &key_value_pairs;
+		}
+
+		result = ParseHTTPHeader(client, &rq);
+		switch (result)
+		{
+		case WEB_PARSE_MORE:
+			if (millis() - parser.timer <= parser.timeout)
+				return false;
+			// the client is too slow - reply and drop the connection (parser is released with the connection)
+			WebDispatch(n, client, WEB_PARSE_TIMEOUT);
+			return true;
+
+		case WEB_PARSE_DONE:
+			if (WebGenQueue(n))
+				return true;
+			if (recvbufptr >= recvbufend)
+				parserOwner = -1;		// keep the parser if the next (pipelined) request is already in the buffer
+			WebDispatch(n, client, result);
+			return true;
+
+		default:
+			parserOwner = -1;
+			WebDispatch(n, client, result);
+			return true;
+		}
+
+	case WEB_CONN_BODY:
+	{
+		uint16_t len = W5100.getTXFreeSize(conn.sock);
+
+		if (len > sizeof(sendbuf))
+			len = sizeof(sendbuf);
+		if (len > conn.remaining)
+			len = conn.remaining;
+		if (len == 0)
+		{
+			// TX buffer is full, wait for the client to receive the data
+			if (!client.connected() || (millis() - conn.timer > WEB_SEND_TIMEOUT))
+			{
+				webAbortedConnections++;
+				WebConnClose(n);
+			}
+			return false;
+		}
+
+		int bytes = conn.file.read(sendbuf, len);
+		sdlog.fat_read = true;		// the file may be a log file, SdFat cache may now hold its blocks
+		if ((bytes <= 0) || !client.write((uint8_t*) sendbuf, bytes))
+		{
+			// file is shorter than advertised Content-Length, or the client is gone - connection cannot be reused
+			conn.bKeepAlive = false;
+			conn.remaining = 0;
+		}
+		else
+			conn.remaining -= bytes;
+
+		conn.timer = millis();
+		if (conn.remaining == 0)
+		{
+			WebConnCloseFile(conn);
+			WebConnEndResponse(n);
+		}
+		return true;
+	}
+
+	case WEB_CONN_QUEUED:
+		if (!client.connected())
+		{
+			WebConnClose(n);
+			return false;
+		}
+		if (webGen.conn >= 0)
+			return false;
+		if (recvbufptr >= recvbufend)
+			parserOwner = -1;
+		WebDispatch(n, client, WEB_PARSE_DONE);
+		return true;
+
+	case WEB_CONN_GEN:
+		if (!client.connected())
+		{
+			// client is gone, the response is dropped
+			webAbortedConnections++;
+			WebConnClose(n);
+			return true;
+		}
+		return WebGenService(n, client);
+
+	case WEB_CONN_EVENTS:
+		if (!client.connected())
+		{
+			WebConnClose(n);
+			return false;
+		}
+		if (W5100.getTXFreeSize(conn.sock) < sizeof(sendbuf))
+		{
+			// client does not keep up with the events
+			if (millis() - conn.timer > WEB_SEND_TIMEOUT)
+			{
+				webAbortedConnections++;
+				WebConnClose(n);
+			}
+			return false;
+		}
+		return WebEmitEvent(conn, client);
+
+	default:
+		return false;
 	}
 }
 
+void web::ProcessWebClients()
+{
+	unsigned long slice_start = millis();
+	bool bProgress;
+
+	m_server->available();		// let the server library maintain the listening socket
+	WebAcceptClients(m_port);
+
+	// Serve active connections round-robin, until there is nothing to do or the time slice is used up.
+	// The slice is checked between steps (see WEB_TIME_SLICE).
+	do
+	{
+		bProgress = false;
+		for (int8_t n = 0; n < WEB_MAX_CONNECTIONS; n++)
+		{
+			if (WebServiceConn(n, m_port))
+				bProgress = true;
+		}
+	} while (bProgress && (millis() - slice_start < WEB_TIME_SLICE));
+}
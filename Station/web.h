@@ -13,10 +13,13 @@
 #include <stdio.h>
 #include <SdFat.h>
 #include <Ethernet.h>
+#include "Defines.h"
 
 class EthernetServer;
 
-#define NUM_KEY_VALUES 60
+// Query parameters of the routes without form handler. Routes with many parameters (settings, schedules, zones)
+// use form handlers instead, which receive the parameters one by one as the request is parsed.
+#define NUM_KEY_VALUES 8
 #define KEY_SIZE 10
 #define VALUE_SIZE 20
 
@@ -27,6 +30,142 @@ struct KVPairs
 	char values[NUM_KEY_VALUES][VALUE_SIZE];
 };
 
+// HTTP methods
+#define WEB_METHOD_GET			0x01
+#define WEB_METHOD_POST			0x02
+
+// Route flags
+#define WEB_ROUTE_GET			WEB_METHOD_GET		// route accepts GET
+#define WEB_ROUTE_POST			WEB_METHOD_POST		// route accepts POST
+#define WEB_ROUTE_CACHE			0x04				// response can be cached by the browser
+#define WEB_ROUTE_PREFIX		0x10				// route matches the first path segment (e.g. "logs" matches "logs/tempr.log")
+#define WEB_ROUTE_NOSTORE		0x20				// response must not be stored by the browser
+#define WEB_ROUTE_GEN			0x40				// response is generated in steps (see WEB_CONN_GEN)
+
+// Response cache policies (Cache-Control)
+#define WEB_CACHE_NOCACHE		0					// browser must revalidate the response each time
+#define WEB_CACHE_STATIC		1					// static content, cached for WEB_STATIC_MAX_AGE and then revalidated
+#define WEB_CACHE_NOSTORE		2					// response is never stored (configuration and control requests)
+
+#define WEB_STATIC_MAX_AGE		600					// static files max age, seconds
+#define WEB_ETAG_SIZE			32					// max ETag (If-None-Match) length
+#define WEB_HTTP_DATE_SIZE		30					// HTTP date string length, e.g. "Fri, 02 Jun 2006 09:46:32 GMT"
+
+// Byte range requests
+#define WEB_RANGE_NONE			0
+#define WEB_RANGE_BYTES			1					// rangeFirst-rangeLast
+#define WEB_RANGE_SUFFIX		2					// last rangeFirst bytes of the file
+
+#define WEB_FILE_SIZE_AUTO		0xFFFFFFFFUL		// ServeFile() - data size is the file size
+
+#define WEB_ROUTE_NONE			-1					// no route matched, static file request
+
+#define WEB_PAGE_SIZE			35
+#define WEB_HEADER_LINE_SIZE	64					// max length of the request header line we look at, longer lines are truncated
+#define WEB_MAX_URI_SIZE		1024				// max length of the request path and query string, longer requests get 414
+#define WEB_MAX_HEADER_SIZE		2048				// max size of the request header fields, larger headers get 431
+
+// Pre-compressed static files. Directory mirrors /web/ and holds gzip-compressed copies of the files (produced by mkwebgz.sh).
+#define WEB_DIR					"/web/"
+#define WEB_DIR_LEN				5
+#define WEB_GZ_DIR				"/web.gz/"
+#define WEB_GZ_DIR_LEN			8
+
+// Persistent (keep-alive) connections
+#define WEB_KEEPALIVE_TIMEOUT		250				// time to wait for the next request on the connection, ms
+#define WEB_KEEPALIVE_MAX_REQUESTS	16				// max number of requests served on one connection
+
+// Concurrent connections
+#define WEB_MAX_CONNECTIONS		3					// max number of client connections served concurrently
+// Web clients are served in time slices of WEB_TIME_SLICE. The slice is checked between the steps of the connections:
+// header parsing, sending a block of the file, and a step of the generated response - json/tlogs, json/schlogs and json/sens
+// scan LOG_SCAN_RECORDS log records per step, json/wcheck polls the weather service connection.
+#define WEB_TIME_SLICE			20					// time spent serving web clients per main loop pass (see above), ms
+#define WEB_REQUEST_TIMEOUT		2000				// max time to receive request header, ms
+#define WEB_BODY_TIMEOUT		5000				// max time to receive request body, ms
+#define WEB_SEND_TIMEOUT		5000				// max time without progress sending response, ms
+#define WEB_CLOSE_TIMEOUT		1000				// max time to wait for graceful connection close, ms
+
+// Connection phases
+#define WEB_CONN_FREE			0					// connection slot is not used
+#define WEB_CONN_REQUEST		1					// receiving and parsing request header
+#define WEB_CONN_BODY			2					// sending response file
+#define WEB_CONN_IDLE			3					// persistent connection waiting for the next request
+#define WEB_CONN_CLOSING		4					// waiting for the connection to close
+#define WEB_CONN_EVENTS			5					// live event stream (Server-Sent Events)
+#define WEB_CONN_GEN			6					// generating the response (json/tlogs, json/schlogs, json/sens, json/wcheck)
+#define WEB_CONN_QUEUED			7					// request is parsed, waits for the response generator (keeps the parser)
+
+// Live event stream
+#define WEB_MAX_EVENT_STREAMS	1					// max number of concurrent event streams (each one holds a connection slot)
+#define WEB_EVENTS_HEARTBEAT	15000				// heartbeat interval, ms
+#define WEB_EVENTS_RETRY		5000				// client reconnect delay, ms
+
+// Event types for WebNotify()
+#define WEB_EVT_STATE			0					// schedule started or stopped, active zone changed, pause
+#define WEB_EVT_ZONE			1					// zone state changed (index - zone number, 0-based)
+#define WEB_EVT_SENSOR			2					// sensor reading received (index - sensor number)
+#define WEB_EVT_STATION			3					// remote station reported (index - station ID)
+
+// Form field handler. Called with key == NULL when the request for the route starts, and then for each key=value pair
+// of the query string and of the urlencoded (POST) request body, as they are parsed.
+// Values longer than VALUE_SIZE-1 are passed in pieces, one call per piece - offs is the position of the piece in the value.
+typedef void (*WebFormHandler)(const char * key, const char * value, uint16_t offs);
+
+// Parsed HTTP request
+struct WebRequest
+{
+	char			sPage[WEB_PAGE_SIZE];	// requested path, without leading '/'
+	uint8_t			method;					// WEB_METHOD_xxx
+	int8_t			route;					// index in the routes table, or WEB_ROUTE_NONE
+	uint8_t			cache;					// response cache policy WEB_CACHE_xxx (from the route flags)
+	bool			bReset;					// handler requested controller reset after the response is sent
+	bool			bKeepAlive;				// client wants persistent connection
+	bool			bAcceptGzip;			// client accepts gzip content encoding
+	char			etag[WEB_ETAG_SIZE];	// If-None-Match value, empty if none
+	time_t			ims;					// If-Modified-Since time, 0 if none
+	uint8_t			range;					// Range request type WEB_RANGE_xxx
+	uint32_t		rangeFirst;
+	uint32_t		rangeLast;
+	uint32_t		contentLength;			// request body length
+	bool			bFormBody;				// request body is application/x-www-form-urlencoded
+	WebFormHandler	form;					// form handler of the route, NULL if query parameters go to key_value_pairs
+	KVPairs			*key_value_pairs;
+	EthernetClient	*client;
+	SdFile			*file;					// response file of the connection, see ServeFile()
+};
+
+// Client connection state
+struct WebConn
+{
+	uint8_t			sock;					// W5x00 socket number
+	uint8_t			phase;					// WEB_CONN_xxx
+	uint8_t			nRequests;				// number of requests served on this connection
+	bool			bKeepAlive;				// keep connection open after the response
+	unsigned long	timer;					// start of the current phase (or last progress), millis()
+	uint32_t		remaining;				// bytes of the response file still to be sent
+	SdFile			file;					// response file
+	int8_t			cacheEntry;				// JSON cache entry of the response file (see Logging::cacheLookup()), or -1
+
+	// event stream - pending changes
+	bool			evtState;
+	uint8_t			evtZones[(MAX_ZONES+7)/8];
+	uint8_t			evtSensors[(MAX_SENSORS+7)/8];
+	uint8_t			evtStations[(MAX_STATIONS+7)/8];
+};
+
+// Route handler. Handler is responsible for emitting complete response, including headers.
+typedef void (*WebHandler)(WebRequest & rq, FILE * stream_file);
+
+// Route table entry (stored in PROGMEM)
+struct WebRoute
+{
+	char			path[16];				// path without leading '/'
+	uint8_t			flags;					// WEB_ROUTE_xxx
+	WebHandler		handler;
+	WebFormHandler	form;					// optional form field handler
+};
+
 class web
 {
 public:
@@ -36,13 +175,21 @@ public:
 	void ProcessWebClients();
 private:
 	EthernetServer * m_server;
+	uint16_t m_port;
 };
 
-void ServeHeader(FILE * stream_file, int code, const char * pReason, bool cache, char * type);
-void ServeHeader(FILE * stream_file, int code, const char * pReason, bool cache);
-void ServeFile(FILE * stream_file, const char * fname, SdFile & theFile, EthernetClient & client);
+void ServeHeader(FILE * stream_file, int code, const char * pReason, uint8_t cache, const char * type, long contentLength);
+void ServeHeader(FILE * stream_file, int code, const char * pReason, uint8_t cache, char * type);
+void ServeHeader(FILE * stream_file, int code, const char * pReason, uint8_t cache);
+void ServeFile(FILE * stream_file, const char * fname, SdFile & theFile, EthernetClient & client, bool bGzip = false, uint32_t dataSize = WEB_FILE_SIZE_AUTO);
 void Serve404(FILE * stream_file);
 
+// Notify live event stream clients about a change
+void WebNotify(uint8_t evt, uint8_t index = 0);
+
+// Number of client connections dropped because of timeouts, malformed or oversized requests
+extern uint16_t webAbortedConnections;
+
 
 
 #endif
@@ -43,7 +43,7 @@ class RFM69_ATC: public RFM69 {
       RFM69(slaveSelectPin, interruptPin, isRFM69HW, interruptNum) {
     }
 
-    bool initialize(uint8_t freqBand, uint8_t ID, uint8_t networkID=1);
+    bool initialize(uint8_t freqBand, uint8_t ID, uint8_t networkID=1, bool fUseInterrupts=true);
     void sendACK(const void* buffer = "", uint8_t bufferSize=0);
     //void setHighPower(bool onOFF=true, uint8_t PA_ctl=0x60); //have to call it after initialize for RFM69HW
     //void setPowerLevel(uint8_t level); // reduce/increase transmit power level